@@ -206,6 +206,7 @@ handle_memory_finished_cb (EphyAboutHandler       *handler,
                            GAsyncResult           *result,
                            WebKitURISchemeRequest *request)
 {
+  EphyTabHibernator *hibernator;
   GString *data_str;
   gsize data_length;
   char *memory;
@@ -221,6 +222,19 @@ handle_memory_finished_cb (EphyAboutHandler       *handler,
                             _("Memory usage"));
 
     g_string_append_printf (data_str, "<h1>%s</h1>", _("Memory usage"));
+
+    hibernator = ephy_embed_shell_get_tab_hibernator (ephy_embed_shell_get_default ());
+    if (hibernator) {
+      g_string_append_printf (data_str, "<table class=\"memory-table\"><caption>%s</caption><tbody>", _("Tab hibernation"));
+      g_string_append_printf (data_str, "<tr><td>%s</td><td>%u</td></tr>",
+                              _("Tabs hibernated"),
+                              ephy_tab_hibernator_get_n_hibernated (hibernator));
+      g_string_append_printf (data_str, "<tr><td>%s</td><td>%.1f MB</td></tr>",
+                              _("Memory reclaimed"),
+                              ephy_tab_hibernator_get_reclaimed_size (hibernator) / (1024.0 * 1024.0));
+      g_string_append (data_str, "</tbody></table>");
+    }
+
     g_string_append (data_str, memory);
     g_free (memory);
   }
@@ -35,6 +35,7 @@
 #include "ephy-profile-utils.h"
 #include "ephy-settings.h"
 #include "ephy-snapshot-service.h"
+#include "ephy-tab-hibernator.h"
 #include "ephy-uri-tester-shared.h"
 #include "ephy-view-source-handler.h"
 #include "ephy-web-app-utils.h"
@@ -66,9 +67,13 @@ typedef struct {
   EphyViewSourceHandler *source_handler;
   guint update_overview_timeout_id;
   guint hiding_overview_item;
+  GList *overview_urls;
+  gboolean overview_urls_loaded;
   GDBusServer *dbus_server;
   GList *web_extensions;
   EphyFiltersManager *filters_manager;
+  EphyTabHibernator *tab_hibernator;
+  EphyFaviconCache *favicon_cache;
   GCancellable *cancellable;
 } EphyEmbedShellPrivate;
 
@@ -112,6 +117,9 @@ ephy_embed_shell_dispose (GObject *object)
     priv->update_overview_timeout_id = 0;
   }
 
+  g_list_free_full (priv->overview_urls, (GDestroyNotify)ephy_history_url_free);
+  priv->overview_urls = NULL;
+
   g_clear_object (&priv->encodings);
   g_clear_object (&priv->page_setup);
   g_clear_object (&priv->print_settings);
@@ -124,6 +132,8 @@ ephy_embed_shell_dispose (GObject *object)
   g_clear_object (&priv->web_context);
   g_clear_object (&priv->dbus_server);
   g_clear_object (&priv->filters_manager);
+  g_clear_object (&priv->tab_hibernator);
+  g_clear_object (&priv->favicon_cache);
 
   G_OBJECT_CLASS (ephy_embed_shell_parent_class)->dispose (object);
 }
@@ -170,6 +180,86 @@ web_extension_sensitive_form_focused_message_received_cb (WebKitUserContentManag
   g_variant_unref (variant);
 }
 
+/* Returns the changes turning @old_urls into @new_urls as an (asa(uss))
+ * variant: the URLs that are gone, then the (position, url, title) of every
+ * URL that was inserted, moved or retitled, sorted by position. Applying the
+ * placements in order to the list left after the removals yields @new_urls.
+ * Returns %NULL when the lists are the same.
+ */
+static GVariant *
+overview_urls_delta_new (GList *old_urls,
+                         GList *new_urls)
+{
+  GHashTable *new_set;
+  GHashTable *old_titles;
+  GPtrArray *working;
+  GVariantBuilder removed;
+  GVariantBuilder placed;
+  gboolean changed = FALSE;
+  GList *l;
+  guint i, j;
+
+  new_set = g_hash_table_new (g_str_hash, g_str_equal);
+  for (l = new_urls; l; l = g_list_next (l))
+    g_hash_table_add (new_set, ((EphyHistoryURL *)l->data)->url);
+
+  old_titles = g_hash_table_new (g_str_hash, g_str_equal);
+  working = g_ptr_array_new ();
+  g_variant_builder_init (&removed, G_VARIANT_TYPE ("as"));
+  for (l = old_urls; l; l = g_list_next (l)) {
+    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+
+    if (!g_hash_table_contains (new_set, url->url)) {
+      g_variant_builder_add (&removed, "s", url->url);
+      changed = TRUE;
+      continue;
+    }
+
+    g_ptr_array_add (working, url->url);
+    g_hash_table_insert (old_titles, url->url, url->title);
+  }
+
+  g_variant_builder_init (&placed, G_VARIANT_TYPE ("a(uss)"));
+  for (l = new_urls, i = 0; l; l = g_list_next (l), i++) {
+    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+
+    if (i < working->len && g_strcmp0 (g_ptr_array_index (working, i), url->url) == 0) {
+      if (g_strcmp0 (g_hash_table_lookup (old_titles, url->url), url->title) != 0) {
+        g_variant_builder_add (&placed, "(uss)", i, url->url, url->title);
+        changed = TRUE;
+      }
+      continue;
+    }
+
+    /* Either moved up from a later position or new, keep the working list
+     * in sync with what the web process will have after this placement. */
+    for (j = i + 1; j < working->len; j++) {
+      if (g_strcmp0 (g_ptr_array_index (working, j), url->url) == 0) {
+        g_ptr_array_remove_index (working, j);
+        break;
+      }
+    }
+    g_ptr_array_insert (working, i, url->url);
+
+    g_variant_builder_add (&placed, "(uss)", i, url->url, url->title);
+    changed = TRUE;
+  }
+
+  g_ptr_array_free (working, TRUE);
+  g_hash_table_destroy (old_titles);
+  g_hash_table_destroy (new_set);
+
+  if (!changed) {
+    g_variant_builder_clear (&removed);
+    g_variant_builder_clear (&placed);
+    return NULL;
+  }
+
+  return g_variant_new ("(@as@a(uss))",
+                        g_variant_builder_end (&removed),
+                        g_variant_builder_end (&placed));
+}
+
 static void
 history_service_query_urls_cb (EphyHistoryService *service,
                                gboolean            success,
@@ -177,17 +267,30 @@ history_service_query_urls_cb (EphyHistoryService *service,
                                EphyEmbedShell     *shell)
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  GVariant *delta;
   GList *l;
 
   if (!success)
     return;
 
-  for (l = priv->web_extensions; l; l = g_list_next (l)) {
-    EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
+  /* Only web processes showing an overview get the changes, the others get
+   * the whole list once they start showing one. */
+  delta = overview_urls_delta_new (priv->overview_urls, urls);
+  if (delta) {
+    g_variant_ref_sink (delta);
+    for (l = priv->web_extensions; l; l = g_list_next (l)) {
+      EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
 
-    ephy_web_extension_proxy_history_set_urls (web_extension, urls);
+      if (ephy_web_extension_proxy_get_overview_watched (web_extension))
+        ephy_web_extension_proxy_history_apply_urls_delta (web_extension, delta);
+    }
+    g_variant_unref (delta);
   }
 
+  g_list_free_full (priv->overview_urls, (GDestroyNotify)ephy_history_url_free);
+  priv->overview_urls = g_list_copy_deep (urls, (GCopyFunc)ephy_history_url_copy, NULL);
+  priv->overview_urls_loaded = TRUE;
+
   for (l = urls; l; l = g_list_next (l))
     ephy_embed_shell_schedule_thumbnail_update (shell, (EphyHistoryURL *)l->data);
 }
@@ -318,6 +421,16 @@ history_service_url_deleted_cb (EphyHistoryService *service,
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
   GList *l;
 
+  for (l = priv->overview_urls; l; l = g_list_next (l)) {
+    EphyHistoryURL *overview_url = (EphyHistoryURL *)l->data;
+
+    if (g_strcmp0 (overview_url->url, url) == 0) {
+      ephy_history_url_free (overview_url);
+      priv->overview_urls = g_list_delete_link (priv->overview_urls, l);
+      break;
+    }
+  }
+
   for (l = priv->web_extensions; l; l = g_list_next (l)) {
     EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
 
@@ -336,6 +449,21 @@ history_service_host_deleted_cb (EphyHistoryService *service,
 
   deleted_uri = soup_uri_new (deleted_url);
 
+  l = priv->overview_urls;
+  while (l) {
+    EphyHistoryURL *overview_url = (EphyHistoryURL *)l->data;
+    SoupURI *uri = soup_uri_new (overview_url->url);
+    GList *next = l->next;
+
+    if (uri && g_strcmp0 (soup_uri_get_host (uri), soup_uri_get_host (deleted_uri)) == 0) {
+      ephy_history_url_free (overview_url);
+      priv->overview_urls = g_list_delete_link (priv->overview_urls, l);
+    }
+
+    g_clear_pointer (&uri, soup_uri_free);
+    l = next;
+  }
+
   for (l = priv->web_extensions; l; l = g_list_next (l)) {
     EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
 
@@ -352,6 +480,9 @@ history_service_cleared_cb (EphyHistoryService *service,
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
   GList *l;
 
+  g_list_free_full (priv->overview_urls, (GDestroyNotify)ephy_history_url_free);
+  priv->overview_urls = NULL;
+
   for (l = priv->web_extensions; l; l = g_list_next (l)) {
     EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
 
@@ -697,6 +828,25 @@ web_extension_page_created (EphyWebExtensionProxy *extension,
   g_signal_emit (shell, signals[PAGE_CREATED], 0, page_id, extension);
 }
 
+static void
+web_extension_overview_watched_changed (EphyWebExtensionProxy *extension,
+                                        gboolean               watched,
+                                        EphyEmbedShell        *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  if (!watched)
+    return;
+
+  /* The web process missed every change while it wasn't showing an
+   * overview, so bring it up to date with the whole list. Until the
+   * first query finishes, its result will reach it as a delta. */
+  if (priv->overview_urls_loaded)
+    ephy_web_extension_proxy_history_set_urls (extension, priv->overview_urls);
+  else
+    ephy_embed_shell_update_overview_urls (shell);
+}
+
 static gboolean
 new_connection_cb (GDBusServer     *server,
                    GDBusConnection *connection,
@@ -709,6 +859,8 @@ new_connection_cb (GDBusServer     *server,
 
   g_signal_connect_object (extension, "page-created",
                            G_CALLBACK (web_extension_page_created), shell, 0);
+  g_signal_connect_object (extension, "overview-watched-changed",
+                           G_CALLBACK (web_extension_overview_watched_changed), shell, 0);
 
   return TRUE;
 }
@@ -940,6 +1092,11 @@ ephy_embed_shell_startup (GApplication *application)
   /* Do not ignore TLS errors. */
   webkit_web_context_set_tls_errors_policy (priv->web_context, WEBKIT_TLS_ERRORS_POLICY_FAIL);
 
+  /* Release hidden tabs when memory runs short. */
+  if (priv->mode != EPHY_EMBED_SHELL_MODE_TEST &&
+      priv->mode != EPHY_EMBED_SHELL_MODE_SEARCH_PROVIDER)
+    priv->tab_hibernator = ephy_tab_hibernator_new ();
+
 
   /* about: URIs handler */
   priv->about_handler = ephy_about_handler_new ();
@@ -1462,3 +1619,38 @@ ephy_embed_shell_get_permissions_manager (EphyEmbedShell *shell)
 
   return priv->permissions_manager;
 }
+
+/**
+ * ephy_embed_shell_get_tab_hibernator:
+ * @shell: an #EphyEmbedShell
+ *
+ * Returns: (transfer none) (nullable): the #EphyTabHibernator, or %NULL in
+ * modes that do not show tabs
+ */
+EphyTabHibernator *
+ephy_embed_shell_get_tab_hibernator (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  return priv->tab_hibernator;
+}
+
+/**
+ * ephy_embed_shell_get_favicon_cache:
+ * @shell: an #EphyEmbedShell
+ *
+ * Returns: (transfer none): the #EphyFaviconCache shared by everything
+ * that shows the favicons of pages other than the ones being browsed
+ */
+EphyFaviconCache *
+ephy_embed_shell_get_favicon_cache (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  g_return_val_if_fail (EPHY_IS_EMBED_SHELL (shell), NULL);
+
+  if (priv->favicon_cache == NULL)
+    priv->favicon_cache = ephy_favicon_cache_new (webkit_web_context_get_favicon_database (priv->web_context));
+
+  return priv->favicon_cache;
+}
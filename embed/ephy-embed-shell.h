@@ -23,8 +23,10 @@
 
 #include <webkit2/webkit2.h>
 #include "ephy-downloads-manager.h"
+#include "ephy-favicon-cache.h"
 #include "ephy-history-service.h"
 #include "ephy-permissions-manager.h"
+#include "ephy-tab-hibernator.h"
 
 G_BEGIN_DECLS
 
@@ -76,5 +78,7 @@ void               ephy_embed_shell_schedule_thumbnail_update  (EphyEmbedShell
 WebKitUserContentManager *ephy_embed_shell_get_user_content_manager (EphyEmbedShell *shell);
 EphyDownloadsManager     *ephy_embed_shell_get_downloads_manager    (EphyEmbedShell *shell);
 EphyPermissionsManager   *ephy_embed_shell_get_permissions_manager  (EphyEmbedShell *shell);
+EphyTabHibernator        *ephy_embed_shell_get_tab_hibernator       (EphyEmbedShell *shell);
+EphyFaviconCache         *ephy_embed_shell_get_favicon_cache        (EphyEmbedShell *shell);
 
 G_END_DECLS
@@ -25,10 +25,12 @@
 #include "config.h"
 #include "ephy-embed.h"
 
+#include "ephy-about-handler.h"
 #include "ephy-debug.h"
 #include "ephy-embed-prefs.h"
 #include "ephy-embed-shell.h"
 #include "ephy-embed-utils.h"
+#include "ephy-favicon-helpers.h"
 #include "ephy-find-toolbar.h"
 #include "ephy-notification-container.h"
 #include "ephy-prefs.h"
@@ -41,6 +43,7 @@
 #include <webkit2/webkit2.h>
 
 static void     ephy_embed_constructed (GObject *object);
+static void     ephy_embed_ensure_web_view (EphyEmbed *embed);
 static void     ephy_embed_restored_window_cb (EphyEmbedShell *shell,
                                                EphyEmbed      *embed);
 
@@ -72,6 +75,16 @@ struct _EphyEmbed {
   WebKitWebViewSessionState *delayed_state;
   guint delayed_request_source_id;
 
+  /* Virtual embeds, restored from the session, have no web view until they
+   * are shown or someone asks for it. */
+  char *virtual_url;
+  GBytes *virtual_state;
+  GdkPixbuf *virtual_icon;
+  GCancellable *virtual_icon_cancellable;
+
+  /* Monotonic time the embed was last unmapped, or created. */
+  gint64 last_visible_time;
+
   GSList *messages;
   GSList *keys;
 
@@ -96,6 +109,7 @@ enum {
   PROP_0,
   PROP_WEB_VIEW,
   PROP_TITLE,
+  PROP_VIRTUAL_ICON,
   LAST_PROP
 };
 
@@ -253,7 +267,10 @@ ephy_embed_set_title (EphyEmbed  *embed,
     g_free (new_title);
     new_title = NULL;
 
-    address = ephy_web_view_get_address (EPHY_WEB_VIEW (embed->web_view));
+    if (embed->web_view)
+      address = ephy_web_view_get_address (EPHY_WEB_VIEW (embed->web_view));
+    else
+      address = embed->virtual_url;
     if (address && strcmp (address, "about:blank") != 0)
       new_title = ephy_embed_utils_get_title_from_address (address);
 
@@ -382,8 +399,15 @@ ephy_embed_dispose (GObject *object)
     embed->fullscreen_message_id = 0;
   }
 
+  if (embed->virtual_icon_cancellable) {
+    g_cancellable_cancel (embed->virtual_icon_cancellable);
+    g_clear_object (&embed->virtual_icon_cancellable);
+  }
+
   g_clear_object (&embed->delayed_request);
   g_clear_pointer (&embed->delayed_state, webkit_web_view_session_state_unref);
+  g_clear_pointer (&embed->virtual_state, g_bytes_unref);
+  g_clear_object (&embed->virtual_icon);
 
   G_OBJECT_CLASS (ephy_embed_parent_class)->dispose (object);
 }
@@ -422,6 +446,7 @@ ephy_embed_finalize (GObject *object)
   embed->keys = NULL;
 
   g_free (embed->title);
+  g_free (embed->virtual_url);
 
   G_OBJECT_CLASS (ephy_embed_parent_class)->finalize (object);
 }
@@ -462,6 +487,9 @@ ephy_embed_get_property (GObject    *object,
     case PROP_TITLE:
       g_value_set_string (value, ephy_embed_get_title (embed));
       break;
+    case PROP_VIRTUAL_ICON:
+      g_value_set_object (value, embed->virtual_icon);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -504,6 +532,19 @@ ephy_embed_class_init (EphyEmbedClass *klass)
                          NULL,
                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * EphyEmbed:virtual-icon:
+   *
+   * The favicon of the page a virtual embed will load. Once the web view is
+   * created, its #EphyWebView:icon is the one to use.
+   */
+  obj_properties[PROP_VIRTUAL_ICON] =
+    g_param_spec_object ("virtual-icon",
+                         "Virtual icon",
+                         "The favicon of a virtual embed",
+                         GDK_TYPE_PIXBUF,
+                         G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, LAST_PROP, obj_properties);
 }
 
@@ -691,22 +732,109 @@ ephy_embed_restored_window_cb (EphyEmbedShell *shell, EphyEmbed *embed)
 static void
 ephy_embed_mapped_cb (GtkWidget *widget, gpointer data)
 {
+  ephy_embed_ensure_web_view ((EphyEmbed *)widget);
   ephy_embed_maybe_load_delayed_request ((EphyEmbed *)widget);
 }
 
+static void
+ephy_embed_unmapped_cb (GtkWidget *widget, gpointer data)
+{
+  ((EphyEmbed *)widget)->last_visible_time = g_get_monotonic_time ();
+}
+
+static void
+ephy_embed_setup_web_view (EphyEmbed *embed)
+{
+  WebKitWebInspector *inspector;
+
+  gtk_container_add (GTK_CONTAINER (embed->overlay), GTK_WIDGET (embed->web_view));
+
+  embed->find_toolbar = ephy_find_toolbar_new (embed->web_view);
+  g_signal_connect (embed->find_toolbar, "close",
+                    G_CALLBACK (ephy_embed_find_toolbar_close_cb),
+                    embed);
+
+  gtk_box_pack_start (GTK_BOX (embed),
+                      GTK_WIDGET (embed->find_toolbar),
+                      FALSE, FALSE, 0);
+  gtk_box_reorder_child (GTK_BOX (embed), GTK_WIDGET (embed->find_toolbar), 0);
+
+  embed->progress_update_handler_id = g_signal_connect (embed->web_view, "notify::estimated-load-progress",
+                                                        G_CALLBACK (progress_update), embed);
+
+  gtk_widget_show (GTK_WIDGET (embed->web_view));
+
+  g_object_connect (embed->web_view,
+                    "signal::notify::title", G_CALLBACK (web_view_title_changed_cb), embed,
+                    "signal::load-changed", G_CALLBACK (load_changed_cb), embed,
+                    "signal::enter-fullscreen", G_CALLBACK (entering_fullscreen_cb), embed,
+                    "signal::leave-fullscreen", G_CALLBACK (leaving_fullscreen_cb), embed,
+                    NULL);
+
+  embed->status_handler_id = g_signal_connect (embed->web_view, "notify::status-message",
+                                               G_CALLBACK (status_message_notify_cb),
+                                               embed);
+
+  /* The inspector */
+  inspector = webkit_web_view_get_inspector (embed->web_view);
+
+  g_signal_connect (inspector, "attach",
+                    G_CALLBACK (ephy_embed_attach_inspector_cb),
+                    embed);
+  g_signal_connect (inspector, "closed",
+                    G_CALLBACK (ephy_embed_close_inspector_cb),
+                    embed);
+}
+
+static void
+ephy_embed_ensure_web_view (EphyEmbed *embed)
+{
+  WebKitURIRequest *request;
+  WebKitWebViewSessionState *state = NULL;
+
+  if (embed->web_view)
+    return;
+
+  LOG ("Creating the web view of virtual embed %p for %s", embed, embed->virtual_url);
+
+  embed->web_view = WEBKIT_WEB_VIEW (ephy_web_view_new ());
+  ephy_embed_setup_web_view (embed);
+
+  /* From here on, this is a regular delayed tab. */
+  request = webkit_uri_request_new (embed->virtual_url);
+  if (embed->virtual_state)
+    state = webkit_web_view_session_state_new (embed->virtual_state);
+  ephy_embed_set_delayed_load_request (embed, request, state);
+  ephy_web_view_set_placeholder (EPHY_WEB_VIEW (embed->web_view), embed->virtual_url, embed->title);
+  g_object_unref (request);
+  if (state)
+    webkit_web_view_session_state_unref (state);
+
+  if (embed->virtual_icon_cancellable) {
+    g_cancellable_cancel (embed->virtual_icon_cancellable);
+    g_clear_object (&embed->virtual_icon_cancellable);
+  }
+  g_clear_pointer (&embed->virtual_url, g_free);
+  g_clear_pointer (&embed->virtual_state, g_bytes_unref);
+  g_clear_object (&embed->virtual_icon);
+
+  g_object_notify_by_pspec (G_OBJECT (embed), obj_properties[PROP_WEB_VIEW]);
+}
+
 static void
 ephy_embed_constructed (GObject *object)
 {
   EphyEmbed *embed = (EphyEmbed *)object;
   EphyEmbedShell *shell = ephy_embed_shell_get_default ();
   GtkWidget *paned;
-  WebKitWebInspector *inspector;
 
   g_signal_connect (shell, "window-restored",
                     G_CALLBACK (ephy_embed_restored_window_cb), embed);
 
   g_signal_connect (embed, "map",
                     G_CALLBACK (ephy_embed_mapped_cb), NULL);
+  g_signal_connect (embed, "unmap",
+                    G_CALLBACK (ephy_embed_unmapped_cb), NULL);
 
   /* Skeleton */
   embed->overlay = gtk_overlay_new ();
@@ -714,7 +842,6 @@ ephy_embed_constructed (GObject *object)
   gtk_widget_add_events (embed->overlay,
                          GDK_ENTER_NOTIFY_MASK |
                          GDK_LEAVE_NOTIFY_MASK);
-  gtk_container_add (GTK_CONTAINER (embed->overlay), GTK_WIDGET (embed->web_view));
 
   /* Floating message popup for fullscreen mode. */
   embed->fullscreen_message_label = gtk_label_new (NULL);
@@ -740,19 +867,8 @@ ephy_embed_constructed (GObject *object)
   gtk_widget_set_valign (embed->progress, GTK_ALIGN_START);
   gtk_overlay_add_overlay (GTK_OVERLAY (embed->overlay), embed->progress);
 
-  embed->find_toolbar = ephy_find_toolbar_new (embed->web_view);
-  g_signal_connect (embed->find_toolbar, "close",
-                    G_CALLBACK (ephy_embed_find_toolbar_close_cb),
-                    embed);
-
-  gtk_box_pack_start (GTK_BOX (embed),
-                      GTK_WIDGET (embed->find_toolbar),
-                      FALSE, FALSE, 0);
-
   paned = GTK_WIDGET (embed->paned);
 
-  embed->progress_update_handler_id = g_signal_connect (embed->web_view, "notify::estimated-load-progress",
-                                                        G_CALLBACK (progress_update), object);
   gtk_paned_pack1 (GTK_PANED (paned), GTK_WIDGET (embed->overlay),
                    TRUE, FALSE);
 
@@ -762,29 +878,10 @@ ephy_embed_constructed (GObject *object)
   gtk_box_pack_start (GTK_BOX (embed), paned, TRUE, TRUE, 0);
 
   gtk_widget_show (GTK_WIDGET (embed->top_widgets_vbox));
-  gtk_widget_show (GTK_WIDGET (embed->web_view));
   gtk_widget_show_all (paned);
 
-  g_object_connect (embed->web_view,
-                    "signal::notify::title", G_CALLBACK (web_view_title_changed_cb), embed,
-                    "signal::load-changed", G_CALLBACK (load_changed_cb), embed,
-                    "signal::enter-fullscreen", G_CALLBACK (entering_fullscreen_cb), embed,
-                    "signal::leave-fullscreen", G_CALLBACK (leaving_fullscreen_cb), embed,
-                    NULL);
-
-  embed->status_handler_id = g_signal_connect (embed->web_view, "notify::status-message",
-                                               G_CALLBACK (status_message_notify_cb),
-                                               embed);
-
-  /* The inspector */
-  inspector = webkit_web_view_get_inspector (embed->web_view);
-
-  g_signal_connect (inspector, "attach",
-                    G_CALLBACK (ephy_embed_attach_inspector_cb),
-                    embed);
-  g_signal_connect (inspector, "closed",
-                    G_CALLBACK (ephy_embed_close_inspector_cb),
-                    embed);
+  if (embed->web_view)
+    ephy_embed_setup_web_view (embed);
 }
 
 static void
@@ -799,6 +896,7 @@ ephy_embed_init (EphyEmbed *embed)
   embed->seq_message_id = 1;
   embed->tab_message_id = ephy_embed_statusbar_get_context_id (embed, EPHY_EMBED_STATUSBAR_TAB_MESSAGE_CONTEXT_DESCRIPTION);
   embed->inspector_loaded = FALSE;
+  embed->last_visible_time = g_get_monotonic_time ();
 }
 
 /**
@@ -814,6 +912,8 @@ ephy_embed_get_web_view (EphyEmbed *embed)
 {
   g_return_val_if_fail (EPHY_IS_EMBED (embed), NULL);
 
+  ephy_embed_ensure_web_view (embed);
+
   return EPHY_WEB_VIEW (embed->web_view);
 }
 
@@ -830,6 +930,8 @@ ephy_embed_get_find_toolbar (EphyEmbed *embed)
 {
   g_return_val_if_fail (EPHY_IS_EMBED (embed), NULL);
 
+  ephy_embed_ensure_web_view (embed);
+
   return EPHY_FIND_TOOLBAR (embed->find_toolbar);
 }
 
@@ -922,7 +1024,7 @@ ephy_embed_has_load_pending (EphyEmbed *embed)
 {
   g_return_val_if_fail (EPHY_IS_EMBED (embed), FALSE);
 
-  return !!embed->delayed_request;
+  return embed->delayed_request || !embed->web_view;
 }
 
 const char *
@@ -934,6 +1036,210 @@ ephy_embed_get_title (EphyEmbed *embed)
 }
 
 
+static void
+virtual_icon_loaded_cb (WebKitFaviconDatabase *database,
+                        GAsyncResult          *result,
+                        EphyEmbed             *embed)
+{
+  cairo_surface_t *surface;
+  GError *error = NULL;
+
+  surface = webkit_favicon_database_get_favicon_finish (database, result, &error);
+  if (!surface) {
+    /* The embed may be gone already if the request was cancelled. */
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_clear_object (&embed->virtual_icon_cancellable);
+    g_error_free (error);
+    return;
+  }
+
+  g_clear_object (&embed->virtual_icon_cancellable);
+  embed->virtual_icon = ephy_pixbuf_get_from_surface_scaled (surface, FAVICON_SIZE, FAVICON_SIZE);
+  cairo_surface_destroy (surface);
+
+  g_object_notify_by_pspec (G_OBJECT (embed), obj_properties[PROP_VIRTUAL_ICON]);
+}
+
+/**
+ * ephy_embed_new_virtual:
+ * @url: the address the embed will load
+ * @title: (nullable): the title of the page at @url
+ * @session_state: (nullable): the serialized #WebKitWebViewSessionState
+ *
+ * Creates a virtual #EphyEmbed: a tab that only holds its address, title,
+ * favicon and serialized session state. Its #EphyWebView is created, and
+ * @session_state restored into it, the first time the embed is shown or
+ * ephy_embed_get_web_view() is called, so restoring a session with many
+ * tabs does not pay for web views that are never looked at.
+ *
+ * Returns: (transfer floating): a new virtual #EphyEmbed
+ */
+EphyEmbed *
+ephy_embed_new_virtual (const char *url,
+                        const char *title,
+                        GBytes     *session_state)
+{
+  EphyEmbed *embed;
+  WebKitFaviconDatabase *database;
+
+  g_return_val_if_fail (url != NULL, NULL);
+
+  embed = g_object_new (EPHY_TYPE_EMBED, NULL);
+  embed->virtual_url = g_strdup (url);
+  if (session_state)
+    embed->virtual_state = g_bytes_ref (session_state);
+  ephy_embed_set_title (embed, title);
+
+  database = webkit_web_context_get_favicon_database (ephy_embed_shell_get_web_context (ephy_embed_shell_get_default ()));
+  embed->virtual_icon_cancellable = g_cancellable_new ();
+  webkit_favicon_database_get_favicon (database, url,
+                                       embed->virtual_icon_cancellable,
+                                       (GAsyncReadyCallback)virtual_icon_loaded_cb,
+                                       embed);
+
+  return embed;
+}
+
+/**
+ * ephy_embed_is_virtual:
+ * @embed: an #EphyEmbed
+ *
+ * Checks whether @embed is still waiting to create its web view.
+ *
+ * Returns: %TRUE if @embed has no #EphyWebView yet
+ */
+gboolean
+ephy_embed_is_virtual (EphyEmbed *embed)
+{
+  g_return_val_if_fail (EPHY_IS_EMBED (embed), FALSE);
+
+  return embed->web_view == NULL;
+}
+
+const char *
+ephy_embed_get_virtual_url (EphyEmbed *embed)
+{
+  g_return_val_if_fail (EPHY_IS_EMBED (embed), NULL);
+
+  return embed->virtual_url;
+}
+
+GBytes *
+ephy_embed_get_virtual_session_state (EphyEmbed *embed)
+{
+  g_return_val_if_fail (EPHY_IS_EMBED (embed), NULL);
+
+  return embed->virtual_state;
+}
+
+GdkPixbuf *
+ephy_embed_get_virtual_icon (EphyEmbed *embed)
+{
+  g_return_val_if_fail (EPHY_IS_EMBED (embed), NULL);
+
+  return embed->virtual_icon;
+}
+
+/**
+ * ephy_embed_hibernate:
+ * @embed: an #EphyEmbed
+ *
+ * Turns @embed back into a virtual embed: its address, title, favicon and
+ * session state are kept while its #EphyWebView, and the web process memory
+ * behind it, are released. As with any virtual embed, the web view is
+ * created again and the page reloaded the next time @embed is shown.
+ *
+ * #EphyEmbed:web-view is notified once the web view is gone. It is up to
+ * the caller to make sure the page has nothing that would be lost, see
+ * #EphyTabHibernator.
+ */
+void
+ephy_embed_hibernate (EphyEmbed *embed)
+{
+  WebKitWebViewSessionState *state;
+  GdkPixbuf *icon;
+
+  g_return_if_fail (EPHY_IS_EMBED (embed));
+
+  if (!embed->web_view)
+    return;
+
+  LOG ("Hibernating embed %p", embed);
+
+  /* A tab that never got to load goes back to what it was waiting for. */
+  if (embed->delayed_request) {
+    embed->virtual_url = g_strdup (webkit_uri_request_get_uri (embed->delayed_request));
+    if (embed->delayed_state)
+      embed->virtual_state = webkit_web_view_session_state_serialize (embed->delayed_state);
+  } else {
+    const char *address = ephy_web_view_get_address (EPHY_WEB_VIEW (embed->web_view));
+
+    /* ephy-about: URIs are not valid for loading. */
+    if (g_str_has_prefix (address, EPHY_ABOUT_SCHEME))
+      embed->virtual_url = g_strconcat ("about", address + EPHY_ABOUT_SCHEME_LEN, NULL);
+    else
+      embed->virtual_url = g_strdup (address);
+
+    state = webkit_web_view_get_session_state (embed->web_view);
+    embed->virtual_state = webkit_web_view_session_state_serialize (state);
+    webkit_web_view_session_state_unref (state);
+  }
+
+  icon = ephy_web_view_get_icon (EPHY_WEB_VIEW (embed->web_view));
+  if (icon)
+    embed->virtual_icon = g_object_ref (icon);
+
+  if (embed->delayed_request_source_id) {
+    g_source_remove (embed->delayed_request_source_id);
+    embed->delayed_request_source_id = 0;
+  }
+  g_clear_object (&embed->delayed_request);
+  g_clear_pointer (&embed->delayed_state, webkit_web_view_session_state_unref);
+
+  if (embed->clear_progress_source_id) {
+    g_source_remove (embed->clear_progress_source_id);
+    embed->clear_progress_source_id = 0;
+  }
+  gtk_widget_hide (embed->progress);
+
+  if (embed->pop_statusbar_later_source_id) {
+    g_source_remove (embed->pop_statusbar_later_source_id);
+    embed->pop_statusbar_later_source_id = 0;
+  }
+  ephy_embed_statusbar_pop (embed, embed->tab_message_id);
+
+  /* Nothing here should hear from the web view while it goes away. */
+  g_signal_handlers_disconnect_by_data (webkit_web_view_get_inspector (embed->web_view), embed);
+  g_signal_handlers_disconnect_by_data (embed->web_view, embed);
+  embed->status_handler_id = 0;
+  embed->progress_update_handler_id = 0;
+
+  gtk_widget_destroy (GTK_WIDGET (embed->find_toolbar));
+  embed->find_toolbar = NULL;
+  gtk_widget_destroy (GTK_WIDGET (embed->web_view));
+  embed->web_view = NULL;
+
+  g_object_notify_by_pspec (G_OBJECT (embed), obj_properties[PROP_WEB_VIEW]);
+}
+
+/**
+ * ephy_embed_get_last_visible_time:
+ * @embed: an #EphyEmbed
+ *
+ * Returns: the monotonic time @embed was last visible, or the current time
+ * if it is visible now
+ */
+gint64
+ephy_embed_get_last_visible_time (EphyEmbed *embed)
+{
+  g_return_val_if_fail (EPHY_IS_EMBED (embed), 0);
+
+  if (gtk_widget_get_mapped (GTK_WIDGET (embed)))
+    return g_get_monotonic_time ();
+
+  return embed->last_visible_time;
+}
+
 /**
  * ephy_embed_inspector_is_loaded:
  * @embed: a #EphyEmbed
@@ -32,6 +32,15 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (EphyEmbed, ephy_embed, EPHY, EMBED, GtkBox)
 
+EphyEmbed*       ephy_embed_new_virtual                   (const char *url,
+                                                           const char *title,
+                                                           GBytes     *session_state);
+gboolean         ephy_embed_is_virtual                    (EphyEmbed  *embed);
+const char      *ephy_embed_get_virtual_url               (EphyEmbed  *embed);
+GBytes          *ephy_embed_get_virtual_session_state     (EphyEmbed  *embed);
+GdkPixbuf       *ephy_embed_get_virtual_icon              (EphyEmbed  *embed);
+void             ephy_embed_hibernate                     (EphyEmbed  *embed);
+gint64           ephy_embed_get_last_visible_time         (EphyEmbed  *embed);
 EphyWebView*     ephy_embed_get_web_view                  (EphyEmbed  *embed);
 EphyFindToolbar* ephy_embed_get_find_toolbar              (EphyEmbed  *embed);
 void             ephy_embed_add_top_widget                (EphyEmbed  *embed,
@@ -0,0 +1,333 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-favicon-cache.h"
+
+#include "ephy-embed-prefs.h"
+#include "ephy-favicon-helpers.h"
+
+/* Enough for the completion popup, the bookmarks popover and the history
+ * menus to be shown again without reloading their icons. */
+#define MAX_CACHED_FAVICONS 256
+
+typedef struct {
+  char *page_url;
+  /* NULL when the page has no favicon. */
+  GdkPixbuf *favicon;
+} CacheEntry;
+
+typedef struct {
+  EphyFaviconCache *cache;
+  char *page_url;
+  GList *tasks;
+  gboolean invalidated;
+} PendingLoad;
+
+struct _EphyFaviconCache {
+  GObject parent_instance;
+
+  WebKitFaviconDatabase *database;
+
+  /* Most recently used first. */
+  GQueue entries;
+  GHashTable *entry_links;
+  GHashTable *pending_loads;
+};
+
+G_DEFINE_TYPE (EphyFaviconCache, ephy_favicon_cache, G_TYPE_OBJECT)
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_free (entry->page_url);
+  g_clear_object (&entry->favicon);
+  g_free (entry);
+}
+
+static void
+remove_entry (EphyFaviconCache *self,
+              GList            *link)
+{
+  CacheEntry *entry = link->data;
+
+  g_hash_table_remove (self->entry_links, entry->page_url);
+  g_queue_delete_link (&self->entries, link);
+  cache_entry_free (entry);
+}
+
+static void
+add_entry (EphyFaviconCache *self,
+           const char       *page_url,
+           GdkPixbuf        *favicon)
+{
+  CacheEntry *entry;
+  GList *link;
+
+  link = g_hash_table_lookup (self->entry_links, page_url);
+  if (link)
+    remove_entry (self, link);
+
+  entry = g_new (CacheEntry, 1);
+  entry->page_url = g_strdup (page_url);
+  entry->favicon = favicon ? g_object_ref (favicon) : NULL;
+
+  g_queue_push_head (&self->entries, entry);
+  g_hash_table_insert (self->entry_links, entry->page_url, self->entries.head);
+
+  if (self->entries.length > MAX_CACHED_FAVICONS)
+    remove_entry (self, self->entries.tail);
+}
+
+static void
+favicon_changed_cb (WebKitFaviconDatabase *database,
+                    const char            *page_url,
+                    const char            *favicon_url,
+                    EphyFaviconCache      *self)
+{
+  PendingLoad *load;
+  GList *link;
+
+  link = g_hash_table_lookup (self->entry_links, page_url);
+  if (link)
+    remove_entry (self, link);
+
+  /* A load already running may still return the previous icon. */
+  load = g_hash_table_lookup (self->pending_loads, page_url);
+  if (load)
+    load->invalidated = TRUE;
+}
+
+static void
+favicon_loaded_cb (WebKitFaviconDatabase *database,
+                   GAsyncResult          *result,
+                   PendingLoad           *load)
+{
+  EphyFaviconCache *self = load->cache;
+  cairo_surface_t *surface;
+  GdkPixbuf *favicon = NULL;
+  GError *error = NULL;
+  gboolean cacheable;
+
+  surface = webkit_favicon_database_get_favicon_finish (database, result, &error);
+  if (surface) {
+    favicon = ephy_pixbuf_get_from_surface_scaled (surface, FAVICON_SIZE, FAVICON_SIZE);
+    cairo_surface_destroy (surface);
+  }
+
+  /* Pages without a favicon are remembered too, until the database
+   * announces one for them. */
+  cacheable = !load->invalidated &&
+              (surface ||
+               g_error_matches (error, WEBKIT_FAVICON_DATABASE_ERROR, WEBKIT_FAVICON_DATABASE_ERROR_FAVICON_NOT_FOUND) ||
+               g_error_matches (error, WEBKIT_FAVICON_DATABASE_ERROR, WEBKIT_FAVICON_DATABASE_ERROR_FAVICON_UNKNOWN));
+  g_clear_error (&error);
+
+  g_hash_table_remove (self->pending_loads, load->page_url);
+  if (cacheable)
+    add_entry (self, load->page_url, favicon);
+
+  for (GList *l = load->tasks; l; l = l->next) {
+    GTask *task = l->data;
+
+    g_task_return_pointer (task, favicon ? g_object_ref (favicon) : NULL, g_object_unref);
+    g_object_unref (task);
+  }
+
+  g_clear_object (&favicon);
+  g_list_free (load->tasks);
+  g_free (load->page_url);
+  g_object_unref (load->cache);
+  g_free (load);
+}
+
+static void
+ephy_favicon_cache_dispose (GObject *object)
+{
+  EphyFaviconCache *self = EPHY_FAVICON_CACHE (object);
+
+  if (self->database) {
+    g_signal_handlers_disconnect_by_func (self->database, favicon_changed_cb, self);
+    g_clear_object (&self->database);
+  }
+
+  G_OBJECT_CLASS (ephy_favicon_cache_parent_class)->dispose (object);
+}
+
+static void
+ephy_favicon_cache_finalize (GObject *object)
+{
+  EphyFaviconCache *self = EPHY_FAVICON_CACHE (object);
+
+  g_queue_foreach (&self->entries, (GFunc)cache_entry_free, NULL);
+  g_queue_clear (&self->entries);
+  g_hash_table_destroy (self->entry_links);
+  g_hash_table_destroy (self->pending_loads);
+
+  G_OBJECT_CLASS (ephy_favicon_cache_parent_class)->finalize (object);
+}
+
+static void
+ephy_favicon_cache_class_init (EphyFaviconCacheClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_favicon_cache_dispose;
+  object_class->finalize = ephy_favicon_cache_finalize;
+}
+
+static void
+ephy_favicon_cache_init (EphyFaviconCache *self)
+{
+  g_queue_init (&self->entries);
+  self->entry_links = g_hash_table_new (g_str_hash, g_str_equal);
+  self->pending_loads = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+/**
+ * ephy_favicon_cache_new:
+ * @database: the #WebKitFaviconDatabase to load favicons from
+ *
+ * Creates a cache of the favicons of recently shown pages, scaled to
+ * %FAVICON_SIZE. Entries are dropped when @database signals that the
+ * favicon of their page changed.
+ *
+ * Returns: (transfer full): a new #EphyFaviconCache
+ */
+EphyFaviconCache *
+ephy_favicon_cache_new (WebKitFaviconDatabase *database)
+{
+  EphyFaviconCache *self;
+
+  g_return_val_if_fail (WEBKIT_IS_FAVICON_DATABASE (database), NULL);
+
+  self = g_object_new (EPHY_TYPE_FAVICON_CACHE, NULL);
+  self->database = g_object_ref (database);
+  g_signal_connect (database, "favicon-changed",
+                    G_CALLBACK (favicon_changed_cb), self);
+
+  return self;
+}
+
+/**
+ * ephy_favicon_cache_lookup:
+ * @cache: an #EphyFaviconCache
+ * @page_url: the address of a page
+ * @favicon: (out) (transfer none) (nullable): return location for the
+ *   favicon of @page_url, or %NULL if it has none
+ *
+ * Looks up the favicon of @page_url without loading it.
+ *
+ * Returns: %TRUE if @cache knows whether @page_url has a favicon
+ */
+gboolean
+ephy_favicon_cache_lookup (EphyFaviconCache  *self,
+                           const char        *page_url,
+                           GdkPixbuf        **favicon)
+{
+  GList *link;
+
+  g_return_val_if_fail (EPHY_IS_FAVICON_CACHE (self), FALSE);
+  g_return_val_if_fail (page_url != NULL, FALSE);
+  g_return_val_if_fail (favicon != NULL, FALSE);
+
+  link = g_hash_table_lookup (self->entry_links, page_url);
+  if (!link) {
+    *favicon = NULL;
+    return FALSE;
+  }
+
+  g_queue_unlink (&self->entries, link);
+  g_queue_push_head_link (&self->entries, link);
+
+  *favicon = ((CacheEntry *)link->data)->favicon;
+
+  return TRUE;
+}
+
+/**
+ * ephy_favicon_cache_get_favicon_async:
+ * @cache: an #EphyFaviconCache
+ * @page_url: the address of a page
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: called when the favicon is available
+ * @user_data: data for @callback
+ *
+ * Gets the favicon of @page_url from @cache, or loads it from the favicon
+ * database. Requests for a page already being loaded share its load.
+ */
+void
+ephy_favicon_cache_get_favicon_async (EphyFaviconCache    *self,
+                                      const char          *page_url,
+                                      GCancellable        *cancellable,
+                                      GAsyncReadyCallback  callback,
+                                      gpointer             user_data)
+{
+  PendingLoad *load;
+  GdkPixbuf *favicon;
+  GTask *task;
+
+  g_return_if_fail (EPHY_IS_FAVICON_CACHE (self));
+  g_return_if_fail (page_url != NULL);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ephy_favicon_cache_get_favicon_async);
+
+  if (ephy_favicon_cache_lookup (self, page_url, &favicon)) {
+    g_task_return_pointer (task, favicon ? g_object_ref (favicon) : NULL, g_object_unref);
+    g_object_unref (task);
+    return;
+  }
+
+  load = g_hash_table_lookup (self->pending_loads, page_url);
+  if (load) {
+    load->tasks = g_list_append (load->tasks, task);
+    return;
+  }
+
+  load = g_new0 (PendingLoad, 1);
+  load->cache = g_object_ref (self);
+  load->page_url = g_strdup (page_url);
+  load->tasks = g_list_prepend (NULL, task);
+  g_hash_table_insert (self->pending_loads, load->page_url, load);
+
+  webkit_favicon_database_get_favicon (self->database, page_url, NULL,
+                                       (GAsyncReadyCallback)favicon_loaded_cb,
+                                       load);
+}
+
+/**
+ * ephy_favicon_cache_get_favicon_finish:
+ * @cache: an #EphyFaviconCache
+ * @result: a #GAsyncResult
+ * @error: return location for a #GError, or %NULL
+ *
+ * Returns: (transfer full) (nullable): the favicon, scaled to
+ *   %FAVICON_SIZE, or %NULL if the page has none
+ */
+GdkPixbuf *
+ephy_favicon_cache_get_favicon_finish (EphyFaviconCache  *self,
+                                       GAsyncResult      *result,
+                                       GError           **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,47 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <webkit2/webkit2.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_FAVICON_CACHE (ephy_favicon_cache_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyFaviconCache, ephy_favicon_cache, EPHY, FAVICON_CACHE, GObject)
+
+EphyFaviconCache *ephy_favicon_cache_new                (WebKitFaviconDatabase *database);
+
+gboolean          ephy_favicon_cache_lookup             (EphyFaviconCache      *cache,
+                                                         const char            *page_url,
+                                                         GdkPixbuf            **favicon);
+
+void              ephy_favicon_cache_get_favicon_async  (EphyFaviconCache      *cache,
+                                                         const char            *page_url,
+                                                         GCancellable          *cancellable,
+                                                         GAsyncReadyCallback    callback,
+                                                         gpointer               user_data);
+GdkPixbuf        *ephy_favicon_cache_get_favicon_finish (EphyFaviconCache      *cache,
+                                                         GAsyncResult          *result,
+                                                         GError               **error);
+
+G_END_DECLS
@@ -0,0 +1,576 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-tab-hibernator.h"
+
+#include "ephy-debug.h"
+#include "ephy-download.h"
+#include "ephy-downloads-manager.h"
+#include "ephy-embed.h"
+#include "ephy-embed-container.h"
+#include "ephy-embed-shell.h"
+#include "ephy-prefs.h"
+#include "ephy-settings.h"
+#include "ephy-smaps.h"
+#include "ephy-web-view.h"
+
+#if !GLIB_CHECK_VERSION (2, 64, 0)
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+/* How often the memory use is compared with the budget. */
+#define BUDGET_CHECK_INTERVAL 60 /* seconds */
+
+/* Web processes take a moment to exit once their web view is gone. */
+#define RECLAIMED_SIZE_DELAY 5 /* seconds */
+
+#if !GLIB_CHECK_VERSION (2, 64, 0)
+/* Tasks stalled on memory for 150 ms within any 2 s window. This is the
+ * smallest window the kernel accepts from unprivileged processes. */
+#define PSI_MEMORY_TRIGGER "some 150000 2000000"
+#endif
+
+struct _EphyTabHibernator {
+  GObject parent_instance;
+
+  GCancellable *cancellable;
+  guint budget_check_source_id;
+  struct _HibernationRun *run;
+
+#if GLIB_CHECK_VERSION (2, 64, 0)
+  GMemoryMonitor *memory_monitor;
+#else
+  int psi_fd;
+  guint psi_source_id;
+#endif
+
+  guint n_hibernated;
+  guint64 reclaimed_size;
+};
+
+G_DEFINE_TYPE (EphyTabHibernator, ephy_tab_hibernator, G_TYPE_OBJECT)
+
+/* A pass over the open tabs. Only one runs at a time, and it owns whatever
+ * async operation is in flight: when the hibernator goes away, the
+ * operation is cancelled and its callback frees the run. */
+typedef struct _HibernationRun {
+  EphyTabHibernator *hibernator;
+  GCancellable *cancellable;
+  gboolean under_pressure;
+  gsize resident_size;
+  guint n_to_hibernate;
+  guint n_hibernated;
+  GList *candidates;
+  guint reclaimed_size_source_id;
+} HibernationRun;
+
+static void hibernation_run_next (HibernationRun *run);
+
+static HibernationRun *
+hibernation_run_new (EphyTabHibernator *hibernator,
+                     gboolean           under_pressure)
+{
+  HibernationRun *run = g_slice_new0 (HibernationRun);
+
+  run->hibernator = hibernator;
+  run->cancellable = g_object_ref (hibernator->cancellable);
+  run->under_pressure = under_pressure;
+
+  return run;
+}
+
+static void
+hibernation_run_free (HibernationRun *run)
+{
+  g_object_unref (run->cancellable);
+  g_list_free_full (run->candidates, g_object_unref);
+
+  g_slice_free (HibernationRun, run);
+}
+
+static void
+hibernation_run_finish (HibernationRun *run)
+{
+  run->hibernator->run = NULL;
+  hibernation_run_free (run);
+}
+
+static void
+get_resident_size_thread (GTask        *task,
+                          gpointer      source_object,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  g_task_return_int (task, ephy_smaps_get_resident_size ());
+}
+
+static void
+get_resident_size_async (EphyTabHibernator  *hibernator,
+                         GAsyncReadyCallback callback,
+                         HibernationRun     *run)
+{
+  GTask *task;
+
+  task = g_task_new (hibernator, run->cancellable, callback, run);
+  g_task_set_return_on_cancel (task, TRUE);
+  g_task_run_in_thread (task, get_resident_size_thread);
+  g_object_unref (task);
+}
+
+static gboolean
+web_view_has_active_downloads (EphyWebView *view)
+{
+  EphyDownloadsManager *manager;
+
+  manager = ephy_embed_shell_get_downloads_manager (ephy_embed_shell_get_default ());
+  for (GList *l = ephy_downloads_manager_get_downloads (manager); l; l = l->next) {
+    EphyDownload *download = EPHY_DOWNLOAD (l->data);
+
+    if (ephy_download_is_active (download) &&
+        webkit_download_get_web_view (ephy_download_get_webkit_download (download)) == WEBKIT_WEB_VIEW (view))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Whether @embed can lose its web view without the user noticing, other
+ * than the page loading again. Modified forms are checked separately, as
+ * that needs a round trip to the web process. */
+static gboolean
+embed_can_hibernate (EphyEmbed *embed,
+                     gint64     hidden_since)
+{
+  GtkWidget *toplevel;
+  EphyWebView *view;
+
+  if (ephy_embed_is_virtual (embed))
+    return FALSE;
+
+  /* Closed tabs and the tab on display in each window stay as they are. */
+  toplevel = gtk_widget_get_toplevel (GTK_WIDGET (embed));
+  if (!EPHY_IS_EMBED_CONTAINER (toplevel) ||
+      ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (toplevel)) == embed)
+    return FALSE;
+
+  if (ephy_embed_get_last_visible_time (embed) > hidden_since)
+    return FALSE;
+
+  if (ephy_embed_inspector_is_loaded (embed))
+    return FALSE;
+
+  view = ephy_embed_get_web_view (embed);
+  if (webkit_web_view_is_playing_audio (WEBKIT_WEB_VIEW (view)))
+    return FALSE;
+
+  if (ephy_web_view_is_loading (view) && !ephy_embed_has_load_pending (embed))
+    return FALSE;
+
+  return !web_view_has_active_downloads (view);
+}
+
+static gint64
+get_hidden_since (void)
+{
+  guint timeout;
+
+  timeout = g_settings_get_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_TAB_HIBERNATION_TIMEOUT);
+
+  return g_get_monotonic_time () - (gint64)timeout * 60 * G_USEC_PER_SEC;
+}
+
+static int
+compare_last_visible_time (EphyEmbed *a,
+                           EphyEmbed *b)
+{
+  gint64 time_a = ephy_embed_get_last_visible_time (a);
+  gint64 time_b = ephy_embed_get_last_visible_time (b);
+
+  return time_a < time_b ? -1 : time_a > time_b;
+}
+
+/* Returns the tabs that could be hibernated, the ones hidden for longest
+ * first, and sets @n_web_views to the number of tabs with a web view. */
+static GList *
+get_candidates (guint *n_web_views)
+{
+  GList *candidates = NULL;
+  gint64 hidden_since = get_hidden_since ();
+
+  *n_web_views = 0;
+
+  for (GList *w = gtk_application_get_windows (GTK_APPLICATION (ephy_embed_shell_get_default ())); w; w = w->next) {
+    GList *tabs;
+
+    if (!EPHY_IS_EMBED_CONTAINER (w->data))
+      continue;
+
+    tabs = ephy_embed_container_get_children (EPHY_EMBED_CONTAINER (w->data));
+    for (GList *l = tabs; l; l = l->next) {
+      EphyEmbed *embed = EPHY_EMBED (l->data);
+
+      if (ephy_embed_is_virtual (embed))
+        continue;
+
+      (*n_web_views)++;
+      if (embed_can_hibernate (embed, hidden_since))
+        candidates = g_list_prepend (candidates, g_object_ref (embed));
+    }
+    g_list_free (tabs);
+  }
+
+  return g_list_sort (candidates, (GCompareFunc)compare_last_visible_time);
+}
+
+static void
+reclaimed_size_cb (EphyTabHibernator *hibernator,
+                   GAsyncResult      *result,
+                   HibernationRun    *run)
+{
+  gssize resident_size;
+
+  resident_size = g_task_propagate_int (G_TASK (result), NULL);
+  if (g_cancellable_is_cancelled (run->cancellable)) {
+    hibernation_run_free (run);
+    return;
+  }
+
+  /* Other tabs may have grown in the meantime, so this undercounts rather
+   * than claim memory that was not given back. */
+  if (resident_size >= 0 && (gsize)resident_size < run->resident_size)
+    hibernator->reclaimed_size += run->resident_size - resident_size;
+
+  LOG ("Hibernated %u tabs, resident size went from %" G_GSIZE_FORMAT " to %" G_GSSIZE_FORMAT " bytes",
+       run->n_hibernated, run->resident_size, resident_size);
+
+  hibernation_run_finish (run);
+}
+
+static gboolean
+measure_reclaimed_size_cb (HibernationRun *run)
+{
+  run->reclaimed_size_source_id = 0;
+  get_resident_size_async (run->hibernator, (GAsyncReadyCallback)reclaimed_size_cb, run);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+has_modified_forms_cb (EphyWebView    *view,
+                       GAsyncResult   *result,
+                       HibernationRun *run)
+{
+  EphyEmbed *embed;
+  gboolean has_modified_forms;
+
+  has_modified_forms = ephy_web_view_has_modified_forms_finish (view, result, NULL);
+  if (g_cancellable_is_cancelled (run->cancellable)) {
+    hibernation_run_free (run);
+    return;
+  }
+
+  embed = run->candidates->data;
+  run->candidates = g_list_delete_link (run->candidates, run->candidates);
+
+  /* Things may have changed while the web process was answering. */
+  if (!has_modified_forms && embed_can_hibernate (embed, get_hidden_since ())) {
+    ephy_embed_hibernate (embed);
+    run->n_hibernated++;
+    run->hibernator->n_hibernated++;
+  }
+  g_object_unref (embed);
+
+  hibernation_run_next (run);
+}
+
+static void
+hibernation_run_next (HibernationRun *run)
+{
+  if (run->candidates && run->n_hibernated < run->n_to_hibernate) {
+    EphyEmbed *embed = run->candidates->data;
+
+    if (!ephy_embed_is_virtual (embed)) {
+      ephy_web_view_has_modified_forms (ephy_embed_get_web_view (embed),
+                                        run->cancellable,
+                                        (GAsyncReadyCallback)has_modified_forms_cb,
+                                        run);
+      return;
+    }
+
+    /* Shown and hidden again while we were busy with other tabs. */
+    run->candidates = g_list_delete_link (run->candidates, run->candidates);
+    g_object_unref (embed);
+    hibernation_run_next (run);
+    return;
+  }
+
+  if (run->n_hibernated == 0) {
+    hibernation_run_finish (run);
+    return;
+  }
+
+  run->reclaimed_size_source_id = g_timeout_add_seconds (RECLAIMED_SIZE_DELAY,
+                                                         (GSourceFunc)measure_reclaimed_size_cb,
+                                                         run);
+  g_source_set_name_by_id (run->reclaimed_size_source_id, "[epiphany] measure_reclaimed_size_cb");
+}
+
+static void
+resident_size_cb (EphyTabHibernator *hibernator,
+                  GAsyncResult      *result,
+                  HibernationRun    *run)
+{
+  gssize resident_size;
+  gsize budget;
+  guint n_web_views;
+
+  resident_size = g_task_propagate_int (G_TASK (result), NULL);
+  if (g_cancellable_is_cancelled (run->cancellable)) {
+    hibernation_run_free (run);
+    return;
+  }
+
+  run->resident_size = MAX (resident_size, 0);
+  run->candidates = get_candidates (&n_web_views);
+
+  if (run->under_pressure) {
+    run->n_to_hibernate = G_MAXUINT;
+  } else {
+    budget = (gsize)g_settings_get_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_TAB_HIBERNATION_MEMORY_BUDGET) * 1024 * 1024;
+    if (run->resident_size > budget && n_web_views > 0) {
+      gsize per_web_view = run->resident_size / n_web_views;
+
+      /* Web views cost roughly the same, hibernate as many as the excess
+       * would take. What the UI process uses is spread among them. */
+      run->n_to_hibernate = (run->resident_size - budget + per_web_view - 1) / per_web_view;
+    }
+  }
+
+  LOG ("Resident size is %" G_GSIZE_FORMAT " bytes, hibernating up to %u of %u tabs",
+       run->resident_size, MIN (run->n_to_hibernate, g_list_length (run->candidates)), n_web_views);
+
+  hibernation_run_next (run);
+}
+
+static void
+hibernation_run_start (EphyTabHibernator *hibernator,
+                       gboolean           under_pressure)
+{
+  if (hibernator->run) {
+    hibernator->run->under_pressure |= under_pressure;
+    return;
+  }
+
+  if (g_settings_get_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_TAB_HIBERNATION_TIMEOUT) == 0)
+    return;
+
+  hibernator->run = hibernation_run_new (hibernator, under_pressure);
+  get_resident_size_async (hibernator, (GAsyncReadyCallback)resident_size_cb, hibernator->run);
+}
+
+static gboolean
+budget_check_cb (EphyTabHibernator *hibernator)
+{
+  if (g_settings_get_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_TAB_HIBERNATION_MEMORY_BUDGET) > 0)
+    hibernation_run_start (hibernator, FALSE);
+
+  return G_SOURCE_CONTINUE;
+}
+
+#if GLIB_CHECK_VERSION (2, 64, 0)
+static void
+low_memory_warning_cb (GMemoryMonitor            *monitor,
+                       GMemoryMonitorWarningLevel level,
+                       EphyTabHibernator         *hibernator)
+{
+  LOG ("Low memory warning, level %d", level);
+
+  hibernation_run_start (hibernator, TRUE);
+}
+#else
+static gboolean
+psi_memory_event_cb (int                fd,
+                     GIOCondition       condition,
+                     EphyTabHibernator *hibernator)
+{
+  if (condition & G_IO_ERR) {
+    g_warning ("Memory pressure monitor stopped working");
+    hibernator->psi_source_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  LOG ("Memory pressure stall over the threshold");
+
+  hibernation_run_start (hibernator, TRUE);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+psi_memory_monitor_start (EphyTabHibernator *hibernator)
+{
+  hibernator->psi_fd = open ("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (hibernator->psi_fd < 0) {
+    LOG ("Pressure stall information is not available: %s", g_strerror (errno));
+    return;
+  }
+
+  if (write (hibernator->psi_fd, PSI_MEMORY_TRIGGER, strlen (PSI_MEMORY_TRIGGER) + 1) < 0) {
+    LOG ("Could not set up a memory pressure trigger: %s", g_strerror (errno));
+    close (hibernator->psi_fd);
+    hibernator->psi_fd = -1;
+    return;
+  }
+
+  hibernator->psi_source_id = g_unix_fd_add (hibernator->psi_fd, G_IO_PRI | G_IO_ERR,
+                                             (GUnixFDSourceFunc)psi_memory_event_cb,
+                                             hibernator);
+}
+#endif
+
+static void
+ephy_tab_hibernator_dispose (GObject *object)
+{
+  EphyTabHibernator *hibernator = EPHY_TAB_HIBERNATOR (object);
+
+  if (hibernator->cancellable) {
+    g_cancellable_cancel (hibernator->cancellable);
+    g_clear_object (&hibernator->cancellable);
+  }
+
+  /* Otherwise the cancelled operation of the run frees it. */
+  if (hibernator->run) {
+    if (hibernator->run->reclaimed_size_source_id) {
+      g_source_remove (hibernator->run->reclaimed_size_source_id);
+      hibernation_run_free (hibernator->run);
+    }
+    hibernator->run = NULL;
+  }
+
+  if (hibernator->budget_check_source_id) {
+    g_source_remove (hibernator->budget_check_source_id);
+    hibernator->budget_check_source_id = 0;
+  }
+
+#if GLIB_CHECK_VERSION (2, 64, 0)
+  if (hibernator->memory_monitor) {
+    g_signal_handlers_disconnect_by_data (hibernator->memory_monitor, hibernator);
+    g_clear_object (&hibernator->memory_monitor);
+  }
+#else
+  if (hibernator->psi_source_id) {
+    g_source_remove (hibernator->psi_source_id);
+    hibernator->psi_source_id = 0;
+  }
+
+  if (hibernator->psi_fd >= 0) {
+    close (hibernator->psi_fd);
+    hibernator->psi_fd = -1;
+  }
+#endif
+
+  G_OBJECT_CLASS (ephy_tab_hibernator_parent_class)->dispose (object);
+}
+
+static void
+ephy_tab_hibernator_class_init (EphyTabHibernatorClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_tab_hibernator_dispose;
+}
+
+static void
+ephy_tab_hibernator_init (EphyTabHibernator *hibernator)
+{
+  hibernator->cancellable = g_cancellable_new ();
+
+  hibernator->budget_check_source_id = g_timeout_add_seconds (BUDGET_CHECK_INTERVAL,
+                                                              (GSourceFunc)budget_check_cb,
+                                                              hibernator);
+  g_source_set_name_by_id (hibernator->budget_check_source_id, "[epiphany] budget_check_cb");
+
+#if GLIB_CHECK_VERSION (2, 64, 0)
+  hibernator->memory_monitor = g_memory_monitor_dup_default ();
+  g_signal_connect (hibernator->memory_monitor, "low-memory-warning",
+                    G_CALLBACK (low_memory_warning_cb), hibernator);
+#else
+  hibernator->psi_fd = -1;
+  psi_memory_monitor_start (hibernator);
+#endif
+}
+
+/**
+ * ephy_tab_hibernator_new:
+ *
+ * Creates the object that releases the web views of tabs that have been
+ * hidden for a while, see ephy_embed_hibernate(). It does so when the
+ * browser and its web processes take more memory than the
+ * #EPHY_PREFS_TAB_HIBERNATION_MEMORY_BUDGET, hidden tabs first, and for all
+ * the hidden tabs when the system runs low on memory.
+ *
+ * Returns: (transfer full): a new #EphyTabHibernator
+ */
+EphyTabHibernator *
+ephy_tab_hibernator_new (void)
+{
+  return EPHY_TAB_HIBERNATOR (g_object_new (EPHY_TYPE_TAB_HIBERNATOR, NULL));
+}
+
+/**
+ * ephy_tab_hibernator_hibernate_tabs:
+ * @hibernator: an #EphyTabHibernator
+ *
+ * Hibernates every tab that can be, as if the system was low on memory.
+ */
+void
+ephy_tab_hibernator_hibernate_tabs (EphyTabHibernator *hibernator)
+{
+  g_return_if_fail (EPHY_IS_TAB_HIBERNATOR (hibernator));
+
+  hibernation_run_start (hibernator, TRUE);
+}
+
+guint
+ephy_tab_hibernator_get_n_hibernated (EphyTabHibernator *hibernator)
+{
+  g_return_val_if_fail (EPHY_IS_TAB_HIBERNATOR (hibernator), 0);
+
+  return hibernator->n_hibernated;
+}
+
+/**
+ * ephy_tab_hibernator_get_reclaimed_size:
+ * @hibernator: an #EphyTabHibernator
+ *
+ * Returns: the memory, in bytes, given back by hibernating tabs so far
+ */
+guint64
+ephy_tab_hibernator_get_reclaimed_size (EphyTabHibernator *hibernator)
+{
+  g_return_val_if_fail (EPHY_IS_TAB_HIBERNATOR (hibernator), 0);
+
+  return hibernator->reclaimed_size;
+}
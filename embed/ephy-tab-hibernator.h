@@ -0,0 +1,38 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_TAB_HIBERNATOR (ephy_tab_hibernator_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyTabHibernator, ephy_tab_hibernator, EPHY, TAB_HIBERNATOR, GObject)
+
+EphyTabHibernator *ephy_tab_hibernator_new                (void);
+
+void               ephy_tab_hibernator_hibernate_tabs     (EphyTabHibernator *hibernator);
+
+guint              ephy_tab_hibernator_get_n_hibernated   (EphyTabHibernator *hibernator);
+guint64            ephy_tab_hibernator_get_reclaimed_size (EphyTabHibernator *hibernator);
+
+G_END_DECLS
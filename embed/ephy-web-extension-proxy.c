@@ -32,10 +32,14 @@ struct _EphyWebExtensionProxy {
   GDBusConnection *connection;
 
   guint page_created_signal_id;
+  guint overview_watched_signal_id;
+
+  gboolean overview_watched;
 };
 
 enum {
   PAGE_CREATED,
+  OVERVIEW_WATCHED_CHANGED,
 
   LAST_SIGNAL
 };
@@ -55,6 +59,12 @@ ephy_web_extension_proxy_dispose (GObject *object)
     web_extension->page_created_signal_id = 0;
   }
 
+  if (web_extension->overview_watched_signal_id > 0) {
+    g_dbus_connection_signal_unsubscribe (web_extension->connection,
+                                          web_extension->overview_watched_signal_id);
+    web_extension->overview_watched_signal_id = 0;
+  }
+
   if (web_extension->cancellable) {
     g_cancellable_cancel (web_extension->cancellable);
     g_clear_object (&web_extension->cancellable);
@@ -92,6 +102,23 @@ ephy_web_extension_proxy_class_init (EphyWebExtensionProxyClass *klass)
                   0, NULL, NULL, NULL,
                   G_TYPE_NONE, 1,
                   G_TYPE_UINT64);
+
+  /**
+   * EphyWebExtensionProxy::overview-watched-changed:
+   * @web_extension: the #EphyWebExtensionProxy
+   * @watched: whether the web process is showing an overview
+   *
+   * Emitted when the web process starts or stops showing about:overview
+   * in any of its pages. Most visited URL updates are only useful while
+   * it is.
+   */
+  signals[OVERVIEW_WATCHED_CHANGED] =
+    g_signal_new ("overview-watched-changed",
+                  EPHY_TYPE_WEB_EXTENSION_PROXY,
+                  G_SIGNAL_RUN_FIRST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1,
+                  G_TYPE_BOOLEAN);
 }
 
 static void
@@ -108,6 +135,25 @@ web_extension_page_created (GDBusConnection       *connection,
   g_signal_emit (web_extension, signals[PAGE_CREATED], 0, page_id);
 }
 
+static void
+web_extension_overview_watched (GDBusConnection       *connection,
+                                const char            *sender_name,
+                                const char            *object_path,
+                                const char            *interface_name,
+                                const char            *signal_name,
+                                GVariant              *parameters,
+                                EphyWebExtensionProxy *web_extension)
+{
+  gboolean watched;
+
+  g_variant_get (parameters, "(b)", &watched);
+  if (web_extension->overview_watched == watched)
+    return;
+
+  web_extension->overview_watched = watched;
+  g_signal_emit (web_extension, signals[OVERVIEW_WATCHED_CHANGED], 0, watched);
+}
+
 static void
 web_extension_proxy_created_cb (GDBusProxy            *proxy,
                                 GAsyncResult          *result,
@@ -143,6 +189,17 @@ web_extension_proxy_created_cb (GDBusProxy            *proxy,
                                         (GDBusSignalCallback)web_extension_page_created,
                                         web_extension,
                                         NULL);
+  web_extension->overview_watched_signal_id =
+    g_dbus_connection_signal_subscribe (web_extension->connection,
+                                        NULL,
+                                        EPHY_WEB_EXTENSION_INTERFACE,
+                                        "OverviewWatched",
+                                        EPHY_WEB_EXTENSION_OBJECT_PATH,
+                                        NULL,
+                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                        (GDBusSignalCallback)web_extension_overview_watched,
+                                        web_extension,
+                                        NULL);
   g_object_unref (web_extension);
 }
 
@@ -419,6 +476,39 @@ ephy_web_extension_proxy_history_set_urls (EphyWebExtensionProxy *web_extension,
                      NULL, NULL);
 }
 
+/**
+ * ephy_web_extension_proxy_history_apply_urls_delta:
+ * @web_extension: an #EphyWebExtensionProxy
+ * @delta: an (asa(uss)) #GVariant with the URLs to remove and the
+ *   (position, url, title) placements to apply, in that order
+ *
+ * Sends the changes to the most visited URLs since the last list the
+ * web process got, instead of the whole list.
+ */
+void
+ephy_web_extension_proxy_history_apply_urls_delta (EphyWebExtensionProxy *web_extension,
+                                                   GVariant              *delta)
+{
+  if (!web_extension->proxy)
+    return;
+
+  g_dbus_proxy_call (web_extension->proxy,
+                     "HistoryApplyURLsDelta",
+                     delta,
+                     G_DBUS_CALL_FLAGS_NONE,
+                     -1,
+                     web_extension->cancellable,
+                     NULL, NULL);
+}
+
+gboolean
+ephy_web_extension_proxy_get_overview_watched (EphyWebExtensionProxy *web_extension)
+{
+  g_return_val_if_fail (EPHY_IS_WEB_EXTENSION_PROXY (web_extension), FALSE);
+
+  return web_extension->overview_watched;
+}
+
 void
 ephy_web_extension_proxy_history_set_url_thumbnail (EphyWebExtensionProxy *web_extension,
                                                     const char            *url,
@@ -61,6 +61,9 @@ char                  *ephy_web_extension_proxy_get_web_app_title_finish
                                                                                            GError               **error);
 void                   ephy_web_extension_proxy_history_set_urls                          (EphyWebExtensionProxy *web_extension,
                                                                                            GList                 *urls);
+void                   ephy_web_extension_proxy_history_apply_urls_delta                  (EphyWebExtensionProxy *web_extension,
+                                                                                           GVariant              *delta);
+gboolean               ephy_web_extension_proxy_get_overview_watched                      (EphyWebExtensionProxy *web_extension);
 void                   ephy_web_extension_proxy_history_set_url_thumbnail                 (EphyWebExtensionProxy *web_extension,
                                                                                            const char            *url,
                                                                                            const char            *path);
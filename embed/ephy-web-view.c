@@ -1526,6 +1526,17 @@ permission_request_cb (WebKitWebView           *web_view,
   return TRUE;
 }
 
+static void
+set_zoom_level (EphyWebView *view,
+                double       zoom_level)
+{
+  if (zoom_level != webkit_web_view_get_zoom_level (WEBKIT_WEB_VIEW (view))) {
+    view->is_setting_zoom = TRUE;
+    webkit_web_view_set_zoom_level (WEBKIT_WEB_VIEW (view), zoom_level);
+    view->is_setting_zoom = FALSE;
+  }
+}
+
 static void
 get_host_for_url_cb (gpointer service,
                      gboolean success,
@@ -1533,22 +1544,12 @@ get_host_for_url_cb (gpointer service,
                      gpointer user_data)
 {
   EphyHistoryHost *host;
-  EphyWebView *view;
-  double current_zoom;
 
   if (success == FALSE)
     return;
 
-  view = EPHY_WEB_VIEW (user_data);
   host = (EphyHistoryHost *)result_data;
-
-  current_zoom = webkit_web_view_get_zoom_level (WEBKIT_WEB_VIEW (view));
-
-  if (host->zoom_level != current_zoom) {
-    view->is_setting_zoom = TRUE;
-    webkit_web_view_set_zoom_level (WEBKIT_WEB_VIEW (view), host->zoom_level);
-    view->is_setting_zoom = FALSE;
-  }
+  set_zoom_level (EPHY_WEB_VIEW (user_data), host->zoom_level);
 
   ephy_history_host_free (host);
 }
@@ -1557,7 +1558,14 @@ static void
 restore_zoom_level (EphyWebView *view,
                     const char  *address)
 {
-  if (ephy_embed_utils_address_has_web_scheme (address))
+  double zoom_level;
+
+  if (!ephy_embed_utils_address_has_web_scheme (address))
+    return;
+
+  if (ephy_history_service_get_cached_zoom_level (view->history_service, address, &zoom_level))
+    set_zoom_level (view, zoom_level);
+  else
     ephy_history_service_get_host_for_url (view->history_service,
                                            address, view->history_service_cancellable,
                                            (EphyHistoryJobCallback)get_host_for_url_cb, view);
@@ -27,6 +27,7 @@
 #include "config.h"
 #include "ephy-uri-tester.h"
 
+#include "ephy-adblock-matcher.h"
 #include "ephy-debug.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
@@ -41,29 +42,39 @@
 #include <httpseverywhere.h>
 #endif
 
-#define SIGNATURE_SIZE 8
+/* Number of adblock verdicts remembered per web process. */
+#define URL_CACHE_SIZE 4096
+
+typedef struct {
+  guint64 key;
+  gboolean matched;
+  GList link;
+} UrlCacheEntry;
+
+/* A fixed-size LRU of adblock verdicts keyed by a 64-bit hash of the
+ * request, so no URI is ever copied and memory use is bounded. */
+typedef struct {
+  UrlCacheEntry *entries;
+  guint n_entries;
+  GHashTable *index;
+  GQueue lru;
+
+  guint64 hits;
+  guint64 misses;
+  guint64 evictions;
+} UrlCache;
 
 struct _EphyUriTester {
   GObject parent_instance;
 
   char *adblock_data_dir;
 
-  GHashTable *pattern;
-  GHashTable *keys;
-  GHashTable *optslist;
-  GHashTable *urlcache;
-
-  GHashTable *whitelisted_pattern;
-  GHashTable *whitelisted_keys;
-  GHashTable *whitelisted_optslist;
-  GHashTable *whitelisted_urlcache;
+  EphyAdblockMatcher *matcher;
+  UrlCache urlcache;
 
   GString *blockcss;
   GString *blockcssprivate;
 
-  GRegex *regex_third_party;
-  GRegex *regex_pattern;
-  GRegex *regex_subdocument;
   GRegex *regex_frame_add;
 
   GMainLoop *load_loop;
@@ -86,334 +97,124 @@ static GParamSpec *obj_properties[LAST_PROP];
 
 G_DEFINE_TYPE (EphyUriTester, ephy_uri_tester, G_TYPE_OBJECT)
 
-static GString *
-ephy_uri_tester_fixup_regexp (const char *prefix, char *src);
-
-static inline int
-ephy_uri_tester_check_rule (EphyUriTester *tester,
-                            GRegex        *regex,
-                            const char    *patt,
-                            const char    *req_uri,
-                            const char    *page_uri,
-                            gboolean       whitelist)
+static void
+url_cache_init (UrlCache *cache)
 {
-  char *opts;
-  GHashTable *optslist = tester->optslist;
-  if (whitelist)
-    optslist = tester->whitelisted_optslist;
-
-  if (!g_regex_match_full (regex, req_uri, -1, 0, 0, NULL, NULL))
-    return FALSE;
-
-  opts = g_hash_table_lookup (optslist, patt);
-  if (opts && g_regex_match (tester->regex_third_party, opts, 0, NULL)) {
-    if (page_uri && g_regex_match_full (regex, page_uri, -1, 0, 0, NULL, NULL))
-      return FALSE;
-  }
-  /* TODO: Domain and document opt check */
-  if (whitelist)
-    LOG ("whitelisted by pattern regexp=%s -- %s", g_regex_get_pattern (regex), req_uri);
-  else
-    LOG ("blocked by pattern regexp=%s -- %s", g_regex_get_pattern (regex), req_uri);
-  return TRUE;
-}
+  cache->entries = g_new0 (UrlCacheEntry, URL_CACHE_SIZE);
+  cache->index = g_hash_table_new (g_int64_hash, g_int64_equal);
+  g_queue_init (&cache->lru);
 
-static inline gboolean
-ephy_uri_tester_is_matched_by_pattern (EphyUriTester *tester,
-                                       const char    *req_uri,
-                                       const char    *page_uri,
-                                       gboolean       whitelist)
-{
-  GHashTableIter iter;
-  gpointer patt, regex;
-  GHashTable *pattern = tester->pattern;
-  if (whitelist)
-    pattern = tester->whitelisted_pattern;
-
-  g_hash_table_iter_init (&iter, pattern);
-  while (g_hash_table_iter_next (&iter, &patt, &regex)) {
-    if (ephy_uri_tester_check_rule (tester, regex, patt, req_uri, page_uri, whitelist))
-      return TRUE;
-  }
-  return FALSE;
+  REGISTER_PROFILER_COUNTER ("adblock cache hits", &cache->hits);
+  REGISTER_PROFILER_COUNTER ("adblock cache misses", &cache->misses);
+  REGISTER_PROFILER_COUNTER ("adblock cache evictions", &cache->evictions);
 }
 
-static inline gboolean
-ephy_uri_tester_is_matched_by_key (EphyUriTester *tester,
-                                   const char    *opts,
-                                   const char    *req_uri,
-                                   const char    *page_uri,
-                                   gboolean       whitelist)
+static void
+url_cache_clear (UrlCache *cache)
 {
-  char *uri;
-  int len;
-  int pos = 0;
-  GList *regex_bl = NULL;
-  GString *guri;
-  gboolean ret = FALSE;
-  char sig[SIGNATURE_SIZE + 1];
-  GHashTable *keys = tester->keys;
-  if (whitelist)
-    keys = tester->whitelisted_keys;
-
-  memset (&sig[0], 0, sizeof (sig));
-  /* Signatures are made on pattern, so we need to convert url to a pattern as well */
-  guri = ephy_uri_tester_fixup_regexp ("", (char *)req_uri);
-  uri = guri->str;
-  len = guri->len;
-
-  for (pos = len - SIGNATURE_SIZE; pos >= 0; pos--) {
-    GRegex *regex;
-    strncpy (sig, uri + pos, SIGNATURE_SIZE);
-    regex = g_hash_table_lookup (keys, sig);
-
-    /* Dont check if regex is already blacklisted */
-    if (!regex || g_list_find (regex_bl, regex))
-      continue;
-    ret = ephy_uri_tester_check_rule (tester, regex, sig, req_uri, page_uri, whitelist);
-    if (ret)
-      break;
-    regex_bl = g_list_prepend (regex_bl, regex);
-  }
-  g_string_free (guri, TRUE);
-  g_list_free (regex_bl);
-  return ret;
+  g_hash_table_remove_all (cache->index);
+  g_queue_init (&cache->lru);
+  cache->n_entries = 0;
 }
 
-static gboolean
-ephy_uri_tester_is_matched (EphyUriTester *tester,
-                            const char    *opts,
-                            const char    *req_uri,
-                            const char    *page_uri,
-                            gboolean       whitelist)
+static void
+url_cache_destroy (UrlCache *cache)
 {
-  char *value;
-  GHashTable *urlcache = tester->urlcache;
-  if (whitelist)
-    urlcache = tester->whitelisted_urlcache;
-
-  /* Check cached URLs first. */
-  if ((value = g_hash_table_lookup (urlcache, req_uri)))
-    return GPOINTER_TO_INT (value);
+  UNREGISTER_PROFILER_COUNTER (&cache->hits);
+  UNREGISTER_PROFILER_COUNTER (&cache->misses);
+  UNREGISTER_PROFILER_COUNTER (&cache->evictions);
 
-  /* Look for a match either by key or by pattern. */
-  if (ephy_uri_tester_is_matched_by_key (tester, opts, req_uri, page_uri, whitelist)) {
-    g_hash_table_insert (urlcache, g_strdup (req_uri), g_strdup ("1"));
-    return TRUE;
-  }
-
-  /* Matching by pattern is pretty expensive, so do it if needed only. */
-  if (ephy_uri_tester_is_matched_by_pattern (tester, req_uri, page_uri, whitelist)) {
-    g_hash_table_insert (urlcache, g_strdup (req_uri), GINT_TO_POINTER (TRUE));
-    return TRUE;
-  }
-
-  g_hash_table_insert (urlcache, g_strdup (req_uri), GINT_TO_POINTER (FALSE));
-  return FALSE;
+  g_hash_table_destroy (cache->index);
+  g_free (cache->entries);
 }
 
-static GString *
-ephy_uri_tester_fixup_regexp (const char *prefix, char *src)
+static guint64
+url_cache_hash (const char              *req_uri,
+                const char              *page_uri,
+                EphyAdblockResourceType  resource_type,
+                gboolean                 whitelist)
 {
-  GString *str;
-
-  if (!src)
-    return NULL;
+  /* 64-bit FNV-1a. The page and the resource type take part in the key
+   * because rule options can give different verdicts for the same request. */
+  guint64 hash = G_GUINT64_CONSTANT (14695981039346656037);
+  const char *p;
 
-  str = g_string_new (prefix);
+  for (p = req_uri; *p; p++)
+    hash = (hash ^ (guchar)*p) * G_GUINT64_CONSTANT (1099511628211);
+  hash = (hash ^ '\n') * G_GUINT64_CONSTANT (1099511628211);
+  for (p = page_uri ? page_uri : ""; *p; p++)
+    hash = (hash ^ (guchar)*p) * G_GUINT64_CONSTANT (1099511628211);
 
-  /* lets strip first .* */
-  if (src[0] == '*') {
-    (void)*src++;
-  }
-
-  /* NOTE: The '$' is used as separator for the rule options, so rule patterns
-     cannot ever contain them. If a rule needs to match it, it uses "%24".
-     Splitting the option is done in ephy_uri_tester_add_url_pattern().
-
-     The loop below always escapes square brackets. This way there is no chance
-     that they get interpreted as a character class, and it is NOT needed to
-     escape '-' because it's only special inside a character class. */
-  do {
-    switch (*src) {
-      case '*':
-        g_string_append (str, ".*");
-        break;
-      case '^':
-      /* Matches a separator character, defined as:
-       * "anything but a letter, a digit, or one of the following: _ - . %" */
-        g_string_append (str, "([^a-zA-Z\\d]|[_\\-\\.%])");
-        break;
-      case '|':
-      /* If at the end of the pattern, the match is anchored at the end. In
-       * the middle of a pattern it matches a literal vertical bar and the
-       * character must be escaped. */
-        if (src[1] == '\0')
-          g_string_append (str, "$");
-        else
-          g_string_append (str, "\\|");
-        break;
-      /* The following characters are escaped as they have a meaning in
-       * regular expressions:
-       *   - '.' matches any character.
-       *   - '+' matches the preceding pattern one or more times.
-       *   - '?' matches the preceding pattern zero or one times.
-       *   - '[' ']' are used to define a character class.
-       *   - '{' '}' are used to define a min/max quantifier.
-       *   - '(' ')' are used to defin a submatch expression.
-       *   - '\' has several uses in regexps (shortcut character classes.
-       *     matching non-printing characters, using octal/hex, octal
-       *     constants, backreferences... they must to be escaped to
-       *     match a literal backslash and prevent wrecking havoc!). */
-      case '.':
-      case '+':
-      case '?':
-      case '[':
-      case ']':
-      case '{':
-      case '}':
-      case '(':
-      case ')':
-      case '\\':
-        g_string_append_printf (str, "\\%c", *src);
-        break;
-      default:
-        g_string_append_printf (str, "%c", *src);
-        break;
-    }
-    src++;
-  } while (*src);
+  hash = (hash ^ resource_type) * G_GUINT64_CONSTANT (1099511628211);
 
-  return str;
+  return hash ^ (whitelist ? 1 : 0);
 }
 
-static void
-ephy_uri_tester_compile_regexp (EphyUriTester *tester,
-                                GString       *gpatt,
-                                const char    *opts,
-                                gboolean       whitelist)
+static gboolean
+url_cache_lookup (UrlCache *cache,
+                  guint64   key,
+                  gboolean *matched)
 {
-  GHashTable *pattern;
-  GHashTable *keys;
-  GHashTable *optslist;
-  GRegex *regex;
-  GError *error = NULL;
-  char *patt;
-  int len;
-
-  if (!gpatt)
-    return;
-
-  patt = gpatt->str;
-  len = gpatt->len;
+  UrlCacheEntry *entry;
 
-  /* TODO: Play with optimization flags */
-  regex = g_regex_new (patt, G_REGEX_OPTIMIZE | G_REGEX_JAVASCRIPT_COMPAT,
-                       G_REGEX_MATCH_NOTEMPTY, &error);
-  if (error) {
-    g_warning ("%s: %s", G_STRFUNC, error->message);
-    g_error_free (error);
-    return;
+  entry = g_hash_table_lookup (cache->index, &key);
+  if (!entry) {
+    cache->misses++;
+    return FALSE;
   }
 
-  pattern = tester->pattern;
-  keys = tester->keys;
-  optslist = tester->optslist;
-  if (whitelist) {
-    pattern = tester->whitelisted_pattern;
-    keys = tester->whitelisted_keys;
-    optslist = tester->whitelisted_optslist;
-  }
+  g_queue_unlink (&cache->lru, &entry->link);
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  cache->hits++;
 
-  if (!g_regex_match (tester->regex_pattern, patt, 0, NULL)) {
-    int signature_count = 0;
-    int pos = 0;
-    char *sig;
-
-    for (pos = len - SIGNATURE_SIZE; pos >= 0; pos--) {
-      sig = g_strndup (patt + pos, SIGNATURE_SIZE);
-      if (!strchr (sig, '*') &&
-          !g_hash_table_lookup (keys, sig)) {
-        LOG ("sig: %s %s", sig, patt);
-        g_hash_table_insert (keys, g_strdup (sig), g_regex_ref (regex));
-        g_hash_table_insert (optslist, g_strdup (sig), g_strdup (opts));
-        signature_count++;
-      } else {
-        if (sig[0] == '*' &&
-            !g_hash_table_lookup (pattern, patt)) {
-          LOG ("patt2: %s %s", sig, patt);
-          g_hash_table_insert (pattern, g_strdup (patt), g_regex_ref (regex));
-          g_hash_table_insert (optslist, g_strdup (patt), g_strdup (opts));
-        }
-      }
-      g_free (sig);
-    }
-    g_regex_unref (regex);
-
-    if (signature_count > 1 && g_hash_table_lookup (pattern, patt))
-      g_hash_table_remove (pattern, patt);
-  } else {
-    LOG ("patt: %s%s", patt, "");
-    /* Pattern is a regexp chars */
-    g_hash_table_insert (pattern, g_strdup (patt), regex);
-    g_hash_table_insert (optslist, g_strdup (patt), g_strdup (opts));
-  }
+  *matched = entry->matched;
+  return TRUE;
 }
 
 static void
-ephy_uri_tester_add_url_pattern (EphyUriTester *tester,
-                                 const char    *prefix,
-                                 const char    *type,
-                                 char          *line,
-                                 gboolean       whitelist)
+url_cache_insert (UrlCache *cache,
+                  guint64   key,
+                  gboolean  matched)
 {
-  char **data;
-  char *patt;
-  GString *format_patt;
-  const char *opts;
-
-  data = g_strsplit (line, "$", -1);
-  if (!data || !data[0]) {
-    g_strfreev (data);
-    return;
-  }
+  UrlCacheEntry *entry;
 
-  if (data[1] && data[2]) {
-    patt = g_strconcat (data[0], data[1], NULL);
-    opts = g_strconcat (type, ",", data[2], NULL);
-  } else if (data[1]) {
-    patt = data[0];
-    opts = g_strconcat (type, ",", data[1], NULL);
+  if (cache->n_entries < URL_CACHE_SIZE) {
+    entry = &cache->entries[cache->n_entries++];
   } else {
-    patt = data[0];
-    opts = type;
-  }
+    GList *link = g_queue_peek_tail_link (&cache->lru);
 
-  if (g_regex_match (tester->regex_subdocument, opts, 0, NULL)) {
-    if (data[1] && data[2])
-      g_free (patt);
-    if (data[1])
-      g_free ((char *)opts);
-    g_strfreev (data);
-    return;
+    entry = link->data;
+    g_queue_unlink (&cache->lru, link);
+    g_hash_table_remove (cache->index, &entry->key);
+    cache->evictions++;
   }
 
-  format_patt = ephy_uri_tester_fixup_regexp (prefix, patt);
-
-  if (whitelist)
-    LOG ("whitelist: %s opts %s", format_patt->str, opts);
-  else
-    LOG ("blacklist: %s opts %s", format_patt->str, opts);
+  entry->key = key;
+  entry->matched = matched;
+  entry->link.data = entry;
+  entry->link.prev = entry->link.next = NULL;
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  g_hash_table_insert (cache->index, &entry->key, entry);
+}
 
-  ephy_uri_tester_compile_regexp (tester, format_patt, opts, whitelist);
+static gboolean
+ephy_uri_tester_is_matched (EphyUriTester           *tester,
+                            const char              *req_uri,
+                            const char              *page_uri,
+                            EphyAdblockResourceType  resource_type,
+                            gboolean                 whitelist)
+{
+  guint64 key;
+  gboolean matched;
 
-  if (data[1] && data[2])
-    g_free (patt);
-  if (data[1])
-    g_free ((char *)opts);
-  g_strfreev (data);
+  /* Check cached URLs first. */
+  key = url_cache_hash (req_uri, page_uri, resource_type, whitelist);
+  if (url_cache_lookup (&tester->urlcache, key, &matched))
+    return matched;
 
-  g_string_free (format_patt, TRUE);
+  matched = ephy_adblock_matcher_match (tester->matcher, req_uri, page_uri, resource_type, whitelist);
+  url_cache_insert (&tester->urlcache, key, matched);
+  return matched;
 }
 
 static inline void
@@ -467,8 +268,7 @@ ephy_uri_tester_frame_add_private (EphyUriTester *tester,
 
 static void
 ephy_uri_tester_parse_line (EphyUriTester *tester,
-                            char          *line,
-                            gboolean       whitelist)
+                            char          *line)
 {
   if (!line)
     return;
@@ -481,16 +281,6 @@ ephy_uri_tester_parse_line (EphyUriTester *tester,
   if (line[0] == '[')
     return;
 
-  /* Whitelisted exception rules */
-  if (g_str_has_prefix (line, "@@")) {
-    ephy_uri_tester_parse_line (tester, line + 2, TRUE);
-    return;
-  }
-
-  /* FIXME: No support for domain= */
-  if (strstr (line, "domain="))
-    return;
-
   /* Skip garbage */
   if (line[0] == ' ' || !line[0])
     return;
@@ -515,22 +305,9 @@ ephy_uri_tester_parse_line (EphyUriTester *tester,
     ephy_uri_tester_frame_add_private (tester, line, "#");
     return;
   }
-  /* Got URL blocker rule */
-  if (line[0] == '|' && line[1] == '|') {
-    (void)*line++;
-    (void)*line++;
-    /* set a regex prefix to ensure that '||' patterns are anchored at the
-     * start and that any characters (if any) preceding the domain specified
-     * by the rule is separated from it by a dot '.'  */
-    ephy_uri_tester_add_url_pattern (tester, "^[\\w\\-]+:\\/+(?!\\/)(?:[^\\/]+\\.)?", "fulluri", line, whitelist);
-    return;
-  }
-  if (line[0] == '|') {
-    (void)*line++;
-    ephy_uri_tester_add_url_pattern (tester, "^", "fulluri", line, whitelist);
-    return;
-  }
-  ephy_uri_tester_add_url_pattern (tester, "", "uri", line, whitelist);
+
+  /* Got URL blocker rule, or an exception rule if it starts with "@@" */
+  ephy_adblock_matcher_add_filter (tester->matcher, line);
 }
 
 static void
@@ -574,7 +351,7 @@ file_parse_cb (GDataInputStream *stream, GAsyncResult *result, EphyUriTester *te
     return;
   }
 
-  ephy_uri_tester_parse_line (tester, line, FALSE);
+  ephy_uri_tester_parse_line (tester, line);
   g_free (line);
 
   g_data_input_stream_read_line_async (stream, G_PRIORITY_DEFAULT_IDLE, NULL,
@@ -610,25 +387,27 @@ file_read_cb (GFile *file, GAsyncResult *result, EphyUriTester *tester)
 }
 
 static gboolean
-ephy_uri_tester_block_uri (EphyUriTester *tester,
-                          const char    *req_uri,
-                          const char    *page_uri)
+ephy_uri_tester_block_uri (EphyUriTester           *tester,
+                           const char              *req_uri,
+                           const char              *page_uri,
+                           EphyAdblockResourceType  resource_type)
 {
   /* check whitelisting rules before the normal ones */
-  if (ephy_uri_tester_is_matched (tester, NULL, req_uri, page_uri, TRUE))
+  if (ephy_uri_tester_is_matched (tester, req_uri, page_uri, resource_type, TRUE))
     return FALSE;
-  return ephy_uri_tester_is_matched (tester, NULL, req_uri, page_uri, FALSE);
+  return ephy_uri_tester_is_matched (tester, req_uri, page_uri, resource_type, FALSE);
 }
 
 char *
-ephy_uri_tester_rewrite_uri (EphyUriTester    *tester,
-                             const char       *request_uri,
-                             const char       *page_uri,
-                             EphyUriTestFlags  flags)
+ephy_uri_tester_rewrite_uri (EphyUriTester           *tester,
+                             const char              *request_uri,
+                             const char              *page_uri,
+                             EphyAdblockResourceType  resource_type,
+                             EphyUriTestFlags         flags)
 {
   /* Should we block the URL outright? */
   if ((flags & EPHY_URI_TEST_ADBLOCK) &&
-      ephy_uri_tester_block_uri (tester, request_uri, page_uri)) {
+      ephy_uri_tester_block_uri (tester, request_uri, page_uri, resource_type)) {
     g_debug ("Request '%s' blocked (page: '%s')", request_uri, page_uri);
 
     return NULL;
@@ -712,6 +491,36 @@ ephy_uri_tester_begin_loading_adblock_filters (EphyUriTester  *tester,
   g_strfreev (filters);
 }
 
+static gboolean
+ephy_uri_tester_load_adblock_snapshot (EphyUriTester *tester)
+{
+  EphyAdblockMatcher *matcher;
+  char **filters;
+  char *snapshot_path;
+  GError *error = NULL;
+
+  filters = g_settings_get_strv (EPHY_SETTINGS_MAIN, EPHY_PREFS_ADBLOCK_FILTERS);
+  snapshot_path = ephy_uri_tester_get_adblock_snapshot_path (tester->adblock_data_dir);
+
+  /* The UI process compiles the filters into a snapshot after retrieving
+   * them. Fall back to parsing the filter files if it is not ready yet. */
+  matcher = ephy_adblock_matcher_new_from_file (snapshot_path, (const char * const *)filters, &error);
+  if (matcher) {
+    LOG ("Using adblock snapshot %s with %u rules", snapshot_path,
+         ephy_adblock_matcher_get_n_rules (matcher));
+    ephy_adblock_matcher_free (tester->matcher);
+    tester->matcher = matcher;
+  } else {
+    LOG ("Not using adblock snapshot %s: %s", snapshot_path, error->message);
+    g_error_free (error);
+  }
+
+  g_free (snapshot_path);
+  g_strfreev (filters);
+
+  return matcher != NULL;
+}
+
 static void
 ephy_uri_tester_load_sync (GTask         *task,
                            EphyUriTester *tester)
@@ -751,47 +560,12 @@ ephy_uri_tester_init (EphyUriTester *tester)
 {
   LOG ("EphyUriTester initializing %p", tester);
 
-  tester->pattern = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                           (GDestroyNotify)g_free,
-                                           (GDestroyNotify)g_regex_unref);
-  tester->keys = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                        (GDestroyNotify)g_free,
-                                        (GDestroyNotify)g_regex_unref);
-  tester->optslist = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                            (GDestroyNotify)g_free,
-                                            (GDestroyNotify)g_free);
-  tester->urlcache = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                            (GDestroyNotify)g_free,
-                                            NULL);
-
-  tester->whitelisted_pattern = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                       (GDestroyNotify)g_free,
-                                                       (GDestroyNotify)g_regex_unref);
-  tester->whitelisted_keys = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                    (GDestroyNotify)g_free,
-                                                    (GDestroyNotify)g_regex_unref);
-  tester->whitelisted_optslist = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                        (GDestroyNotify)g_free,
-                                                        (GDestroyNotify)g_free);
-  tester->whitelisted_urlcache = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                        (GDestroyNotify)g_free,
-                                                        NULL);
+  tester->matcher = ephy_adblock_matcher_new ();
+  url_cache_init (&tester->urlcache);
 
   tester->blockcss = g_string_new ("z-non-exist");
   tester->blockcssprivate = g_string_new ("");
 
-  tester->regex_third_party = g_regex_new (",third-party",
-                                           G_REGEX_CASELESS | G_REGEX_OPTIMIZE,
-                                           G_REGEX_MATCH_NOTEMPTY,
-                                           NULL);
-  tester->regex_pattern = g_regex_new ("^/.*[\\^\\$\\*].*/$",
-                                       G_REGEX_UNGREEDY | G_REGEX_OPTIMIZE,
-                                       G_REGEX_MATCH_NOTEMPTY,
-                                       NULL);
-  tester->regex_subdocument = g_regex_new ("subdocument",
-                                           G_REGEX_CASELESS | G_REGEX_OPTIMIZE,
-                                           G_REGEX_MATCH_NOTEMPTY,
-                                           NULL);
   tester->regex_frame_add = g_regex_new (".*\\[.*:.*\\].*",
                                          G_REGEX_CASELESS | G_REGEX_OPTIMIZE,
                                          G_REGEX_MATCH_NOTEMPTY,
@@ -841,22 +615,12 @@ ephy_uri_tester_finalize (GObject *object)
 
   g_free (tester->adblock_data_dir);
 
-  g_hash_table_destroy (tester->pattern);
-  g_hash_table_destroy (tester->keys);
-  g_hash_table_destroy (tester->optslist);
-  g_hash_table_destroy (tester->urlcache);
-
-  g_hash_table_destroy (tester->whitelisted_pattern);
-  g_hash_table_destroy (tester->whitelisted_keys);
-  g_hash_table_destroy (tester->whitelisted_optslist);
-  g_hash_table_destroy (tester->whitelisted_urlcache);
+  ephy_adblock_matcher_free (tester->matcher);
+  url_cache_destroy (&tester->urlcache);
 
   g_string_free (tester->blockcss, TRUE);
   g_string_free (tester->blockcssprivate, TRUE);
 
-  g_regex_unref (tester->regex_third_party);
-  g_regex_unref (tester->regex_pattern);
-  g_regex_unref (tester->regex_subdocument);
   g_regex_unref (tester->regex_frame_add);
 
   G_OBJECT_CLASS (ephy_uri_tester_parent_class)->finalize (object);
@@ -890,15 +654,10 @@ ephy_uri_tester_new (const char *adblock_data_dir)
 static void
 ephy_uri_tester_reload_adblock_filters (EphyUriTester *tester)
 {
-  g_hash_table_remove_all (tester->pattern);
-  g_hash_table_remove_all (tester->keys);
-  g_hash_table_remove_all (tester->optslist);
-  g_hash_table_remove_all (tester->urlcache);
-
-  g_hash_table_remove_all (tester->whitelisted_pattern);
-  g_hash_table_remove_all (tester->whitelisted_keys);
-  g_hash_table_remove_all (tester->whitelisted_optslist);
-  g_hash_table_remove_all (tester->whitelisted_urlcache);
+  ephy_adblock_matcher_free (tester->matcher);
+  tester->matcher = ephy_adblock_matcher_new ();
+  DUMP_PROFILER_COUNTERS ();
+  url_cache_clear (&tester->urlcache);
 
   tester->adblock_loaded = FALSE;
   ephy_uri_tester_load (tester);
@@ -941,9 +700,18 @@ ephy_uri_tester_load (EphyUriTester *tester)
   g_signal_handlers_disconnect_by_func (EPHY_SETTINGS_WEB, ephy_uri_tester_adblock_filters_changed_cb, tester);
   g_signal_handlers_disconnect_by_func (EPHY_SETTINGS_WEB, ephy_uri_tester_enable_adblock_changed_cb, tester);
 
-  task = g_task_new (tester, NULL, NULL, NULL);
-  g_task_run_in_thread_sync (task, (GTaskThreadFunc)ephy_uri_tester_load_sync);
-  g_object_unref (task);
+  if (!tester->adblock_loaded && ephy_uri_tester_load_adblock_snapshot (tester))
+    tester->adblock_loaded = TRUE;
+
+  if (!tester->adblock_loaded
+#ifdef HAVE_LIBHTTPSEVERYWHERE
+      || !tester->https_everywhere_loaded
+#endif
+     ) {
+    task = g_task_new (tester, NULL, NULL, NULL);
+    g_task_run_in_thread_sync (task, (GTaskThreadFunc)ephy_uri_tester_load_sync);
+    g_object_unref (task);
+  }
 
   g_signal_connect (EPHY_SETTINGS_MAIN, "changed::" EPHY_PREFS_ADBLOCK_FILTERS,
                     G_CALLBACK (ephy_uri_tester_adblock_filters_changed_cb), tester);
@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include "ephy-adblock-matcher.h"
+
 #include <gio/gio.h>
 
 G_BEGIN_DECLS
@@ -36,12 +38,13 @@ typedef enum
 } EphyUriTestFlags;
 
 
-EphyUriTester *ephy_uri_tester_new         (const char       *adblock_data_dir);
-void           ephy_uri_tester_load        (EphyUriTester    *tester);
-char          *ephy_uri_tester_rewrite_uri (EphyUriTester    *tester,
-                                            const char       *request_uri,
-                                            const char       *page_uri,
-                                            EphyUriTestFlags  flags);
+EphyUriTester *ephy_uri_tester_new         (const char              *adblock_data_dir);
+void           ephy_uri_tester_load        (EphyUriTester           *tester);
+char          *ephy_uri_tester_rewrite_uri (EphyUriTester           *tester,
+                                            const char              *request_uri,
+                                            const char              *page_uri,
+                                            EphyAdblockResourceType  resource_type,
+                                            EphyUriTestFlags         flags);
 
 
 G_END_DECLS
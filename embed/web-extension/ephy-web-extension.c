@@ -54,6 +54,7 @@ struct _EphyWebExtension {
   EphyFormAuthDataCache *form_auth_data_cache;
   GHashTable *form_auth_data_save_requests;
   EphyWebOverviewModel *overview_model;
+  guint n_overviews;
   EphyPermissionsManager *permissions_manager;
   EphyUriTester *uri_tester;
 };
@@ -64,6 +65,9 @@ static const char introspection_xml[] =
   "  <signal name='PageCreated'>"
   "   <arg type='t' name='page_id' direction='out'/>"
   "  </signal>"
+  "  <signal name='OverviewWatched'>"
+  "   <arg type='b' name='watched' direction='out'/>"
+  "  </signal>"
   "  <method name='HasModifiedForms'>"
   "   <arg type='t' name='page_id' direction='in'/>"
   "   <arg type='b' name='has_modified_forms' direction='out'/>"
@@ -85,6 +89,10 @@ static const char introspection_xml[] =
   "  <method name='HistorySetURLs'>"
   "   <arg type='a(ss)' name='urls' direction='in'/>"
   "  </method>"
+  "  <method name='HistoryApplyURLsDelta'>"
+  "   <arg type='as' name='removed' direction='in'/>"
+  "   <arg type='a(uss)' name='placed' direction='in'/>"
+  "  </method>"
   "  <method name='HistorySetURLThumbnail'>"
   "   <arg type='s' name='url' direction='in'/>"
   "   <arg type='s' name='path' direction='in'/>"
@@ -175,6 +183,78 @@ should_use_adblocker (const char *request_uri,
   return TRUE;
 }
 
+typedef struct {
+  const char *extension;
+  EphyAdblockResourceType type;
+} ResourceTypeExtension;
+
+static const ResourceTypeExtension resource_type_extensions[] = {
+  { ".js", EPHY_ADBLOCK_RESOURCE_SCRIPT },
+  { ".css", EPHY_ADBLOCK_RESOURCE_STYLESHEET },
+  { ".png", EPHY_ADBLOCK_RESOURCE_IMAGE },
+  { ".jpg", EPHY_ADBLOCK_RESOURCE_IMAGE },
+  { ".jpeg", EPHY_ADBLOCK_RESOURCE_IMAGE },
+  { ".gif", EPHY_ADBLOCK_RESOURCE_IMAGE },
+  { ".svg", EPHY_ADBLOCK_RESOURCE_IMAGE },
+  { ".webp", EPHY_ADBLOCK_RESOURCE_IMAGE },
+  { ".ico", EPHY_ADBLOCK_RESOURCE_IMAGE },
+  { ".woff", EPHY_ADBLOCK_RESOURCE_FONT },
+  { ".woff2", EPHY_ADBLOCK_RESOURCE_FONT },
+  { ".ttf", EPHY_ADBLOCK_RESOURCE_FONT },
+  { ".otf", EPHY_ADBLOCK_RESOURCE_FONT },
+  { ".eot", EPHY_ADBLOCK_RESOURCE_FONT },
+  { ".mp3", EPHY_ADBLOCK_RESOURCE_MEDIA },
+  { ".mp4", EPHY_ADBLOCK_RESOURCE_MEDIA },
+  { ".ogg", EPHY_ADBLOCK_RESOURCE_MEDIA },
+  { ".webm", EPHY_ADBLOCK_RESOURCE_MEDIA },
+  { ".swf", EPHY_ADBLOCK_RESOURCE_OBJECT }
+};
+
+/* WebKit does not tell the extension what a request is for, so guess it from
+ * the Accept header WebCore sets for each kind of load, and from the file
+ * extension. Requests that cannot be told apart, like scripts and XHRs that
+ * both accept anything, are matched against rules of every type. */
+static EphyAdblockResourceType
+get_request_resource_type (WebKitURIRequest *request,
+                           const char       *request_uri)
+{
+  SoupMessageHeaders *headers;
+  const char *accept = NULL;
+  const char *path_end;
+  const char *path_start;
+  gsize path_length;
+
+  headers = webkit_uri_request_get_http_headers (request);
+  if (headers)
+    accept = soup_message_headers_get_one (headers, "Accept");
+
+  if (accept) {
+    if (g_str_has_prefix (accept, "text/html"))
+      return EPHY_ADBLOCK_RESOURCE_SUBDOCUMENT;
+    if (g_str_has_prefix (accept, "text/css"))
+      return EPHY_ADBLOCK_RESOURCE_STYLESHEET;
+    if (g_str_has_prefix (accept, "image/"))
+      return EPHY_ADBLOCK_RESOURCE_IMAGE;
+  }
+
+  path_end = request_uri + strcspn (request_uri, "?#");
+  path_start = path_end;
+  while (path_start > request_uri && path_start[-1] != '/' && path_start[-1] != '.')
+    path_start--;
+  if (path_start == request_uri || path_start[-1] != '.')
+    return EPHY_ADBLOCK_RESOURCE_ANY;
+
+  path_start--;
+  path_length = path_end - path_start;
+  for (guint i = 0; i < G_N_ELEMENTS (resource_type_extensions); i++) {
+    if (strlen (resource_type_extensions[i].extension) == path_length &&
+        g_ascii_strncasecmp (path_start, resource_type_extensions[i].extension, path_length) == 0)
+      return resource_type_extensions[i].type;
+  }
+
+  return EPHY_ADBLOCK_RESOURCE_ANY;
+}
+
 static gboolean
 web_page_send_request (WebKitWebPage     *web_page,
                        WebKitURIRequest  *request,
@@ -214,7 +294,9 @@ web_page_send_request (WebKitWebPage     *web_page,
     ephy_uri_tester_load (extension->uri_tester);
     result = ephy_uri_tester_rewrite_uri (extension->uri_tester,
                                           modified_uri ? modified_uri : request_uri,
-                                          page_uri, flags);
+                                          page_uri,
+                                          get_request_resource_type (request, request_uri),
+                                          flags);
     g_free (modified_uri);
 
     if (!result) {
@@ -1182,6 +1264,37 @@ web_page_form_controls_associated (WebKitWebPage    *web_page,
   }
 }
 
+static void
+ephy_web_extension_emit_overview_watched (EphyWebExtension *extension)
+{
+  GError *error = NULL;
+
+  if (!extension->dbus_connection)
+    return;
+
+  g_dbus_connection_emit_signal (extension->dbus_connection,
+                                 NULL,
+                                 EPHY_WEB_EXTENSION_OBJECT_PATH,
+                                 EPHY_WEB_EXTENSION_INTERFACE,
+                                 "OverviewWatched",
+                                 g_variant_new ("(b)", extension->n_overviews > 0),
+                                 &error);
+  if (error) {
+    g_warning ("Error emitting signal OverviewWatched: %s\n", error->message);
+    g_error_free (error);
+  }
+}
+
+static void
+overview_destroyed_cb (EphyWebExtension *extension,
+                       GObject          *overview)
+{
+  /* Once no page shows the overview, the UI process can stop sending us
+   * the most visited URLs until one does again. */
+  if (--extension->n_overviews == 0)
+    ephy_web_extension_emit_overview_watched (extension);
+}
+
 static void
 web_page_uri_changed (WebKitWebPage    *web_page,
                       GParamSpec       *param_spec,
@@ -1189,8 +1302,12 @@ web_page_uri_changed (WebKitWebPage    *web_page,
 {
   EphyWebOverview *overview = NULL;
 
-  if (g_strcmp0 (webkit_web_page_get_uri (web_page), "ephy-about:overview") == 0)
+  if (g_strcmp0 (webkit_web_page_get_uri (web_page), "ephy-about:overview") == 0) {
     overview = ephy_web_overview_new (web_page, extension->overview_model);
+    g_object_weak_ref (G_OBJECT (overview), (GWeakNotify)overview_destroyed_cb, extension);
+    if (extension->n_overviews++ == 0)
+      ephy_web_extension_emit_overview_watched (extension);
+  }
 
   g_object_set_data_full (G_OBJECT (web_page), "ephy-web-overview", overview, g_object_unref);
 }
@@ -1420,6 +1537,30 @@ handle_method_call (GDBusConnection       *connection,
       ephy_web_overview_model_set_urls (extension->overview_model, g_list_reverse (items));
     }
     g_dbus_method_invocation_return_value (invocation, NULL);
+  } else if (g_strcmp0 (method_name, "HistoryApplyURLsDelta") == 0) {
+    if (extension->overview_model) {
+      GVariantIter iter;
+      GVariant *removed;
+      GVariant *placed;
+      const char *url;
+      const char *title;
+      guint32 position;
+
+      g_variant_get (parameters, "(@as@a(uss))", &removed, &placed);
+
+      g_variant_iter_init (&iter, removed);
+      while (g_variant_iter_loop (&iter, "&s", &url))
+        ephy_web_overview_model_delete_url (extension->overview_model, url);
+      g_variant_unref (removed);
+
+      /* Placements come sorted by position, so every item before the one
+       * being placed is already where it belongs. */
+      g_variant_iter_init (&iter, placed);
+      while (g_variant_iter_loop (&iter, "(u&s&s)", &position, &url, &title))
+        ephy_web_overview_model_place_url (extension->overview_model, position, url, title);
+      g_variant_unref (placed);
+    }
+    g_dbus_method_invocation_return_value (invocation, NULL);
   } else if (g_strcmp0 (method_name, "HistorySetURLThumbnail") == 0) {
     if (extension->overview_model) {
       const char *url;
@@ -1559,6 +1700,8 @@ dbus_connection_created_cb (GObject          *source_object,
 
   extension->dbus_connection = connection;
   ephy_web_extension_emit_page_created_signals_pending (extension);
+  if (extension->n_overviews > 0)
+    ephy_web_extension_emit_overview_watched (extension);
 }
 
 static gboolean
@@ -34,6 +34,9 @@ G_DEFINE_TYPE (EphyWebOverviewModel, ephy_web_overview_model, G_TYPE_OBJECT)
 
 enum {
   URLS_CHANGED,
+  URL_INSERTED,
+  URL_MOVED,
+  URL_REMOVED,
   THUMBNAIL_CHANGED,
   TITLE_CHANGED,
 
@@ -74,6 +77,33 @@ ephy_web_overview_model_class_init (EphyWebOverviewModelClass *klass)
                   0, NULL, NULL, NULL,
                   G_TYPE_NONE, 0);
 
+  signals[URL_INSERTED] =
+    g_signal_new ("url-inserted",
+                  EPHY_TYPE_WEB_OVERVIEW_MODEL,
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 3,
+                  G_TYPE_UINT,
+                  G_TYPE_STRING,
+                  G_TYPE_STRING);
+
+  signals[URL_MOVED] =
+    g_signal_new ("url-moved",
+                  EPHY_TYPE_WEB_OVERVIEW_MODEL,
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 2,
+                  G_TYPE_STRING,
+                  G_TYPE_UINT);
+
+  signals[URL_REMOVED] =
+    g_signal_new ("url-removed",
+                  EPHY_TYPE_WEB_OVERVIEW_MODEL,
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1,
+                  G_TYPE_STRING);
+
   signals[THUMBNAIL_CHANGED] =
     g_signal_new ("thumbnail-changed",
                   EPHY_TYPE_WEB_OVERVIEW_MODEL,
@@ -181,12 +211,64 @@ ephy_web_overview_model_set_url_title (EphyWebOverviewModel *model,
     g_signal_emit (model, signals[TITLE_CHANGED], 0, url, title);
 }
 
+/**
+ * ephy_web_overview_model_place_url:
+ * @model: an #EphyWebOverviewModel
+ * @position: the position @url must end up at
+ * @url: the URL
+ * @title: the title of @url
+ *
+ * Makes @url the item at @position, moving it there if the model already
+ * contains it or inserting it otherwise, and updates its title. This is how
+ * the UI process delta updates are applied, so that overviews only touch
+ * the items that changed instead of rebuilding the whole grid.
+ */
+void
+ephy_web_overview_model_place_url (EphyWebOverviewModel *model,
+                                   guint                 position,
+                                   const char           *url,
+                                   const char           *title)
+{
+  EphyWebOverviewModelItem *item = NULL;
+  GList *l;
+  guint i;
+
+  g_return_if_fail (EPHY_IS_WEB_OVERVIEW_MODEL (model));
+  g_return_if_fail (url);
+
+  for (l = model->items, i = 0; l; l = g_list_next (l), i++) {
+    if (g_strcmp0 (((EphyWebOverviewModelItem *)l->data)->url, url) == 0) {
+      item = (EphyWebOverviewModelItem *)l->data;
+      break;
+    }
+  }
+
+  if (!item) {
+    model->items = g_list_insert (model->items,
+                                  ephy_web_overview_model_item_new (url, title),
+                                  position);
+    g_signal_emit (model, signals[URL_INSERTED], 0, position, url, title);
+    return;
+  }
+
+  if (i != position) {
+    model->items = g_list_delete_link (model->items, l);
+    model->items = g_list_insert (model->items, item, position);
+    g_signal_emit (model, signals[URL_MOVED], 0, url, position);
+  }
+
+  if (g_strcmp0 (item->title, title) != 0) {
+    g_free (item->title);
+    item->title = g_strdup (title);
+    g_signal_emit (model, signals[TITLE_CHANGED], 0, url, title);
+  }
+}
+
 void
 ephy_web_overview_model_delete_url (EphyWebOverviewModel *model,
                                     const char           *url)
 {
   GList *l;
-  gboolean changed = FALSE;
 
   g_return_if_fail (EPHY_IS_WEB_OVERVIEW_MODEL (model));
 
@@ -196,17 +278,13 @@ ephy_web_overview_model_delete_url (EphyWebOverviewModel *model,
     GList *next = l->next;
 
     if (g_strcmp0 (item->url, url) == 0) {
-      changed = TRUE;
-
       ephy_web_overview_model_item_free (item);
       model->items = g_list_delete_link (model->items, l);
+      g_signal_emit (model, signals[URL_REMOVED], 0, url);
     }
 
     l = next;
   }
-
-  if (changed)
-    g_signal_emit (model, signals[URLS_CHANGED], 0);
 }
 
 void
@@ -214,7 +292,6 @@ ephy_web_overview_model_delete_host (EphyWebOverviewModel *model,
                                      const char           *host)
 {
   GList *l;
-  gboolean changed = FALSE;
 
   g_return_if_fail (EPHY_IS_WEB_OVERVIEW_MODEL (model));
 
@@ -225,18 +302,18 @@ ephy_web_overview_model_delete_host (EphyWebOverviewModel *model,
     GList *next = l->next;
 
     if (g_strcmp0 (soup_uri_get_host (uri), host) == 0) {
-      changed = TRUE;
+      char *url = item->url;
 
+      item->url = NULL;
       ephy_web_overview_model_item_free (item);
       model->items = g_list_delete_link (model->items, l);
+      g_signal_emit (model, signals[URL_REMOVED], 0, url);
+      g_free (url);
     }
 
     soup_uri_free (uri);
     l = next;
   }
-
-  if (changed)
-    g_signal_emit (model, signals[URLS_CHANGED], 0);
 }
 
 void
@@ -40,6 +40,10 @@ const char           *ephy_web_overview_model_get_url_thumbnail (EphyWebOverview
 void                  ephy_web_overview_model_set_url_title     (EphyWebOverviewModel *model,
                                                                  const char           *url,
                                                                  const char           *title);
+void                  ephy_web_overview_model_place_url         (EphyWebOverviewModel *model,
+                                                                 guint                 position,
+                                                                 const char           *url,
+                                                                 const char           *title);
 void                  ephy_web_overview_model_delete_url        (EphyWebOverviewModel *model,
                                                                  const char           *url);
 void                  ephy_web_overview_model_delete_host       (EphyWebOverviewModel *model,
@@ -348,6 +348,181 @@ ephy_web_overview_model_urls_changed (EphyWebOverviewModel *model,
   }
 }
 
+static GList *
+ephy_web_overview_find_item (EphyWebOverview *overview,
+                             const char      *url)
+{
+  GList *l;
+
+  for (l = overview->items; l; l = g_list_next (l)) {
+    if (g_strcmp0 (((OverviewItem *)l->data)->url, url) == 0)
+      return l;
+  }
+
+  return NULL;
+}
+
+static WebKitDOMNode *
+ephy_web_overview_create_first_item (EphyWebOverview *overview,
+                                     WebKitDOMNode  **parent)
+{
+  WebKitDOMDocument *document;
+  WebKitDOMElement *container;
+  WebKitDOMElement *anchor;
+  WebKitDOMElement *element;
+
+  document = webkit_web_page_get_dom_document (overview->web_page);
+  if (!document)
+    return NULL;
+
+  /* An empty overview is rendered with a welcome message instead of the
+   * grid, so replace it with the grid before adding the first item. */
+  container = webkit_dom_document_get_element_by_id (document, "overview");
+  if (!container) {
+    WebKitDOMElement *empty;
+
+    empty = webkit_dom_document_query_selector (document, ".overview-empty", NULL);
+    if (!empty)
+      return NULL;
+
+    container = webkit_dom_document_create_element (document, "div", NULL);
+    webkit_dom_element_set_attribute (container, "id", "overview", NULL);
+    webkit_dom_node_replace_child (webkit_dom_node_get_parent_node (WEBKIT_DOM_NODE (empty)),
+                                   WEBKIT_DOM_NODE (container),
+                                   WEBKIT_DOM_NODE (empty),
+                                   NULL);
+  }
+
+  anchor = webkit_dom_document_create_element (document, "a", NULL);
+  webkit_dom_element_set_class_name (anchor, "overview-item");
+
+  element = webkit_dom_document_create_element (document, "div", NULL);
+  webkit_dom_element_set_class_name (element, "overview-close-button");
+  webkit_dom_element_set_attribute (element, "onclick", "removeFromOverview(this.parentNode, event)", NULL);
+  webkit_dom_node_set_text_content (WEBKIT_DOM_NODE (element), "\u2716", NULL);
+  webkit_dom_node_append_child (WEBKIT_DOM_NODE (anchor), WEBKIT_DOM_NODE (element), NULL);
+
+  element = webkit_dom_document_create_element (document, "span", NULL);
+  webkit_dom_element_set_class_name (element, "overview-thumbnail");
+  webkit_dom_node_append_child (WEBKIT_DOM_NODE (anchor), WEBKIT_DOM_NODE (element), NULL);
+
+  element = webkit_dom_document_create_element (document, "span", NULL);
+  webkit_dom_element_set_class_name (element, "overview-title");
+  webkit_dom_node_append_child (WEBKIT_DOM_NODE (anchor), WEBKIT_DOM_NODE (element), NULL);
+
+  *parent = WEBKIT_DOM_NODE (container);
+
+  return WEBKIT_DOM_NODE (anchor);
+}
+
+static void
+ephy_web_overview_model_url_inserted (EphyWebOverviewModel *model,
+                                      guint                 position,
+                                      const char           *url,
+                                      const char           *title,
+                                      EphyWebOverview      *overview)
+{
+  WebKitDOMNode *anchor;
+  WebKitDOMNode *parent = NULL;
+  WebKitDOMDOMTokenList *class_list;
+  OverviewItem *item;
+  GList *sibling;
+  const char *thumbnail_path;
+
+  if (overview->items) {
+    WebKitDOMNode *template;
+
+    template = WEBKIT_DOM_NODE (((OverviewItem *)overview->items->data)->anchor);
+    anchor = webkit_dom_node_clone_node_with_error (template, TRUE, NULL);
+    parent = webkit_dom_node_get_parent_node (template);
+  } else {
+    /* There's no item to copy, so this is the first one. */
+    anchor = ephy_web_overview_create_first_item (overview, &parent);
+    position = 0;
+  }
+  if (!anchor)
+    return;
+
+  item = overview_item_new (WEBKIT_DOM_ELEMENT (anchor));
+  if (!item->thumbnail || !item->title) {
+    overview_item_free (item);
+    return;
+  }
+
+  g_free (item->url);
+  item->url = g_strdup (url);
+
+  class_list = webkit_dom_element_get_class_list (item->anchor);
+  if (class_list && webkit_dom_dom_token_list_contains (class_list, "overview-removed"))
+    webkit_dom_dom_token_list_remove (class_list, NULL, "overview-removed", NULL);
+  g_clear_object (&class_list);
+
+  webkit_dom_element_set_attribute (item->anchor, "href", url, NULL);
+  webkit_dom_element_set_attribute (item->anchor, "title", title, NULL);
+  webkit_dom_node_set_text_content (WEBKIT_DOM_NODE (item->title), title, NULL);
+
+  thumbnail_path = ephy_web_overview_model_get_url_thumbnail (model, url);
+  if (thumbnail_path)
+    update_thumbnail_element_style (item->thumbnail, thumbnail_path);
+  else
+    webkit_dom_element_remove_attribute (item->thumbnail, "style");
+
+  sibling = g_list_nth (overview->items, position);
+  webkit_dom_node_insert_before (parent, anchor,
+                                 sibling ? WEBKIT_DOM_NODE (((OverviewItem *)sibling->data)->anchor) : NULL,
+                                 NULL);
+
+  overview->items = g_list_insert (overview->items, item, position);
+}
+
+static void
+ephy_web_overview_model_url_moved (EphyWebOverviewModel *model,
+                                   const char           *url,
+                                   guint                 position,
+                                   EphyWebOverview      *overview)
+{
+  WebKitDOMNode *anchor;
+  OverviewItem *item;
+  GList *link;
+  GList *sibling;
+
+  link = ephy_web_overview_find_item (overview, url);
+  if (!link)
+    return;
+
+  item = (OverviewItem *)link->data;
+  overview->items = g_list_delete_link (overview->items, link);
+
+  anchor = WEBKIT_DOM_NODE (item->anchor);
+  sibling = g_list_nth (overview->items, position);
+  webkit_dom_node_insert_before (webkit_dom_node_get_parent_node (anchor), anchor,
+                                 sibling ? WEBKIT_DOM_NODE (((OverviewItem *)sibling->data)->anchor) : NULL,
+                                 NULL);
+
+  overview->items = g_list_insert (overview->items, item, position);
+}
+
+static void
+ephy_web_overview_model_url_removed (EphyWebOverviewModel *model,
+                                     const char           *url,
+                                     EphyWebOverview      *overview)
+{
+  WebKitDOMNode *anchor;
+  OverviewItem *item;
+  GList *link;
+
+  link = ephy_web_overview_find_item (overview, url);
+  if (!link)
+    return;
+
+  item = (OverviewItem *)link->data;
+  anchor = WEBKIT_DOM_NODE (item->anchor);
+  webkit_dom_node_remove_child (webkit_dom_node_get_parent_node (anchor), anchor, NULL);
+
+  overview_item_free (item);
+  overview->items = g_list_delete_link (overview->items, link);
+}
+
 static void
 ephy_web_overview_set_property (GObject      *object,
                                 guint         prop_id,
@@ -398,6 +573,15 @@ ephy_web_overview_constructed (GObject *object)
   g_signal_connect_object (overview->model, "urls-changed",
                            G_CALLBACK (ephy_web_overview_model_urls_changed),
                            overview, 0);
+  g_signal_connect_object (overview->model, "url-inserted",
+                           G_CALLBACK (ephy_web_overview_model_url_inserted),
+                           overview, 0);
+  g_signal_connect_object (overview->model, "url-moved",
+                           G_CALLBACK (ephy_web_overview_model_url_moved),
+                           overview, 0);
+  g_signal_connect_object (overview->model, "url-removed",
+                           G_CALLBACK (ephy_web_overview_model_url_removed),
+                           overview, 0);
   g_signal_connect_object (overview->model, "thumbnail-changed",
                            G_CALLBACK (ephy_web_overview_model_thumbnail_changed),
                            overview, 0);
@@ -0,0 +1,1169 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-adblock-matcher.h"
+
+#include "ephy-debug.h"
+#include "gvdb-builder.h"
+#include "gvdb-reader.h"
+
+#include <libsoup/soup.h>
+#include <string.h>
+
+/* Every URL filter is indexed under one "token" of its pattern: a maximal
+ * run of alphanumeric characters (or '%') that any URL matched by the filter
+ * is guaranteed to contain as a token too. Matching a request only needs to
+ * split its URL into tokens, look each of them up and test the few rules
+ * found there, plus the generic rules for which no token could be chosen.
+ * Patterns are matched natively; GRegex is only used for /regexp/ rules.
+ *
+ * Rules anchored to a complete host name ("||ads.example.com^") are instead
+ * bucketed by the registrable domain of that host, which every request they
+ * can match shares. Rule options are parsed once into flags, a mask of
+ * resource types and the raw "a.com|~b.com" list of domain= entries.
+ *
+ * The compiled index can be saved as a GVDB snapshot, with one table entry
+ * per token, so that web processes can mmap it and match requests without
+ * parsing the filter lists again. Bump the version below whenever the layout
+ * of the snapshot or the meaning of the rule flags changes. */
+
+#define MIN_TOKEN_LENGTH 2
+
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_GENERIC_KEY "*"
+#define SNAPSHOT_HOST_PREFIX "@"
+
+typedef enum {
+  RULE_ANCHOR_START  = 1 << 0,
+  RULE_ANCHOR_DOMAIN = 1 << 1,
+  RULE_ANCHOR_END    = 1 << 2,
+  RULE_REGEX         = 1 << 3,
+  RULE_THIRD_PARTY   = 1 << 4,
+  RULE_FIRST_PARTY   = 1 << 5
+} AdblockRuleFlags;
+
+typedef struct {
+  char *pattern;
+  GRegex *regex;
+  guint flags;
+  guint types;
+  char *domains;
+} AdblockRule;
+
+typedef struct {
+  GHashTable *buckets;
+  GHashTable *host_buckets;
+  GPtrArray *generic_rules;
+
+  /* Set instead of the above when loaded from a snapshot. */
+  GvdbTable *table;
+} AdblockRuleSet;
+
+typedef enum {
+  PARTY_UNKNOWN,
+  PARTY_FIRST,
+  PARTY_THIRD
+} AdblockParty;
+
+typedef struct {
+  char *uri;
+  const char *host;
+  const char *host_end;
+  char *host_name;
+  const char *domain;
+
+  char *page_host;
+  AdblockParty party;
+  EphyAdblockResourceType type;
+} AdblockRequest;
+
+typedef struct {
+  const char *name;
+  EphyAdblockResourceType type;
+} ResourceTypeOption;
+
+static const ResourceTypeOption resource_type_options[] = {
+  { "other", EPHY_ADBLOCK_RESOURCE_OTHER },
+  { "script", EPHY_ADBLOCK_RESOURCE_SCRIPT },
+  { "image", EPHY_ADBLOCK_RESOURCE_IMAGE },
+  { "stylesheet", EPHY_ADBLOCK_RESOURCE_STYLESHEET },
+  { "object", EPHY_ADBLOCK_RESOURCE_OBJECT },
+  { "object-subrequest", EPHY_ADBLOCK_RESOURCE_OBJECT },
+  { "xmlhttprequest", EPHY_ADBLOCK_RESOURCE_XMLHTTPREQUEST },
+  { "subdocument", EPHY_ADBLOCK_RESOURCE_SUBDOCUMENT },
+  { "media", EPHY_ADBLOCK_RESOURCE_MEDIA },
+  { "font", EPHY_ADBLOCK_RESOURCE_FONT },
+  { "ping", EPHY_ADBLOCK_RESOURCE_OTHER },
+  { "websocket", EPHY_ADBLOCK_RESOURCE_OTHER }
+};
+
+struct _EphyAdblockMatcher {
+  AdblockRuleSet blocklist;
+  AdblockRuleSet whitelist;
+  guint n_rules;
+
+  GvdbTable *snapshot;
+  GHashTable *snapshot_regexes;
+};
+
+GQuark adblock_matcher_error_quark (void);
+G_DEFINE_QUARK (adblock-matcher-error-quark, adblock_matcher_error)
+#define ADBLOCK_MATCHER_ERROR adblock_matcher_error_quark ()
+
+static void
+adblock_rule_free (AdblockRule *rule)
+{
+  g_free (rule->pattern);
+  g_free (rule->domains);
+  if (rule->regex)
+    g_regex_unref (rule->regex);
+
+  g_slice_free (AdblockRule, rule);
+}
+
+static void
+adblock_rule_set_init (AdblockRuleSet *set)
+{
+  set->buckets = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                        NULL,
+                                        (GDestroyNotify)g_ptr_array_unref);
+  set->host_buckets = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             (GDestroyNotify)g_free,
+                                             (GDestroyNotify)g_ptr_array_unref);
+  set->generic_rules = g_ptr_array_new_with_free_func ((GDestroyNotify)adblock_rule_free);
+}
+
+static void
+adblock_rule_set_clear (AdblockRuleSet *set)
+{
+  g_hash_table_destroy (set->buckets);
+  g_hash_table_destroy (set->host_buckets);
+  g_ptr_array_unref (set->generic_rules);
+
+  if (set->table)
+    gvdb_table_free (set->table);
+}
+
+static inline gboolean
+is_token_char (char c)
+{
+  return g_ascii_isalnum (c) || c == '%';
+}
+
+static inline gboolean
+is_separator_char (char c)
+{
+  /* Anything but a letter, a digit, or one of the following: _ - . % */
+  return !g_ascii_isalnum (c) && c != '_' && c != '-' && c != '.' && c != '%';
+}
+
+static inline guint
+token_hash (const char *token,
+            gsize       length)
+{
+  guint hash = 2166136261u;
+
+  for (gsize i = 0; i < length; i++) {
+    hash ^= (guchar)token[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/* Matches @pattern against @text, where '*' matches any sequence of
+ * characters and '^' matches a separator character or the end of @text.
+ * Unless @anchor_start is set, the match can begin anywhere in @text, and
+ * unless @anchor_end is set, it can end anywhere. */
+static gboolean
+pattern_matches (const char *pattern,
+                 const char *text,
+                 gboolean    anchor_start,
+                 gboolean    anchor_end)
+{
+  const char *p = pattern;
+  const char *t = text;
+  const char *star_p = NULL;
+  const char *star_t = NULL;
+
+  if (!anchor_start) {
+    star_p = pattern;
+    star_t = text;
+  }
+
+  for (;;) {
+    if (*p == '*') {
+      star_p = ++p;
+      star_t = t;
+      continue;
+    }
+
+    if (*p == '\0') {
+      if (!anchor_end || *t == '\0')
+        return TRUE;
+    } else if (*t == '\0') {
+      /* Only separators and wildcards can match the end of the text. */
+      while (*p == '^' || *p == '*')
+        p++;
+      return *p == '\0';
+    } else if (*p == *t || (*p == '^' && is_separator_char (*t))) {
+      p++;
+      t++;
+      continue;
+    }
+
+    /* Mismatch: retry from the last wildcard, one character further. */
+    if (!star_p || *star_t == '\0')
+      return FALSE;
+
+    p = star_p;
+    t = ++star_t;
+  }
+}
+
+/* Returns the registrable domain of @host, e.g. "example.co.uk" for
+ * "www.example.co.uk", or %NULL for IP addresses and unknown suffixes. */
+static const char *
+get_registrable_domain (const char *host)
+{
+  return soup_tld_get_base_domain (host, NULL);
+}
+
+static const char *
+uri_find_host (const char  *uri,
+               const char **host_end)
+{
+  const char *scheme_end;
+  const char *host;
+
+  scheme_end = strstr (uri, "://");
+  if (!scheme_end)
+    return NULL;
+
+  host = scheme_end + 3;
+  *host_end = host + strcspn (host, "/?#:");
+
+  return host;
+}
+
+static void
+adblock_request_init (AdblockRequest          *request,
+                      const char              *uri,
+                      const char              *page_uri,
+                      EphyAdblockResourceType  type)
+{
+  const char *page_domain = NULL;
+
+  memset (request, 0, sizeof (AdblockRequest));
+  request->uri = g_ascii_strdown (uri, -1);
+  request->type = type;
+
+  request->host = uri_find_host (request->uri, &request->host_end);
+  if (request->host) {
+    request->host_name = g_strndup (request->host, request->host_end - request->host);
+    request->domain = get_registrable_domain (request->host_name);
+  }
+
+  if (page_uri) {
+    const char *page_host;
+    const char *page_host_end;
+
+    page_host = uri_find_host (page_uri, &page_host_end);
+    if (page_host) {
+      request->page_host = g_ascii_strdown (page_host, page_host_end - page_host);
+      page_domain = get_registrable_domain (request->page_host);
+    }
+  }
+
+  /* Requests to hosts without a registrable domain, such as IP addresses,
+   * are only considered first-party when the hosts are the same. */
+  if (request->host_name && request->page_host) {
+    const char *domain = request->domain ? request->domain : request->host_name;
+
+    if (!page_domain)
+      page_domain = request->page_host;
+    request->party = strcmp (domain, page_domain) == 0 ? PARTY_FIRST : PARTY_THIRD;
+  }
+}
+
+static void
+adblock_request_clear (AdblockRequest *request)
+{
+  g_free (request->uri);
+  g_free (request->host_name);
+  g_free (request->page_host);
+}
+
+static gboolean
+host_is_in_domain (const char *host,
+                   const char *domain,
+                   gsize       domain_length)
+{
+  gsize host_length = strlen (host);
+
+  if (host_length < domain_length ||
+      memcmp (host + host_length - domain_length, domain, domain_length) != 0)
+    return FALSE;
+
+  return host_length == domain_length || host[host_length - domain_length - 1] == '.';
+}
+
+/* Checks @host against a domain= option value such as "a.com|~b.a.com".
+ * Excluded domains win over included ones, and a list with only exclusions
+ * applies to every other host. */
+static gboolean
+adblock_domains_match (const char *domains,
+                       const char *host)
+{
+  const char *d = domains;
+  gboolean has_included = FALSE;
+  gboolean included = FALSE;
+
+  while (*d) {
+    gboolean excluded = *d == '~';
+    gsize length;
+
+    if (excluded)
+      d++;
+    length = strcspn (d, "|");
+
+    if (!excluded)
+      has_included = TRUE;
+
+    if (host && length > 0 && host_is_in_domain (host, d, length)) {
+      if (excluded)
+        return FALSE;
+      included = TRUE;
+    }
+
+    d += length;
+    if (*d == '|')
+      d++;
+  }
+
+  return !has_included || included;
+}
+
+static gboolean
+adblock_rule_matches_uri (AdblockRule    *rule,
+                          AdblockRequest *request)
+{
+  gboolean anchor_end = (rule->flags & RULE_ANCHOR_END) != 0;
+
+  if (rule->flags & RULE_REGEX)
+    return g_regex_match (rule->regex, request->uri, 0, NULL);
+
+  if (rule->flags & RULE_ANCHOR_DOMAIN) {
+    if (!request->host)
+      return FALSE;
+
+    /* The pattern must start at the beginning of the host or of any of its
+     * subdomain labels. */
+    if (pattern_matches (rule->pattern, request->host, TRUE, anchor_end))
+      return TRUE;
+
+    for (const char *p = request->host; p < request->host_end; p++) {
+      if (*p == '.' && pattern_matches (rule->pattern, p + 1, TRUE, anchor_end))
+        return TRUE;
+    }
+
+    return FALSE;
+  }
+
+  return pattern_matches (rule->pattern, request->uri,
+                          (rule->flags & RULE_ANCHOR_START) != 0,
+                          anchor_end);
+}
+
+static gboolean
+adblock_rule_matches (AdblockRule    *rule,
+                      AdblockRequest *request)
+{
+  /* Options are cheaper to check than the pattern itself. */
+  if (!(rule->types & request->type))
+    return FALSE;
+
+  if ((rule->flags & RULE_THIRD_PARTY) && request->party == PARTY_FIRST)
+    return FALSE;
+
+  if ((rule->flags & RULE_FIRST_PARTY) && request->party == PARTY_THIRD)
+    return FALSE;
+
+  if (rule->domains && !adblock_domains_match (rule->domains, request->page_host))
+    return FALSE;
+
+  return adblock_rule_matches_uri (rule, request);
+}
+
+static gboolean
+adblock_rules_match (GPtrArray      *rules,
+                     AdblockRequest *request)
+{
+  for (guint i = 0; i < rules->len; i++) {
+    AdblockRule *rule = g_ptr_array_index (rules, i);
+
+    if (adblock_rule_matches (rule, request)) {
+      LOG ("matched by rule %s -- %s", rule->pattern, request->uri);
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static GRegex *
+ephy_adblock_matcher_get_snapshot_regex (EphyAdblockMatcher *matcher,
+                                         const char         *pattern)
+{
+  GRegex *regex;
+  GError *error = NULL;
+
+  regex = g_hash_table_lookup (matcher->snapshot_regexes, pattern);
+  if (regex)
+    return regex;
+
+  /* The pattern was validated when the snapshot was compiled, but the
+   * snapshot may come from another PCRE. The rule is skipped then. */
+  regex = g_regex_new (pattern, G_REGEX_CASELESS | G_REGEX_OPTIMIZE,
+                       G_REGEX_MATCH_NOTEMPTY, &error);
+  if (error) {
+    g_warning ("%s: %s", G_STRFUNC, error->message);
+    g_error_free (error);
+    return NULL;
+  }
+
+  g_hash_table_insert (matcher->snapshot_regexes, g_strdup (pattern), regex);
+
+  return regex;
+}
+
+static gboolean
+ephy_adblock_matcher_match_snapshot_bucket (EphyAdblockMatcher *matcher,
+                                            GvdbTable          *table,
+                                            const char         *key,
+                                            AdblockRequest     *request)
+{
+  GVariant *bucket;
+  GVariantIter iter;
+  AdblockRule rule = { NULL, NULL, 0, 0, NULL };
+  gboolean matched = FALSE;
+
+  bucket = gvdb_table_get_value (table, key);
+  if (!bucket)
+    return FALSE;
+
+  g_variant_iter_init (&iter, bucket);
+  while (!matched && g_variant_iter_next (&iter, "(&suu&s)", &rule.pattern, &rule.flags,
+                                          &rule.types, &rule.domains)) {
+    if (rule.flags & RULE_REGEX) {
+      rule.regex = ephy_adblock_matcher_get_snapshot_regex (matcher, rule.pattern);
+      if (!rule.regex)
+        continue;
+    }
+
+    if (*rule.domains == '\0')
+      rule.domains = NULL;
+
+    matched = adblock_rule_matches (&rule, request);
+    if (matched)
+      LOG ("matched by rule %s -- %s", rule.pattern, request->uri);
+  }
+  g_variant_unref (bucket);
+
+  return matched;
+}
+
+static gboolean
+ephy_adblock_matcher_match_bucket (EphyAdblockMatcher *matcher,
+                                   AdblockRuleSet     *set,
+                                   guint               hash,
+                                   AdblockRequest     *request)
+{
+  GPtrArray *bucket;
+  char key[9];
+
+  if (set->table) {
+    g_snprintf (key, sizeof (key), "%08x", hash);
+    return ephy_adblock_matcher_match_snapshot_bucket (matcher, set->table, key, request);
+  }
+
+  bucket = g_hash_table_lookup (set->buckets, GUINT_TO_POINTER (hash));
+  return bucket && adblock_rules_match (bucket, request);
+}
+
+static gboolean
+ephy_adblock_matcher_match_host (EphyAdblockMatcher *matcher,
+                                 AdblockRuleSet     *set,
+                                 AdblockRequest     *request)
+{
+  GPtrArray *bucket;
+
+  if (!request->domain)
+    return FALSE;
+
+  if (set->table) {
+    char *key;
+    gboolean matched;
+
+    key = g_strconcat (SNAPSHOT_HOST_PREFIX, request->domain, NULL);
+    matched = ephy_adblock_matcher_match_snapshot_bucket (matcher, set->table, key, request);
+    g_free (key);
+
+    return matched;
+  }
+
+  bucket = g_hash_table_lookup (set->host_buckets, request->domain);
+  return bucket && adblock_rules_match (bucket, request);
+}
+
+static gboolean
+ephy_adblock_matcher_match_generic (EphyAdblockMatcher *matcher,
+                                    AdblockRuleSet     *set,
+                                    AdblockRequest     *request)
+{
+  if (set->table)
+    return ephy_adblock_matcher_match_snapshot_bucket (matcher, set->table, SNAPSHOT_GENERIC_KEY, request);
+
+  return adblock_rules_match (set->generic_rules, request);
+}
+
+static gboolean
+adblock_rule_parse_resource_type (const char *name,
+                                  guint      *type)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (resource_type_options); i++) {
+    if (strcmp (name, resource_type_options[i].name) == 0) {
+      *type = resource_type_options[i].type;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static gboolean
+adblock_rule_parse_options (AdblockRule *rule,
+                            const char  *options)
+{
+  char **opts;
+  guint included_types = 0;
+  guint excluded_types = 0;
+  gboolean supported = TRUE;
+
+  opts = g_strsplit (options, ",", -1);
+  for (guint i = 0; supported && opts[i]; i++) {
+    char *opt = g_ascii_strdown (opts[i], -1);
+    gboolean inverse = opt[0] == '~';
+    const char *name = inverse ? opt + 1 : opt;
+    guint type;
+
+    if (strcmp (name, "third-party") == 0) {
+      rule->flags |= inverse ? RULE_FIRST_PARTY : RULE_THIRD_PARTY;
+    } else if (!inverse && g_str_has_prefix (name, "domain=")) {
+      g_free (rule->domains);
+      rule->domains = g_strdup (name + strlen ("domain="));
+    } else if (adblock_rule_parse_resource_type (name, &type)) {
+      if (inverse)
+        excluded_types |= type;
+      else
+        included_types |= type;
+    } else if (strcmp (name, "match-case") != 0 && strcmp (name, "collapse") != 0) {
+      /* Options such as popup, document or elemhide change what the rule
+       * applies to. Ignoring them would block requests they never meant to. */
+      supported = FALSE;
+    }
+
+    g_free (opt);
+  }
+  g_strfreev (opts);
+
+  rule->types = (included_types ? included_types : EPHY_ADBLOCK_RESOURCE_ANY) & ~excluded_types;
+  if (rule->domains && *rule->domains == '\0')
+    g_clear_pointer (&rule->domains, g_free);
+
+  return supported && rule->types != 0;
+}
+
+/* Returns the registrable domain of the host a "||host^" rule is anchored to,
+ * or %NULL if the rule does not name a complete host. */
+static char *
+adblock_rule_get_host_domain (AdblockRule *rule)
+{
+  const char *pattern = rule->pattern;
+  const char *p;
+  const char *domain;
+  char *host;
+  char *result = NULL;
+
+  if ((rule->flags & (RULE_ANCHOR_DOMAIN | RULE_REGEX)) != RULE_ANCHOR_DOMAIN)
+    return NULL;
+
+  p = pattern + strspn (pattern, "abcdefghijklmnopqrstuvwxyz0123456789-.");
+  if (p == pattern)
+    return NULL;
+
+  if (*p != '^' && *p != '/' && *p != ':' &&
+      !(*p == '\0' && (rule->flags & RULE_ANCHOR_END)))
+    return NULL;
+
+  host = g_strndup (pattern, p - pattern);
+  domain = get_registrable_domain (host);
+  if (domain)
+    result = g_strdup (domain);
+  g_free (host);
+
+  return result;
+}
+
+/* Returns the bucket hash of the least used token of @rule's pattern that is
+ * guaranteed to appear as a whole token in the URLs it matches, or 0 if there
+ * is none. */
+static guint
+adblock_rule_set_find_token (AdblockRuleSet *set,
+                             AdblockRule    *rule)
+{
+  const char *pattern = rule->pattern;
+  const char *p = pattern;
+  guint best_hash = 0;
+  guint best_count = G_MAXUINT;
+  gsize best_length = 0;
+
+  while (*p) {
+    const char *start;
+    gsize length;
+    GPtrArray *bucket;
+    guint hash;
+    guint count;
+
+    if (!is_token_char (*p)) {
+      p++;
+      continue;
+    }
+
+    start = p;
+    while (is_token_char (*p))
+      p++;
+    length = p - start;
+
+    if (length < MIN_TOKEN_LENGTH)
+      continue;
+
+    /* The token must be delimited in the pattern itself, otherwise the URL
+     * could contain it as part of a longer token. */
+    if (start == pattern) {
+      if (!(rule->flags & (RULE_ANCHOR_START | RULE_ANCHOR_DOMAIN)))
+        continue;
+    } else if (start[-1] == '*') {
+      continue;
+    }
+
+    if (*p == '\0') {
+      if (!(rule->flags & RULE_ANCHOR_END))
+        continue;
+    } else if (*p == '*') {
+      continue;
+    }
+
+    hash = token_hash (start, length);
+    bucket = g_hash_table_lookup (set->buckets, GUINT_TO_POINTER (hash));
+    count = bucket ? bucket->len : 0;
+
+    if (count < best_count || (count == best_count && length > best_length)) {
+      best_hash = hash;
+      best_count = count;
+      best_length = length;
+    }
+  }
+
+  return best_length ? best_hash : 0;
+}
+
+static void
+adblock_rule_set_add_rule (AdblockRuleSet *set,
+                           AdblockRule    *rule)
+{
+  GPtrArray *bucket;
+  char *domain;
+  guint hash = 0;
+
+  domain = adblock_rule_get_host_domain (rule);
+  if (domain) {
+    bucket = g_hash_table_lookup (set->host_buckets, domain);
+    if (!bucket) {
+      bucket = g_ptr_array_new_with_free_func ((GDestroyNotify)adblock_rule_free);
+      g_hash_table_insert (set->host_buckets, domain, bucket);
+    } else {
+      g_free (domain);
+    }
+    g_ptr_array_add (bucket, rule);
+    return;
+  }
+
+  if (!(rule->flags & RULE_REGEX))
+    hash = adblock_rule_set_find_token (set, rule);
+
+  if (hash == 0) {
+    g_ptr_array_add (set->generic_rules, rule);
+    return;
+  }
+
+  bucket = g_hash_table_lookup (set->buckets, GUINT_TO_POINTER (hash));
+  if (!bucket) {
+    bucket = g_ptr_array_new_with_free_func ((GDestroyNotify)adblock_rule_free);
+    g_hash_table_insert (set->buckets, GUINT_TO_POINTER (hash), bucket);
+  }
+  g_ptr_array_add (bucket, rule);
+}
+
+static AdblockRule *
+adblock_rule_new (const char *filter,
+                  gsize       length)
+{
+  AdblockRule *rule;
+  char *pattern;
+  char *start;
+  char *end;
+
+  rule = g_slice_new0 (AdblockRule);
+  rule->types = EPHY_ADBLOCK_RESOURCE_ANY;
+
+  if (length > 2 && filter[0] == '/' && filter[length - 1] == '/') {
+    GError *error = NULL;
+
+    pattern = g_strndup (filter + 1, length - 2);
+    rule->regex = g_regex_new (pattern, G_REGEX_CASELESS | G_REGEX_OPTIMIZE,
+                               G_REGEX_MATCH_NOTEMPTY, &error);
+    if (error) {
+      g_warning ("%s: %s", G_STRFUNC, error->message);
+      g_error_free (error);
+      g_free (pattern);
+      g_slice_free (AdblockRule, rule);
+      return NULL;
+    }
+
+    rule->pattern = pattern;
+    rule->flags |= RULE_REGEX;
+    return rule;
+  }
+
+  pattern = g_ascii_strdown (filter, length);
+  start = pattern;
+  end = pattern + strlen (pattern);
+
+  if (start[0] == '|' && start[1] == '|') {
+    rule->flags |= RULE_ANCHOR_DOMAIN;
+    start += 2;
+  } else if (start[0] == '|') {
+    rule->flags |= RULE_ANCHOR_START;
+    start++;
+  }
+
+  if (end > start && end[-1] == '|') {
+    rule->flags |= RULE_ANCHOR_END;
+    *--end = '\0';
+  }
+
+  /* Leading and trailing wildcards make the anchors meaningless. */
+  if (*start == '*') {
+    rule->flags &= ~(RULE_ANCHOR_START | RULE_ANCHOR_DOMAIN);
+    while (*start == '*')
+      start++;
+  }
+
+  if (end > start && end[-1] == '*') {
+    rule->flags &= ~RULE_ANCHOR_END;
+    while (end > start && end[-1] == '*')
+      *--end = '\0';
+  }
+
+  if (*start == '\0') {
+    g_free (pattern);
+    g_slice_free (AdblockRule, rule);
+    return NULL;
+  }
+
+  rule->pattern = g_strdup (start);
+  g_free (pattern);
+
+  return rule;
+}
+
+/**
+ * ephy_adblock_matcher_add_filter:
+ * @matcher: an #EphyAdblockMatcher
+ * @filter: a line of an Adblock Plus filter list
+ *
+ * Compiles @filter into @matcher if it is a URL blocking or exception rule.
+ *
+ * Returns: %TRUE if @filter was added, %FALSE if it is not a URL rule or
+ * it uses unsupported features.
+ **/
+gboolean
+ephy_adblock_matcher_add_filter (EphyAdblockMatcher *matcher,
+                                 const char         *filter)
+{
+  AdblockRuleSet *set = &matcher->blocklist;
+  AdblockRule *rule;
+  const char *options;
+  gsize length;
+
+  g_return_val_if_fail (matcher, FALSE);
+  g_return_val_if_fail (!matcher->snapshot, FALSE);
+  g_return_val_if_fail (filter, FALSE);
+
+  /* Whitelisted exception rules */
+  if (g_str_has_prefix (filter, "@@")) {
+    set = &matcher->whitelist;
+    filter += 2;
+  }
+
+  /* Comments, section headers and element hiding rules are not URL rules. */
+  if (filter[0] == '\0' || filter[0] == ' ' || filter[0] == '!' ||
+      filter[0] == '[' || strchr (filter, '#'))
+    return FALSE;
+
+  /* The '$' is used as separator for the rule options, so rule patterns
+   * cannot ever contain them. If a rule needs to match it, it uses "%24". */
+  options = strrchr (filter, '$');
+  length = options ? (gsize)(options - filter) : strlen (filter);
+
+  rule = adblock_rule_new (filter, length);
+  if (!rule)
+    return FALSE;
+
+  if (options && !adblock_rule_parse_options (rule, options + 1)) {
+    adblock_rule_free (rule);
+    return FALSE;
+  }
+
+  adblock_rule_set_add_rule (set, rule);
+  matcher->n_rules++;
+
+  return TRUE;
+}
+
+guint
+ephy_adblock_matcher_get_n_rules (EphyAdblockMatcher *matcher)
+{
+  g_return_val_if_fail (matcher, 0);
+
+  return matcher->n_rules;
+}
+
+/**
+ * ephy_adblock_matcher_match:
+ * @matcher: an #EphyAdblockMatcher
+ * @request_uri: the URI of the resource being loaded
+ * @page_uri: (allow-none): the URI of the page loading the resource
+ * @resource_type: the kind of resource, or %EPHY_ADBLOCK_RESOURCE_ANY if unknown
+ * @whitelist: whether to check exception rules instead of blocking rules
+ *
+ * Returns: %TRUE if any rule of the requested kind matches @request_uri
+ **/
+gboolean
+ephy_adblock_matcher_match (EphyAdblockMatcher      *matcher,
+                            const char              *request_uri,
+                            const char              *page_uri,
+                            EphyAdblockResourceType  resource_type,
+                            gboolean                 whitelist)
+{
+  AdblockRuleSet *set;
+  AdblockRequest request;
+  const char *p;
+  gboolean matched = FALSE;
+
+  g_return_val_if_fail (matcher, FALSE);
+  g_return_val_if_fail (request_uri, FALSE);
+
+  set = whitelist ? &matcher->whitelist : &matcher->blocklist;
+  adblock_request_init (&request, request_uri, page_uri, resource_type);
+
+  matched = ephy_adblock_matcher_match_host (matcher, set, &request);
+
+  p = request.uri;
+  while (*p && !matched) {
+    const char *start;
+
+    if (!is_token_char (*p)) {
+      p++;
+      continue;
+    }
+
+    start = p;
+    while (is_token_char (*p))
+      p++;
+
+    if (p - start < MIN_TOKEN_LENGTH)
+      continue;
+
+    matched = ephy_adblock_matcher_match_bucket (matcher, set, token_hash (start, p - start),
+                                                 &request);
+  }
+
+  if (!matched)
+    matched = ephy_adblock_matcher_match_generic (matcher, set, &request);
+
+  adblock_request_clear (&request);
+
+  return matched;
+}
+
+static GVariant *
+adblock_rules_to_variant (GPtrArray *rules)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(suus)"));
+  for (guint i = 0; i < rules->len; i++) {
+    AdblockRule *rule = g_ptr_array_index (rules, i);
+
+    g_variant_builder_add (&builder, "(suus)", rule->pattern, rule->flags,
+                           rule->types, rule->domains ? rule->domains : "");
+  }
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+gvdb_hash_table_insert_variant (GHashTable *table,
+                                const char *key,
+                                GVariant   *value)
+{
+  GvdbItem *item;
+
+  item = gvdb_hash_table_insert (table, key);
+  gvdb_item_set_value (item, value);
+}
+
+static void
+adblock_rule_set_save (AdblockRuleSet *set,
+                       GHashTable     *root_table,
+                       const char     *name)
+{
+  GHashTable *table;
+  GHashTableIter iter;
+  gpointer hash;
+  const char *domain;
+  GPtrArray *bucket;
+
+  table = gvdb_hash_table_new (root_table, name);
+
+  g_hash_table_iter_init (&iter, set->buckets);
+  while (g_hash_table_iter_next (&iter, &hash, (gpointer *)&bucket)) {
+    char key[9];
+
+    g_snprintf (key, sizeof (key), "%08x", GPOINTER_TO_UINT (hash));
+    gvdb_hash_table_insert_variant (table, key, adblock_rules_to_variant (bucket));
+  }
+
+  g_hash_table_iter_init (&iter, set->host_buckets);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&domain, (gpointer *)&bucket)) {
+    char *key = g_strconcat (SNAPSHOT_HOST_PREFIX, domain, NULL);
+
+    gvdb_hash_table_insert_variant (table, key, adblock_rules_to_variant (bucket));
+    g_free (key);
+  }
+
+  if (set->generic_rules->len > 0)
+    gvdb_hash_table_insert_variant (table, SNAPSHOT_GENERIC_KEY,
+                                    adblock_rules_to_variant (set->generic_rules));
+
+  g_hash_table_unref (table);
+}
+
+/**
+ * ephy_adblock_matcher_save:
+ * @matcher: an #EphyAdblockMatcher built with ephy_adblock_matcher_add_filter()
+ * @filters: the URLs of the filter lists compiled into @matcher
+ * @filename: the snapshot file to write
+ * @error: return location for a #GError, or %NULL
+ *
+ * Saves the compiled rules of @matcher so that they can be loaded with
+ * ephy_adblock_matcher_new_from_file(). The file is replaced atomically.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+ephy_adblock_matcher_save (EphyAdblockMatcher  *matcher,
+                           const char * const  *filters,
+                           const char          *filename,
+                           GError             **error)
+{
+  GHashTable *root_table;
+  gboolean result;
+
+  g_return_val_if_fail (matcher, FALSE);
+  g_return_val_if_fail (!matcher->snapshot, FALSE);
+  g_return_val_if_fail (filters, FALSE);
+  g_return_val_if_fail (filename, FALSE);
+
+  root_table = gvdb_hash_table_new (NULL, NULL);
+
+  gvdb_hash_table_insert_variant (root_table, "version", g_variant_new_uint32 (SNAPSHOT_VERSION));
+  gvdb_hash_table_insert_variant (root_table, "filters", g_variant_new_strv (filters, -1));
+  gvdb_hash_table_insert_variant (root_table, "n-rules", g_variant_new_uint32 (matcher->n_rules));
+
+  adblock_rule_set_save (&matcher->blocklist, root_table, "blocklist");
+  adblock_rule_set_save (&matcher->whitelist, root_table, "whitelist");
+
+  result = gvdb_table_write_contents (root_table, filename, FALSE, error);
+  g_hash_table_unref (root_table);
+
+  return result;
+}
+
+static gboolean
+snapshot_filters_equal (GVariant           *value,
+                        const char * const *filters)
+{
+  const char **snapshot_filters;
+  gsize length;
+  gboolean equal;
+
+  snapshot_filters = g_variant_get_strv (value, &length);
+  equal = length == g_strv_length ((char **)filters);
+  for (gsize i = 0; equal && i < length; i++)
+    equal = strcmp (snapshot_filters[i], filters[i]) == 0;
+  g_free (snapshot_filters);
+
+  return equal;
+}
+
+static GVariant *
+snapshot_get_value (GvdbTable          *table,
+                    const char         *key,
+                    const GVariantType *type)
+{
+  GVariant *value;
+
+  value = gvdb_table_get_value (table, key);
+  if (value && !g_variant_is_of_type (value, type)) {
+    g_variant_unref (value);
+    value = NULL;
+  }
+
+  return value;
+}
+
+/**
+ * ephy_adblock_matcher_new_from_file:
+ * @filename: a snapshot written by ephy_adblock_matcher_save()
+ * @filters: the URLs of the filter lists the snapshot is expected to contain
+ * @error: return location for a #GError, or %NULL
+ *
+ * Maps the snapshot in @filename read-only. Rules are read directly from the
+ * mapped file when matching, so the pages are shared by every process using
+ * the same snapshot.
+ *
+ * Returns: a new #EphyAdblockMatcher, or %NULL if the snapshot cannot be read,
+ * has an unknown version or was compiled from different filter lists
+ **/
+EphyAdblockMatcher *
+ephy_adblock_matcher_new_from_file (const char          *filename,
+                                    const char * const  *filters,
+                                    GError             **error)
+{
+  EphyAdblockMatcher *matcher;
+  GvdbTable *snapshot;
+  GvdbTable *blocklist;
+  GvdbTable *whitelist;
+  GVariant *value;
+
+  g_return_val_if_fail (filename, NULL);
+  g_return_val_if_fail (filters, NULL);
+
+  snapshot = gvdb_table_new (filename, TRUE, error);
+  if (!snapshot)
+    return NULL;
+
+  value = snapshot_get_value (snapshot, "version", G_VARIANT_TYPE_UINT32);
+  if (!value || g_variant_get_uint32 (value) != SNAPSHOT_VERSION) {
+    g_set_error (error, ADBLOCK_MATCHER_ERROR, 0, "Snapshot %s has an unsupported version", filename);
+    g_clear_pointer (&value, g_variant_unref);
+    gvdb_table_free (snapshot);
+    return NULL;
+  }
+  g_variant_unref (value);
+
+  value = snapshot_get_value (snapshot, "filters", G_VARIANT_TYPE_STRING_ARRAY);
+  if (!value || !snapshot_filters_equal (value, filters)) {
+    g_set_error (error, ADBLOCK_MATCHER_ERROR, 0, "Snapshot %s was compiled from other filters", filename);
+    g_clear_pointer (&value, g_variant_unref);
+    gvdb_table_free (snapshot);
+    return NULL;
+  }
+  g_variant_unref (value);
+
+  blocklist = gvdb_table_get_table (snapshot, "blocklist");
+  whitelist = gvdb_table_get_table (snapshot, "whitelist");
+  if (!blocklist || !whitelist) {
+    g_set_error (error, ADBLOCK_MATCHER_ERROR, 0, "Snapshot %s is missing rule tables", filename);
+    if (blocklist)
+      gvdb_table_free (blocklist);
+    if (whitelist)
+      gvdb_table_free (whitelist);
+    gvdb_table_free (snapshot);
+    return NULL;
+  }
+
+  matcher = ephy_adblock_matcher_new ();
+  matcher->snapshot = snapshot;
+  matcher->snapshot_regexes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                     (GDestroyNotify)g_free,
+                                                     (GDestroyNotify)g_regex_unref);
+  matcher->blocklist.table = blocklist;
+  matcher->whitelist.table = whitelist;
+
+  value = snapshot_get_value (snapshot, "n-rules", G_VARIANT_TYPE_UINT32);
+  if (value) {
+    matcher->n_rules = g_variant_get_uint32 (value);
+    g_variant_unref (value);
+  }
+
+  return matcher;
+}
+
+EphyAdblockMatcher *
+ephy_adblock_matcher_new (void)
+{
+  EphyAdblockMatcher *matcher = g_slice_new0 (EphyAdblockMatcher);
+
+  adblock_rule_set_init (&matcher->blocklist);
+  adblock_rule_set_init (&matcher->whitelist);
+
+  return matcher;
+}
+
+void
+ephy_adblock_matcher_free (EphyAdblockMatcher *matcher)
+{
+  g_return_if_fail (matcher);
+
+  adblock_rule_set_clear (&matcher->blocklist);
+  adblock_rule_set_clear (&matcher->whitelist);
+
+  if (matcher->snapshot)
+    gvdb_table_free (matcher->snapshot);
+  if (matcher->snapshot_regexes)
+    g_hash_table_destroy (matcher->snapshot_regexes);
+
+  g_slice_free (EphyAdblockMatcher, matcher);
+}
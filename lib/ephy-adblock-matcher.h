@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EphyAdblockMatcher EphyAdblockMatcher;
+
+typedef enum
+{
+  EPHY_ADBLOCK_RESOURCE_OTHER          = 1 << 0,
+  EPHY_ADBLOCK_RESOURCE_SCRIPT         = 1 << 1,
+  EPHY_ADBLOCK_RESOURCE_IMAGE          = 1 << 2,
+  EPHY_ADBLOCK_RESOURCE_STYLESHEET     = 1 << 3,
+  EPHY_ADBLOCK_RESOURCE_OBJECT         = 1 << 4,
+  EPHY_ADBLOCK_RESOURCE_XMLHTTPREQUEST = 1 << 5,
+  EPHY_ADBLOCK_RESOURCE_SUBDOCUMENT    = 1 << 6,
+  EPHY_ADBLOCK_RESOURCE_MEDIA          = 1 << 7,
+  EPHY_ADBLOCK_RESOURCE_FONT           = 1 << 8,
+  EPHY_ADBLOCK_RESOURCE_ANY            = (1 << 9) - 1
+} EphyAdblockResourceType;
+
+EphyAdblockMatcher *ephy_adblock_matcher_new           (void);
+EphyAdblockMatcher *ephy_adblock_matcher_new_from_file (const char          *filename,
+                                                        const char * const  *filters,
+                                                        GError             **error);
+void                ephy_adblock_matcher_free          (EphyAdblockMatcher  *matcher);
+
+gboolean            ephy_adblock_matcher_add_filter    (EphyAdblockMatcher  *matcher,
+                                                        const char          *filter);
+guint               ephy_adblock_matcher_get_n_rules   (EphyAdblockMatcher  *matcher);
+gboolean            ephy_adblock_matcher_save          (EphyAdblockMatcher  *matcher,
+                                                        const char * const  *filters,
+                                                        const char          *filename,
+                                                        GError             **error);
+
+gboolean            ephy_adblock_matcher_match         (EphyAdblockMatcher      *matcher,
+                                                        const char              *request_uri,
+                                                        const char              *page_uri,
+                                                        EphyAdblockResourceType  resource_type,
+                                                        gboolean                 whitelist);
+
+G_END_DECLS
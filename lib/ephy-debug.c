@@ -43,6 +43,8 @@ static const char *ephy_debug_break = NULL;
 
 #ifndef DISABLE_PROFILING
 static GHashTable *ephy_profilers_hash = NULL;
+static GList *ephy_profiler_counters = NULL;
+G_LOCK_DEFINE_STATIC (ephy_profiler_counters);
 static char **ephy_profile_modules;
 static gboolean ephy_profile_all_modules;
 #endif /* !DISABLE_PROFILING */
@@ -169,6 +171,10 @@ ephy_debug_init (void)
 
 #ifndef DISABLE_PROFILING
   ephy_profile_modules = build_modules ("EPHY_PROFILE_MODULES", &ephy_profile_all_modules);
+
+  /* Counters live as long as the process, so print them on the way out. */
+  if (ephy_profile_all_modules || ephy_profile_modules != NULL)
+    atexit (ephy_profiler_dump_counters);
 #endif
 }
 
@@ -280,4 +286,87 @@ ephy_profiler_stop (const char *name)
   ephy_profiler_dump (profiler);
   ephy_profiler_free (profiler);
 }
+
+static void
+ephy_profiler_counter_dump (EphyProfilerCounter *counter)
+{
+  g_print ("[ %s ] %s %" G_GUINT64_FORMAT "\n",
+           counter->module, counter->name,
+           *counter->value);
+}
+
+static void
+ephy_profiler_counter_free (EphyProfilerCounter *counter)
+{
+  g_free (counter->name);
+  g_free (counter->module);
+  g_free (counter);
+}
+
+/**
+ * ephy_profiler_register_counter:
+ * @name: name of the counter
+ * @module: Epiphany module owning the counter
+ * @counter: location of the counter value
+ *
+ * Registers the counter at @counter under @name. The caller keeps updating
+ * the value itself, so counting costs nothing more than an increment. The
+ * value is printed when the counter is unregistered, when
+ * ephy_profiler_dump_counters() is called and when the process exits.
+ **/
+void
+ephy_profiler_register_counter (const char    *name,
+                                const char    *module,
+                                const guint64 *counter)
+{
+  EphyProfilerCounter *profiler_counter;
+
+  if (!ephy_profile_all_modules &&
+      (ephy_profile_modules == NULL || !ephy_should_profile (module))) return;
+
+  profiler_counter = g_new0 (EphyProfilerCounter, 1);
+  profiler_counter->value = counter;
+  profiler_counter->name = g_strdup (name);
+  profiler_counter->module = g_strdup (module);
+
+  G_LOCK (ephy_profiler_counters);
+  ephy_profiler_counters = g_list_append (ephy_profiler_counters, profiler_counter);
+  G_UNLOCK (ephy_profiler_counters);
+}
+
+/**
+ * ephy_profiler_unregister_counter:
+ * @counter: location of a counter value
+ *
+ * Prints and unregisters the counter at @counter, if it was registered.
+ **/
+void
+ephy_profiler_unregister_counter (const guint64 *counter)
+{
+  G_LOCK (ephy_profiler_counters);
+  for (GList *l = ephy_profiler_counters; l; l = l->next) {
+    EphyProfilerCounter *profiler_counter = l->data;
+
+    if (profiler_counter->value == counter) {
+      ephy_profiler_counters = g_list_delete_link (ephy_profiler_counters, l);
+      ephy_profiler_counter_dump (profiler_counter);
+      ephy_profiler_counter_free (profiler_counter);
+      break;
+    }
+  }
+  G_UNLOCK (ephy_profiler_counters);
+}
+
+/**
+ * ephy_profiler_dump_counters:
+ *
+ * Prints the current value of every registered counter.
+ **/
+void
+ephy_profiler_dump_counters (void)
+{
+  G_LOCK (ephy_profiler_counters);
+  g_list_foreach (ephy_profiler_counters, (GFunc)ephy_profiler_counter_dump, NULL);
+  G_UNLOCK (ephy_profiler_counters);
+}
 #endif
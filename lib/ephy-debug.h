@@ -60,6 +60,19 @@ ephy_profiler_start (name, __FILE__);
 ephy_profiler_stop (name);
 #endif
 
+#ifdef DISABLE_PROFILING
+#define REGISTER_PROFILER_COUNTER(name, counter)
+#define UNREGISTER_PROFILER_COUNTER(counter)
+#define DUMP_PROFILER_COUNTERS()
+#else
+#define REGISTER_PROFILER_COUNTER(name, counter)	\
+ephy_profiler_register_counter (name, __FILE__, counter);
+#define UNREGISTER_PROFILER_COUNTER(counter)	\
+ephy_profiler_unregister_counter (counter);
+#define DUMP_PROFILER_COUNTERS()	\
+ephy_profiler_dump_counters ();
+#endif
+
 typedef struct
 {
 	GTimer *timer;
@@ -67,6 +80,13 @@ typedef struct
 	char *module;
 } EphyProfiler;
 
+typedef struct
+{
+	const guint64 *value;
+	char *name;
+	char *module;
+} EphyProfilerCounter;
+
 void		ephy_debug_init		(void);
 
 #ifndef DISABLE_PROFILING
@@ -76,6 +96,14 @@ void		ephy_profiler_start	(const char *name,
 
 void		ephy_profiler_stop	(const char *name);
 
+void		ephy_profiler_register_counter	(const char    *name,
+						 const char    *module,
+						 const guint64 *counter);
+
+void		ephy_profiler_unregister_counter	(const guint64 *counter);
+
+void		ephy_profiler_dump_counters	(void);
+
 #endif
 
 G_END_DECLS
@@ -21,6 +21,8 @@
 #include "config.h"
 #include "ephy-filters-manager.h"
 
+#include "ephy-adblock-matcher.h"
+#include "ephy-debug.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
 #include "ephy-uri-tester-shared.h"
@@ -34,6 +36,7 @@ struct _EphyFiltersManager {
 
   char *filters_dir;
   GCancellable *cancellable;
+  guint n_retrievals_pending;
 };
 
 G_DEFINE_TYPE (EphyFiltersManager, ephy_filters_manager, G_TYPE_OBJECT)
@@ -78,8 +81,148 @@ adblock_filter_file_is_valid (GFile *file)
   return result;
 }
 
+static guint64
+get_file_modification_time (GFile *file)
+{
+  GFileInfo *file_info;
+  guint64 mod_time = 0;
+
+  file_info = g_file_query_info (file,
+                                 G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                 G_FILE_QUERY_INFO_NONE,
+                                 NULL,
+                                 NULL);
+  if (file_info) {
+    mod_time = g_file_info_get_attribute_uint64 (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    g_object_unref (file_info);
+  }
+
+  return mod_time;
+}
+
+static gboolean
+adblock_snapshot_is_current (EphyFiltersManager *manager,
+                             char              **filters)
+{
+  EphyAdblockMatcher *matcher;
+  GFile *snapshot_file;
+  char *snapshot_path;
+  guint64 snapshot_time;
+  gboolean result = TRUE;
+
+  snapshot_path = ephy_uri_tester_get_adblock_snapshot_path (manager->filters_dir);
+  matcher = ephy_adblock_matcher_new_from_file (snapshot_path, (const char * const *)filters, NULL);
+  if (!matcher) {
+    g_free (snapshot_path);
+    return FALSE;
+  }
+  ephy_adblock_matcher_free (matcher);
+
+  snapshot_file = g_file_new_for_path (snapshot_path);
+  snapshot_time = get_file_modification_time (snapshot_file);
+  g_object_unref (snapshot_file);
+  g_free (snapshot_path);
+
+  /* Filters retrieved after the snapshot was compiled make it outdated. */
+  for (guint i = 0; result && filters[i]; i++) {
+    GFile *filter_file;
+
+    filter_file = ephy_uri_tester_get_adblock_filter_file (manager->filters_dir, filters[i]);
+    result = get_file_modification_time (filter_file) <= snapshot_time;
+    g_object_unref (filter_file);
+  }
+
+  return result;
+}
+
+static void
+compile_adblock_filters_thread (GTask              *task,
+                                EphyFiltersManager *manager,
+                                char              **filters,
+                                GCancellable       *cancellable)
+{
+  EphyAdblockMatcher *matcher;
+  char *snapshot_path;
+  GError *error = NULL;
+
+  matcher = ephy_adblock_matcher_new ();
+
+  for (guint i = 0; filters[i]; i++) {
+    GFile *filter_file;
+    char *contents;
+    char **lines;
+
+    if (g_task_return_error_if_cancelled (task)) {
+      ephy_adblock_matcher_free (matcher);
+      return;
+    }
+
+    filter_file = ephy_uri_tester_get_adblock_filter_file (manager->filters_dir, filters[i]);
+    if (!g_file_load_contents (filter_file, cancellable, &contents, NULL, NULL, &error)) {
+      g_object_unref (filter_file);
+      ephy_adblock_matcher_free (matcher);
+      g_task_return_error (task, error);
+      return;
+    }
+    g_object_unref (filter_file);
+
+    lines = g_strsplit (contents, "\n", -1);
+    for (guint j = 0; lines[j]; j++)
+      ephy_adblock_matcher_add_filter (matcher, g_strchomp (lines[j]));
+    g_strfreev (lines);
+    g_free (contents);
+  }
+
+  LOG ("Compiled %u adblock rules", ephy_adblock_matcher_get_n_rules (matcher));
+
+  snapshot_path = ephy_uri_tester_get_adblock_snapshot_path (manager->filters_dir);
+  if (ephy_adblock_matcher_save (matcher, (const char * const *)filters, snapshot_path, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  g_free (snapshot_path);
+  ephy_adblock_matcher_free (matcher);
+}
+
+static void
+compile_adblock_filters_cb (EphyFiltersManager *manager,
+                            GAsyncResult       *result,
+                            gpointer            user_data)
+{
+  GError *error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to compile adblock filters: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+/* Compiles the current filters into a snapshot that web processes can map
+ * instead of parsing the filter files themselves. */
+static void
+compile_adblock_filters (EphyFiltersManager *manager)
+{
+  GTask *task;
+  char **filters;
+
+  filters = g_settings_get_strv (EPHY_SETTINGS_MAIN, EPHY_PREFS_ADBLOCK_FILTERS);
+  if (adblock_snapshot_is_current (manager, filters)) {
+    g_strfreev (filters);
+    return;
+  }
+
+  task = g_task_new (manager, manager->cancellable,
+                     (GAsyncReadyCallback)compile_adblock_filters_cb, NULL);
+  g_task_set_task_data (task, filters, (GDestroyNotify)g_strfreev);
+  g_task_run_in_thread (task, (GTaskThreadFunc)compile_adblock_filters_thread);
+  g_object_unref (task);
+}
+
 typedef struct {
   EphyFiltersManager *manager;
+  GCancellable *cancellable;
 
   char *src_uri;
   GFile *filter_file;
@@ -96,6 +239,7 @@ adblock_filter_retrieve_data_new (EphyFiltersManager *manager,
 
   data = g_slice_new (AdblockFilterRetrieveData);
   data->manager = g_object_ref (manager);
+  data->cancellable = g_object_ref (manager->cancellable);
   data->src_uri = g_file_get_uri (src_file);
   data->filter_file = g_object_ref (filter_file);
 
@@ -112,6 +256,7 @@ static void
 adblock_filter_retrieve_data_free (AdblockFilterRetrieveData *data)
 {
   g_object_unref (data->manager);
+  g_object_unref (data->cancellable);
   g_object_unref (data->filter_file);
   g_object_unref (data->tmp_file);
 
@@ -141,6 +286,11 @@ retrieve_filter_file_finished (GFile                     *src,
     g_error_free (error);
   }
 
+  /* Retrievals started for a previous set of filters no longer count. */
+  if (data->cancellable == data->manager->cancellable &&
+      --data->manager->n_retrievals_pending == 0)
+    compile_adblock_filters (data->manager);
+
   adblock_filter_retrieve_data_free (data);
 }
 
@@ -154,6 +304,7 @@ retrieve_filter_file (EphyFiltersManager *manager,
 
   data = adblock_filter_retrieve_data_new (manager, src, file);
 
+  manager->n_retrievals_pending++;
   g_file_copy_async (src, data->tmp_file,
                      G_FILE_COPY_OVERWRITE,
                      G_PRIORITY_DEFAULT,
@@ -230,6 +381,7 @@ static void
 update_adblock_filter_files (EphyFiltersManager *manager)
 {
   char **filters;
+  char *snapshot_path;
   GList *files = NULL;
 
   if (!g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_ENABLE_ADBLOCK))
@@ -239,6 +391,7 @@ update_adblock_filter_files (EphyFiltersManager *manager)
   g_cancellable_cancel (manager->cancellable);
   g_object_unref (manager->cancellable);
   manager->cancellable = g_cancellable_new ();
+  manager->n_retrievals_pending = 0;
 
   filters = g_settings_get_strv (EPHY_SETTINGS_MAIN, EPHY_PREFS_ADBLOCK_FILTERS);
   for (guint i = 0; filters[i]; i++) {
@@ -250,8 +403,15 @@ update_adblock_filter_files (EphyFiltersManager *manager)
     files = g_list_prepend (files, filter_file);
   }
 
+  snapshot_path = ephy_uri_tester_get_adblock_snapshot_path (manager->filters_dir);
+  files = g_list_prepend (files, g_file_new_for_path (snapshot_path));
+  g_free (snapshot_path);
+
   remove_old_adblock_filters (manager, files);
 
+  if (manager->n_retrievals_pending == 0)
+    compile_adblock_filters (manager);
+
   g_strfreev (filters);
   g_list_free_full (files, g_object_unref);
 }
@@ -136,6 +136,8 @@ static const char * const ephy_prefs_web_schema[] = {
 #define EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS     "restore-session-delaying-loads"
 #define EPHY_PREFS_PROCESS_MODEL                      "process-model"
 #define EPHY_PREFS_MAX_PROCESSES                      "max-processes"
+#define EPHY_PREFS_TAB_HIBERNATION_TIMEOUT            "tab-hibernation-timeout"
+#define EPHY_PREFS_TAB_HIBERNATION_MEMORY_BUDGET      "tab-hibernation-memory-budget"
 #define EPHY_PREFS_SYNC_USER                          "sync-user"
 #define EPHY_PREFS_SYNC_TIME                          "sync-time"
 #define EPHY_PREFS_ADBLOCK_FILTERS                    "adblock-filters"
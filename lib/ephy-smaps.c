@@ -25,6 +25,7 @@
 #include <gio/gio.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 struct _EphySMaps {
   GObject parent_instance;
@@ -454,6 +455,82 @@ char *ephy_smaps_to_html (EphySMaps *smaps)
   return g_string_free (str, FALSE);
 }
 
+static gsize get_resident_size (pid_t pid)
+{
+  char *path;
+  char *data;
+  char *p;
+  char *end_ptr = NULL;
+  guint64 pages;
+
+  path = g_strdup_printf ("/proc/%u/statm", pid);
+  if (!g_file_get_contents (path, &data, NULL, NULL)) {
+    g_free (path);
+
+    return 0;
+  }
+  g_free (path);
+
+  /* The second field is the resident set, in pages. */
+  p = strchr (data, ' ');
+  if (!p) {
+    g_free (data);
+
+    return 0;
+  }
+
+  errno = 0;
+  pages = g_ascii_strtoull (p + 1, &end_ptr, 10);
+  if (errno || end_ptr == p + 1) {
+    g_free (data);
+
+    return 0;
+  }
+  g_free (data);
+
+  return pages * sysconf (_SC_PAGESIZE);
+}
+
+/**
+ * ephy_smaps_get_resident_size:
+ *
+ * Adds up the resident memory of this process and of its web and plugin
+ * processes. This reads a few files for each running process, so avoid
+ * calling it from the main thread.
+ *
+ * Returns: the resident size in bytes
+ */
+gsize ephy_smaps_get_resident_size (void)
+{
+  GDir *proc;
+  const char *name;
+  pid_t parent_pid = getpid ();
+  gsize size;
+
+  size = get_resident_size (parent_pid);
+
+  proc = g_dir_open ("/proc/", 0, NULL);
+  if (!proc)
+    return size;
+
+  while ((name = g_dir_read_name (proc))) {
+    pid_t pid;
+
+    pid = get_pid_from_proc_name (name);
+    if (pid == 0 || pid == parent_pid)
+      continue;
+
+    if (get_parent_pid (pid) != parent_pid)
+      continue;
+
+    if (get_ephy_process (pid) != EPHY_PROCESS_OTHER)
+      size += get_resident_size (pid);
+  }
+  g_dir_close (proc);
+
+  return size;
+}
+
 static void
 ephy_smaps_init (EphySMaps *smaps)
 {
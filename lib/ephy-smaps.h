@@ -31,4 +31,6 @@ G_DECLARE_FINAL_TYPE (EphySMaps, ephy_smaps, EPHY, SMAPS, GObject)
 EphySMaps * ephy_smaps_new      (void);
 char      * ephy_smaps_to_html  (EphySMaps *smaps);
 
+gsize       ephy_smaps_get_resident_size (void);
+
 G_END_DECLS
@@ -21,20 +21,37 @@
 #include "config.h"
 #include "ephy-sqlite-connection.h"
 
+#include "ephy-debug.h"
+
 #include <sqlite3.h>
 
+/* Maximum number of distinct idle statements kept prepared. */
+#define STATEMENT_CACHE_SIZE 64
+
 struct _EphySQLiteConnection {
   GObject parent_instance;
   sqlite3 *database;
+
+  /* SQL text -> idle sqlite3_stmt, owned by the cache. */
+  GHashTable *statement_cache;
+  guint64 statements_prepared;
+  guint64 statements_reused;
 };
 
 G_DEFINE_TYPE (EphySQLiteConnection, ephy_sqlite_connection, G_TYPE_OBJECT);
 
 static void
-ephy_sqlite_connection_finalize (GObject *self)
+ephy_sqlite_connection_finalize (GObject *object)
 {
-  ephy_sqlite_connection_close (EPHY_SQLITE_CONNECTION (self));
-  G_OBJECT_CLASS (ephy_sqlite_connection_parent_class)->finalize (self);
+  EphySQLiteConnection *self = EPHY_SQLITE_CONNECTION (object);
+
+  ephy_sqlite_connection_close (self);
+  g_hash_table_destroy (self->statement_cache);
+
+  UNREGISTER_PROFILER_COUNTER (&self->statements_prepared);
+  UNREGISTER_PROFILER_COUNTER (&self->statements_reused);
+
+  G_OBJECT_CLASS (ephy_sqlite_connection_parent_class)->finalize (object);
 }
 
 static void
@@ -48,6 +65,12 @@ static void
 ephy_sqlite_connection_init (EphySQLiteConnection *self)
 {
   self->database = NULL;
+  self->statement_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 (GDestroyNotify)g_free,
+                                                 (GDestroyNotify)sqlite3_finalize);
+
+  REGISTER_PROFILER_COUNTER ("sqlite statements prepared", &self->statements_prepared);
+  REGISTER_PROFILER_COUNTER ("sqlite statement prepares avoided", &self->statements_reused);
 }
 
 static GQuark get_ephy_sqlite_quark (void)
@@ -89,6 +112,8 @@ void
 ephy_sqlite_connection_close (EphySQLiteConnection *self)
 {
   if (self->database) {
+    /* Cached statements would keep the database from being closed. */
+    g_hash_table_remove_all (self->statement_cache);
     sqlite3_close (self->database);
     self->database = NULL;
   }
@@ -109,7 +134,12 @@ ephy_sqlite_connection_execute (EphySQLiteConnection *self, const char *sql, GEr
     return FALSE;
   }
 
-  return sqlite3_exec (self->database, sql, NULL, NULL, NULL) == SQLITE_OK;
+  if (sqlite3_exec (self->database, sql, NULL, NULL, NULL) != SQLITE_OK) {
+    ephy_sqlite_connection_get_error (self, error);
+    return FALSE;
+  }
+
+  return TRUE;
 }
 
 EphySQLiteStatement *
@@ -133,6 +163,71 @@ ephy_sqlite_connection_create_statement (EphySQLiteConnection *self, const char
                                               NULL));
 }
 
+/**
+ * ephy_sqlite_connection_borrow_statement:
+ * @self: an #EphySQLiteConnection
+ * @sql: the SQL text of the statement
+ * @error: return location for a #GError, or %NULL
+ *
+ * Like ephy_sqlite_connection_create_statement(), but reuses a statement
+ * previously prepared for the same @sql on this connection when there is an
+ * idle one. Unreffing the returned statement resets it, clears its bindings
+ * and returns it to the connection. Use it for SQL that is run repeatedly;
+ * statements built on the fly are better created.
+ *
+ * Returns: (transfer full): an #EphySQLiteStatement, or %NULL on error
+ **/
+EphySQLiteStatement *
+ephy_sqlite_connection_borrow_statement (EphySQLiteConnection *self, const char *sql, GError **error)
+{
+  sqlite3_stmt *prepared_statement = NULL;
+  char *cached_sql;
+
+  if (self->database == NULL) {
+    set_error_from_string ("Connection not open.", error);
+    return NULL;
+  }
+
+  /* Steal the statement from the cache, so that nested borrows of the same
+   * SQL get a statement of their own. */
+  if (g_hash_table_lookup_extended (self->statement_cache, sql,
+                                    (gpointer *)&cached_sql, (gpointer *)&prepared_statement)) {
+    g_hash_table_steal (self->statement_cache, sql);
+    g_free (cached_sql);
+    self->statements_reused++;
+  } else {
+    if (sqlite3_prepare_v2 (self->database, sql, -1, &prepared_statement, NULL) != SQLITE_OK) {
+      ephy_sqlite_connection_get_error (self, error);
+      return NULL;
+    }
+    self->statements_prepared++;
+  }
+
+  return EPHY_SQLITE_STATEMENT (g_object_new (EPHY_TYPE_SQLITE_STATEMENT,
+                                              "prepared-statement", prepared_statement,
+                                              "connection", self,
+                                              "borrowed", TRUE,
+                                              NULL));
+}
+
+/* Called by EphySQLiteStatement when a borrowed statement is released. */
+void
+ephy_sqlite_connection_return_prepared_statement (EphySQLiteConnection *self, gpointer prepared_statement)
+{
+  const char *sql = sqlite3_sql (prepared_statement);
+
+  if (self->database == NULL ||
+      g_hash_table_size (self->statement_cache) >= STATEMENT_CACHE_SIZE ||
+      g_hash_table_contains (self->statement_cache, sql)) {
+    sqlite3_finalize (prepared_statement);
+    return;
+  }
+
+  sqlite3_reset (prepared_statement);
+  sqlite3_clear_bindings (prepared_statement);
+  g_hash_table_insert (self->statement_cache, g_strdup (sql), prepared_statement);
+}
+
 gint64
 ephy_sqlite_connection_get_last_insert_id (EphySQLiteConnection *self)
 {
@@ -163,7 +258,7 @@ ephy_sqlite_connection_table_exists (EphySQLiteConnection *self, const char *tab
   GError *error = NULL;
   gboolean table_exists = FALSE;
 
-  EphySQLiteStatement *statement = ephy_sqlite_connection_create_statement (self,
+  EphySQLiteStatement *statement = ephy_sqlite_connection_borrow_statement (self,
                                                                             "SELECT COUNT(type) FROM sqlite_master WHERE type='table' and name=?", &error);
   if (error) {
     g_warning ("Could not detect table existence: %s", error->message);
@@ -38,6 +38,8 @@ void                    ephy_sqlite_connection_get_error               (EphySQLi
 
 gboolean                ephy_sqlite_connection_execute                 (EphySQLiteConnection *self, const char *sql, GError **error);
 EphySQLiteStatement *   ephy_sqlite_connection_create_statement        (EphySQLiteConnection *self, const char *sql, GError **error);
+EphySQLiteStatement *   ephy_sqlite_connection_borrow_statement        (EphySQLiteConnection *self, const char *sql, GError **error);
+void                    ephy_sqlite_connection_return_prepared_statement (EphySQLiteConnection *self, gpointer prepared_statement);
 gint64                  ephy_sqlite_connection_get_last_insert_id      (EphySQLiteConnection *self);
 
 gboolean                ephy_sqlite_connection_begin_transaction       (EphySQLiteConnection *self, GError **error);
@@ -28,6 +28,7 @@ enum {
   PROP_0,
   PROP_PREPARED_STATEMENT,
   PROP_CONNECTION,
+  PROP_BORROWED,
   LAST_PROP
 };
 
@@ -37,6 +38,7 @@ struct _EphySQLiteStatement {
   GObject parent_instance;
   sqlite3_stmt *prepared_statement;
   EphySQLiteConnection *connection;
+  gboolean borrowed;
 };
 
 G_DEFINE_TYPE (EphySQLiteStatement, ephy_sqlite_statement, G_TYPE_OBJECT);
@@ -53,6 +55,9 @@ ephy_sqlite_statement_set_property (GObject *object, guint property_id, const GV
     case PROP_CONNECTION:
       self->connection = EPHY_SQLITE_CONNECTION (g_object_ref (g_value_get_object (value)));
       break;
+    case PROP_BORROWED:
+      self->borrowed = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (self, property_id, pspec);
       break;
@@ -65,7 +70,10 @@ ephy_sqlite_statement_finalize (GObject *object)
   EphySQLiteStatement *self = EPHY_SQLITE_STATEMENT (object);
 
   if (self->prepared_statement) {
-    sqlite3_finalize (self->prepared_statement);
+    if (self->borrowed)
+      ephy_sqlite_connection_return_prepared_statement (self->connection, self->prepared_statement);
+    else
+      sqlite3_finalize (self->prepared_statement);
     self->prepared_statement = NULL;
   }
 
@@ -97,6 +105,13 @@ ephy_sqlite_statement_class_init (EphySQLiteStatementClass *klass)
                          EPHY_TYPE_SQLITE_CONNECTION,
                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS);
 
+  obj_properties[PROP_BORROWED] =
+    g_param_spec_boolean ("borrowed",
+                          "Borrowed",
+                          "Whether the prepared statement goes back to the connection's cache when released",
+                          FALSE,
+                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (gobject_class, LAST_PROP, obj_properties);
 }
 
@@ -105,6 +120,7 @@ ephy_sqlite_statement_init (EphySQLiteStatement *self)
 {
   self->prepared_statement = NULL;
   self->connection = NULL;
+  self->borrowed = FALSE;
 }
 
 gboolean
@@ -278,3 +294,27 @@ ephy_sqlite_create_match_pattern (const char *match_string)
 
   return pattern;
 }
+
+/* Builds an FTS5 query matching the tokens of @match_string, the last one
+ * as a prefix, e.g. "gnome.or" matches the tokens "gnome" followed by "org".
+ * Returns %NULL if @match_string contains no token to look for. */
+char *
+ephy_sqlite_create_fts_prefix_query (const char *match_string)
+{
+  GString *query;
+  gboolean has_token = FALSE;
+
+  query = g_string_new ("\"");
+  for (const char *p = match_string; *p; p++) {
+    /* Non-ASCII characters are token characters for the unicode61 tokenizer. */
+    if (g_ascii_isalnum (*p) || (guchar)*p >= 0x80)
+      has_token = TRUE;
+
+    if (*p == '"')
+      g_string_append_c (query, '"');
+    g_string_append_c (query, *p);
+  }
+  g_string_append (query, "\"*");
+
+  return g_string_free (query, !has_token);
+}
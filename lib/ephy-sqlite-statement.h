@@ -51,5 +51,6 @@ const char*              ephy_sqlite_statement_get_column_as_string  (EphySQLite
 const void*              ephy_sqlite_statement_get_column_as_blob    (EphySQLiteStatement *statement, int column);
 
 char*                    ephy_sqlite_create_match_pattern (const char *match_string);
+char*                    ephy_sqlite_create_fts_prefix_query (const char *match_string);
 
 G_END_DECLS
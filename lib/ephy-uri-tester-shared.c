@@ -21,6 +21,8 @@
 #include "config.h"
 #include "ephy-uri-tester-shared.h"
 
+#define ADBLOCK_SNAPSHOT_FILENAME "adblock-filters.gvdb"
+
 GFile *
 ephy_uri_tester_get_adblock_filter_file (const char *adblock_data_dir,
                                          const char *filter_url)
@@ -36,3 +38,9 @@ ephy_uri_tester_get_adblock_filter_file (const char *adblock_data_dir,
 
   return filter_file;
 }
+
+char *
+ephy_uri_tester_get_adblock_snapshot_path (const char *adblock_data_dir)
+{
+  return g_build_filename (adblock_data_dir, ADBLOCK_SNAPSHOT_FILENAME, NULL);
+}
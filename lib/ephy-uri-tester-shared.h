@@ -27,7 +27,8 @@ G_BEGIN_DECLS
 #define ADBLOCK_DEFAULT_FILTER_URL "https://easylist.to/easylist/easylist.txt"
 #define ADBLOCK_PRIVACY_FILTER_URL "https://easylist.to/easylist/easyprivacy.txt"
 
-GFile *ephy_uri_tester_get_adblock_filter_file (const char *adblock_data_dir,
-                                                const char *filter_url);
+GFile *ephy_uri_tester_get_adblock_filter_file    (const char *adblock_data_dir,
+                                                   const char *filter_url);
+char  *ephy_uri_tester_get_adblock_snapshot_path  (const char *adblock_data_dir);
 
 G_END_DECLS
@@ -50,6 +50,92 @@ ephy_history_service_initialize_hosts_table (EphyHistoryService *self)
   return TRUE;
 }
 
+/* Publishes the zoom level of @host to other threads. */
+static void
+set_zoom_level (EphyHistoryService *self,
+                const char         *host_url,
+                double              zoom_level)
+{
+  double *value = g_new (double, 1);
+
+  *value = zoom_level;
+
+  g_rw_lock_writer_lock (&self->zoom_levels_lock);
+  g_hash_table_replace (self->zoom_levels, g_strdup (host_url), value);
+  g_rw_lock_writer_unlock (&self->zoom_levels_lock);
+}
+
+static void
+cache_host (EphyHistoryService *self,
+            EphyHistoryHost    *host)
+{
+  EphyHistoryHost *cached;
+
+  if (!self->hosts_cached || host->id == -1 || host->url == NULL)
+    return;
+
+  cached = g_hash_table_lookup (self->hosts_by_id, GINT_TO_POINTER (host->id));
+  if (cached)
+    g_hash_table_remove (self->hosts_by_url, cached->url);
+
+  cached = ephy_history_host_copy (host);
+  g_hash_table_replace (self->hosts_by_id, GINT_TO_POINTER (cached->id), cached);
+  g_hash_table_replace (self->hosts_by_url, cached->url, cached);
+
+  set_zoom_level (self, cached->url, cached->zoom_level);
+}
+
+/**
+ * ephy_history_service_load_host_cache:
+ * @self: an #EphyHistoryService
+ *
+ * Reads every host row, so that looking hosts up on visits and zoom changes
+ * does not need the database, and publishes their zoom levels for
+ * ephy_history_service_get_cached_zoom_level(). Every change to the hosts
+ * table must then go through the functions in this file, or reload the
+ * cache. Read-only services keep querying the database, because another
+ * instance writes to it.
+ */
+void
+ephy_history_service_load_host_cache (EphyHistoryService *self)
+{
+  GList *hosts;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  ephy_history_service_clear_host_cache (self);
+
+  if (self->read_only)
+    return;
+
+  hosts = ephy_history_service_get_all_hosts (self);
+
+  self->hosts_cached = TRUE;
+  for (GList *l = hosts; l; l = l->next)
+    cache_host (self, l->data);
+
+  g_rw_lock_writer_lock (&self->zoom_levels_lock);
+  self->zoom_levels_loaded = TRUE;
+  g_rw_lock_writer_unlock (&self->zoom_levels_lock);
+
+  g_list_free_full (hosts, (GDestroyNotify)ephy_history_host_free);
+}
+
+void
+ephy_history_service_clear_host_cache (EphyHistoryService *self)
+{
+  g_assert (self->history_thread == g_thread_self ());
+
+  self->hosts_cached = FALSE;
+  g_hash_table_remove_all (self->hosts_by_url);
+  g_hash_table_remove_all (self->hosts_by_id);
+
+  g_rw_lock_writer_lock (&self->zoom_levels_lock);
+  g_hash_table_remove_all (self->zoom_levels);
+  self->zoom_levels_loaded = FALSE;
+  g_rw_lock_writer_unlock (&self->zoom_levels_lock);
+}
+
 void
 ephy_history_service_add_host_row (EphyHistoryService *self, EphyHistoryHost *host)
 {
@@ -59,7 +145,7 @@ ephy_history_service_add_host_row (EphyHistoryService *self, EphyHistoryHost *ho
   g_assert (self->history_thread == g_thread_self ());
   g_assert (self->history_database != NULL);
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_borrow_statement (self->history_database,
                                                        "INSERT INTO hosts (url, title, visit_count, zoom_level) "
                                                        "VALUES (?, ?, ?, ?)", &error);
 
@@ -85,6 +171,7 @@ ephy_history_service_add_host_row (EphyHistoryService *self, EphyHistoryHost *ho
     g_error_free (error);
   } else {
     host->id = ephy_sqlite_connection_get_last_insert_id (self->history_database);
+    cache_host (self, host);
   }
 
   g_object_unref (statement);
@@ -99,7 +186,7 @@ ephy_history_service_update_host_row (EphyHistoryService *self, EphyHistoryHost
   g_assert (self->history_thread == g_thread_self ());
   g_assert (self->history_database != NULL);
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_borrow_statement (self->history_database,
                                                        "UPDATE hosts SET url=?, title=?, visit_count=?, zoom_level=?"
                                                        "WHERE id=?", &error);
   if (error) {
@@ -123,6 +210,8 @@ ephy_history_service_update_host_row (EphyHistoryService *self, EphyHistoryHost
   if (error) {
     g_warning ("Could not modify URL in urls table: %s", error->message);
     g_error_free (error);
+  } else {
+    cache_host (self, host);
   }
   g_object_unref (statement);
 }
@@ -142,11 +231,11 @@ ephy_history_service_get_host_row (EphyHistoryService *self, const gchar *host_s
   g_assert (host_string || host->id != -1);
 
   if (host != NULL && host->id != -1) {
-    statement = ephy_sqlite_connection_create_statement (self->history_database,
+    statement = ephy_sqlite_connection_borrow_statement (self->history_database,
                                                          "SELECT id, url, title, visit_count, zoom_level FROM hosts "
                                                          "WHERE id=?", &error);
   } else {
-    statement = ephy_sqlite_connection_create_statement (self->history_database,
+    statement = ephy_sqlite_connection_borrow_statement (self->history_database,
                                                          "SELECT id, url, title, visit_count, zoom_level FROM hosts "
                                                          "WHERE url=?", &error);
   }
@@ -211,14 +300,14 @@ create_host_from_statement (EphySQLiteStatement *statement)
 GList *
 ephy_history_service_get_all_hosts (EphyHistoryService *self)
 {
+  EphySQLiteConnection *connection = ephy_history_service_get_connection (self);
   EphySQLiteStatement *statement = NULL;
   GList *hosts = NULL;
   GError *error = NULL;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database != NULL);
+  g_assert (connection != NULL);
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_create_statement (connection,
                                                        "SELECT id, url, title, visit_count, zoom_level FROM hosts", &error);
 
   if (error) {
@@ -241,9 +330,10 @@ ephy_history_service_get_all_hosts (EphyHistoryService *self)
   return hosts;
 }
 
-GList *
-ephy_history_service_find_host_rows (EphyHistoryService *self, EphyHistoryQuery *query)
+static GList *
+find_host_rows (EphyHistoryService *self, EphyHistoryQuery *query, gboolean use_fts)
 {
+  EphySQLiteConnection *connection = ephy_history_service_get_connection (self);
   EphySQLiteStatement *statement = NULL;
   GList *substring;
   GString *statement_str;
@@ -261,13 +351,12 @@ ephy_history_service_find_host_rows (EphyHistoryService *self, EphyHistoryQuery
 
   int i = 0;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database != NULL);
+  g_assert (connection != NULL);
 
   statement_str = g_string_new (base_statement);
 
   /* In either of these cases we need to at least join with the urls table. */
-  if (query->substring_list || query->from > 0 || query->to > 0)
+  if ((query->substring_list && !use_fts) || query->from > 0 || query->to > 0)
     statement_str = g_string_append (statement_str, "JOIN urls on hosts.id = urls.host ");
 
   /* In these cases, we additionally need to join with the visits table. */
@@ -281,13 +370,19 @@ ephy_history_service_find_host_rows (EphyHistoryService *self, EphyHistoryQuery
     statement_str = g_string_append (statement_str, "WHERE ");
   }
 
-  for (substring = query->substring_list; substring != NULL; substring = substring->next)
-    statement_str = g_string_append (statement_str, "(hosts.url LIKE ? OR hosts.title LIKE ? OR "
-                                     "urls.url LIKE ? OR urls.title LIKE ?) AND ");
+  for (substring = query->substring_list; substring != NULL; substring = substring->next) {
+    if (use_fts)
+      statement_str = g_string_append (statement_str, "(hosts.url LIKE ? OR hosts.title LIKE ? OR "
+                                       "hosts.id IN (SELECT urls.host FROM urls_fts JOIN urls ON urls.id = urls_fts.rowid "
+                                       "WHERE urls_fts MATCH ?)) AND ");
+    else
+      statement_str = g_string_append (statement_str, "(hosts.url LIKE ? OR hosts.title LIKE ? OR "
+                                       "urls.url LIKE ? OR urls.title LIKE ?) AND ");
+  }
 
   statement_str = g_string_append (statement_str, "1 ");
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_create_statement (connection,
                                                        statement_str->str, &error);
   g_string_free (statement_str, TRUE);
 
@@ -315,6 +410,25 @@ ephy_history_service_find_host_rows (EphyHistoryService *self, EphyHistoryQuery
   for (substring = query->substring_list; substring != NULL; substring = substring->next) {
     int j = 4;
     char *string = ephy_sqlite_create_match_pattern (substring->data);
+
+    if (use_fts) {
+      char *fts_query = ephy_sqlite_create_fts_prefix_query (substring->data);
+
+      if (ephy_sqlite_statement_bind_string (statement, i++, string, &error) == FALSE ||
+          ephy_sqlite_statement_bind_string (statement, i++, string + 2, &error) == FALSE ||
+          ephy_sqlite_statement_bind_string (statement, i++, fts_query, &error) == FALSE) {
+        g_warning ("Could not build hosts table query statement: %s", error->message);
+        g_error_free (error);
+        g_object_unref (statement);
+        g_free (fts_query);
+        g_free (string);
+        return NULL;
+      }
+      g_free (fts_query);
+      g_free (string);
+      continue;
+    }
+
     while (j--)
       /* The bitwise operation ensures we only skip two characters for titles. */
       if (ephy_sqlite_statement_bind_string (statement, i++, string + 2 * ((j + 1) & 1), &error) == FALSE) {
@@ -341,9 +455,29 @@ ephy_history_service_find_host_rows (EphyHistoryService *self, EphyHistoryQuery
   return hosts;
 }
 
+GList *
+ephy_history_service_find_host_rows (EphyHistoryService *self, EphyHistoryQuery *query)
+{
+  GList *hosts = NULL;
+  gboolean use_fts = self->urls_fts_enabled && query->substring_list;
+
+  /* See ephy_history_service_find_url_rows(). */
+  for (GList *l = query->substring_list; use_fts && l; l = l->next) {
+    char *fts_query = ephy_sqlite_create_fts_prefix_query (l->data);
+
+    use_fts = fts_query != NULL;
+    g_free (fts_query);
+  }
+
+  if (use_fts)
+    hosts = find_host_rows (self, query, TRUE);
+
+  return hosts ? hosts : find_host_rows (self, query, FALSE);
+}
+
 /* Inspired from ephy-history.c */
-static GList *
-get_hostname_and_locations (const gchar *url, gchar **hostname)
+GList *
+ephy_history_service_get_host_locations (const char *url, char **hostname)
 {
   GList *host_locations = NULL;
   char *scheme = NULL;
@@ -400,10 +534,13 @@ ephy_history_service_get_host_row_from_url (EphyHistoryService *self,
   char *hostname;
   EphyHistoryHost *host = NULL;
 
-  host_locations = get_hostname_and_locations (url, &hostname);
+  host_locations = ephy_history_service_get_host_locations (url, &hostname);
 
   for (l = host_locations; l != NULL; l = l->next) {
-    host = ephy_history_service_get_host_row (self, l->data, NULL);
+    if (self->hosts_cached)
+      host = ephy_history_host_copy (g_hash_table_lookup (self->hosts_by_url, l->data));
+    else
+      host = ephy_history_service_get_host_row (self, l->data, NULL);
     if (host != NULL)
       break;
   }
@@ -437,7 +574,7 @@ ephy_history_service_delete_host_row (EphyHistoryService *self,
   else
     sql_statement = g_strdup ("DELETE FROM hosts WHERE url=?");
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_borrow_statement (self->history_database,
                                                        sql_statement, &error);
   g_free (sql_statement);
 
@@ -465,6 +602,25 @@ ephy_history_service_delete_host_row (EphyHistoryService *self,
     g_error_free (error);
   }
   g_object_unref (statement);
+
+  /* The URLs of the host were deleted along with it. */
+  if (self->hosts_cached) {
+    EphyHistoryHost *cached;
+
+    if (host->id != -1)
+      cached = g_hash_table_lookup (self->hosts_by_id, GINT_TO_POINTER (host->id));
+    else
+      cached = g_hash_table_lookup (self->hosts_by_url, host->url);
+
+    if (cached) {
+      g_rw_lock_writer_lock (&self->zoom_levels_lock);
+      g_hash_table_remove (self->zoom_levels, cached->url);
+      g_rw_lock_writer_unlock (&self->zoom_levels_lock);
+
+      g_hash_table_remove (self->hosts_by_url, cached->url);
+      g_hash_table_remove (self->hosts_by_id, GINT_TO_POINTER (cached->id));
+    }
+  }
 }
 
 void
@@ -489,4 +645,7 @@ ephy_history_service_delete_orphan_hosts (EphyHistoryService *self)
     g_warning ("Couldn't remove orphan hosts from database: %s", error->message);
     g_error_free (error);
   }
+
+  if (self->hosts_cached)
+    ephy_history_service_load_host_cache (self);
 }
@@ -30,22 +30,40 @@ struct _EphyHistoryService {
   EphySQLiteConnection *history_database;
   GThread *history_thread;
   GAsyncQueue *queue;
+  GThreadPool *reader_pool;
+  GAsyncQueue *idle_readers;
   gboolean scheduled_to_quit;
   gboolean scheduled_to_commit;
   gboolean read_only;
+  gboolean urls_fts_enabled;
   int queue_urls_visited_id;
+
+  /* Every host row, only used on the history thread. */
+  GHashTable *hosts_by_id;
+  GHashTable *hosts_by_url;
+  gboolean hosts_cached;
+
+  /* Host URLs to their zoom level, for any thread. */
+  GRWLock zoom_levels_lock;
+  GHashTable *zoom_levels;
+  gboolean zoom_levels_loaded;
 };
 
 void                     ephy_history_service_schedule_commit         (EphyHistoryService *self); 
+EphySQLiteConnection *   ephy_history_service_get_connection          (EphyHistoryService *self);
 gboolean                 ephy_history_service_initialize_urls_table   (EphyHistoryService *self);
+gboolean                 ephy_history_service_initialize_urls_fts_table (EphyHistoryService *self, GError **error);
+gboolean                 ephy_history_service_drop_urls_fts_table     (EphyHistoryService *self, GError **error);
+char *                   ephy_history_service_create_fts_query        (GList *substring_list);
 EphyHistoryURL *         ephy_history_service_get_url_row             (EphyHistoryService *self, const char *url_string, EphyHistoryURL *url);
 void                     ephy_history_service_add_url_row             (EphyHistoryService *self, EphyHistoryURL *url);
 void                     ephy_history_service_update_url_row          (EphyHistoryService *self, EphyHistoryURL *url);
 GList*                   ephy_history_service_find_url_rows           (EphyHistoryService *self, EphyHistoryQuery *query);
+guint                    ephy_history_service_count_url_rows          (EphyHistoryService *self, EphyHistoryQuery *query, EphyHistoryURLMatch *url_match);
 void                     ephy_history_service_delete_url              (EphyHistoryService *self, EphyHistoryURL *url);
 
 gboolean                 ephy_history_service_initialize_visits_table (EphyHistoryService *self);
-void                     ephy_history_service_add_visit_row           (EphyHistoryService *self, EphyHistoryPageVisit *visit);
+gboolean                 ephy_history_service_add_visit_rows          (EphyHistoryService *self, GPtrArray *visits);
 GList *                  ephy_history_service_find_visit_rows         (EphyHistoryService *self, EphyHistoryQuery *query);
 
 gboolean                 ephy_history_service_initialize_hosts_table  (EphyHistoryService *self);
@@ -55,6 +73,9 @@ EphyHistoryHost *        ephy_history_service_get_host_row            (EphyHisto
 GList *                  ephy_history_service_get_all_hosts           (EphyHistoryService *self);
 GList*                   ephy_history_service_find_host_rows          (EphyHistoryService *self, EphyHistoryQuery *query);
 EphyHistoryHost *        ephy_history_service_get_host_row_from_url   (EphyHistoryService *self, const gchar *url);
+GList *                  ephy_history_service_get_host_locations      (const char *url, char **hostname);
+void                     ephy_history_service_load_host_cache         (EphyHistoryService *self);
+void                     ephy_history_service_clear_host_cache        (EphyHistoryService *self);
 void                     ephy_history_service_delete_host_row         (EphyHistoryService *self, EphyHistoryHost *host);
 void                     ephy_history_service_delete_orphan_hosts     (EphyHistoryService *self);
 
@@ -20,9 +20,12 @@
 
 #include "config.h"
 
+#include "ephy-debug.h"
 #include "ephy-history-service.h"
 #include "ephy-history-service-private.h"
 
+#include <string.h>
+
 gboolean
 ephy_history_service_initialize_urls_table (EphyHistoryService *self)
 {
@@ -52,14 +55,105 @@ ephy_history_service_initialize_urls_table (EphyHistoryService *self)
   return TRUE;
 }
 
+gboolean
+ephy_history_service_initialize_urls_fts_table (EphyHistoryService *self,
+                                                GError            **error)
+{
+  static const char * const statements[] = {
+    /* Only the index is stored; the text is read back from urls. */
+    "CREATE VIRTUAL TABLE urls_fts USING fts5 ("
+    "url, title, content='urls', content_rowid='id', prefix='2 3')",
+    "CREATE TRIGGER urls_fts_insert AFTER INSERT ON urls BEGIN "
+    "INSERT INTO urls_fts (rowid, url, title) VALUES (new.id, new.url, new.title); "
+    "END",
+    "CREATE TRIGGER urls_fts_delete AFTER DELETE ON urls BEGIN "
+    "INSERT INTO urls_fts (urls_fts, rowid, url, title) VALUES ('delete', old.id, old.url, old.title); "
+    "END",
+    /* Visits rewrite the title every time, so check it really changed. */
+    "CREATE TRIGGER urls_fts_update AFTER UPDATE OF url, title ON urls "
+    "WHEN old.url IS NOT new.url OR old.title IS NOT new.title BEGIN "
+    "INSERT INTO urls_fts (urls_fts, rowid, url, title) VALUES ('delete', old.id, old.url, old.title); "
+    "INSERT INTO urls_fts (rowid, url, title) VALUES (new.id, new.url, new.title); "
+    "END",
+    "INSERT INTO urls_fts (urls_fts) VALUES ('rebuild')"
+  };
+  GError *local_error = NULL;
+
+  /* SQLite may be built without FTS5, in which case queries keep using LIKE. */
+  ephy_sqlite_connection_execute (self->history_database, statements[0], &local_error);
+  if (local_error) {
+    if (strstr (local_error->message, "no such module")) {
+      LOG ("Not creating the history full-text index: %s", local_error->message);
+      g_error_free (local_error);
+      return TRUE;
+    }
+
+    g_propagate_error (error, local_error);
+    return FALSE;
+  }
+
+  for (guint i = 1; i < G_N_ELEMENTS (statements); i++) {
+    if (!ephy_sqlite_connection_execute (self->history_database, statements[i], error))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Bulk imports fill the urls table first and call
+ * ephy_history_service_initialize_urls_fts_table() afterwards, which is much
+ * faster than updating the index row by row. */
+gboolean
+ephy_history_service_drop_urls_fts_table (EphyHistoryService *self,
+                                          GError            **error)
+{
+  static const char * const statements[] = {
+    "DROP TRIGGER IF EXISTS urls_fts_insert",
+    "DROP TRIGGER IF EXISTS urls_fts_delete",
+    "DROP TRIGGER IF EXISTS urls_fts_update",
+    "DROP TABLE IF EXISTS urls_fts"
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS (statements); i++) {
+    if (!ephy_sqlite_connection_execute (self->history_database, statements[i], error))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Returns an FTS5 query matching URLs where every substring starts a token
+ * of the address or the title, or %NULL if some substring has no tokens. */
+char *
+ephy_history_service_create_fts_query (GList *substring_list)
+{
+  GString *query = g_string_new (NULL);
+
+  for (GList *l = substring_list; l; l = l->next) {
+    char *prefix_query = ephy_sqlite_create_fts_prefix_query (l->data);
+
+    if (!prefix_query) {
+      g_string_free (query, TRUE);
+      return NULL;
+    }
+
+    if (query->len > 0)
+      g_string_append_c (query, ' ');
+    g_string_append (query, prefix_query);
+    g_free (prefix_query);
+  }
+
+  return g_string_free (query, FALSE);
+}
+
 EphyHistoryURL *
 ephy_history_service_get_url_row (EphyHistoryService *self, const char *url_string, EphyHistoryURL *url)
 {
+  EphySQLiteConnection *connection = ephy_history_service_get_connection (self);
   EphySQLiteStatement *statement = NULL;
   GError *error = NULL;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database != NULL);
+  g_assert (connection != NULL);
 
   if (url_string == NULL && url != NULL)
     url_string = url->url;
@@ -67,11 +161,11 @@ ephy_history_service_get_url_row (EphyHistoryService *self, const char *url_stri
   g_return_val_if_fail (url_string || url->id != -1, NULL);
 
   if (url != NULL && url->id != -1) {
-    statement = ephy_sqlite_connection_create_statement (self->history_database,
+    statement = ephy_sqlite_connection_borrow_statement (connection,
                                                          "SELECT id, url, title, visit_count, typed_count, last_visit_time, hidden_from_overview, thumbnail_update_time FROM urls "
                                                          "WHERE id=?", &error);
   } else {
-    statement = ephy_sqlite_connection_create_statement (self->history_database,
+    statement = ephy_sqlite_connection_borrow_statement (connection,
                                                          "SELECT id, url, title, visit_count, typed_count, last_visit_time, hidden_from_overview, thumbnail_update_time FROM urls "
                                                          "WHERE url=?", &error);
   }
@@ -131,7 +225,7 @@ ephy_history_service_add_url_row (EphyHistoryService *self, EphyHistoryURL *url)
   g_assert (self->history_thread == g_thread_self ());
   g_assert (self->history_database != NULL);
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_borrow_statement (self->history_database,
                                                        "INSERT INTO urls (url, title, visit_count, typed_count, last_visit_time, host) "
                                                        " VALUES (?, ?, ?, ?, ?, ?)", &error);
   if (error) {
@@ -172,7 +266,7 @@ ephy_history_service_update_url_row (EphyHistoryService *self, EphyHistoryURL *u
   g_assert (self->history_thread == g_thread_self ());
   g_assert (self->history_database != NULL);
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_borrow_statement (self->history_database,
                                                        "UPDATE urls SET title=?, visit_count=?, typed_count=?, last_visit_time=?, hidden_from_overview=?, thumbnail_update_time=? "
                                                        "WHERE id=?", &error);
   if (error) {
@@ -220,11 +314,170 @@ create_url_from_statement (EphySQLiteStatement *statement)
   return url;
 }
 
-GList *
-ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *query)
+/* What each sort type orders rows by. Rows with the same key are ordered by
+ * id, so that every row has a well defined position and a query can be read
+ * page by page, each page starting right after the last row of the previous
+ * one. */
+typedef struct {
+  const char *column;
+  const char *value;
+  gboolean descending;
+} SortKey;
+
+static const SortKey *
+get_sort_key (EphyHistorySortType sort_type)
 {
-  EphySQLiteStatement *statement = NULL;
+  static const SortKey visit_count = { "urls.visit_count", "?", FALSE };
+  static const SortKey visit_count_desc = { "urls.visit_count", "?", TRUE };
+  static const SortKey last_visit_time = { "urls.last_visit_time", "?", FALSE };
+  static const SortKey last_visit_time_desc = { "urls.last_visit_time", "?", TRUE };
+  static const SortKey title = { "IFNULL(LOWER(urls.title), '')", "IFNULL(LOWER(?), '')", FALSE };
+  static const SortKey title_desc = { "IFNULL(LOWER(urls.title), '')", "IFNULL(LOWER(?), '')", TRUE };
+  static const SortKey url = { "LOWER(urls.url)", "LOWER(?)", FALSE };
+  static const SortKey url_desc = { "LOWER(urls.url)", "LOWER(?)", TRUE };
+
+  switch (sort_type) {
+    case EPHY_HISTORY_SORT_MOST_VISITED:
+      return &visit_count_desc;
+    case EPHY_HISTORY_SORT_LEAST_VISITED:
+      return &visit_count;
+    case EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED:
+      return &last_visit_time_desc;
+    case EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED:
+      return &last_visit_time;
+    case EPHY_HISTORY_SORT_TITLE_ASCENDING:
+      return &title;
+    case EPHY_HISTORY_SORT_TITLE_DESCENDING:
+      return &title_desc;
+    case EPHY_HISTORY_SORT_URL_ASCENDING:
+      return &url;
+    case EPHY_HISTORY_SORT_URL_DESCENDING:
+      return &url_desc;
+    case EPHY_HISTORY_SORT_NONE:
+    default:
+      return NULL;
+  }
+}
+
+static gboolean
+bind_sort_key_value (EphySQLiteStatement *statement,
+                     int                  column,
+                     EphyHistorySortType  sort_type,
+                     EphyHistoryURL      *url,
+                     GError             **error)
+{
+  switch (sort_type) {
+    case EPHY_HISTORY_SORT_MOST_VISITED:
+    case EPHY_HISTORY_SORT_LEAST_VISITED:
+      return ephy_sqlite_statement_bind_int (statement, column, url->visit_count, error);
+    case EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED:
+    case EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED:
+      return ephy_sqlite_statement_bind_int64 (statement, column, url->last_visit_time, error);
+    case EPHY_HISTORY_SORT_TITLE_ASCENDING:
+    case EPHY_HISTORY_SORT_TITLE_DESCENDING:
+      return ephy_sqlite_statement_bind_string (statement, column, url->title, error);
+    case EPHY_HISTORY_SORT_URL_ASCENDING:
+    case EPHY_HISTORY_SORT_URL_DESCENDING:
+    case EPHY_HISTORY_SORT_NONE:
+    default:
+      return ephy_sqlite_statement_bind_string (statement, column, url->url, error);
+  }
+}
+
+/* Appends the joins and the WHERE clause selecting the rows of @query. */
+static void
+append_url_rows_conditions (GString          *statement_str,
+                            EphyHistoryQuery *query,
+                            const char       *fts_query)
+{
+  const SortKey *sort_key = get_sort_key (query->sort_type);
   GList *substring;
+
+  if (query->from > 0 || query->to > 0) {
+    g_string_append (statement_str, "JOIN visits ON visits.url = urls.id WHERE ");
+    if (query->from > 0)
+      g_string_append (statement_str, "visits.visit_time >= ? AND ");
+    if (query->to > 0)
+      g_string_append (statement_str, "visits.visit_time <= ? AND ");
+  } else {
+    g_string_append (statement_str, "WHERE ");
+  }
+
+  if (query->ignore_hidden)
+    g_string_append (statement_str, "urls.hidden_from_overview = 0 AND ");
+
+  if (query->ignore_local)
+    g_string_append (statement_str, "urls.url LIKE 'http%' AND ");
+
+  if (query->host > 0)
+    g_string_append (statement_str, "urls.host = ? AND ");
+
+  if (fts_query) {
+    g_string_append (statement_str, "urls.id IN (SELECT rowid FROM urls_fts WHERE urls_fts MATCH ?) AND ");
+  } else {
+    for (substring = query->substring_list; substring != NULL; substring = substring->next)
+      g_string_append (statement_str, "(urls.url LIKE ? OR urls.title LIKE ?) AND ");
+  }
+
+  if (query->after && sort_key) {
+    char op = sort_key->descending ? '<' : '>';
+
+    g_string_append_printf (statement_str, "(%s %c %s OR (%s = %s AND urls.id %c ?)) AND ",
+                            sort_key->column, op, sort_key->value,
+                            sort_key->column, sort_key->value, op);
+  }
+
+  g_string_append (statement_str, "1 ");
+}
+
+static gboolean
+bind_url_rows_conditions (EphySQLiteStatement *statement,
+                          EphyHistoryQuery    *query,
+                          const char          *fts_query,
+                          int                 *i,
+                          GError             **error)
+{
+  GList *substring;
+
+  if (query->from > 0 && !ephy_sqlite_statement_bind_int (statement, (*i)++, (int)query->from, error))
+    return FALSE;
+
+  if (query->to > 0 && !ephy_sqlite_statement_bind_int (statement, (*i)++, (int)query->to, error))
+    return FALSE;
+
+  if (query->host > 0 && !ephy_sqlite_statement_bind_int (statement, (*i)++, (int)query->host, error))
+    return FALSE;
+
+  if (fts_query && !ephy_sqlite_statement_bind_string (statement, (*i)++, fts_query, error))
+    return FALSE;
+
+  for (substring = fts_query ? NULL : query->substring_list; substring != NULL; substring = substring->next) {
+    char *string = ephy_sqlite_create_match_pattern (substring->data);
+    gboolean bound;
+
+    bound = ephy_sqlite_statement_bind_string (statement, (*i)++, string, error) &&
+            ephy_sqlite_statement_bind_string (statement, (*i)++, string + 2, error);
+    g_free (string);
+    if (!bound)
+      return FALSE;
+  }
+
+  if (query->after && get_sort_key (query->sort_type)) {
+    if (!bind_sort_key_value (statement, (*i)++, query->sort_type, query->after, error) ||
+        !bind_sort_key_value (statement, (*i)++, query->sort_type, query->after, error) ||
+        !ephy_sqlite_statement_bind_int (statement, (*i)++, query->after->id, error))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static GList *
+find_url_rows (EphyHistoryService *self, EphyHistoryQuery *query, const char *fts_query)
+{
+  EphySQLiteConnection *connection = ephy_history_service_get_connection (self);
+  EphySQLiteStatement *statement = NULL;
+  const SortKey *sort_key;
   GString *statement_str;
   GList *urls = NULL;
   GError *error = NULL;
@@ -244,70 +497,28 @@ ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *
 
   int i = 0;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database != NULL);
+  g_assert (connection != NULL);
 
   statement_str = g_string_new (base_statement);
+  append_url_rows_conditions (statement_str, query, fts_query);
 
-  if (query->from > 0 || query->to > 0) {
-    statement_str = g_string_append (statement_str, "JOIN visits ON visits.url = urls.id WHERE ");
-    if (query->from > 0)
-      statement_str = g_string_append (statement_str, "visits.visit_time >= ? AND ");
-    if (query->to > 0)
-      statement_str = g_string_append (statement_str, "visits.visit_time <= ? AND ");
+  sort_key = get_sort_key (query->sort_type);
+  if (sort_key) {
+    const char *direction = sort_key->descending ? "DESC" : "ASC";
+
+    g_string_append_printf (statement_str, "ORDER BY %s %s, urls.id %s ",
+                            sort_key->column, direction, direction);
   } else {
-    statement_str = g_string_append (statement_str, "WHERE ");
+    g_warning ("We don't support this sorting method yet.");
   }
 
-  if (query->ignore_hidden)
-    statement_str = g_string_append (statement_str, "urls.hidden_from_overview = 0 AND ");
-
-  if (query->ignore_local)
-    statement_str = g_string_append (statement_str, "urls.url LIKE 'http%' AND ");
-
-  if (query->host > 0)
-    statement_str = g_string_append (statement_str, "urls.host = ? AND ");
+  if (query->limit || query->offset)
+    g_string_append (statement_str, "LIMIT ? ");
 
-  for (substring = query->substring_list; substring != NULL; substring = substring->next)
-    statement_str = g_string_append (statement_str, "(urls.url LIKE ? OR urls.title LIKE ?) AND ");
+  if (query->offset)
+    g_string_append (statement_str, "OFFSET ? ");
 
-  statement_str = g_string_append (statement_str, "1 ");
-
-  switch (query->sort_type) {
-    case EPHY_HISTORY_SORT_MOST_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.visit_count DESC ");
-      break;
-    case EPHY_HISTORY_SORT_LEAST_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.visit_count ");
-      break;
-    case EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.last_visit_time DESC ");
-      break;
-    case EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.last_visit_time ");
-      break;
-    case EPHY_HISTORY_SORT_TITLE_ASCENDING:
-      statement_str = g_string_append (statement_str, "ORDER BY LOWER(urls.title) ");
-      break;
-    case EPHY_HISTORY_SORT_TITLE_DESCENDING:
-      statement_str = g_string_append (statement_str, "ORDER BY LOWER(urls.title) DESC ");
-      break;
-    case EPHY_HISTORY_SORT_URL_ASCENDING:
-      statement_str = g_string_append (statement_str, "ORDER BY LOWER(urls.url) ");
-      break;
-    case EPHY_HISTORY_SORT_URL_DESCENDING:
-      statement_str = g_string_append (statement_str, "ORDER BY LOWER(urls.url) DESC ");
-      break;
-    case EPHY_HISTORY_SORT_NONE:
-    default:
-      g_warning ("We don't support this sorting method yet.");
-  }
-
-  if (query->limit) {
-    statement_str = g_string_append (statement_str, "LIMIT ? ");
-  }
-
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_create_statement (connection,
                                                        statement_str->str, &error);
   g_string_free (statement_str, TRUE);
 
@@ -317,57 +528,17 @@ ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *
     return NULL;
   }
 
-  if (query->from > 0) {
-    if (ephy_sqlite_statement_bind_int (statement, i++, (int)query->from, &error) == FALSE) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      return NULL;
-    }
-  }
-  if (query->to > 0) {
-    if (ephy_sqlite_statement_bind_int (statement, i++, (int)query->to, &error) == FALSE) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      return NULL;
-    }
-  }
-  if (query->host > 0) {
-    if (ephy_sqlite_statement_bind_int (statement, i++, (int)query->host, &error) == FALSE) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      return NULL;
-    }
-  }
-  for (substring = query->substring_list; substring != NULL; substring = substring->next) {
-    char *string = ephy_sqlite_create_match_pattern (substring->data);
-    if (ephy_sqlite_statement_bind_string (statement, i++, string, &error) == FALSE) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      g_free (string);
-      return NULL;
-    }
-    if (ephy_sqlite_statement_bind_string (statement, i++, string + 2, &error) == FALSE) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      g_free (string);
-      return NULL;
-    }
-    g_free (string);
+  if (!bind_url_rows_conditions (statement, query, fts_query, &i, &error) ||
+      ((query->limit || query->offset) &&
+       !ephy_sqlite_statement_bind_int (statement, i++, query->limit ? (int)query->limit : -1, &error)) ||
+      (query->offset &&
+       !ephy_sqlite_statement_bind_int (statement, i++, query->offset, &error))) {
+    g_warning ("Could not build urls table query statement: %s", error->message);
+    g_error_free (error);
+    g_object_unref (statement);
+    return NULL;
   }
 
-  if (query->limit)
-    if (ephy_sqlite_statement_bind_int (statement, i++, query->limit, &error) == FALSE) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      return NULL;
-    }
-
   while (ephy_sqlite_statement_step (statement, &error))
     urls = g_list_prepend (urls, create_url_from_statement (statement));
 
@@ -385,6 +556,111 @@ ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *
   return urls;
 }
 
+static guint
+count_url_rows (EphyHistoryService *self, EphyHistoryQuery *query, const char *fts_query)
+{
+  EphySQLiteConnection *connection = ephy_history_service_get_connection (self);
+  EphySQLiteStatement *statement = NULL;
+  GString *statement_str;
+  GError *error = NULL;
+  guint count = 0;
+  int i = 0;
+
+  g_assert (connection != NULL);
+
+  statement_str = g_string_new ("SELECT COUNT(DISTINCT urls.id) FROM urls ");
+  append_url_rows_conditions (statement_str, query, fts_query);
+
+  statement = ephy_sqlite_connection_create_statement (connection,
+                                                       statement_str->str, &error);
+  g_string_free (statement_str, TRUE);
+
+  if (error) {
+    g_warning ("Could not build urls table count statement: %s", error->message);
+    g_error_free (error);
+    return 0;
+  }
+
+  if (!bind_url_rows_conditions (statement, query, fts_query, &i, &error)) {
+    g_warning ("Could not build urls table count statement: %s", error->message);
+    g_error_free (error);
+    g_object_unref (statement);
+    return 0;
+  }
+
+  if (ephy_sqlite_statement_step (statement, &error))
+    count = ephy_sqlite_statement_get_column_as_int (statement, 0);
+
+  if (error) {
+    g_warning ("Could not execute urls table count statement: %s", error->message);
+    g_error_free (error);
+  }
+
+  g_object_unref (statement);
+  return count;
+}
+
+/* Returns the full-text query for the substrings of @query, or NULL if they
+ * have to be matched as substrings. */
+static char *
+create_url_rows_fts_query (EphyHistoryService *self, EphyHistoryQuery *query)
+{
+  if (!query->substring_list || !self->urls_fts_enabled ||
+      query->url_match == EPHY_HISTORY_URL_MATCH_SUBSTRINGS)
+    return NULL;
+
+  return ephy_history_service_create_fts_query (query->substring_list);
+}
+
+GList *
+ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *query)
+{
+  GList *urls = NULL;
+  char *fts_query;
+
+  /* Token and prefix matches are answered by the full-text index. Scanning
+   * the table for substrings in the middle of words is the fallback for when
+   * the index finds nothing, unless the count already chose the match: the
+   * pages of one query must all be read the same way. */
+  fts_query = create_url_rows_fts_query (self, query);
+  if (fts_query) {
+    urls = find_url_rows (self, query, fts_query);
+    g_free (fts_query);
+
+    if (urls || query->url_match == EPHY_HISTORY_URL_MATCH_WORDS)
+      return urls;
+  }
+
+  return find_url_rows (self, query, NULL);
+}
+
+/* Counts the rows ephy_history_service_find_url_rows() would return without
+ * a limit, falling back from the full-text index the same way. The match
+ * used is stored in @url_match, so that the queries reading the rows can
+ * stick to it. */
+guint
+ephy_history_service_count_url_rows (EphyHistoryService  *self,
+                                     EphyHistoryQuery    *query,
+                                     EphyHistoryURLMatch *url_match)
+{
+  guint count = 0;
+  char *fts_query;
+
+  fts_query = create_url_rows_fts_query (self, query);
+  if (fts_query) {
+    count = count_url_rows (self, query, fts_query);
+    g_free (fts_query);
+
+    if (count || query->url_match == EPHY_HISTORY_URL_MATCH_WORDS) {
+      *url_match = EPHY_HISTORY_URL_MATCH_WORDS;
+      return count;
+    }
+  }
+
+  *url_match = EPHY_HISTORY_URL_MATCH_SUBSTRINGS;
+  return count_url_rows (self, query, NULL);
+}
+
 void
 ephy_history_service_delete_url (EphyHistoryService *self, EphyHistoryURL *url)
 {
@@ -402,7 +678,7 @@ ephy_history_service_delete_url (EphyHistoryService *self, EphyHistoryURL *url)
   else
     sql_statement = g_strdup ("DELETE FROM urls WHERE url=?");
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_borrow_statement (self->history_database,
                                                        sql_statement, &error);
   g_free (sql_statement);
 
@@ -48,44 +48,88 @@ ephy_history_service_initialize_visits_table (EphyHistoryService *self)
   return TRUE;
 }
 
-void
-ephy_history_service_add_visit_row (EphyHistoryService *self, EphyHistoryPageVisit *visit)
+/* Keeps the statement under SQLite's default limit of 999 variables. */
+#define VISIT_ROWS_PER_INSERT 64
+
+static gboolean
+insert_visit_rows (EphyHistoryService    *self,
+                   EphyHistoryPageVisit **visits,
+                   guint                  n_visits)
 {
   EphySQLiteStatement *statement;
+  GString *sql;
   GError *error = NULL;
+  int i = 0;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database != NULL);
+  sql = g_string_new ("INSERT INTO visits (url, visit_time, visit_type) VALUES (?, ?, ?)");
+  for (guint n = 1; n < n_visits; n++)
+    g_string_append (sql, ", (?, ?, ?)");
+
+  /* Only full batches come back often enough to be worth keeping. */
+  if (n_visits == VISIT_ROWS_PER_INSERT)
+    statement = ephy_sqlite_connection_borrow_statement (self->history_database, sql->str, &error);
+  else
+    statement = ephy_sqlite_connection_create_statement (self->history_database, sql->str, &error);
+  g_string_free (sql, TRUE);
 
-  statement = ephy_sqlite_connection_create_statement (
-    self->history_database,
-    "INSERT INTO visits (url, visit_time, visit_type) "
-    " VALUES (?, ?, ?) ", &error);
   if (error) {
     g_warning ("Could not build visits table addition statement: %s", error->message);
     g_error_free (error);
-    return;
+    return FALSE;
   }
 
-  if (ephy_sqlite_statement_bind_int (statement, 0, visit->url->id, &error) == FALSE ||
-      ephy_sqlite_statement_bind_int (statement, 1, visit->visit_time, &error) == FALSE ||
-      ephy_sqlite_statement_bind_int (statement, 2, visit->visit_type, &error) == FALSE) {
-    g_warning ("Could not build visits table addition statement: %s", error->message);
-    g_error_free (error);
-    g_object_unref (statement);
-    return;
+  for (guint n = 0; n < n_visits; n++) {
+    if (ephy_sqlite_statement_bind_int (statement, i++, visits[n]->url->id, &error) == FALSE ||
+        ephy_sqlite_statement_bind_int (statement, i++, visits[n]->visit_time, &error) == FALSE ||
+        ephy_sqlite_statement_bind_int (statement, i++, visits[n]->visit_type, &error) == FALSE) {
+      g_warning ("Could not build visits table addition statement: %s", error->message);
+      g_error_free (error);
+      g_object_unref (statement);
+      return FALSE;
+    }
   }
 
   ephy_sqlite_statement_step (statement, &error);
+  g_object_unref (statement);
+
   if (error) {
-    g_warning ("Could not insert URL into visits table: %s", error->message);
+    g_warning ("Could not insert URLs into visits table: %s", error->message);
     g_error_free (error);
-  } else {
-    visit->id = ephy_sqlite_connection_get_last_insert_id (self->history_database);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * ephy_history_service_add_visit_rows:
+ * @self: an #EphyHistoryService
+ * @visits: (element-type EphyHistoryPageVisit): visits of URLs already in
+ *   the database
+ *
+ * Inserts @visits with as few statements as possible. Their ids are not
+ * set.
+ *
+ * Returns: %TRUE if every visit was inserted
+ */
+gboolean
+ephy_history_service_add_visit_rows (EphyHistoryService *self,
+                                     GPtrArray          *visits)
+{
+  gboolean success = TRUE;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database != NULL);
+
+  for (guint i = 0; i < visits->len; i += VISIT_ROWS_PER_INSERT) {
+    success &= insert_visit_rows (self,
+                                  (EphyHistoryPageVisit **)visits->pdata + i,
+                                  MIN (visits->len - i, VISIT_ROWS_PER_INSERT));
   }
 
   ephy_history_service_schedule_commit (self);
-  g_object_unref (statement);
+
+  return success;
 }
 
 static EphyHistoryPageVisit *
@@ -102,6 +146,7 @@ create_page_visit_from_statement (EphySQLiteStatement *statement)
 GList *
 ephy_history_service_find_visit_rows (EphyHistoryService *self, EphyHistoryQuery *query)
 {
+  EphySQLiteConnection *connection = ephy_history_service_get_connection (self);
   EphySQLiteStatement *statement = NULL;
   GList *substring;
   GString *statement_str;
@@ -121,8 +166,7 @@ ephy_history_service_find_visit_rows (EphyHistoryService *self, EphyHistoryQuery
 
   int i = 0;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database != NULL);
+  g_assert (connection != NULL);
 
   statement_str = g_string_new (base_statement);
 
@@ -147,7 +191,7 @@ ephy_history_service_find_visit_rows (EphyHistoryService *self, EphyHistoryQuery
 
   statement_str = g_string_append (statement_str, "1");
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
+  statement = ephy_sqlite_connection_create_statement (connection,
                                                        statement_str->str, &error);
   g_string_free (statement_str, TRUE);
 
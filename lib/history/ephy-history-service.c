@@ -21,6 +21,7 @@
 #include "config.h"
 #include "ephy-history-service.h"
 
+#include "ephy-debug.h"
 #include "ephy-history-service-private.h"
 #include "ephy-history-types.h"
 #include "ephy-history-type-builtins.h"
@@ -43,12 +44,14 @@ typedef enum {
   DELETE_URLS,
   DELETE_HOST,
   CLEAR,
+  IMPORT,
   /* QUIT */
   QUIT,
   /* READ */
   GET_URL,
   GET_HOST_FOR_URL,
   QUERY_URLS,
+  COUNT_URLS,
   QUERY_VISITS,
   GET_HOSTS,
   QUERY_HOSTS
@@ -58,6 +61,7 @@ enum {
   VISIT_URL,
   URLS_VISITED,
   CLEARED,
+  IMPORTED,
   URL_TITLE_CHANGED,
   URL_DELETED,
   HOST_DELETED,
@@ -66,6 +70,13 @@ enum {
 
 static guint signals[LAST_SIGNAL];
 
+/* Read-only queries run on this many threads, each with its own connection,
+ * so they never wait behind writes on the history thread. */
+#define READER_POOL_SIZE 2
+
+/* The reader connection used by the current reader pool thread, if any. */
+static GPrivate reader_connection;
+
 typedef struct _EphyHistoryServiceMessage {
   EphyHistoryService *service;
   EphyHistoryServiceMessageType type;
@@ -80,6 +91,7 @@ typedef struct _EphyHistoryServiceMessage {
 
 static gpointer run_history_service_thread (EphyHistoryService *self);
 static void ephy_history_service_process_message (EphyHistoryService *self, EphyHistoryServiceMessage *message);
+static void ephy_history_service_run_reader (EphyHistoryServiceMessage *message, EphyHistoryService *self);
 static gboolean ephy_history_service_execute_quit (EphyHistoryService *self, gpointer data, gpointer *result);
 static void ephy_history_service_quit (EphyHistoryService *self, EphyHistoryJobCallback callback, gpointer user_data);
 
@@ -138,6 +150,10 @@ ephy_history_service_finalize (GObject *object)
     g_thread_join (self->history_thread);
 
   g_free (self->history_filename);
+  g_hash_table_destroy (self->hosts_by_url);
+  g_hash_table_destroy (self->hosts_by_id);
+  g_hash_table_destroy (self->zoom_levels);
+  g_rw_lock_clear (&self->zoom_levels_lock);
 
   G_OBJECT_CLASS (ephy_history_service_parent_class)->finalize (object);
 }
@@ -220,6 +236,22 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
                   G_TYPE_NONE,
                   0);
 
+/**
+ * EphyHistoryService::imported:
+ * @service: the #EphyHistoryService that received the signal
+ *
+ * The ::imported signal is emitted after ephy_history_service_import()
+ * added the history of another browser. Unlike regular visits, imported
+ * ones are not announced one by one with ::visit-url.
+ **/
+  signals[IMPORTED] =
+    g_signal_new ("imported",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  0);
+
   signals[URL_TITLE_CHANGED] =
     g_signal_new ("url-title-changed",
                   G_OBJECT_CLASS_TYPE (gobject_class),
@@ -268,6 +300,11 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
 static void
 ephy_history_service_init (EphyHistoryService *self)
 {
+  self->hosts_by_id = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)ephy_history_host_free);
+  self->hosts_by_url = g_hash_table_new (g_str_hash, g_str_equal);
+  g_rw_lock_init (&self->zoom_levels_lock);
+  self->zoom_levels = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
   self->history_thread = g_thread_new ("EphyHistoryService", (GThreadFunc)run_history_service_thread, self);
   self->queue = g_async_queue_new ();
 }
@@ -354,6 +391,42 @@ ephy_history_service_commit (EphyHistoryService *self)
   self->scheduled_to_commit = FALSE;
 }
 
+static void
+ephy_history_service_enable_wal (EphyHistoryService *self)
+{
+  static const char * const statements[] = {
+    /* Lets the reader connections query the database while the history
+     * thread holds its long-running write transaction. */
+    "PRAGMA journal_mode = WAL",
+    /* In WAL mode this only syncs on checkpoints. A crash can lose the last
+     * commits, but never corrupts the database. */
+    "PRAGMA synchronous = NORMAL",
+    /* Checkpoint every 16 MiB of WAL rather than every 4 MiB, since we
+     * commit every time the queue drains, and shrink the file back
+     * afterwards. */
+    "PRAGMA wal_autocheckpoint = 4096",
+    "PRAGMA journal_size_limit = 16777216"
+  };
+  GError *error = NULL;
+
+  if (NULL == self->history_database)
+    return;
+
+  /* The journal mode is persistent, so read-only instances get it from the
+   * database file. */
+  if (self->read_only)
+    return;
+
+  for (guint i = 0; i < G_N_ELEMENTS (statements); i++) {
+    ephy_sqlite_connection_execute (self->history_database, statements[i], &error);
+    if (error) {
+      g_warning ("Could not set up write-ahead logging in history database: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+  }
+}
+
 static void
 ephy_history_service_enable_foreign_keys (EphyHistoryService *self)
 {
@@ -371,6 +444,152 @@ ephy_history_service_enable_foreign_keys (EphyHistoryService *self)
   }
 }
 
+static gboolean
+ephy_history_service_add_indexes (EphyHistoryService *self,
+                                  GError            **error)
+{
+  static const char * const statements[] = {
+    /* Looked up on every visit and title change. */
+    "CREATE INDEX IF NOT EXISTS urls_url_index ON urls (url)",
+    /* Sorting of the overview and of completion results. */
+    "CREATE INDEX IF NOT EXISTS urls_visit_count_index ON urls (visit_count)",
+    "CREATE INDEX IF NOT EXISTS visits_url_time_index ON visits (url, visit_time)",
+    "CREATE INDEX IF NOT EXISTS hosts_url_index ON hosts (url)"
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS (statements); i++) {
+    if (!ephy_sqlite_connection_execute (self->history_database, statements[i], error))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Pages of the history dialog are ordered by time and then by id, which
+ * SQLite stores in every index. */
+static gboolean
+ephy_history_service_add_last_visit_time_index (EphyHistoryService *self,
+                                                GError            **error)
+{
+  return ephy_sqlite_connection_execute (self->history_database,
+                                         "CREATE INDEX IF NOT EXISTS urls_last_visit_time_index ON urls (last_visit_time)",
+                                         error);
+}
+
+/* SQLite may be built without FTS5, in which case nothing is created. The
+ * step is then not done, so that it is tried again with the next SQLite. */
+static gboolean
+ephy_history_service_add_urls_fts_table (EphyHistoryService *self,
+                                         GError            **error)
+{
+  if (!ephy_history_service_initialize_urls_fts_table (self, error))
+    return FALSE;
+
+  if (!ephy_sqlite_connection_table_exists (self->history_database, "urls_fts")) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                         "SQLite was built without FTS5");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+typedef gboolean (*EphyHistorySchemaMigrator) (EphyHistoryService *self,
+                                               GError            **error);
+
+/* Each step brings the database schema from the version equal to its index
+ * to the next one. To change the schema of existing databases, add a step at
+ * the end of this array; the current version is stored in the database's
+ * user_version pragma. A step failing with G_IO_ERROR_NOT_SUPPORTED is left
+ * for a later start, and the steps after it run again until it is done, so
+ * they must cope with finding their changes already made. */
+static const EphyHistorySchemaMigrator schema_migrators[] = {
+  ephy_history_service_add_indexes,
+  ephy_history_service_add_urls_fts_table,
+  ephy_history_service_add_last_visit_time_index
+};
+
+static int
+ephy_history_service_get_schema_version (EphyHistoryService *self)
+{
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+  int version = -1;
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "PRAGMA user_version", &error);
+  if (error) {
+    g_warning ("Could not build history schema version query: %s", error->message);
+    g_error_free (error);
+    return -1;
+  }
+
+  if (ephy_sqlite_statement_step (statement, &error))
+    version = ephy_sqlite_statement_get_column_as_int (statement, 0);
+
+  if (error) {
+    g_warning ("Could not query history schema version: %s", error->message);
+    g_error_free (error);
+  }
+
+  g_object_unref (statement);
+  return version;
+}
+
+static gboolean
+ephy_history_service_migrate_schema (EphyHistoryService *self)
+{
+  GError *error = NULL;
+  gboolean skipped = FALSE;
+  int old_version;
+  int version;
+  char *sql;
+
+  old_version = version = ephy_history_service_get_schema_version (self);
+  if (version < 0)
+    return FALSE;
+
+  if (version >= (int)G_N_ELEMENTS (schema_migrators))
+    return TRUE;
+
+  for (int i = version; i < (int)G_N_ELEMENTS (schema_migrators); i++) {
+    LOG ("Migrating history database schema to version %d", i + 1);
+
+    if (!schema_migrators[i] (self, &error)) {
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+        LOG ("Leaving history database schema version %d for later: %s", i + 1, error->message);
+        g_clear_error (&error);
+        skipped = TRUE;
+        continue;
+      }
+
+      g_warning ("Could not migrate history database schema to version %d: %s",
+                 i + 1, error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+    /* The version only covers the steps done without a gap. */
+    if (!skipped)
+      version = i + 1;
+  }
+
+  if (version > old_version) {
+    sql = g_strdup_printf ("PRAGMA user_version = %d", version);
+    ephy_sqlite_connection_execute (self->history_database, sql, &error);
+    g_free (sql);
+
+    if (error) {
+      g_warning ("Could not store history schema version: %s", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+  }
+
+  ephy_history_service_schedule_commit (self);
+  return TRUE;
+}
+
 static gboolean
 ephy_history_service_open_database_connections (EphyHistoryService *self)
 {
@@ -388,6 +607,7 @@ ephy_history_service_open_database_connections (EphyHistoryService *self)
     return FALSE;
   }
 
+  ephy_history_service_enable_wal (self);
   ephy_history_service_enable_foreign_keys (self);
 
   ephy_sqlite_connection_begin_transaction (self->history_database, &error);
@@ -402,23 +622,91 @@ ephy_history_service_open_database_connections (EphyHistoryService *self)
       ephy_history_service_initialize_visits_table (self) == FALSE)
     return FALSE;
 
+  /* Read-only databases belong to another instance, which migrates them. */
+  if (!self->read_only && !ephy_history_service_migrate_schema (self))
+    return FALSE;
+
+  self->urls_fts_enabled = ephy_sqlite_connection_table_exists (self->history_database, "urls_fts");
+  ephy_history_service_load_host_cache (self);
+
+  /* Make the tables visible to the reader connections. */
+  ephy_history_service_commit (self);
+
+  self->idle_readers = g_async_queue_new_full (g_object_unref);
+  self->reader_pool = g_thread_pool_new ((GFunc)ephy_history_service_run_reader, self,
+                                         READER_POOL_SIZE, FALSE, NULL);
+
   return TRUE;
 }
 
+static void
+ephy_history_service_close_readers (EphyHistoryService *self)
+{
+  if (self->reader_pool) {
+    /* Wait for the queries already handed to the pool. */
+    g_thread_pool_free (self->reader_pool, FALSE, TRUE);
+    self->reader_pool = NULL;
+  }
+
+  if (self->idle_readers) {
+    g_async_queue_unref (self->idle_readers);
+    self->idle_readers = NULL;
+  }
+}
+
 static void
 ephy_history_service_close_database_connections (EphyHistoryService *self)
 {
   g_assert (self->history_thread == g_thread_self ());
 
+  ephy_history_service_close_readers (self);
+  ephy_history_service_clear_host_cache (self);
+
+  if (self->history_database == NULL)
+    return;
+
   ephy_sqlite_connection_close (self->history_database);
   g_object_unref (self->history_database);
   self->history_database = NULL;
 }
 
+static EphySQLiteConnection *
+ephy_history_service_open_reader (EphyHistoryService *self)
+{
+  EphySQLiteConnection *connection;
+  GError *error = NULL;
+
+  connection = ephy_sqlite_connection_new ();
+  ephy_sqlite_connection_open (connection, self->history_filename, &error);
+  if (!error)
+    ephy_sqlite_connection_execute (connection, "PRAGMA query_only = ON", &error);
+
+  if (error) {
+    g_warning ("Could not open history database reader at %s: %s", self->history_filename, error->message);
+    g_error_free (error);
+    g_object_unref (connection);
+    return NULL;
+  }
+
+  return connection;
+}
+
+EphySQLiteConnection *
+ephy_history_service_get_connection (EphyHistoryService *self)
+{
+  EphySQLiteConnection *connection = g_private_get (&reader_connection);
+
+  if (connection)
+    return connection;
+
+  g_assert (self->history_thread == g_thread_self ());
+  return self->history_database;
+}
+
 static void
 ephy_history_service_clear_all (EphyHistoryService *self)
 {
-  char *journal_filename;
+  static const char * const journal_suffixes[] = { "-journal", "-wal", "-shm" };
 
   if (self->history_database == NULL)
     return;
@@ -426,15 +714,18 @@ ephy_history_service_clear_all (EphyHistoryService *self)
   if (self->read_only)
     return;
 
-  ephy_sqlite_connection_close (self->history_database);
+  ephy_history_service_close_database_connections (self);
 
   if (g_unlink (self->history_filename) == -1)
     g_warning ("Failed to delete %s: %s", self->history_filename, g_strerror (errno));
 
-  journal_filename = g_strdup_printf ("%s-journal", self->history_filename);
-  if (g_unlink (journal_filename) == -1 && errno != ENOENT)
-    g_warning ("Failed to delete %s: %s", journal_filename, g_strerror (errno));
-  g_free (journal_filename);
+  for (guint i = 0; i < G_N_ELEMENTS (journal_suffixes); i++) {
+    char *journal_filename = g_strconcat (self->history_filename, journal_suffixes[i], NULL);
+
+    if (g_unlink (journal_filename) == -1 && errno != ENOENT)
+      g_warning ("Failed to delete %s: %s", journal_filename, g_strerror (errno));
+    g_free (journal_filename);
+  }
 
   ephy_history_service_open_database_connections (self);
 }
@@ -508,7 +799,7 @@ ephy_history_service_execute_job_callback (gpointer data)
 {
   EphyHistoryServiceMessage *message = (EphyHistoryServiceMessage *)data;
 
-  g_assert (message->callback || message->type == CLEAR);
+  g_assert (message->callback || message->type == CLEAR || message->type == IMPORT);
 
   if (g_cancellable_is_cancelled (message->cancellable)) {
     ephy_history_service_message_free (message);
@@ -520,6 +811,8 @@ ephy_history_service_execute_job_callback (gpointer data)
 
   if (message->type == CLEAR)
     g_signal_emit (message->service, signals[CLEARED], 0);
+  else if (message->type == IMPORT && message->success)
+    g_signal_emit (message->service, signals[IMPORTED], 0);
 
   ephy_history_service_message_free (message);
 
@@ -555,77 +848,582 @@ signal_emission_context_new (EphyHistoryService *service,
   return ctx;
 }
 
-static gboolean
-ephy_history_service_execute_add_visit_helper (EphyHistoryService *self, EphyHistoryPageVisit *visit)
+/* Visits queued together are written as one batch: every URL and host is
+ * looked up and updated once, however many visits it got, and the visit
+ * rows go in with multi-row inserts. The hash tables borrow their rows from
+ * the visits, which outlive the batch. */
+typedef struct {
+  GHashTable *hosts;
+  GHashTable *urls;
+  GPtrArray *visits;
+} VisitBatch;
+
+static void
+visit_batch_init (VisitBatch *batch)
+{
+  batch->hosts = g_hash_table_new (NULL, NULL);
+  batch->urls = g_hash_table_new (g_str_hash, g_str_equal);
+  batch->visits = g_ptr_array_new ();
+}
+
+static void
+visit_batch_clear (VisitBatch *batch)
+{
+  g_hash_table_destroy (batch->hosts);
+  g_hash_table_destroy (batch->urls);
+  g_ptr_array_free (batch->visits, TRUE);
+}
+
+static EphyHistoryHost *
+visit_batch_get_host (EphyHistoryService *self,
+                      VisitBatch         *batch,
+                      EphyHistoryURL     *url)
 {
-  if (visit->url->host == NULL)
-    visit->url->host = ephy_history_service_get_host_row_from_url (self, visit->url->url);
-  else if (visit->url->host->id == -1) {
+  EphyHistoryHost *host;
+
+  if (url->host == NULL)
+    url->host = ephy_history_service_get_host_row_from_url (self, url->url);
+  else if (url->host->id == -1) {
     /* This will happen when we migrate the old history to the new
      * format. We need to store a zoom level for a not-yet-created
      * host, so we'll end up here. Ugly, but it works. */
-    double zoom_level = visit->url->host->zoom_level;
-    ephy_history_host_free (visit->url->host);
-    visit->url->host = ephy_history_service_get_host_row_from_url (self, visit->url->url);
-    visit->url->host->zoom_level = zoom_level;
+    double zoom_level = url->host->zoom_level;
+    ephy_history_host_free (url->host);
+    url->host = ephy_history_service_get_host_row_from_url (self, url->url);
+    url->host->zoom_level = zoom_level;
   }
 
-  visit->url->host->visit_count++;
-  ephy_history_service_update_host_row (self, visit->url->host);
+  host = g_hash_table_lookup (batch->hosts, GINT_TO_POINTER (url->host->id));
+  if (!host) {
+    host = url->host;
+    g_hash_table_insert (batch->hosts, GINT_TO_POINTER (host->id), host);
+  }
 
-  /* A NULL return here means that the URL does not yet exist in the database */
-  if (NULL == ephy_history_service_get_url_row (self, visit->url->url, visit->url)) {
-    visit->url->last_visit_time = visit->visit_time;
-    visit->url->visit_count = 1;
+  return host;
+}
 
-    ephy_history_service_add_url_row (self, visit->url);
+static gboolean
+visit_batch_add (EphyHistoryService   *self,
+                 VisitBatch           *batch,
+                 EphyHistoryPageVisit *visit)
+{
+  EphyHistoryURL *url;
+  EphyHistoryHost *host;
 
-    if (visit->url->id == -1) {
-      g_warning ("Adding visit failed after failed URL addition.");
-      return FALSE;
+  url = g_hash_table_lookup (batch->urls, visit->url->url);
+  if (url) {
+    /* Each visit used to rewrite the title, so the last one wins. */
+    if (visit->url->title) {
+      g_free (url->title);
+      url->title = g_strdup (visit->url->title);
     }
+    host = g_hash_table_lookup (batch->hosts, GINT_TO_POINTER (url->host->id));
   } else {
-    visit->url->visit_count++;
+    url = visit->url;
+    host = visit_batch_get_host (self, batch, url);
+
+    /* A NULL return here means that the URL does not yet exist in the database */
+    if (NULL == ephy_history_service_get_url_row (self, url->url, url)) {
+      url->last_visit_time = visit->visit_time;
+      url->visit_count = 0;
 
-    if (visit->visit_time > visit->url->last_visit_time)
-      visit->url->last_visit_time = visit->visit_time;
+      ephy_history_service_add_url_row (self, url);
 
-    ephy_history_service_update_url_row (self, visit->url);
+      if (url->id == -1) {
+        g_warning ("Adding visit failed after failed URL addition.");
+        return FALSE;
+      }
+    }
+
+    g_hash_table_insert (batch->urls, url->url, url);
   }
 
-  ephy_history_service_add_visit_row (self, visit);
-  return visit->id != -1;
+  host->visit_count++;
+  url->visit_count++;
+  if (visit->visit_time > url->last_visit_time)
+    url->last_visit_time = visit->visit_time;
+
+  visit->url->id = url->id;
+  g_ptr_array_add (batch->visits, visit);
+
+  return TRUE;
 }
 
 static gboolean
-ephy_history_service_execute_add_visit (EphyHistoryService *self, EphyHistoryPageVisit *visit, gpointer *result)
+visit_batch_write (EphyHistoryService *self,
+                   VisitBatch         *batch)
 {
+  GHashTableIter iter;
+  gpointer value;
   gboolean success;
-  g_assert (self->history_thread == g_thread_self ());
 
-  if (self->read_only)
+  success = ephy_history_service_add_visit_rows (self, batch->visits);
+
+  g_hash_table_iter_init (&iter, batch->urls);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    ephy_history_service_update_url_row (self, value);
+
+  g_hash_table_iter_init (&iter, batch->hosts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    ephy_history_service_update_host_row (self, value);
+
+  ephy_history_service_schedule_commit (self);
+
+  return success;
+}
+
+/* The indexes that are only used to query the history. Bulk imports drop
+ * them and build them again at the end. */
+static const char * const deferred_indexes[] = {
+  "urls_visit_count_index",
+  "urls_last_visit_time_index",
+  "visits_url_time_index"
+};
+
+static gboolean
+ephy_history_service_defer_indexes (EphyHistoryService *self,
+                                    GError            **error)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (deferred_indexes); i++) {
+    char *sql = g_strdup_printf ("DROP INDEX IF EXISTS %s", deferred_indexes[i]);
+    gboolean dropped = ephy_sqlite_connection_execute (self->history_database, sql, error);
+
+    g_free (sql);
+    if (!dropped)
+      return FALSE;
+  }
+
+  if (self->urls_fts_enabled)
+    return ephy_history_service_drop_urls_fts_table (self, error);
+
+  return TRUE;
+}
+
+static gboolean
+ephy_history_service_restore_indexes (EphyHistoryService *self,
+                                      GError            **error)
+{
+  if (!ephy_history_service_add_indexes (self, error) ||
+      !ephy_history_service_add_last_visit_time_index (self, error))
     return FALSE;
 
-  success = ephy_history_service_execute_add_visit_helper (self, visit);
+  if (self->urls_fts_enabled)
+    return ephy_history_service_initialize_urls_fts_table (self, error);
+
+  return TRUE;
+}
+
+static const char * const import_queries[] = {
+  [EPHY_HISTORY_IMPORT_FIREFOX] =
+    "SELECT p.url, p.title, v.visit_date, v.visit_type "
+    "FROM moz_historyvisits v "
+    "JOIN moz_places p ON p.id = v.place_id "
+    "WHERE p.hidden = 0 AND p.url NOT LIKE 'about%' "
+    "                   AND p.url NOT LIKE 'place%'",
+  [EPHY_HISTORY_IMPORT_CHROMIUM] =
+    "SELECT u.url, u.title, v.visit_time, v.transition "
+    "FROM visits v "
+    "JOIN urls u ON u.id = v.url "
+    "WHERE u.hidden = 0"
+};
+
+/* Chromium counts microseconds from 1601-01-01. */
+#define CHROMIUM_EPOCH_DELTA G_GINT64_CONSTANT (11644473600)
+
+static EphyHistoryPageVisitType
+get_firefox_visit_type (int visit_type)
+{
+  /* See nsINavHistoryService.idl in the Firefox source code. */
+  switch (visit_type) {
+    case 2:
+      return EPHY_PAGE_VISIT_TYPED;
+    case 3:
+      return EPHY_PAGE_VISIT_BOOKMARK;
+    case 8:
+      return EPHY_PAGE_VISIT_MANUAL_SUBFRAME;
+    default:
+      return EPHY_PAGE_VISIT_LINK;
+  }
+}
+
+static EphyHistoryPageVisitType
+get_chromium_visit_type (int transition)
+{
+  /* See ui/base/page_transition_types.h in the Chromium source code. The
+   * low byte is the core type, the rest are qualifiers. */
+  switch (transition & 0xff) {
+    case 1:
+    case 5:
+    case 9:
+    case 10:
+      return EPHY_PAGE_VISIT_TYPED;
+    case 2:
+      return EPHY_PAGE_VISIT_BOOKMARK;
+    case 3:
+      return EPHY_PAGE_VISIT_AUTO_SUBFRAME;
+    case 4:
+      return EPHY_PAGE_VISIT_MANUAL_SUBFRAME;
+    case 6:
+      return EPHY_PAGE_VISIT_STARTUP;
+    case 7:
+      return EPHY_PAGE_VISIT_FORM_SUBMISSION;
+    default:
+      return EPHY_PAGE_VISIT_LINK;
+  }
+}
+
+static EphyHistoryPageVisit *
+read_imported_visit (EphyHistoryImportSource source,
+                     EphySQLiteStatement    *statement)
+{
+  const char *url = ephy_sqlite_statement_get_column_as_string (statement, 0);
+  const char *title = ephy_sqlite_statement_get_column_as_string (statement, 1);
+  gint64 visit_time = ephy_sqlite_statement_get_column_as_int64 (statement, 2);
+  int visit_type = ephy_sqlite_statement_get_column_as_int (statement, 3);
+
+  if (!url)
+    return NULL;
+
+  /* Keep the title we already have rather than replacing it with nothing. */
+  if (title && !*title)
+    title = NULL;
+
+  visit_time /= G_USEC_PER_SEC;
+  if (source == EPHY_HISTORY_IMPORT_CHROMIUM)
+    visit_time -= CHROMIUM_EPOCH_DELTA;
+
+  return ephy_history_page_visit_new_with_url (ephy_history_url_new (url, title, 0, 0, 0),
+                                               visit_time,
+                                               source == EPHY_HISTORY_IMPORT_FIREFOX ?
+                                               get_firefox_visit_type (visit_type) :
+                                               get_chromium_visit_type (visit_type));
+}
+
+typedef struct {
+  EphyHistoryImportSource source;
+  char *filename;
+  GCancellable *cancellable;
+  EphyHistoryImportProgressCallback progress_callback;
+  gpointer user_data;
+} ImportJob;
+
+static void
+import_job_free (ImportJob *job)
+{
+  g_free (job->filename);
+  g_clear_object (&job->cancellable);
+  g_slice_free (ImportJob, job);
+}
+
+typedef struct {
+  EphyHistoryService *service;
+  GCancellable *cancellable;
+  EphyHistoryImportProgressCallback callback;
+  gpointer user_data;
+  guint n_visits;
+} ImportProgress;
+
+static gboolean
+report_import_progress (ImportProgress *progress)
+{
+  if (!g_cancellable_is_cancelled (progress->cancellable))
+    progress->callback (progress->service, progress->n_visits, progress->user_data);
+
+  g_object_unref (progress->service);
+  g_clear_object (&progress->cancellable);
+  g_slice_free (ImportProgress, progress);
+
+  return FALSE;
+}
+
+static void
+queue_import_progress (EphyHistoryService *self,
+                       ImportJob          *job,
+                       guint               n_visits)
+{
+  ImportProgress *progress;
+
+  if (!job->progress_callback)
+    return;
+
+  progress = g_slice_new (ImportProgress);
+  progress->service = g_object_ref (self);
+  progress->cancellable = job->cancellable ? g_object_ref (job->cancellable) : NULL;
+  progress->callback = job->progress_callback;
+  progress->user_data = job->user_data;
+  progress->n_visits = n_visits;
+
+  /* Queued before the job callback, so it always runs first. */
+  g_idle_add ((GSourceFunc)report_import_progress, progress);
+}
+
+static gboolean
+import_visits (EphyHistoryService *self,
+               GPtrArray          *visits)
+{
+  VisitBatch batch;
+  gboolean success = TRUE;
+
+  visit_batch_init (&batch);
+
+  for (guint i = 0; i < visits->len; i++) {
+    if (!visit_batch_add (self, &batch, g_ptr_array_index (visits, i)))
+      success = FALSE;
+  }
+
+  if (!visit_batch_write (self, &batch))
+    success = FALSE;
+
+  visit_batch_clear (&batch);
+
   return success;
 }
 
+#define IMPORT_VISITS_PER_BATCH 8192
+
+/* Keeps the statement under SQLite's default limit of 999 variables. */
+#define IMPORT_ROWS_PER_INSERT 64
+
+/* Imported visits are first staged in a temporary table, so that the ones
+ * already in the history, or repeated in the source, are dropped with a
+ * couple of statements rather than looked up one by one. */
+static const char * const staging_table_sql =
+  "CREATE TEMP TABLE imported_visits ("
+  "url LONGVARCHAR NOT NULL, "
+  "title LONGVARCHAR, "
+  "visit_time INTEGER NOT NULL, "
+  "visit_type INTEGER NOT NULL, "
+  "UNIQUE (url, visit_time))";
+
+static gboolean
+stage_visit_rows (EphyHistoryService    *self,
+                  EphyHistoryPageVisit **visits,
+                  guint                  n_visits,
+                  GError               **error)
+{
+  EphySQLiteStatement *statement;
+  GString *sql;
+  GError *step_error = NULL;
+  int i = 0;
+
+  sql = g_string_new ("INSERT OR IGNORE INTO imported_visits (url, title, visit_time, visit_type) "
+                      "VALUES (?, ?, ?, ?)");
+  for (guint n = 1; n < n_visits; n++)
+    g_string_append (sql, ", (?, ?, ?, ?)");
+
+  if (n_visits == IMPORT_ROWS_PER_INSERT)
+    statement = ephy_sqlite_connection_borrow_statement (self->history_database, sql->str, error);
+  else
+    statement = ephy_sqlite_connection_create_statement (self->history_database, sql->str, error);
+  g_string_free (sql, TRUE);
+
+  if (!statement)
+    return FALSE;
+
+  for (guint n = 0; n < n_visits; n++) {
+    if (!ephy_sqlite_statement_bind_string (statement, i++, visits[n]->url->url, error) ||
+        !ephy_sqlite_statement_bind_string (statement, i++, visits[n]->url->title, error) ||
+        !ephy_sqlite_statement_bind_int64 (statement, i++, visits[n]->visit_time, error) ||
+        !ephy_sqlite_statement_bind_int (statement, i++, visits[n]->visit_type, error)) {
+      g_object_unref (statement);
+      return FALSE;
+    }
+  }
+
+  ephy_sqlite_statement_step (statement, &step_error);
+  g_object_unref (statement);
+
+  if (step_error) {
+    g_propagate_error (error, step_error);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+stage_visits (EphyHistoryService *self,
+              GPtrArray          *visits,
+              GError            **error)
+{
+  for (guint i = 0; i < visits->len; i += IMPORT_ROWS_PER_INSERT) {
+    if (!stage_visit_rows (self,
+                           (EphyHistoryPageVisit **)visits->pdata + i,
+                           MIN (IMPORT_ROWS_PER_INSERT, visits->len - i),
+                           error))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static EphyHistoryPageVisit *
+read_staged_visit (EphySQLiteStatement *statement)
+{
+  return ephy_history_page_visit_new_with_url (ephy_history_url_new (ephy_sqlite_statement_get_column_as_string (statement, 0),
+                                                                     ephy_sqlite_statement_get_column_as_string (statement, 1),
+                                                                     0, 0, 0),
+                                               ephy_sqlite_statement_get_column_as_int64 (statement, 2),
+                                               ephy_sqlite_statement_get_column_as_int (statement, 3));
+}
+
+/* Copies the visits of the source database into the staging table. */
 static gboolean
-ephy_history_service_execute_add_visits (EphyHistoryService *self, GList *visits, gpointer *result)
+ephy_history_service_stage_import (EphyHistoryService   *self,
+                                   ImportJob            *job,
+                                   EphySQLiteConnection *connection,
+                                   GError              **error)
 {
+  EphySQLiteStatement *statement;
+  GPtrArray *visits;
   gboolean success = TRUE;
-  g_assert (self->history_thread == g_thread_self ());
 
-  if (self->read_only)
+  statement = ephy_sqlite_connection_create_statement (connection, import_queries[job->source], error);
+  if (!statement)
     return FALSE;
 
-  while (visits) {
-    success = success && ephy_history_service_execute_add_visit_helper (self, (EphyHistoryPageVisit *)visits->data);
-    visits = visits->next;
+  visits = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_history_page_visit_free);
+
+  while (success && ephy_sqlite_statement_step (statement, error)) {
+    EphyHistoryPageVisit *visit = read_imported_visit (job->source, statement);
+
+    if (visit)
+      g_ptr_array_add (visits, visit);
+
+    if (visits->len < IMPORT_VISITS_PER_BATCH)
+      continue;
+
+    success = stage_visits (self, visits, error);
+    g_ptr_array_set_size (visits, 0);
+
+    if (g_cancellable_is_cancelled (job->cancellable))
+      success = FALSE;
   }
 
+  if (*error)
+    success = FALSE;
+
+  if (success)
+    success = stage_visits (self, visits, error);
+
+  g_ptr_array_free (visits, TRUE);
+  g_object_unref (statement);
+
+  return success;
+}
+
+/* Writes the staged visits to the history, the visits of each URL together
+ * so that every batch looks most URLs up only once. */
+static gboolean
+ephy_history_service_write_import (EphyHistoryService *self,
+                                   ImportJob          *job,
+                                   guint              *n_visits,
+                                   GError            **error)
+{
+  EphySQLiteStatement *statement;
+  GPtrArray *visits;
+  gboolean success = TRUE;
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "SELECT url, title, visit_time, visit_type "
+                                                       "FROM imported_visits ORDER BY url", error);
+  if (!statement)
+    return FALSE;
+
+  visits = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_history_page_visit_free);
+
+  while (success && ephy_sqlite_statement_step (statement, error)) {
+    g_ptr_array_add (visits, read_staged_visit (statement));
+
+    if (visits->len < IMPORT_VISITS_PER_BATCH)
+      continue;
+
+    success = import_visits (self, visits);
+    *n_visits += visits->len;
+    g_ptr_array_set_size (visits, 0);
+
+    queue_import_progress (self, job, *n_visits);
+
+    if (g_cancellable_is_cancelled (job->cancellable))
+      break;
+  }
+
+  if (*error)
+    success = FALSE;
+
+  if (success && visits->len > 0) {
+    success = import_visits (self, visits);
+    *n_visits += visits->len;
+  }
+
+  g_ptr_array_free (visits, TRUE);
+  g_object_unref (statement);
+
+  return success;
+}
+
+/* The whole import happens in the long-running transaction of the history
+ * thread, so it is committed once at the end and readers never see the
+ * database without its indexes. */
+static gboolean
+ephy_history_service_execute_import (EphyHistoryService *self,
+                                     ImportJob          *job,
+                                     gpointer           *result)
+{
+  EphySQLiteConnection *connection;
+  GError *error = NULL;
+  guint n_visits = 0;
+  gboolean success = FALSE;
+
+  if (self->read_only || g_cancellable_is_cancelled (job->cancellable))
+    return FALSE;
+
+  connection = ephy_sqlite_connection_new ();
+  if (!ephy_sqlite_connection_open (connection, job->filename, &error) ||
+      !ephy_sqlite_connection_execute (connection, "PRAGMA query_only = ON", &error))
+    goto out;
+
+  if (!ephy_sqlite_connection_execute (self->history_database, staging_table_sql, &error))
+    goto out;
+
+  /* Known visits are dropped while the visits index is still there. */
+  if (!ephy_history_service_stage_import (self, job, connection, &error) ||
+      !ephy_sqlite_connection_execute (self->history_database,
+                                       "DELETE FROM imported_visits WHERE EXISTS ("
+                                       "SELECT 1 FROM urls JOIN visits ON visits.url = urls.id "
+                                       "WHERE urls.url = imported_visits.url "
+                                       "AND visits.visit_time = imported_visits.visit_time)",
+                                       &error))
+    goto drop;
+
+  if (!ephy_history_service_defer_indexes (self, &error))
+    goto restore;
+
+  success = ephy_history_service_write_import (self, job, &n_visits, &error);
+
+restore:
+  /* Even a failed import must leave the indexes in place. */
+  if (!ephy_history_service_restore_indexes (self, error ? NULL : &error))
+    success = FALSE;
+
   ephy_history_service_schedule_commit (self);
 
+drop:
+  if (!ephy_sqlite_connection_execute (self->history_database, "DROP TABLE temp.imported_visits", error ? NULL : &error))
+    success = FALSE;
+
+out:
+  if (error) {
+    g_warning ("Could not import history from %s: %s", job->filename, error->message);
+    g_error_free (error);
+  }
+
+  ephy_sqlite_connection_close (connection);
+  g_object_unref (connection);
+
+  LOG ("Imported %u visits from %s", n_visits, job->filename);
+  *result = GUINT_TO_POINTER (n_visits);
+
   return success;
 }
 
@@ -757,6 +1555,36 @@ ephy_history_service_query_urls (EphyHistoryService *self, EphyHistoryQuery *que
   ephy_history_service_send_message (self, message);
 }
 
+static gboolean
+ephy_history_service_execute_count_urls (EphyHistoryService *self, EphyHistoryQuery *query, gpointer *result)
+{
+  EphyHistoryURLCount *count = g_slice_new0 (EphyHistoryURLCount);
+
+  count->count = ephy_history_service_count_url_rows (self, query, &count->url_match);
+  *result = count;
+
+  return TRUE;
+}
+
+/* Counts the URLs ephy_history_service_query_urls() would find for @query,
+ * ignoring its limit and offset. The result is an EphyHistoryURLCount, to
+ * be freed with ephy_history_url_count_free(). Copy its url_match into the
+ * queries reading the rows, so that they match them the way they were
+ * counted. */
+void
+ephy_history_service_count_urls (EphyHistoryService *self, EphyHistoryQuery *query, GCancellable *cancellable, EphyHistoryJobCallback callback, gpointer user_data)
+{
+  EphyHistoryServiceMessage *message;
+
+  g_return_if_fail (EPHY_IS_HISTORY_SERVICE (self));
+  g_return_if_fail (query != NULL);
+
+  message = ephy_history_service_message_new (self, COUNT_URLS,
+                                              ephy_history_query_copy (query), (GDestroyNotify)ephy_history_query_free,
+                                              cancellable, callback, user_data);
+  ephy_history_service_send_message (self, message);
+}
+
 void
 ephy_history_service_get_hosts (EphyHistoryService    *self,
                                 GCancellable          *cancellable,
@@ -882,6 +1710,32 @@ ephy_history_service_execute_set_url_zoom_level (EphyHistoryService *self,
   return TRUE;
 }
 
+/* Returns the URL of the host row that ephy_history_service_get_host_row_from_url()
+ * would find or add for @url. Must be called with the zoom levels locked. */
+static char *
+get_zoom_level_host_url (EphyHistoryService *self,
+                         const char         *url)
+{
+  GList *host_locations;
+  char *hostname;
+  char *host_url = NULL;
+
+  host_locations = ephy_history_service_get_host_locations (url, &hostname);
+
+  for (GList *l = host_locations; l && !host_url; l = l->next) {
+    if (g_hash_table_contains (self->zoom_levels, l->data))
+      host_url = g_strdup (l->data);
+  }
+
+  if (!host_url)
+    host_url = g_strdup (host_locations->data);
+
+  g_list_free_full (host_locations, g_free);
+  g_free (hostname);
+
+  return host_url;
+}
+
 void
 ephy_history_service_set_url_zoom_level (EphyHistoryService    *self,
                                          const char            *url,
@@ -896,6 +1750,19 @@ ephy_history_service_set_url_zoom_level (EphyHistoryService    *self,
   g_return_if_fail (EPHY_IS_HISTORY_SERVICE (self));
   g_return_if_fail (url != NULL);
 
+  /* Let the next page of the host find its zoom level before the history
+   * thread gets to this message. */
+  if (!self->read_only) {
+    g_rw_lock_writer_lock (&self->zoom_levels_lock);
+    if (self->zoom_levels_loaded) {
+      double *value = g_new (double, 1);
+
+      *value = zoom_level;
+      g_hash_table_replace (self->zoom_levels, get_zoom_level_host_url (self, url), value);
+    }
+    g_rw_lock_writer_unlock (&self->zoom_levels_lock);
+  }
+
   variant = g_variant_new ("(sd)", url, zoom_level);
 
   message = ephy_history_service_message_new (self, SET_URL_ZOOM_LEVEL,
@@ -904,6 +1771,47 @@ ephy_history_service_set_url_zoom_level (EphyHistoryService    *self,
   ephy_history_service_send_message (self, message);
 }
 
+/**
+ * ephy_history_service_get_cached_zoom_level:
+ * @self: an #EphyHistoryService
+ * @url: the address of a page
+ * @zoom_level: (out): return location for the zoom level of the host of @url
+ *
+ * Looks up the zoom level of the host of @url without waiting for the
+ * history thread, so it can be applied before the page is first painted.
+ * This is not possible while the hosts are being read, or with read-only
+ * services, whose database another instance may be changing.
+ *
+ * Returns: %TRUE if @zoom_level was set
+ */
+gboolean
+ephy_history_service_get_cached_zoom_level (EphyHistoryService *self,
+                                            const char         *url,
+                                            double             *zoom_level)
+{
+  gboolean found;
+
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (self), FALSE);
+  g_return_val_if_fail (url != NULL, FALSE);
+  g_return_val_if_fail (zoom_level != NULL, FALSE);
+
+  g_rw_lock_reader_lock (&self->zoom_levels_lock);
+
+  found = self->zoom_levels_loaded;
+  if (found) {
+    char *host_url = get_zoom_level_host_url (self, url);
+    double *value = g_hash_table_lookup (self->zoom_levels, host_url);
+
+    /* New hosts are added with the default zoom level. */
+    *zoom_level = value ? *value : 1.0;
+    g_free (host_url);
+  }
+
+  g_rw_lock_reader_unlock (&self->zoom_levels_lock);
+
+  return found;
+}
+
 static gboolean
 ephy_history_service_execute_set_url_hidden (EphyHistoryService *self,
                                              EphyHistoryURL     *url,
@@ -1036,6 +1944,9 @@ ephy_history_service_execute_get_host_for_url (EphyHistoryService *self,
   host = ephy_history_service_get_host_row_from_url (self, url);
   g_return_val_if_fail (host != NULL, FALSE);
 
+  /* The host row might just have been created. */
+  ephy_history_service_schedule_commit (self);
+
   *result = host;
 
   return host != NULL;
@@ -1147,6 +2058,54 @@ ephy_history_service_execute_clear (EphyHistoryService *self,
   return TRUE;
 }
 
+/**
+ * ephy_history_service_import:
+ * @self: an #EphyHistoryService
+ * @source: the browser that wrote @filename
+ * @filename: a Firefox places.sqlite or Chromium History database
+ * @cancellable: (nullable): a #GCancellable
+ * @progress_callback: (nullable): called with the number of visits imported
+ *   so far, every few thousand visits
+ * @callback: (nullable): called with the total number of visits imported
+ * @user_data: data for @progress_callback and @callback
+ *
+ * Adds every visit recorded in @filename to the history. The database is
+ * read on the history thread and written in large batches, without the
+ * per-visit overhead of ephy_history_service_add_visit(). Once done, the
+ * ::imported signal is emitted.
+ *
+ * Chromium keeps its database locked while running, so it has to be closed
+ * first, or @filename should be a copy.
+ **/
+void
+ephy_history_service_import (EphyHistoryService               *self,
+                             EphyHistoryImportSource           source,
+                             const char                       *filename,
+                             GCancellable                     *cancellable,
+                             EphyHistoryImportProgressCallback progress_callback,
+                             EphyHistoryJobCallback            callback,
+                             gpointer                          user_data)
+{
+  EphyHistoryServiceMessage *message;
+  ImportJob *job;
+
+  g_return_if_fail (EPHY_IS_HISTORY_SERVICE (self));
+  g_return_if_fail (source == EPHY_HISTORY_IMPORT_FIREFOX || source == EPHY_HISTORY_IMPORT_CHROMIUM);
+  g_return_if_fail (filename != NULL);
+
+  job = g_slice_new (ImportJob);
+  job->source = source;
+  job->filename = g_strdup (filename);
+  job->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  job->progress_callback = progress_callback;
+  job->user_data = user_data;
+
+  message = ephy_history_service_message_new (self, IMPORT,
+                                              job, (GDestroyNotify)import_job_free,
+                                              cancellable, callback, user_data);
+  ephy_history_service_send_message (self, message);
+}
+
 void
 ephy_history_service_delete_urls (EphyHistoryService    *self,
                                   GList                 *urls,
@@ -1212,15 +2171,18 @@ static EphyHistoryServiceMethod methods[] = {
   (EphyHistoryServiceMethod)ephy_history_service_execute_set_url_zoom_level,
   (EphyHistoryServiceMethod)ephy_history_service_execute_set_url_hidden,
   (EphyHistoryServiceMethod)ephy_history_service_execute_set_url_thumbnail_time,
-  (EphyHistoryServiceMethod)ephy_history_service_execute_add_visit,
-  (EphyHistoryServiceMethod)ephy_history_service_execute_add_visits,
+  /* ADD_VISIT and ADD_VISITS, see ephy_history_service_process_visits(). */
+  NULL,
+  NULL,
   (EphyHistoryServiceMethod)ephy_history_service_execute_delete_urls,
   (EphyHistoryServiceMethod)ephy_history_service_execute_delete_host,
   (EphyHistoryServiceMethod)ephy_history_service_execute_clear,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_import,
   (EphyHistoryServiceMethod)ephy_history_service_execute_quit,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_url,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_host_for_url,
   (EphyHistoryServiceMethod)ephy_history_service_execute_query_urls,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_count_urls,
   (EphyHistoryServiceMethod)ephy_history_service_execute_find_visits,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_hosts,
   (EphyHistoryServiceMethod)ephy_history_service_execute_query_hosts
@@ -1232,6 +2194,128 @@ ephy_history_service_message_is_write (EphyHistoryServiceMessage *message)
   return message->type < QUIT;
 }
 
+static gboolean
+ephy_history_service_message_is_reader_query (EphyHistoryServiceMessage *message)
+{
+  /* GET_HOST_FOR_URL is missing on purpose: it creates the host if needed. */
+  switch (message->type) {
+    case GET_URL:
+    case QUERY_URLS:
+    case COUNT_URLS:
+    case QUERY_VISITS:
+    case GET_HOSTS:
+    case QUERY_HOSTS:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static void
+ephy_history_service_complete_message (EphyHistoryServiceMessage *message)
+{
+  if (message->callback || message->type == CLEAR || message->type == IMPORT)
+    g_idle_add ((GSourceFunc)ephy_history_service_execute_job_callback, message);
+  else
+    ephy_history_service_message_free (message);
+}
+
+static void
+ephy_history_service_run_reader (EphyHistoryServiceMessage *message,
+                                 EphyHistoryService        *self)
+{
+  EphySQLiteConnection *connection;
+
+  if (g_cancellable_is_cancelled (message->cancellable)) {
+    ephy_history_service_message_free (message);
+    return;
+  }
+
+  /* There are never more queries running than connections in the pool, so
+   * this opens at most READER_POOL_SIZE connections. */
+  connection = g_async_queue_try_pop (self->idle_readers);
+  if (!connection)
+    connection = ephy_history_service_open_reader (self);
+
+  message->result = NULL;
+  if (connection) {
+    g_private_set (&reader_connection, connection);
+    message->success = methods[message->type] (self, message->method_argument, &message->result);
+    g_private_set (&reader_connection, NULL);
+
+    g_async_queue_push (self->idle_readers, connection);
+  } else
+    message->success = FALSE;
+
+  ephy_history_service_complete_message (message);
+}
+
+static gboolean
+ephy_history_service_message_is_visit (EphyHistoryServiceMessage *message)
+{
+  return message->type == ADD_VISIT || message->type == ADD_VISITS;
+}
+
+static void
+ephy_history_service_process_visits (EphyHistoryService        *self,
+                                     EphyHistoryServiceMessage *message)
+{
+  GPtrArray *messages;
+  VisitBatch batch;
+  gboolean written;
+
+  /* Visits sort before every other write but titles and zoom levels, so all
+   * the ones sent since the thread last woke up are at the head of the
+   * queue. Take them all and leave the rest for later. */
+  messages = g_ptr_array_new ();
+  do {
+    g_ptr_array_add (messages, message);
+    message = g_async_queue_try_pop (self->queue);
+  } while (message && ephy_history_service_message_is_visit (message));
+
+  if (message)
+    g_async_queue_push_front (self->queue, message);
+
+  if (self->read_only || !self->history_database) {
+    for (guint i = 0; i < messages->len; i++) {
+      message = g_ptr_array_index (messages, i);
+      message->result = NULL;
+      message->success = FALSE;
+      ephy_history_service_complete_message (message);
+    }
+    g_ptr_array_free (messages, TRUE);
+    return;
+  }
+
+  visit_batch_init (&batch);
+
+  for (guint i = 0; i < messages->len; i++) {
+    message = g_ptr_array_index (messages, i);
+    message->result = NULL;
+
+    if (message->type == ADD_VISIT) {
+      message->success = visit_batch_add (self, &batch, (EphyHistoryPageVisit *)message->method_argument);
+    } else {
+      message->success = TRUE;
+      for (GList *l = (GList *)message->method_argument; l; l = l->next) {
+        if (!visit_batch_add (self, &batch, l->data))
+          message->success = FALSE;
+      }
+    }
+  }
+
+  written = visit_batch_write (self, &batch);
+  visit_batch_clear (&batch);
+
+  for (guint i = 0; i < messages->len; i++) {
+    message = g_ptr_array_index (messages, i);
+    message->success = message->success && written;
+    ephy_history_service_complete_message (message);
+  }
+
+  g_ptr_array_free (messages, TRUE);
+}
+
 static void
 ephy_history_service_process_message (EphyHistoryService        *self,
                                       EphyHistoryServiceMessage *message)
@@ -1240,12 +2324,27 @@ ephy_history_service_process_message (EphyHistoryService        *self,
 
   g_assert (self->history_thread == g_thread_self ());
 
+  if (ephy_history_service_message_is_visit (message)) {
+    ephy_history_service_process_visits (self, message);
+    return;
+  }
+
   if (g_cancellable_is_cancelled (message->cancellable) &&
       !ephy_history_service_message_is_write (message)) {
     ephy_history_service_message_free (message);
     return;
   }
 
+  if (self->reader_pool && ephy_history_service_message_is_reader_query (message)) {
+    /* Readers only see committed data. Writes are always queued before
+     * reads, so committing here keeps queries consistent with them. */
+    if (ephy_history_service_is_scheduled_to_commit (self))
+      ephy_history_service_commit (self);
+
+    g_thread_pool_push (self->reader_pool, message, NULL);
+    return;
+  }
+
   method = methods[message->type];
   message->result = NULL;
   if (message->service->history_database)
@@ -1253,12 +2352,7 @@ ephy_history_service_process_message (EphyHistoryService        *self,
   else
     message->success = FALSE;
 
-  if (message->callback || message->type == CLEAR)
-    g_idle_add ((GSourceFunc)ephy_history_service_execute_job_callback, message);
-  else
-    ephy_history_service_message_free (message);
-
-  return;
+  ephy_history_service_complete_message (message);
 }
 
 /* Public API. */
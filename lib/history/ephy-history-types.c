@@ -201,6 +201,7 @@ void
 ephy_history_query_free (EphyHistoryQuery *query)
 {
   g_list_free_full (query->substring_list, g_free);
+  ephy_history_url_free (query->after);
   g_slice_free1 (sizeof (EphyHistoryQuery), query);
 }
 
@@ -216,6 +217,9 @@ ephy_history_query_copy (EphyHistoryQuery *query)
   copy->ignore_hidden = query->ignore_hidden;
   copy->ignore_local = query->ignore_local;
   copy->host = query->host;
+  copy->after = ephy_history_url_copy (query->after);
+  copy->offset = query->offset;
+  copy->url_match = query->url_match;
 
   for (iter = query->substring_list; iter != NULL; iter = iter->next) {
     copy->substring_list = g_list_prepend (copy->substring_list, g_strdup (iter->data));
@@ -224,3 +228,9 @@ ephy_history_query_copy (EphyHistoryQuery *query)
 
   return copy;
 }
+
+void
+ephy_history_url_count_free (EphyHistoryURLCount *count)
+{
+  g_slice_free (EphyHistoryURLCount, count);
+}
@@ -45,6 +45,11 @@ typedef enum {
   EPHY_HISTORY_URL_TITLE,
 } EphyHistoryURLProperty;
 
+typedef enum {
+  EPHY_HISTORY_IMPORT_FIREFOX,
+  EPHY_HISTORY_IMPORT_CHROMIUM
+} EphyHistoryImportSource;
+
 typedef enum {
   EPHY_HISTORY_SORT_NONE = 0,
   EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED,
@@ -57,6 +62,14 @@ typedef enum {
   EPHY_HISTORY_SORT_URL_DESCENDING
 } EphyHistorySortType;
 
+/* How the substrings of a URL query are matched. */
+typedef enum {
+  /* Words if the full-text index finds any URL, substrings otherwise. */
+  EPHY_HISTORY_URL_MATCH_ANY = 0,
+  EPHY_HISTORY_URL_MATCH_WORDS,
+  EPHY_HISTORY_URL_MATCH_SUBSTRINGS
+} EphyHistoryURLMatch;
+
 typedef struct
 {
   int id;
@@ -97,8 +110,21 @@ typedef struct _EphyHistoryQuery
   gboolean ignore_local;
   gint host;
   EphyHistorySortType sort_type;
+  /* Only URLs sorted after this one are returned. Only for URL queries. */
+  EphyHistoryURL *after;
+  guint offset;
+  /* Only for URL queries. */
+  EphyHistoryURLMatch url_match;
 } EphyHistoryQuery;
 
+/* The result of ephy_history_service_count_urls(). */
+typedef struct _EphyHistoryURLCount
+{
+  guint count;
+  /* The match the rows were counted with, for the queries reading them. */
+  EphyHistoryURLMatch url_match;
+} EphyHistoryURLCount;
+
 EphyHistoryPageVisit *          ephy_history_page_visit_new (const char *url, gint64 visit_time, EphyHistoryPageVisitType visit_type);
 EphyHistoryPageVisit *          ephy_history_page_visit_new_with_url (EphyHistoryURL *url, gint64 visit_time, EphyHistoryPageVisitType visit_type);
 EphyHistoryPageVisit *          ephy_history_page_visit_copy (EphyHistoryPageVisit *visit);
@@ -122,4 +148,6 @@ EphyHistoryQuery *              ephy_history_query_new (void);
 void                            ephy_history_query_free (EphyHistoryQuery *query);
 EphyHistoryQuery *              ephy_history_query_copy (EphyHistoryQuery *query);
 
+void                            ephy_history_url_count_free (EphyHistoryURLCount *count);
+
 G_END_DECLS
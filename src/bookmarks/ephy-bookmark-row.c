@@ -22,9 +22,7 @@
 
 #include "ephy-bookmark-properties-grid.h"
 #include "ephy-bookmark-row.h"
-#include "ephy-embed-prefs.h"
 #include "ephy-embed-shell.h"
-#include "ephy-favicon-helpers.h"
 
 struct _EphyBookmarkRow {
   GtkListBoxRow    parent_instance;
@@ -83,18 +81,11 @@ ephy_bookmark_row_favicon_loaded_cb (GObject      *source,
                                      gpointer      user_data)
 {
   EphyBookmarkRow *self = user_data;
-  WebKitFaviconDatabase *database = WEBKIT_FAVICON_DATABASE (source);
-  cairo_surface_t *icon_surface;
-  GdkPixbuf *favicon = NULL;
+  GdkPixbuf *favicon;
 
   g_assert (EPHY_IS_BOOKMARK_ROW (self));
 
-  icon_surface = webkit_favicon_database_get_favicon_finish (database, result, NULL);
-  if (icon_surface) {
-    favicon = ephy_pixbuf_get_from_surface_scaled (icon_surface, FAVICON_SIZE, FAVICON_SIZE);
-    cairo_surface_destroy (icon_surface);
-  }
-
+  favicon = ephy_favicon_cache_get_favicon_finish (EPHY_FAVICON_CACHE (source), result, NULL);
   if (favicon) {
     gtk_image_set_from_pixbuf (GTK_IMAGE (self->favicon_image), favicon);
     g_object_unref (favicon);
@@ -153,8 +144,8 @@ static void
 ephy_bookmark_row_constructed (GObject *object)
 {
   EphyBookmarkRow *self = EPHY_BOOKMARK_ROW (object);
-  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
-  WebKitFaviconDatabase *database;
+  EphyFaviconCache *cache;
+  GdkPixbuf *favicon;
 
   G_OBJECT_CLASS (ephy_bookmark_row_parent_class)->constructed (object);
 
@@ -162,12 +153,18 @@ ephy_bookmark_row_constructed (GObject *object)
                           self->title_label, "label",
                           G_BINDING_SYNC_CREATE);
 
-  database = webkit_web_context_get_favicon_database (ephy_embed_shell_get_web_context (shell));
-  webkit_favicon_database_get_favicon (database,
-                                       ephy_bookmark_get_url (self->bookmark),
-                                       NULL,
-                                       (GAsyncReadyCallback)ephy_bookmark_row_favicon_loaded_cb,
-                                       g_object_ref (self));
+  cache = ephy_embed_shell_get_favicon_cache (ephy_embed_shell_get_default ());
+  if (ephy_favicon_cache_lookup (cache, ephy_bookmark_get_url (self->bookmark), &favicon)) {
+    if (favicon)
+      gtk_image_set_from_pixbuf (GTK_IMAGE (self->favicon_image), favicon);
+    return;
+  }
+
+  ephy_favicon_cache_get_favicon_async (cache,
+                                        ephy_bookmark_get_url (self->bookmark),
+                                        NULL,
+                                        (GAsyncReadyCallback)ephy_bookmark_row_favicon_loaded_cb,
+                                        g_object_ref (self));
 }
 
 static void
@@ -22,8 +22,6 @@
 
 #include "ephy-bookmark.h"
 
-#include "ephy-shell.h"
-
 #include <string.h>
 
 #ifdef ENABLE_SYNC
@@ -68,6 +66,7 @@ enum {
 enum {
   TAG_ADDED,
   TAG_REMOVED,
+  ID_CHANGED,
   LAST_SIGNAL
 };
 
@@ -199,6 +198,16 @@ ephy_bookmark_class_init (EphyBookmarkClass *klass)
                   NULL, NULL, NULL,
                   G_TYPE_NONE, 1,
                   G_TYPE_STRING);
+
+  /* The id is not a property, so that it is not serialized with the rest of
+   * the bookmark. */
+  signals[ID_CHANGED] =
+    g_signal_new ("id-changed",
+                  EPHY_TYPE_BOOKMARK,
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE, 0);
 }
 
 static void
@@ -376,8 +385,12 @@ ephy_bookmark_set_id (EphyBookmark *self,
   g_return_if_fail (EPHY_IS_BOOKMARK (self));
   g_return_if_fail (id != NULL);
 
+  if (g_strcmp0 (self->id, id) == 0)
+    return;
+
   g_free (self->id);
   self->id = g_strdup (id);
+  g_signal_emit (self, signals[ID_CHANGED], 0);
 }
 
 const char *
@@ -528,17 +541,41 @@ ephy_bookmark_tags_compare (const char *tag1, const char *tag2)
 
 #ifdef ENABLE_SYNC
 char *
-ephy_bookmark_to_bso (EphyBookmark *self)
+ephy_bookmark_encrypt_bso (const char   *id,
+                           const char   *serialized,
+                           const guint8 *sync_key)
 {
-  EphySyncService *service;
   guint8 *encrypted;
-  guint8 *sync_key;
-  char *serialized;
   char *payload;
   char *bso;
   gsize length;
 
+  g_return_val_if_fail (id != NULL, NULL);
+  g_return_val_if_fail (serialized != NULL, NULL);
+  g_return_val_if_fail (sync_key != NULL, NULL);
+
+  /* This only touches its arguments, so that it can run in a worker thread
+   * on a bookmark serialized beforehand in the main thread. */
+  encrypted = ephy_sync_crypto_aes_256 (AES_256_MODE_ENCRYPT, sync_key,
+                                        (guint8 *)serialized, strlen (serialized), &length);
+  payload = ephy_sync_crypto_base64_urlsafe_encode (encrypted, length, FALSE);
+  bso = ephy_sync_utils_create_bso_json (id, payload);
+
+  g_free (encrypted);
+  g_free (payload);
+
+  return bso;
+}
+
+char *
+ephy_bookmark_to_bso (EphyBookmark *self,
+                      const guint8 *sync_key)
+{
+  char *serialized;
+  char *bso;
+
   g_return_val_if_fail (EPHY_IS_BOOKMARK (self), NULL);
+  g_return_val_if_fail (sync_key != NULL, NULL);
 
   /* Convert a Bookmark object to a BSO (Basic Store Object). That is a generic
    * JSON wrapper around all items passed into and out of the SyncStorage server.
@@ -552,45 +589,38 @@ ephy_bookmark_to_bso (EphyBookmark *self)
    * See https://docs.services.mozilla.com/storage/apis-1.5.html
    */
 
-  service = ephy_shell_get_sync_service (ephy_shell_get_default ());
-  sync_key = ephy_sync_crypto_decode_hex (ephy_sync_service_get_token (service, TOKEN_KB));
   serialized = json_gobject_to_data (G_OBJECT (self), NULL);
-  encrypted = ephy_sync_crypto_aes_256 (AES_256_MODE_ENCRYPT, sync_key,
-                                        (guint8 *)serialized, strlen (serialized), &length);
-  payload = ephy_sync_crypto_base64_urlsafe_encode (encrypted, length, FALSE);
-  bso = ephy_sync_utils_create_bso_json (self->id, payload);
+  bso = ephy_bookmark_encrypt_bso (self->id, serialized, sync_key);
 
-  g_free (sync_key);
   g_free (serialized);
-  g_free (encrypted);
-  g_free (payload);
 
   return bso;
 }
 
 EphyBookmark *
-ephy_bookmark_from_bso (JsonObject *bso)
+ephy_bookmark_from_bso (JsonObject   *bso,
+                        const guint8 *sync_key)
 {
-  EphySyncService *service;
   EphyBookmark *bookmark = NULL;
   GObject *object;
   GError *error = NULL;
-  guint8 *sync_key;
   guint8 *decoded;
   gsize decoded_len;
   char *decrypted;
 
   g_return_val_if_fail (bso != NULL, NULL);
+  g_return_val_if_fail (sync_key != NULL, NULL);
 
   /* Convert a BSO to a Bookmark object. The flow is similar to the one from
    * ephy_bookmark_to_bso(), only that the steps are reversed:
    * 1. Decode the payload from base64 url safe to raw bytes.
    * 2. Decrypt the bytes using the sync key to obtain the serialized Bookmark.
    * 3. Deserialize the JSON string into a Bookmark object.
+   *
+   * Nothing here depends on global state, so this is safe to call from worker
+   * threads as long as the BSO is not modified meanwhile.
    */
 
-  service = ephy_shell_get_sync_service (ephy_shell_get_default ());
-  sync_key = ephy_sync_crypto_decode_hex (ephy_sync_service_get_token (service, TOKEN_KB));
   decoded = ephy_sync_crypto_base64_urlsafe_decode (json_object_get_string_member (bso, "payload"),
                                                     &decoded_len, FALSE);
   decrypted = (char *)ephy_sync_crypto_aes_256 (AES_256_MODE_DECRYPT, sync_key,
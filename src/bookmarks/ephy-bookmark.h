@@ -71,8 +71,13 @@ int                  ephy_bookmark_tags_compare          (const char *tag1,
                                                           const char *tag2);
 
 #ifdef ENABLE_SYNC
-char                *ephy_bookmark_to_bso                (EphyBookmark *self);
-EphyBookmark        *ephy_bookmark_from_bso              (JsonObject *bso);
+char                *ephy_bookmark_encrypt_bso           (const char   *id,
+                                                          const char   *serialized,
+                                                          const guint8 *sync_key);
+char                *ephy_bookmark_to_bso                (EphyBookmark *self,
+                                                          const guint8 *sync_key);
+EphyBookmark        *ephy_bookmark_from_bso              (JsonObject   *bso,
+                                                          const guint8 *sync_key);
 #endif
 
 gboolean             ephy_bookmark_is_smart              (EphyBookmark *self);
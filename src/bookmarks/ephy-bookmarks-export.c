@@ -33,8 +33,8 @@ gvdb_hash_table_insert_variant (GHashTable *table,
   gvdb_item_set_value (item, value);
 }
 
-static GVariant *
-build_variant (EphyBookmark *bookmark)
+GVariant *
+ephy_bookmarks_export_bookmark (EphyBookmark *bookmark)
 {
   GVariantBuilder builder;
   GSequence *tags;
@@ -65,7 +65,7 @@ add_bookmark_to_table (EphyBookmark *bookmark, GHashTable *table)
 {
   gvdb_hash_table_insert_variant (table,
                                   ephy_bookmark_get_url (bookmark),
-                                  build_variant (bookmark));
+                                  ephy_bookmarks_export_bookmark (bookmark));
 }
 
 static void
@@ -98,3 +98,35 @@ ephy_bookmarks_export (EphyBookmarksManager  *manager,
 
   return result;
 }
+
+gboolean
+ephy_bookmarks_export_tables (GHashTable  *tags,
+                              GHashTable  *bookmarks,
+                              const char  *filename,
+                              GError     **error)
+{
+  GHashTable *root_table;
+  GHashTable *table;
+  GHashTableIter iter;
+  gpointer key, value;
+  gboolean result;
+
+  root_table = gvdb_hash_table_new (NULL, NULL);
+
+  table = gvdb_hash_table_new (root_table, "tags");
+  g_hash_table_iter_init (&iter, tags);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    gvdb_hash_table_insert (table, key);
+  g_hash_table_unref (table);
+
+  table = gvdb_hash_table_new (root_table, "bookmarks");
+  g_hash_table_iter_init (&iter, bookmarks);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    gvdb_hash_table_insert_variant (table, key, value);
+  g_hash_table_unref (table);
+
+  result = gvdb_table_write_contents (root_table, filename, FALSE, error);
+  g_hash_table_unref (root_table);
+
+  return result;
+}
@@ -24,8 +24,14 @@
 
 G_BEGIN_DECLS
 
-gboolean        ephy_bookmarks_export       (EphyBookmarksManager  *manager,
-                                             const char            *filename,
-                                             GError               **error);
+gboolean        ephy_bookmarks_export           (EphyBookmarksManager  *manager,
+                                                 const char            *filename,
+                                                 GError               **error);
+gboolean        ephy_bookmarks_export_tables    (GHashTable            *tags,
+                                                 GHashTable            *bookmarks,
+                                                 const char            *filename,
+                                                 GError               **error);
+
+GVariant       *ephy_bookmarks_export_bookmark  (EphyBookmark          *bookmark);
 
 G_END_DECLS
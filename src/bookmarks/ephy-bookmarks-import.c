@@ -22,7 +22,7 @@
 
 #include "config.h"
 
-#include "ephy-shell.h"
+#include "ephy-bookmark.h"
 #include "ephy-sqlite-connection.h"
 #include "gvdb-builder.h"
 #include "gvdb-reader.h"
@@ -38,6 +38,41 @@ typedef enum {
   BOOKMARKS_IMPORT_ERROR_BOOKMARKS = 1002
 } BookmarksImportErrorCode;
 
+EphyBookmark *
+ephy_bookmarks_import_bookmark (const char *url,
+                                GVariant   *variant)
+{
+  EphyBookmark *bookmark;
+  GVariantIter *iter;
+  GSequence *tags;
+  char *tag;
+  const char *title;
+  gint64 time_added;
+  const char *id;
+  double modified;
+  gboolean uploaded;
+
+  g_variant_get (variant, "(x&s&sdbas)", &time_added, &title, &id, &modified, &uploaded, &iter);
+
+  /* Add all stored tags in a GSequence. */
+  tags = g_sequence_new (g_free);
+  while (g_variant_iter_next (iter, "s", &tag)) {
+    g_sequence_insert_sorted (tags, tag,
+                              (GCompareDataFunc)ephy_bookmark_tags_compare,
+                              NULL);
+  }
+  g_variant_iter_free (iter);
+
+  /* Create the new bookmark. */
+  bookmark = ephy_bookmark_new (url, title, tags);
+  ephy_bookmark_set_time_added (bookmark, time_added);
+  ephy_bookmark_set_id (bookmark, id);
+  ephy_bookmark_set_modification_time (bookmark, modified);
+  ephy_bookmark_set_is_uploaded (bookmark, uploaded);
+
+  return bookmark;
+}
+
 static GSequence *
 get_bookmarks_from_table (GvdbTable *table)
 {
@@ -51,39 +86,11 @@ get_bookmarks_from_table (GvdbTable *table)
   /* Iterate over all keys (url's) in the table. */
   list = gvdb_table_get_names (table, &length);
   for (i = 0; i < length; i++) {
-    EphyBookmark *bookmark;
     GVariant *value;
-    GVariantIter *iter;
-    GSequence *tags;
-    char *tag;
-    const char *title;
-    gint64 time_added;
-    char *id;
-    double modified;
-    gboolean uploaded;
 
     /* Obtain the corresponding GVariant. */
     value = gvdb_table_get_value (table, list[i]);
-
-    g_variant_get (value, "(x&s&sdbas)", &time_added, &title, &id, &modified, &uploaded, &iter);
-
-    /* Add all stored tags in a GSequence. */
-    tags = g_sequence_new (g_free);
-    while (g_variant_iter_next (iter, "s", &tag)) {
-      g_sequence_insert_sorted (tags, tag,
-                                (GCompareDataFunc)ephy_bookmark_tags_compare,
-                                NULL);
-    }
-    g_variant_iter_free (iter);
-
-    /* Create the new bookmark. */
-    bookmark = ephy_bookmark_new (list[i], title, tags);
-    ephy_bookmark_set_time_added (bookmark, time_added);
-    ephy_bookmark_set_id (bookmark, id);
-    ephy_bookmark_set_modification_time (bookmark, modified);
-    ephy_bookmark_set_is_uploaded (bookmark, uploaded);
-    g_sequence_prepend (bookmarks, bookmark);
-
+    g_sequence_prepend (bookmarks, ephy_bookmarks_import_bookmark (list[i], value));
     g_variant_unref (value);
   }
 
@@ -155,145 +162,190 @@ ephy_bookmarks_import (EphyBookmarksManager  *manager,
   return res;
 }
 
+typedef struct {
+  GSequence *bookmarks;
+  char **tags;
+} FirefoxBookmarks;
+
 static void
-load_tags_for_bookmark (EphySQLiteConnection  *connection,
-                        EphyBookmark          *bookmark,
-                        int                    bookmark_id)
+firefox_bookmarks_free (FirefoxBookmarks *result)
 {
-  EphyBookmarksManager *manager = ephy_shell_get_bookmarks_manager (ephy_shell_get_default ());
-  EphySQLiteStatement *statement = NULL;
-  GError *error = NULL;
-  const char *statement_str = "SELECT tag.title "
-                              "FROM moz_bookmarks b, moz_bookmarks tag "
-                              "WHERE b.fk=(SELECT fk FROM moz_bookmarks WHERE id=?) "
-                              "AND b.title IS NULL "
-                              "AND tag.id=b.parent "
-                              "ORDER BY tag.title ";
-
-  statement = ephy_sqlite_connection_create_statement (connection,
-                                                       statement_str,
-                                                       &error);
-  if (error) {
-    g_warning ("[Bookmark %d] Could not build tags query statement: %s", bookmark_id, error->message);
-    goto out;
-  }
-
-  if (ephy_sqlite_statement_bind_int (statement, 0, bookmark_id, &error) == FALSE) {
-    g_warning ("[Bookmark %d] Could not bind tag id in statement: %s", bookmark_id, error->message);
-    goto out;
-  }
-
-  while (ephy_sqlite_statement_step (statement, &error)) {
-    const char *tag = ephy_sqlite_statement_get_column_as_string (statement, 0);
-
-    if (!ephy_bookmarks_manager_tag_exists (manager, tag))
-      ephy_bookmarks_manager_create_tag (manager, tag);
-
-    ephy_bookmark_add_tag (bookmark, tag);
-  }
-
-  if (error) {
-    g_warning ("[Bookmark %d] Could not execute tags query statement: %s", bookmark_id, error->message);
-    goto out;
-  }
-
-  out:
-    if (statement)
-      g_object_unref (statement);
-    if (error)
-      g_error_free (error);
+  g_sequence_free (result->bookmarks);
+  g_strfreev (result->tags);
+  g_slice_free (FirefoxBookmarks, result);
 }
 
-gboolean
-ephy_bookmarks_import_from_firefox (EphyBookmarksManager  *manager,
-                                    const gchar           *profile,
-                                    GError               **error)
+/* Tags are bookmarks without a title whose parent is the tag folder. They
+ * are joined to every bookmark of the same place and separated with the
+ * unit separator, which cannot be typed in a tag. */
+#define FIREFOX_TAGS_SEPARATOR "\x1f"
+
+static void
+read_firefox_bookmarks_thread (GTask        *task,
+                               gpointer      source_object,
+                               const char   *filename,
+                               GCancellable *cancellable)
 {
-  EphySQLiteConnection *connection = NULL;
+  EphySQLiteConnection *connection;
   EphySQLiteStatement *statement = NULL;
-  GSequence *bookmarks = NULL;
-  gboolean ret = TRUE;
-  gchar *filename;
-  const char *statement_str = "SELECT b.id, p.url, b.title, b.dateAdded "
+  FirefoxBookmarks *result;
+  GHashTable *all_tags;
+  GError *error = NULL;
+  const char *statement_str = "SELECT p.url, b.title, b.dateAdded, "
+                              "       GROUP_CONCAT(tag.title, char(31)) "
                               "FROM moz_bookmarks b "
                               "JOIN moz_places p ON b.fk=p.id "
+                              "LEFT JOIN moz_bookmarks t ON t.fk=b.fk AND t.title IS NULL "
+                              "LEFT JOIN moz_bookmarks tag ON tag.id=t.parent "
                               "WHERE b.type=1 AND p.url NOT LIKE 'about%' "
                               "               AND p.url NOT LIKE 'place%' "
                               "               AND b.title IS NOT NULL "
+                              "GROUP BY b.id "
                               "ORDER BY p.url ";
 
-  filename = g_build_filename (g_get_home_dir (),
-                               FIREFOX_PROFILES_DIR,
-                               profile,
-                               FIREFOX_BOOKMARKS_FILE,
-                               NULL);
-
   connection = ephy_sqlite_connection_new ();
-  ephy_sqlite_connection_open (connection, filename, error);
-  if (*error) {
-    g_warning ("Could not open database at %s: %s", filename, (*error)->message);
-    g_error_free (*error);
-    g_set_error (error,
-                 BOOKMARKS_IMPORT_ERROR,
-                 BOOKMARKS_IMPORT_ERROR_BOOKMARKS,
-                 _("Firefox bookmarks database could not be opened. Close Firefox and try again."));
+  ephy_sqlite_connection_open (connection, filename, &error);
+  if (error) {
+    g_warning ("Could not open database at %s: %s", filename, error->message);
+    g_error_free (error);
+    g_task_return_new_error (task,
+                             BOOKMARKS_IMPORT_ERROR,
+                             BOOKMARKS_IMPORT_ERROR_BOOKMARKS,
+                             _("Firefox bookmarks database could not be opened. Close Firefox and try again."));
     goto out;
   }
 
   statement = ephy_sqlite_connection_create_statement (connection,
                                                        statement_str,
-                                                       error);
+                                                       &error);
   if (statement == NULL) {
-    g_warning ("Could not build bookmarks query statement: %s", (*error)->message);
-    g_error_free (*error);
-    g_set_error (error,
-                 BOOKMARKS_IMPORT_ERROR,
-                 BOOKMARKS_IMPORT_ERROR_BOOKMARKS,
-                 _("Firefox bookmarks could not be retrieved!"));
-    ret = FALSE;
+    g_warning ("Could not build bookmarks query statement: %s", error->message);
+    g_error_free (error);
+    g_task_return_new_error (task,
+                             BOOKMARKS_IMPORT_ERROR,
+                             BOOKMARKS_IMPORT_ERROR_BOOKMARKS,
+                             _("Firefox bookmarks could not be retrieved!"));
     goto out;
   }
 
-  bookmarks = g_sequence_new (g_object_unref);
-  while (ephy_sqlite_statement_step (statement, error)) {
-    int bookmark_id = ephy_sqlite_statement_get_column_as_int (statement, 0);
-    const char *url = ephy_sqlite_statement_get_column_as_string (statement, 1);
-    const char *title = ephy_sqlite_statement_get_column_as_string (statement, 2);
-    gint64 time_added = ephy_sqlite_statement_get_column_as_int64 (statement, 3);
+  result = g_slice_new (FirefoxBookmarks);
+  result->bookmarks = g_sequence_new (g_object_unref);
+  all_tags = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  while (ephy_sqlite_statement_step (statement, &error)) {
+    const char *url = ephy_sqlite_statement_get_column_as_string (statement, 0);
+    const char *title = ephy_sqlite_statement_get_column_as_string (statement, 1);
+    gint64 time_added = ephy_sqlite_statement_get_column_as_int64 (statement, 2);
+    const char *tags_str = ephy_sqlite_statement_get_column_as_string (statement, 3);
     EphyBookmark *bookmark;
     GSequence *tags;
 
     tags = g_sequence_new (g_free);
+    if (tags_str) {
+      char **split = g_strsplit (tags_str, FIREFOX_TAGS_SEPARATOR, -1);
+
+      for (guint i = 0; split[i]; i++) {
+        if (g_sequence_lookup (tags, split[i], (GCompareDataFunc)ephy_bookmark_tags_compare, NULL))
+          continue;
+
+        g_sequence_insert_sorted (tags, g_strdup (split[i]),
+                                  (GCompareDataFunc)ephy_bookmark_tags_compare,
+                                  NULL);
+        if (!g_hash_table_contains (all_tags, split[i]))
+          g_hash_table_add (all_tags, g_strdup (split[i]));
+      }
+      g_strfreev (split);
+    }
+
     bookmark = ephy_bookmark_new (url, title, tags);
     ephy_bookmark_set_time_added (bookmark, time_added);
-    load_tags_for_bookmark (connection, bookmark, bookmark_id);
 
-    g_sequence_prepend (bookmarks, bookmark);
+    g_sequence_prepend (result->bookmarks, bookmark);
   }
 
-  if (*error) {
-    g_warning ("Could not execute bookmarks query statement: %s", (*error)->message);
-    g_error_free (*error);
-    g_set_error (error,
-                 BOOKMARKS_IMPORT_ERROR,
-                 BOOKMARKS_IMPORT_ERROR_BOOKMARKS,
-                 _("Firefox bookmarks could not be retrieved!"));
-    ret = FALSE;
+  result->tags = (char **)g_hash_table_get_keys_as_array (all_tags, NULL);
+  g_hash_table_steal_all (all_tags);
+  g_hash_table_destroy (all_tags);
+
+  if (error) {
+    g_warning ("Could not execute bookmarks query statement: %s", error->message);
+    g_error_free (error);
+    firefox_bookmarks_free (result);
+    g_task_return_new_error (task,
+                             BOOKMARKS_IMPORT_ERROR,
+                             BOOKMARKS_IMPORT_ERROR_BOOKMARKS,
+                             _("Firefox bookmarks could not be retrieved!"));
     goto out;
   }
 
-  ephy_bookmarks_manager_add_bookmarks (manager, bookmarks);
+  g_task_return_pointer (task, result, (GDestroyNotify)firefox_bookmarks_free);
 
   out:
-    g_free (filename);
-    if (connection) {
-      ephy_sqlite_connection_close (connection);
-      g_object_unref (connection);
-    }
+    ephy_sqlite_connection_close (connection);
+    g_object_unref (connection);
     if (statement)
       g_object_unref (statement);
-    if (bookmarks)
-      g_sequence_free (bookmarks);
+}
+
+static void
+firefox_bookmarks_read_cb (EphyBookmarksManager *manager,
+                           GAsyncResult         *result,
+                           GTask                *task)
+{
+  FirefoxBookmarks *bookmarks;
+  GError *error = NULL;
+
+  bookmarks = g_task_propagate_pointer (G_TASK (result), &error);
+  if (!bookmarks) {
+    g_task_return_error (task, error);
+    g_object_unref (task);
+    return;
+  }
+
+  ephy_bookmarks_manager_create_tags (manager, (const char * const *)bookmarks->tags);
+  ephy_bookmarks_manager_add_bookmarks (manager, bookmarks->bookmarks);
+  firefox_bookmarks_free (bookmarks);
+
+  g_task_return_boolean (task, TRUE);
+  g_object_unref (task);
+}
+
+/* Reads the bookmarks of the Firefox @profile in a thread, then adds them
+ * and their tags to @manager at once. */
+void
+ephy_bookmarks_import_from_firefox_async (EphyBookmarksManager *manager,
+                                          const char           *profile,
+                                          GCancellable         *cancellable,
+                                          GAsyncReadyCallback   callback,
+                                          gpointer              user_data)
+{
+  GTask *task;
+  GTask *read_task;
+  char *filename;
+
+  g_return_if_fail (EPHY_IS_BOOKMARKS_MANAGER (manager));
+  g_return_if_fail (profile != NULL);
+
+  filename = g_build_filename (g_get_home_dir (),
+                               FIREFOX_PROFILES_DIR,
+                               profile,
+                               FIREFOX_BOOKMARKS_FILE,
+                               NULL);
+
+  task = g_task_new (manager, cancellable, callback, user_data);
+
+  read_task = g_task_new (manager, cancellable, (GAsyncReadyCallback)firefox_bookmarks_read_cb, task);
+  g_task_set_task_data (read_task, filename, g_free);
+  g_task_run_in_thread (read_task, (GTaskThreadFunc)read_firefox_bookmarks_thread);
+  g_object_unref (read_task);
+}
+
+gboolean
+ephy_bookmarks_import_from_firefox_finish (EphyBookmarksManager *manager,
+                                           GAsyncResult         *result,
+                                           GError              **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, manager), FALSE);
 
-  return ret;
+  return g_task_propagate_boolean (G_TASK (result), error);
 }
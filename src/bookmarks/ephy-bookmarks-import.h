@@ -32,8 +32,17 @@ gboolean    ephy_bookmarks_import               (EphyBookmarksManager  *manager,
                                                  const char            *filename,
                                                  GError               **error);
 
-gboolean    ephy_bookmarks_import_from_firefox  (EphyBookmarksManager  *manager,
-                                                 const gchar           *profile,
-                                                 GError               **error);
+void        ephy_bookmarks_import_from_firefox_async  (EphyBookmarksManager  *manager,
+                                                       const char            *profile,
+                                                       GCancellable          *cancellable,
+                                                       GAsyncReadyCallback    callback,
+                                                       gpointer               user_data);
+
+gboolean    ephy_bookmarks_import_from_firefox_finish (EphyBookmarksManager  *manager,
+                                                       GAsyncResult          *result,
+                                                       GError               **error);
+
+EphyBookmark *ephy_bookmarks_import_bookmark    (const char            *url,
+                                                 GVariant              *variant);
 
 G_END_DECLS
@@ -26,7 +26,9 @@ struct _EphyBookmarksListModel {
   GObject     parent_instance;
 
   EphyBookmarksManager *bookmarks_manager;
-  GList *dumb_bookmarks;
+
+  /* The bookmarks that are not smart, most recently added first. */
+  GPtrArray *dumb_bookmarks;
 };
 
 static void list_model_iface_init (GListModelInterface *iface);
@@ -42,42 +44,171 @@ enum {
 
 static GParamSpec *obj_properties[LAST_PROP];
 
+/* The order of the manager, made total so that every bookmark has exactly
+ * one place to be found at. */
+static int
+compare_bookmarks (EphyBookmark *bookmark1,
+                   EphyBookmark *bookmark2)
+{
+  gint64 time1 = ephy_bookmark_get_time_added (bookmark1);
+  gint64 time2 = ephy_bookmark_get_time_added (bookmark2);
+
+  if (time1 != time2)
+    return time1 > time2 ? -1 : 1;
+
+  return bookmark1 < bookmark2 ? -1 : bookmark1 > bookmark2;
+}
+
+static int
+compare_bookmark_pointers (EphyBookmark **bookmark1,
+                           EphyBookmark **bookmark2)
+{
+  return compare_bookmarks (*bookmark1, *bookmark2);
+}
+
+/* Returns the position of the first bookmark that sorts after @bookmark. */
+static guint
+get_insert_position (EphyBookmarksListModel *self,
+                     EphyBookmark           *bookmark)
+{
+  guint low = 0;
+  guint high = self->dumb_bookmarks->len;
+
+  while (low < high) {
+    guint middle = low + (high - low) / 2;
+
+    if (compare_bookmarks (g_ptr_array_index (self->dumb_bookmarks, middle), bookmark) <= 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+static gboolean
+find_bookmark_in_place (EphyBookmarksListModel *self,
+                        EphyBookmark           *bookmark,
+                        guint                  *position)
+{
+  guint insert_position;
+
+  insert_position = get_insert_position (self, bookmark);
+  if (insert_position > 0 &&
+      g_ptr_array_index (self->dumb_bookmarks, insert_position - 1) == bookmark) {
+    *position = insert_position - 1;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+find_bookmark (EphyBookmarksListModel *self,
+               EphyBookmark           *bookmark,
+               guint                  *position)
+{
+  if (find_bookmark_in_place (self, bookmark, position))
+    return TRUE;
+
+  /* The time the bookmark was added changed since it was inserted. */
+  for (guint i = 0; i < self->dumb_bookmarks->len; i++) {
+    if (g_ptr_array_index (self->dumb_bookmarks, i) == bookmark) {
+      *position = i;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static gboolean
+is_in_order (EphyBookmarksListModel *self,
+             guint                   position)
+{
+  GPtrArray *bookmarks = self->dumb_bookmarks;
+
+  if (position > 0 &&
+      compare_bookmarks (g_ptr_array_index (bookmarks, position - 1),
+                         g_ptr_array_index (bookmarks, position)) > 0)
+    return FALSE;
+
+  if (position + 1 < bookmarks->len &&
+      compare_bookmarks (g_ptr_array_index (bookmarks, position),
+                         g_ptr_array_index (bookmarks, position + 1)) > 0)
+    return FALSE;
+
+  return TRUE;
+}
+
 static void
-maybe_add_bookmark (EphyBookmark           *bookmark,
-                    EphyBookmarksListModel *self)
+insert_bookmark (EphyBookmarksListModel *self,
+                 EphyBookmark           *bookmark)
 {
-  if (!ephy_bookmark_is_smart (bookmark))
-    self->dumb_bookmarks = g_list_append (self->dumb_bookmarks, g_object_ref (bookmark));
+  guint position;
+
+  position = get_insert_position (self, bookmark);
+  g_ptr_array_insert (self->dumb_bookmarks, position, g_object_ref (bookmark));
+
+  g_list_model_items_changed (G_LIST_MODEL (self), position, 0, 1);
 }
 
 static void
-refresh_bookmarks_list (EphyBookmarksListModel *self)
+remove_bookmark (EphyBookmarksListModel *self,
+                 guint                   position)
 {
-  GSequence *bookmarks;
-  guint previous_length = 0;
+  g_ptr_array_remove_index (self->dumb_bookmarks, position);
 
-  if (self->dumb_bookmarks != NULL) {
-    previous_length = g_list_length (self->dumb_bookmarks);
-    g_list_free_full (self->dumb_bookmarks, g_object_unref);
-    self->dumb_bookmarks = NULL;
-  }
+  g_list_model_items_changed (G_LIST_MODEL (self), position, 1, 0);
+}
 
-  bookmarks = ephy_bookmarks_manager_get_bookmarks (self->bookmarks_manager);
-  g_sequence_foreach (bookmarks, (GFunc)maybe_add_bookmark, self);
+static void
+bookmark_added_cb (EphyBookmarksManager   *manager,
+                   EphyBookmark           *bookmark,
+                   EphyBookmarksListModel *self)
+{
+  guint position;
+
+  /* New bookmarks cannot have moved, so don't look further. */
+  if (!ephy_bookmark_is_smart (bookmark) && !find_bookmark_in_place (self, bookmark, &position))
+    insert_bookmark (self, bookmark);
+}
 
-  g_list_model_items_changed (G_LIST_MODEL (self),
-                              0,
-                              previous_length,
-                              g_list_length (self->dumb_bookmarks));
+static void
+bookmark_removed_cb (EphyBookmarksManager   *manager,
+                     EphyBookmark           *bookmark,
+                     EphyBookmarksListModel *self)
+{
+  guint position;
+
+  if (find_bookmark (self, bookmark, &position))
+    remove_bookmark (self, position);
 }
 
 static void
-bookmarks_modified_cb (EphyBookmarksManager   *manager,
-                       EphyBookmark           *bookmark,
-                       EphyBookmarksListModel *self)
+bookmark_changed_cb (EphyBookmarksManager   *manager,
+                     EphyBookmark           *bookmark,
+                     EphyBookmarksListModel *self)
 {
-  if (!ephy_bookmark_is_smart (bookmark))
-    refresh_bookmarks_list (self);
+  guint position;
+
+  if (!find_bookmark (self, bookmark, &position)) {
+    /* A new URL might have made a smart bookmark a regular one. */
+    if (!ephy_bookmark_is_smart (bookmark))
+      insert_bookmark (self, bookmark);
+    return;
+  }
+
+  if (ephy_bookmark_is_smart (bookmark)) {
+    remove_bookmark (self, position);
+  } else if (!is_in_order (self, position)) {
+    g_object_ref (bookmark);
+    remove_bookmark (self, position);
+    insert_bookmark (self, bookmark);
+    g_object_unref (bookmark);
+  } else {
+    g_list_model_items_changed (G_LIST_MODEL (self), position, 1, 1);
+  }
 }
 
 static GType
@@ -91,7 +222,7 @@ ephy_bookmarks_list_model_list_model_get_n_items (GListModel *model)
 {
   EphyBookmarksListModel *self = EPHY_BOOKMARKS_LIST_MODEL (model);
 
-  return g_list_length (self->dumb_bookmarks);
+  return self->dumb_bookmarks->len;
 }
 
 static gpointer
@@ -100,7 +231,10 @@ ephy_bookmarks_list_model_list_model_get_item (GListModel *model,
 {
   EphyBookmarksListModel *self = EPHY_BOOKMARKS_LIST_MODEL (model);
 
-  return g_object_ref (g_list_nth_data (self->dumb_bookmarks, position));
+  if (position >= self->dumb_bookmarks->len)
+    return NULL;
+
+  return g_object_ref (g_ptr_array_index (self->dumb_bookmarks, position));
 }
 
 static void
@@ -116,14 +250,21 @@ ephy_bookmarks_list_model_dispose (GObject *object)
 {
   EphyBookmarksListModel *self = EPHY_BOOKMARKS_LIST_MODEL (object);
 
-  if (self->dumb_bookmarks != NULL) {
-    g_list_free_full (self->dumb_bookmarks, g_object_unref);
-    self->dumb_bookmarks = NULL;
-  }
+  g_ptr_array_set_size (self->dumb_bookmarks, 0);
 
   G_OBJECT_CLASS (ephy_bookmarks_list_model_parent_class)->dispose (object);
 }
 
+static void
+ephy_bookmarks_list_model_finalize (GObject *object)
+{
+  EphyBookmarksListModel *self = EPHY_BOOKMARKS_LIST_MODEL (object);
+
+  g_ptr_array_free (self->dumb_bookmarks, TRUE);
+
+  G_OBJECT_CLASS (ephy_bookmarks_list_model_parent_class)->finalize (object);
+}
+
 static void
 ephy_bookmarks_list_model_set_property (GObject      *object,
                                         guint         prop_id,
@@ -145,19 +286,30 @@ static void
 ephy_bookmarks_list_model_constructed (GObject *object)
 {
   EphyBookmarksListModel *self = EPHY_BOOKMARKS_LIST_MODEL (object);
+  GSequence *bookmarks;
+  GSequenceIter *iter;
 
   G_OBJECT_CLASS (ephy_bookmarks_list_model_parent_class)->constructed (object);
 
-  refresh_bookmarks_list (self);
+  bookmarks = ephy_bookmarks_manager_get_bookmarks (self->bookmarks_manager);
+  for (iter = g_sequence_get_begin_iter (bookmarks);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter)) {
+    EphyBookmark *bookmark = g_sequence_get (iter);
+
+    if (!ephy_bookmark_is_smart (bookmark))
+      g_ptr_array_add (self->dumb_bookmarks, g_object_ref (bookmark));
+  }
+  g_ptr_array_sort (self->dumb_bookmarks, (GCompareFunc)compare_bookmark_pointers);
 
   g_signal_connect_object (self->bookmarks_manager, "bookmark-added",
-                           G_CALLBACK (bookmarks_modified_cb), self, 0);
+                           G_CALLBACK (bookmark_added_cb), self, 0);
   g_signal_connect_object (self->bookmarks_manager, "bookmark-removed",
-                           G_CALLBACK (bookmarks_modified_cb), self, 0);
+                           G_CALLBACK (bookmark_removed_cb), self, 0);
   g_signal_connect_object (self->bookmarks_manager, "bookmark-title-changed",
-                           G_CALLBACK (bookmarks_modified_cb), self, 0);
+                           G_CALLBACK (bookmark_changed_cb), self, 0);
   g_signal_connect_object (self->bookmarks_manager, "bookmark-url-changed",
-                           G_CALLBACK (bookmarks_modified_cb), self, 0);
+                           G_CALLBACK (bookmark_changed_cb), self, 0);
 }
 
 static void
@@ -167,6 +319,7 @@ ephy_bookmarks_list_model_class_init (EphyBookmarksListModelClass *klass)
 
   object_class->constructed = ephy_bookmarks_list_model_constructed;
   object_class->dispose = ephy_bookmarks_list_model_dispose;
+  object_class->finalize = ephy_bookmarks_list_model_finalize;
   object_class->set_property = ephy_bookmarks_list_model_set_property;
 
   obj_properties[PROP_BOOKMARKS_MANAGER] =
@@ -182,6 +335,7 @@ ephy_bookmarks_list_model_class_init (EphyBookmarksListModelClass *klass)
 static void
 ephy_bookmarks_list_model_init (EphyBookmarksListModel *self)
 {
+  self->dumb_bookmarks = g_ptr_array_new_with_free_func (g_object_unref);
 }
 
 EphyBookmarksListModel *
@@ -27,15 +27,71 @@
 #include "ephy-debug.h"
 #include "ephy-file-helpers.h"
 
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
 #define EPHY_BOOKMARKS_FILE "bookmarks.gvdb"
 
+/* Changes are appended to this file, next to the GVDB file, and folded back
+ * into the GVDB file once the journal grows past JOURNAL_COMPACT_SIZE. While
+ * that happens the journal is moved to the ".old" file. */
+#define JOURNAL_SUFFIX ".journal"
+#define OLD_JOURNAL_SUFFIX ".journal.old"
+#define JOURNAL_COMPACT_SIZE (256 * 1024)
+
+/* Saves requested within this interval are written out together. */
+#define SAVE_DELAY_MS 500
+
+typedef enum {
+  JOURNAL_PUT_BOOKMARK = 'b',
+  JOURNAL_REMOVE_BOOKMARK = 'r',
+  JOURNAL_ADD_TAG = 't',
+  JOURNAL_REMOVE_TAG = 'T'
+} JournalOperation;
+
+typedef struct {
+  EphyBookmark  *bookmark;
+  GSequenceIter *iter;
+  char          *url;
+  char          *id;
+} BookmarkIndexEntry;
+
+typedef struct {
+  GCancellable        *cancellable;
+  GAsyncReadyCallback  callback;
+  gpointer             user_data;
+} PendingSave;
+
 struct _EphyBookmarksManager {
   GObject     parent_instance;
 
   GSequence  *bookmarks;
   GSequence  *tags;
 
+  /* Indexes over the bookmarks sequence. The entries are owned by
+   * bookmark_entries and keyed by their own URL and id strings elsewhere. */
+  GHashTable *bookmark_entries;
+  GHashTable *url_index;
+  GHashTable *id_index;
+  /* Tag -> set of bookmarks, and the set of bookmarks without tags. */
+  GHashTable *tag_index;
+  GHashTable *untagged_bookmarks;
+
   gchar      *gvdb_filename;
+  gchar      *journal_filename;
+  gchar      *old_journal_filename;
+
+  /* What the GVDB file and the journals hold together: URL -> bookmark
+   * variant, and the set of tags. */
+  GHashTable *saved_bookmarks;
+  GHashTable *saved_tags;
+
+  gsize       journal_size;
+  gboolean    compacting;
+
+  GList      *pending_saves;
+  guint       save_source_id;
 };
 
 G_DEFINE_TYPE (EphyBookmarksManager, ephy_bookmarks_manager, G_TYPE_OBJECT)
@@ -54,15 +110,30 @@ enum {
 
 static guint       signals[LAST_SIGNAL];
 
+static void ephy_bookmarks_manager_flush (EphyBookmarksManager *self,
+                                          gboolean              may_compact);
+
 static void
-ephy_bookmarks_manager_save_to_file (EphyBookmarksManager *self, GTask *task)
+bookmark_index_entry_free (BookmarkIndexEntry *entry)
 {
-  gboolean result;
+  g_free (entry->url);
+  g_free (entry->id);
+  g_slice_free (BookmarkIndexEntry, entry);
+}
+
+static void
+ephy_bookmarks_manager_dispose (GObject *object)
+{
+  EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (object);
 
-  result = ephy_bookmarks_export (self, self->gvdb_filename, NULL);
+  /* A compaction holds a reference on the manager until it is done, so
+   * none is running here. Don't start one either: the thread would write
+   * the GVDB file after the manager is gone. The journal is compacted the
+   * next time it is loaded instead. */
+  if (self->save_source_id)
+    ephy_bookmarks_manager_flush (self, FALSE);
 
-  if (task)
-    g_task_return_boolean (task, result);
+  G_OBJECT_CLASS (ephy_bookmarks_manager_parent_class)->dispose (object);
 }
 
 static void
@@ -73,7 +144,18 @@ ephy_bookmarks_manager_finalize (GObject *object)
   g_sequence_free (self->bookmarks);
   g_sequence_free (self->tags);
 
+  g_hash_table_unref (self->url_index);
+  g_hash_table_unref (self->id_index);
+  g_hash_table_unref (self->bookmark_entries);
+  g_hash_table_unref (self->tag_index);
+  g_hash_table_unref (self->untagged_bookmarks);
+
+  g_hash_table_unref (self->saved_bookmarks);
+  g_hash_table_unref (self->saved_tags);
+
   g_free (self->gvdb_filename);
+  g_free (self->journal_filename);
+  g_free (self->old_journal_filename);
 
   G_OBJECT_CLASS (ephy_bookmarks_manager_parent_class)->finalize (object);
 }
@@ -83,6 +165,7 @@ ephy_bookmarks_manager_class_init (EphyBookmarksManagerClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->dispose = ephy_bookmarks_manager_dispose;
   object_class->finalize = ephy_bookmarks_manager_finalize;
 
   signals[BOOKMARK_ADDED] =
@@ -166,10 +249,24 @@ ephy_bookmarks_manager_init (EphyBookmarksManager *self)
   self->gvdb_filename = g_build_filename (ephy_dot_dir (),
                                           EPHY_BOOKMARKS_FILE,
                                           NULL);
+  self->journal_filename = g_strconcat (self->gvdb_filename, JOURNAL_SUFFIX, NULL);
+  self->old_journal_filename = g_strconcat (self->gvdb_filename, OLD_JOURNAL_SUFFIX, NULL);
 
   self->bookmarks = g_sequence_new (g_object_unref);
   self->tags = g_sequence_new (g_free);
 
+  self->bookmark_entries = g_hash_table_new_full (NULL, NULL, NULL,
+                                                  (GDestroyNotify)bookmark_index_entry_free);
+  self->url_index = g_hash_table_new (g_str_hash, g_str_equal);
+  self->id_index = g_hash_table_new (g_str_hash, g_str_equal);
+  self->tag_index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, (GDestroyNotify)g_hash_table_unref);
+  self->untagged_bookmarks = g_hash_table_new (NULL, NULL);
+
+  self->saved_bookmarks = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, (GDestroyNotify)g_variant_unref);
+  self->saved_tags = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
   g_sequence_insert_sorted (self->tags,
                             g_strdup ("Favorites"),
                             (GCompareDataFunc)ephy_bookmark_tags_compare,
@@ -177,11 +274,64 @@ ephy_bookmarks_manager_init (EphyBookmarksManager *self)
 
   /* Create DB file if it doesn't already exists */
   if (!g_file_test (self->gvdb_filename, G_FILE_TEST_EXISTS))
-    ephy_bookmarks_manager_save_to_file (self, NULL);
+    ephy_bookmarks_export (self, self->gvdb_filename, NULL);
 
   ephy_bookmarks_manager_load_from_file (self);
 }
 
+static void
+index_remove_string (GHashTable         *index,
+                     const char         *key,
+                     BookmarkIndexEntry *entry)
+{
+  /* Another bookmark with the same key may have replaced this one. */
+  if (key && g_hash_table_lookup (index, key) == entry)
+    g_hash_table_remove (index, key);
+}
+
+static void
+index_add_string (GHashTable          *index,
+                  char               **entry_key,
+                  const char          *key,
+                  BookmarkIndexEntry  *entry)
+{
+  *entry_key = g_strdup (key);
+
+  /* The index does not own its keys, so the key must always be the one of
+   * the entry it maps to, even if another bookmark had the same one. */
+  if (*entry_key)
+    g_hash_table_replace (index, *entry_key, entry);
+}
+
+static void
+tag_index_add (EphyBookmarksManager *self,
+               const char           *tag,
+               EphyBookmark         *bookmark)
+{
+  GHashTable *bookmarks;
+
+  bookmarks = g_hash_table_lookup (self->tag_index, tag);
+  if (!bookmarks) {
+    bookmarks = g_hash_table_new (NULL, NULL);
+    g_hash_table_insert (self->tag_index, g_strdup (tag), bookmarks);
+  }
+
+  g_hash_table_add (bookmarks, bookmark);
+  g_hash_table_remove (self->untagged_bookmarks, bookmark);
+}
+
+static void
+tag_index_remove (EphyBookmarksManager *self,
+                  const char           *tag,
+                  EphyBookmark         *bookmark)
+{
+  GHashTable *bookmarks;
+
+  bookmarks = g_hash_table_lookup (self->tag_index, tag);
+  if (bookmarks && g_hash_table_remove (bookmarks, bookmark) && g_hash_table_size (bookmarks) == 0)
+    g_hash_table_remove (self->tag_index, tag);
+}
+
 static void
 bookmark_title_changed_cb (EphyBookmark         *bookmark,
                            GParamSpec           *pspec,
@@ -195,14 +345,39 @@ bookmark_url_changed_cb (EphyBookmark         *bookmark,
                          GParamSpec           *pspec,
                          EphyBookmarksManager *self)
 {
+  BookmarkIndexEntry *entry;
+
+  entry = g_hash_table_lookup (self->bookmark_entries, bookmark);
+  if (entry) {
+    index_remove_string (self->url_index, entry->url, entry);
+    g_free (entry->url);
+    index_add_string (self->url_index, &entry->url, ephy_bookmark_get_url (bookmark), entry);
+  }
+
   g_signal_emit (self, signals[BOOKMARK_URL_CHANGED], 0, bookmark);
 }
 
+static void
+bookmark_id_changed_cb (EphyBookmark         *bookmark,
+                        EphyBookmarksManager *self)
+{
+  BookmarkIndexEntry *entry;
+
+  entry = g_hash_table_lookup (self->bookmark_entries, bookmark);
+  if (entry) {
+    index_remove_string (self->id_index, entry->id, entry);
+    g_free (entry->id);
+    index_add_string (self->id_index, &entry->id, ephy_bookmark_get_id (bookmark), entry);
+  }
+}
+
 static void
 bookmark_tag_added_cb (EphyBookmark         *bookmark,
                        const char           *tag,
                        EphyBookmarksManager *self)
 {
+  tag_index_add (self, tag, bookmark);
+
   g_signal_emit (self, signals[BOOKMARK_TAG_ADDED], 0, bookmark, tag);
 }
 
@@ -211,6 +386,10 @@ bookmark_tag_removed_cb (EphyBookmark         *bookmark,
                          const char           *tag,
                          EphyBookmarksManager *self)
 {
+  tag_index_remove (self, tag, bookmark);
+  if (g_sequence_is_empty (ephy_bookmark_get_tags (bookmark)))
+    g_hash_table_add (self->untagged_bookmarks, bookmark);
+
   g_signal_emit (self, signals[BOOKMARK_TAG_REMOVED], 0, bookmark, tag);
 }
 
@@ -221,20 +400,87 @@ ephy_bookmarks_manager_new (void)
   return EPHY_BOOKMARKS_MANAGER (g_object_new (EPHY_TYPE_BOOKMARKS_MANAGER, NULL));
 }
 
+/* Indexes @bookmark, stored in @iter of the bookmarks sequence, and keeps
+ * the indexes up to date as it changes. */
 static void
 ephy_bookmarks_manager_watch_bookmark (EphyBookmarksManager *self,
-                                       EphyBookmark         *bookmark)
+                                       EphyBookmark         *bookmark,
+                                       GSequenceIter        *iter)
 {
+  BookmarkIndexEntry *entry;
+  GSequence *tags;
+  GSequenceIter *tag_iter;
+
+  entry = g_slice_new0 (BookmarkIndexEntry);
+  entry->bookmark = bookmark;
+  entry->iter = iter;
+  index_add_string (self->url_index, &entry->url, ephy_bookmark_get_url (bookmark), entry);
+  index_add_string (self->id_index, &entry->id, ephy_bookmark_get_id (bookmark), entry);
+  g_hash_table_insert (self->bookmark_entries, bookmark, entry);
+
+  tags = ephy_bookmark_get_tags (bookmark);
+  for (tag_iter = g_sequence_get_begin_iter (tags);
+       !g_sequence_iter_is_end (tag_iter);
+       tag_iter = g_sequence_iter_next (tag_iter))
+    tag_index_add (self, g_sequence_get (tag_iter), bookmark);
+  if (g_sequence_is_empty (tags))
+    g_hash_table_add (self->untagged_bookmarks, bookmark);
+
   g_signal_connect_object (bookmark, "notify::title",
                            G_CALLBACK (bookmark_title_changed_cb), self, 0);
   g_signal_connect_object (bookmark, "notify::url",
                            G_CALLBACK (bookmark_url_changed_cb), self, 0);
+  g_signal_connect_object (bookmark, "id-changed",
+                           G_CALLBACK (bookmark_id_changed_cb), self, 0);
   g_signal_connect_object (bookmark, "tag-added",
                            G_CALLBACK (bookmark_tag_added_cb), self, 0);
   g_signal_connect_object (bookmark, "tag-removed",
                            G_CALLBACK (bookmark_tag_removed_cb), self, 0);
 }
 
+/* Undoes ephy_bookmarks_manager_watch_bookmark() and returns where
+ * @bookmark is stored in the bookmarks sequence. */
+static GSequenceIter *
+ephy_bookmarks_manager_unwatch_bookmark (EphyBookmarksManager *self,
+                                         EphyBookmark         *bookmark)
+{
+  BookmarkIndexEntry *entry;
+  GSequence *tags;
+  GSequenceIter *tag_iter;
+  GSequenceIter *iter;
+
+  entry = g_hash_table_lookup (self->bookmark_entries, bookmark);
+  g_assert (entry != NULL);
+
+  index_remove_string (self->url_index, entry->url, entry);
+  index_remove_string (self->id_index, entry->id, entry);
+
+  tags = ephy_bookmark_get_tags (bookmark);
+  for (tag_iter = g_sequence_get_begin_iter (tags);
+       !g_sequence_iter_is_end (tag_iter);
+       tag_iter = g_sequence_iter_next (tag_iter))
+    tag_index_remove (self, g_sequence_get (tag_iter), bookmark);
+  g_hash_table_remove (self->untagged_bookmarks, bookmark);
+
+  g_signal_handlers_disconnect_by_func (bookmark, bookmark_title_changed_cb, self);
+  g_signal_handlers_disconnect_by_func (bookmark, bookmark_url_changed_cb, self);
+  g_signal_handlers_disconnect_by_func (bookmark, bookmark_id_changed_cb, self);
+  g_signal_handlers_disconnect_by_func (bookmark, bookmark_tag_added_cb, self);
+  g_signal_handlers_disconnect_by_func (bookmark, bookmark_tag_removed_cb, self);
+
+  iter = entry->iter;
+  g_hash_table_remove (self->bookmark_entries, bookmark);
+
+  return iter;
+}
+
+static BookmarkIndexEntry *
+ephy_bookmarks_manager_lookup_url (EphyBookmarksManager *self,
+                                   const char           *url)
+{
+  return url ? g_hash_table_lookup (self->url_index, url) : NULL;
+}
+
 void
 ephy_bookmarks_manager_add_bookmark (EphyBookmarksManager *self,
                                      EphyBookmark         *bookmark)
@@ -253,13 +499,13 @@ ephy_bookmarks_manager_add_bookmark (EphyBookmarksManager *self,
   prev_iter = g_sequence_iter_prev (iter);
   if (g_sequence_iter_is_end (prev_iter)
       || ephy_bookmark_get_time_added (g_sequence_get (prev_iter)) != ephy_bookmark_get_time_added (bookmark)) {
-    g_sequence_insert_before (iter, bookmark);
+    iter = g_sequence_insert_before (iter, bookmark);
+    ephy_bookmarks_manager_watch_bookmark (self, bookmark, iter);
     g_signal_emit (self, signals[BOOKMARK_ADDED], 0, bookmark);
 
     ephy_bookmarks_manager_save_to_file_async (self, NULL,
                                                (GAsyncReadyCallback)ephy_bookmarks_manager_save_to_file_warn_on_error_cb,
                                                NULL);
-    ephy_bookmarks_manager_watch_bookmark (self, bookmark);
   }
 }
 
@@ -272,21 +518,23 @@ ephy_bookmarks_manager_add_bookmarks (EphyBookmarksManager *self,
   g_return_if_fail (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_return_if_fail (bookmarks != NULL);
 
+  /* Bookmarks whose URL is already bookmarked are skipped, which also covers
+   * duplicates within @bookmarks since each one is indexed as it goes in. */
   for (iter = g_sequence_get_begin_iter (bookmarks);
        !g_sequence_iter_is_end (iter);
        iter = g_sequence_iter_next (iter)) {
     EphyBookmark *bookmark = g_sequence_get (iter);
 
-    if (!g_sequence_lookup (self->bookmarks,
-                            bookmark,
-                            (GCompareDataFunc)ephy_bookmark_bookmarks_sort_func,
-                            NULL)) {
-      g_sequence_prepend (self->bookmarks, g_object_ref (bookmark));
+    if (!g_hash_table_contains (self->bookmark_entries, bookmark) &&
+        !ephy_bookmarks_manager_lookup_url (self, ephy_bookmark_get_url (bookmark))) {
+      GSequenceIter *new_iter = g_sequence_prepend (self->bookmarks, g_object_ref (bookmark));
+
+      ephy_bookmarks_manager_watch_bookmark (self, bookmark, new_iter);
       g_signal_emit (self, signals[BOOKMARK_ADDED], 0, bookmark);
-      ephy_bookmarks_manager_watch_bookmark (self, bookmark);
     }
   }
 
+  /* Sorting keeps the indexed iterators valid. */
   g_sequence_sort (self->bookmarks,
                    (GCompareDataFunc)ephy_bookmark_bookmarks_sort_func,
                    NULL);
@@ -300,24 +548,22 @@ void
 ephy_bookmarks_manager_remove_bookmark (EphyBookmarksManager *self,
                                         EphyBookmark         *bookmark)
 {
+  BookmarkIndexEntry *entry;
   GSequenceIter *iter;
 
   g_return_if_fail (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_return_if_fail (EPHY_IS_BOOKMARK (bookmark));
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-         !g_sequence_iter_is_end (iter);
-         iter = g_sequence_iter_next (iter)) {
-    if (g_strcmp0 (ephy_bookmark_get_url (g_sequence_get (iter)),
-                   ephy_bookmark_get_url (bookmark)) == 0)
-      break;
-  }
+  entry = ephy_bookmarks_manager_lookup_url (self, ephy_bookmark_get_url (bookmark));
+  if (!entry)
+    return;
 
   /* Ensure the bookmark is removed from our list before the signal is emitted,
    * because this is the bookmark REMOVED signal after all, so callers expect
    * it to be already gone.
    */
-  g_object_ref (bookmark);
+  bookmark = g_object_ref (entry->bookmark);
+  iter = ephy_bookmarks_manager_unwatch_bookmark (self, bookmark);
   g_sequence_remove (iter);
   g_signal_emit (self, signals[BOOKMARK_REMOVED], 0, bookmark);
   g_object_unref (bookmark);
@@ -325,53 +571,172 @@ ephy_bookmarks_manager_remove_bookmark (EphyBookmarksManager *self,
   ephy_bookmarks_manager_save_to_file_async (self, NULL,
                                              (GAsyncReadyCallback)ephy_bookmarks_manager_save_to_file_warn_on_error_cb,
                                              NULL);
-
-  g_signal_handlers_disconnect_by_func (bookmark, bookmark_title_changed_cb, self);
-  g_signal_handlers_disconnect_by_func (bookmark, bookmark_url_changed_cb, self);
-  g_signal_handlers_disconnect_by_func (bookmark, bookmark_tag_added_cb, self);
-  g_signal_handlers_disconnect_by_func (bookmark, bookmark_tag_removed_cb, self);
 }
 
 EphyBookmark *
 ephy_bookmarks_manager_get_bookmark_by_url (EphyBookmarksManager *self,
                                             const char           *url)
 {
-  GSequenceIter *iter;
+  BookmarkIndexEntry *entry;
 
   g_return_val_if_fail (EPHY_IS_BOOKMARKS_MANAGER (self), FALSE);
   g_return_val_if_fail (url != NULL, FALSE);
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-         !g_sequence_iter_is_end (iter);
-         iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark = g_sequence_get (iter);
-
-    if (g_strcmp0 (ephy_bookmark_get_url (bookmark), url) == 0)
-      return bookmark;
-  }
+  entry = ephy_bookmarks_manager_lookup_url (self, url);
 
-  return NULL;
+  return entry ? entry->bookmark : NULL;
 }
 
 EphyBookmark *
 ephy_bookmarks_manager_get_bookmark_by_id (EphyBookmarksManager *self,
                                            const char           *id)
 {
-  GSequenceIter *iter;
+  BookmarkIndexEntry *entry;
 
   g_return_val_if_fail (EPHY_IS_BOOKMARKS_MANAGER (self), FALSE);
   g_return_val_if_fail (id != NULL, FALSE);
 
+  entry = g_hash_table_lookup (self->id_index, id);
+
+  return entry ? entry->bookmark : NULL;
+}
+
+/* Reconciles @remotes, the complete contents of a sync server, with the
+ * local bookmarks and returns the local bookmarks the server is missing or
+ * has an older copy of. A remote bookmark is matched by id first and by URL
+ * second. If it matches by id, the most recently modified copy wins. If it
+ * matches by URL only, the local bookmark adopts its id and tags. Anything
+ * else is added.
+ *
+ * The whole pass is driven by the id and URL indexes, and the additions go
+ * in with a single bulk insert, so this scales linearly with the number of
+ * bookmarks on both sides. */
+GPtrArray *
+ephy_bookmarks_manager_merge_remote_bookmarks (EphyBookmarksManager *self,
+                                               GPtrArray            *remotes)
+{
+  GHashTable *matched;
+  GHashTable *added_urls;
+  GPtrArray *replaced;
+  GPtrArray *adopting;
+  GPtrArray *to_upload;
+  GSequence *to_add;
+  GSequenceIter *iter;
+
+  g_return_val_if_fail (EPHY_IS_BOOKMARKS_MANAGER (self), NULL);
+  g_return_val_if_fail (remotes != NULL, NULL);
+
+  matched = g_hash_table_new (NULL, NULL);
+  added_urls = g_hash_table_new (g_str_hash, g_str_equal);
+  replaced = g_ptr_array_new ();
+  adopting = g_ptr_array_new ();
+  to_upload = g_ptr_array_new_with_free_func (g_object_unref);
+  to_add = g_sequence_new (g_object_unref);
+
+  /* Compute what to do with every remote bookmark without touching the local
+   * state, so that the indexes describe the local bookmarks only. */
+  for (guint i = 0; i < remotes->len; i++) {
+    EphyBookmark *remote = g_ptr_array_index (remotes, i);
+    BookmarkIndexEntry *entry;
+    EphyBookmark *local;
+    double remote_time;
+    double local_time;
+
+    entry = g_hash_table_lookup (self->id_index, ephy_bookmark_get_id (remote));
+    if (!entry) {
+      entry = ephy_bookmarks_manager_lookup_url (self, ephy_bookmark_get_url (remote));
+
+      /* The server may hold several records for the same URL. Only the first
+       * one is merged, as URLs are unique locally. */
+      if (entry && g_hash_table_contains (matched, entry->bookmark))
+        continue;
+
+      if (!entry) {
+        if (g_hash_table_contains (added_urls, ephy_bookmark_get_url (remote)))
+          continue;
+
+        g_hash_table_add (added_urls, (gpointer)ephy_bookmark_get_url (remote));
+        g_sequence_append (to_add, g_object_ref (remote));
+        continue;
+      }
+
+      g_hash_table_add (matched, entry->bookmark);
+      g_ptr_array_add (adopting, entry->bookmark);
+      g_ptr_array_add (adopting, remote);
+      g_ptr_array_add (to_upload, g_object_ref (entry->bookmark));
+      continue;
+    }
+
+    local = entry->bookmark;
+    g_hash_table_add (matched, local);
+    remote_time = ephy_bookmark_get_modification_time (remote);
+    local_time = ephy_bookmark_get_modification_time (local);
+
+    if (remote_time > local_time) {
+      BookmarkIndexEntry *url_entry = ephy_bookmarks_manager_lookup_url (self, ephy_bookmark_get_url (remote));
+
+      /* Replacing the local copy would lose both, if the remote one moved to
+       * a URL that another local bookmark has. */
+      if (url_entry && url_entry != entry)
+        continue;
+
+      g_ptr_array_add (replaced, local);
+      g_sequence_append (to_add, g_object_ref (remote));
+    } else if (local_time > remote_time) {
+      g_ptr_array_add (to_upload, g_object_ref (local));
+    }
+  }
+
+  /* Local bookmarks the server does not know about. */
   for (iter = g_sequence_get_begin_iter (self->bookmarks);
        !g_sequence_iter_is_end (iter);
        iter = g_sequence_iter_next (iter)) {
     EphyBookmark *bookmark = g_sequence_get (iter);
 
-    if (g_strcmp0 (ephy_bookmark_get_id (bookmark), id) == 0)
-      return bookmark;
+    if (!g_hash_table_contains (matched, bookmark))
+      g_ptr_array_add (to_upload, g_object_ref (bookmark));
+  }
+
+  /* Now apply the changes. */
+  for (guint i = 0; i < adopting->len; i += 2) {
+    EphyBookmark *local = g_ptr_array_index (adopting, i);
+    EphyBookmark *remote = g_ptr_array_index (adopting, i + 1);
+    GSequence *tags = ephy_bookmark_get_tags (remote);
+
+    for (iter = g_sequence_get_begin_iter (tags);
+         !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter)) {
+      ephy_bookmark_add_tag (local, g_sequence_get (iter));
+      ephy_bookmarks_manager_create_tag (self, g_sequence_get (iter));
+    }
+
+    ephy_bookmark_set_id (local, ephy_bookmark_get_id (remote));
+  }
+
+  for (guint i = 0; i < replaced->len; i++)
+    ephy_bookmarks_manager_remove_bookmark (self, g_ptr_array_index (replaced, i));
+
+  for (iter = g_sequence_get_begin_iter (to_add);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter)) {
+    GSequence *tags = ephy_bookmark_get_tags (g_sequence_get (iter));
+    GSequenceIter *tag_iter;
+
+    for (tag_iter = g_sequence_get_begin_iter (tags);
+         !g_sequence_iter_is_end (tag_iter);
+         tag_iter = g_sequence_iter_next (tag_iter))
+      ephy_bookmarks_manager_create_tag (self, g_sequence_get (tag_iter));
   }
 
-  return NULL;
+  ephy_bookmarks_manager_add_bookmarks (self, to_add);
+
+  g_sequence_free (to_add);
+  g_ptr_array_unref (adopting);
+  g_ptr_array_unref (replaced);
+  g_hash_table_unref (added_urls);
+  g_hash_table_unref (matched);
+
+  return to_upload;
 }
 
 void
@@ -396,10 +761,48 @@ ephy_bookmarks_manager_create_tag (EphyBookmarksManager *self, const char *tag)
   }
 }
 
+/* Creates the tags of the %NULL-terminated @tags that do not exist yet,
+ * sorting the tags only once. */
+void
+ephy_bookmarks_manager_create_tags (EphyBookmarksManager *self,
+                                    const char * const   *tags)
+{
+  GHashTable *seen;
+  GPtrArray *created;
+
+  g_return_if_fail (EPHY_IS_BOOKMARKS_MANAGER (self));
+  g_return_if_fail (tags != NULL);
+
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  created = g_ptr_array_new ();
+
+  for (guint i = 0; tags[i]; i++) {
+    if (g_hash_table_contains (seen, tags[i]) ||
+        ephy_bookmarks_manager_tag_exists (self, tags[i]))
+      continue;
+
+    g_hash_table_add (seen, (gpointer)tags[i]);
+    g_ptr_array_add (created, (gpointer)tags[i]);
+  }
+
+  for (guint i = 0; i < created->len; i++)
+    g_sequence_append (self->tags, g_strdup (g_ptr_array_index (created, i)));
+
+  if (created->len > 0)
+    g_sequence_sort (self->tags, (GCompareDataFunc)ephy_bookmark_tags_compare, NULL);
+
+  for (guint i = 0; i < created->len; i++)
+    g_signal_emit (self, signals[TAG_CREATED], 0, g_ptr_array_index (created, i));
+
+  g_ptr_array_free (created, TRUE);
+  g_hash_table_destroy (seen);
+}
+
 void
 ephy_bookmarks_manager_delete_tag (EphyBookmarksManager *self, const char *tag)
 {
   GSequenceIter *iter = NULL;
+  GHashTable *tagged;
   int position;
 
   g_return_if_fail (EPHY_IS_BOOKMARKS_MANAGER (self));
@@ -415,8 +818,16 @@ ephy_bookmarks_manager_delete_tag (EphyBookmarksManager *self, const char *tag)
 
   g_sequence_remove (iter);
 
-  /* Also remove the tag from each bookmark if they have it */
-  g_sequence_foreach (self->bookmarks, (GFunc)ephy_bookmark_remove_tag, (gpointer)tag);
+  /* Also remove the tag from each bookmark if they have it. Removing the tag
+   * from the last bookmark also drops the set, so iterate over a copy. */
+  tagged = g_hash_table_lookup (self->tag_index, tag);
+  if (tagged) {
+    GList *list = g_hash_table_get_keys (tagged);
+
+    for (GList *l = list; l; l = l->next)
+      ephy_bookmark_remove_tag (l->data, tag);
+    g_list_free (list);
+  }
 
   g_signal_emit (self, signals[TAG_DELETED], 0, position);
 }
@@ -450,38 +861,29 @@ ephy_bookmarks_manager_get_bookmarks_with_tag (EphyBookmarksManager *self,
                                                const char           *tag)
 {
   GSequence *bookmarks;
-  GSequenceIter *iter;
+  GHashTable *tagged;
+  GHashTableIter iter;
+  gpointer bookmark;
 
   g_return_val_if_fail (EPHY_IS_BOOKMARKS_MANAGER (self), NULL);
 
   bookmarks = g_sequence_new (g_object_unref);
 
-  if (tag == NULL) {
-    for (iter = g_sequence_get_begin_iter (self->bookmarks);
-         !g_sequence_iter_is_end (iter);
-         iter = g_sequence_iter_next (iter)) {
-      EphyBookmark *bookmark = g_sequence_get (iter);
+  if (tag == NULL)
+    tagged = self->untagged_bookmarks;
+  else
+    tagged = g_hash_table_lookup (self->tag_index, tag);
 
-      if (g_sequence_is_empty (ephy_bookmark_get_tags (bookmark))) {
-        g_sequence_insert_sorted (bookmarks,
-                                  g_object_ref (bookmark),
-                                  (GCompareDataFunc)ephy_bookmark_bookmarks_sort_func,
-                                  NULL);
-      }
-    }
-  } else {
-    for (iter = g_sequence_get_begin_iter (self->bookmarks);
-         !g_sequence_iter_is_end (iter);
-         iter = g_sequence_iter_next (iter)) {
-      EphyBookmark *bookmark = g_sequence_get (iter);
+  if (!tagged)
+    return bookmarks;
 
-      if (ephy_bookmark_has_tag (bookmark, tag))
-        g_sequence_insert_sorted (bookmarks,
-                                  g_object_ref (bookmark),
-                                  (GCompareDataFunc)ephy_bookmark_bookmarks_sort_func,
-                                  NULL);
-    }
-  }
+  g_hash_table_iter_init (&iter, tagged);
+  while (g_hash_table_iter_next (&iter, &bookmark, NULL))
+    g_sequence_append (bookmarks, g_object_ref (bookmark));
+
+  g_sequence_sort (bookmarks,
+                   (GCompareDataFunc)ephy_bookmark_bookmarks_sort_func,
+                   NULL);
 
   return bookmarks;
 }
@@ -527,19 +929,325 @@ ephy_bookmarks_manager_get_tags (EphyBookmarksManager *self)
   return self->tags;
 }
 
+static void
+journal_append_record (GByteArray       *journal,
+                       JournalOperation  operation,
+                       const char       *key,
+                       GVariant         *value)
+{
+  GVariant *record;
+  guint32 size;
+
+  if (!journal)
+    return;
+
+  record = g_variant_ref_sink (g_variant_new ("(ysmv)", operation, key, value));
+  if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+    GVariant *swapped = g_variant_byteswap (record);
+    g_variant_unref (record);
+    record = swapped;
+  }
+
+  size = GUINT32_TO_LE (g_variant_get_size (record));
+  g_byte_array_append (journal, (const guint8 *)&size, sizeof (size));
+  g_byte_array_append (journal, g_variant_get_data (record), g_variant_get_size (record));
+
+  g_variant_unref (record);
+}
+
+/* Appends the difference between the bookmarks in memory and the ones on
+ * disk to @journal, if not %NULL, and records them as saved. */
+static void
+ephy_bookmarks_manager_diff_saved_state (EphyBookmarksManager *self,
+                                         GByteArray           *journal)
+{
+  GHashTable *current;
+  GSequenceIter *iter;
+  GHashTableIter saved_iter;
+  gpointer key;
+
+  current = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (iter = g_sequence_get_begin_iter (self->tags);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter)) {
+    const char *tag = g_sequence_get (iter);
+
+    if (!g_hash_table_contains (self->saved_tags, tag)) {
+      journal_append_record (journal, JOURNAL_ADD_TAG, tag, NULL);
+      g_hash_table_add (self->saved_tags, g_strdup (tag));
+    }
+    g_hash_table_add (current, (gpointer)tag);
+  }
+
+  g_hash_table_iter_init (&saved_iter, self->saved_tags);
+  while (g_hash_table_iter_next (&saved_iter, &key, NULL)) {
+    if (!g_hash_table_contains (current, key)) {
+      journal_append_record (journal, JOURNAL_REMOVE_TAG, key, NULL);
+      g_hash_table_iter_remove (&saved_iter);
+    }
+  }
+
+  g_hash_table_remove_all (current);
+
+  for (iter = g_sequence_get_begin_iter (self->bookmarks);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter)) {
+    EphyBookmark *bookmark = g_sequence_get (iter);
+    const char *url = ephy_bookmark_get_url (bookmark);
+    GVariant *saved;
+    GVariant *variant;
+
+    variant = g_variant_ref_sink (ephy_bookmarks_export_bookmark (bookmark));
+    saved = g_hash_table_lookup (self->saved_bookmarks, url);
+    if (!saved || !g_variant_equal (saved, variant)) {
+      journal_append_record (journal, JOURNAL_PUT_BOOKMARK, url, variant);
+      g_hash_table_replace (self->saved_bookmarks, g_strdup (url), g_variant_ref (variant));
+    }
+    g_variant_unref (variant);
+
+    g_hash_table_add (current, (gpointer)url);
+  }
+
+  g_hash_table_iter_init (&saved_iter, self->saved_bookmarks);
+  while (g_hash_table_iter_next (&saved_iter, &key, NULL)) {
+    if (!g_hash_table_contains (current, key)) {
+      journal_append_record (journal, JOURNAL_REMOVE_BOOKMARK, key, NULL);
+      g_hash_table_iter_remove (&saved_iter);
+    }
+  }
+
+  g_hash_table_unref (current);
+}
+
+static GHashTable *
+copy_saved_table (GHashTable     *table,
+                  GDestroyNotify  value_destroy_func,
+                  GBoxedCopyFunc  value_copy_func)
+{
+  GHashTable *copy;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  copy = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, value_destroy_func);
+
+  g_hash_table_iter_init (&iter, table);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_hash_table_insert (copy, g_strdup (key), value_copy_func ? value_copy_func (value) : NULL);
+
+  return copy;
+}
+
+typedef struct {
+  GHashTable *tags;
+  GHashTable *bookmarks;
+  char       *gvdb_filename;
+  char       *old_journal_filename;
+} CompactData;
+
+static void
+compact_data_free (CompactData *data)
+{
+  g_hash_table_unref (data->tags);
+  g_hash_table_unref (data->bookmarks);
+  g_free (data->gvdb_filename);
+  g_free (data->old_journal_filename);
+  g_slice_free (CompactData, data);
+}
+
+static void
+compact_thread (GTask        *task,
+                gpointer      source_object,
+                CompactData  *data,
+                GCancellable *cancellable)
+{
+  GError *error = NULL;
+
+  if (!ephy_bookmarks_export_tables (data->tags, data->bookmarks, data->gvdb_filename, &error)) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  /* The GVDB file now contains everything in the old journal. Replaying the
+   * current journal on top of it is harmless, as records are idempotent. */
+  if (g_unlink (data->old_journal_filename) == -1 && errno != ENOENT) {
+    int errsv = errno;
+
+    g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (errsv),
+                             "Failed to delete %s: %s", data->old_journal_filename, g_strerror (errsv));
+    return;
+  }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void ephy_bookmarks_manager_compact (EphyBookmarksManager *self);
+
+static void
+compact_cb (EphyBookmarksManager *self,
+            GAsyncResult         *result,
+            gpointer              user_data)
+{
+  GError *error = NULL;
+
+  self->compacting = FALSE;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+    g_warning ("Failed to compact bookmarks journal: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  LOG ("Compacted bookmarks journal into %s", self->gvdb_filename);
+
+  if (self->journal_size >= JOURNAL_COMPACT_SIZE)
+    ephy_bookmarks_manager_compact (self);
+}
+
+static void
+ephy_bookmarks_manager_compact (EphyBookmarksManager *self)
+{
+  CompactData *data;
+  GTask *task;
+
+  if (self->compacting)
+    return;
+
+  /* An old journal is only left behind by a compaction that failed; keep
+   * writing to the current journal until it is gone. */
+  if (!g_file_test (self->old_journal_filename, G_FILE_TEST_EXISTS)) {
+    if (g_rename (self->journal_filename, self->old_journal_filename) == -1 && errno != ENOENT) {
+      g_warning ("Failed to move %s: %s", self->journal_filename, g_strerror (errno));
+      return;
+    }
+    self->journal_size = 0;
+  }
+
+  data = g_slice_new (CompactData);
+  data->tags = copy_saved_table (self->saved_tags, NULL, NULL);
+  data->bookmarks = copy_saved_table (self->saved_bookmarks,
+                                      (GDestroyNotify)g_variant_unref,
+                                      (GBoxedCopyFunc)g_variant_ref);
+  data->gvdb_filename = g_strdup (self->gvdb_filename);
+  data->old_journal_filename = g_strdup (self->old_journal_filename);
+
+  self->compacting = TRUE;
+
+  task = g_task_new (self, NULL, (GAsyncReadyCallback)compact_cb, NULL);
+  g_task_set_task_data (task, data, (GDestroyNotify)compact_data_free);
+  g_task_run_in_thread (task, (GTaskThreadFunc)compact_thread);
+  g_object_unref (task);
+}
+
+static gboolean
+ephy_bookmarks_manager_write_journal (EphyBookmarksManager  *self,
+                                      gboolean               may_compact,
+                                      GError               **error)
+{
+  GByteArray *journal;
+  GFile *file;
+  GFileOutputStream *stream;
+  gboolean result = FALSE;
+
+  journal = g_byte_array_new ();
+  ephy_bookmarks_manager_diff_saved_state (self, journal);
+
+  if (journal->len == 0) {
+    g_byte_array_unref (journal);
+    return TRUE;
+  }
+
+  file = g_file_new_for_path (self->journal_filename);
+  stream = g_file_append_to (file, G_FILE_CREATE_NONE, NULL, error);
+  if (stream) {
+    result = g_output_stream_write_all (G_OUTPUT_STREAM (stream), journal->data, journal->len, NULL, NULL, error) &&
+             g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, error);
+    g_object_unref (stream);
+  }
+  g_object_unref (file);
+
+  self->journal_size += journal->len;
+  g_byte_array_unref (journal);
+
+  /* The saved state already includes the changes, so a compaction writes
+   * them out even if appending failed. */
+  if (may_compact && (!result || self->journal_size >= JOURNAL_COMPACT_SIZE))
+    ephy_bookmarks_manager_compact (self);
+
+  return result;
+}
+
+static void
+pending_save_free (PendingSave *save)
+{
+  g_clear_object (&save->cancellable);
+  g_slice_free (PendingSave, save);
+}
+
+static void
+ephy_bookmarks_manager_flush (EphyBookmarksManager *self,
+                              gboolean              may_compact)
+{
+  GError *error = NULL;
+  GList *pending_saves;
+  gboolean result;
+
+  if (self->save_source_id) {
+    g_source_remove (self->save_source_id);
+    self->save_source_id = 0;
+  }
+
+  result = ephy_bookmarks_manager_write_journal (self, may_compact, &error);
+
+  pending_saves = g_list_reverse (self->pending_saves);
+  self->pending_saves = NULL;
+
+  for (GList *l = pending_saves; l; l = l->next) {
+    PendingSave *save = l->data;
+    GTask *task;
+
+    task = g_task_new (self, save->cancellable, save->callback, save->user_data);
+    if (result)
+      g_task_return_boolean (task, TRUE);
+    else
+      g_task_return_error (task, g_error_copy (error));
+    g_object_unref (task);
+  }
+
+  g_list_free_full (pending_saves, (GDestroyNotify)pending_save_free);
+  if (error)
+    g_error_free (error);
+}
+
+static gboolean
+save_timeout_cb (EphyBookmarksManager *self)
+{
+  self->save_source_id = 0;
+  ephy_bookmarks_manager_flush (self, TRUE);
+
+  return G_SOURCE_REMOVE;
+}
+
 void
 ephy_bookmarks_manager_save_to_file_async (EphyBookmarksManager *self,
                                            GCancellable         *cancellable,
                                            GAsyncReadyCallback   callback,
                                            gpointer              user_data)
 {
-  GTask *task;
+  PendingSave *save;
 
-  task = g_task_new (self, cancellable, callback, user_data);
+  g_return_if_fail (EPHY_IS_BOOKMARKS_MANAGER (self));
 
-  ephy_bookmarks_manager_save_to_file (self, task);
+  save = g_slice_new (PendingSave);
+  save->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  save->callback = callback;
+  save->user_data = user_data;
+  self->pending_saves = g_list_prepend (self->pending_saves, save);
 
-  g_object_unref (task);
+  /* The task is only created once the changes are written, so that pending
+   * saves do not keep the manager alive; disposing it flushes them. */
+  if (self->save_source_id == 0)
+    self->save_source_id = g_timeout_add (SAVE_DELAY_MS, (GSourceFunc)save_timeout_cb, self);
 }
 
 gboolean
@@ -552,10 +1260,135 @@ ephy_bookmarks_manager_save_to_file_finish (EphyBookmarksManager *self,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+static void
+ephy_bookmarks_manager_apply_journal_record (EphyBookmarksManager *self,
+                                             GVariant             *record)
+{
+  BookmarkIndexEntry *entry;
+  GSequenceIter *iter;
+  EphyBookmark *bookmark;
+  GVariant *value = NULL;
+  const char *key;
+  guchar operation;
+
+  g_variant_get (record, "(y&smv)", &operation, &key, &value);
+
+  switch (operation) {
+    case JOURNAL_PUT_BOOKMARK:
+      if (!value || !g_variant_is_of_type (value, G_VARIANT_TYPE ("(xssdbas)")))
+        break;
+
+      entry = ephy_bookmarks_manager_lookup_url (self, key);
+      if (entry)
+        g_sequence_remove (ephy_bookmarks_manager_unwatch_bookmark (self, entry->bookmark));
+
+      bookmark = ephy_bookmarks_import_bookmark (key, value);
+      iter = g_sequence_insert_sorted (self->bookmarks, bookmark,
+                                       (GCompareDataFunc)ephy_bookmark_bookmarks_sort_func,
+                                       NULL);
+      ephy_bookmarks_manager_watch_bookmark (self, bookmark, iter);
+      break;
+    case JOURNAL_REMOVE_BOOKMARK:
+      entry = ephy_bookmarks_manager_lookup_url (self, key);
+      if (entry)
+        g_sequence_remove (ephy_bookmarks_manager_unwatch_bookmark (self, entry->bookmark));
+      break;
+    case JOURNAL_ADD_TAG:
+      ephy_bookmarks_manager_create_tag (self, key);
+      break;
+    case JOURNAL_REMOVE_TAG:
+      if (ephy_bookmarks_manager_tag_exists (self, key))
+        ephy_bookmarks_manager_delete_tag (self, key);
+      break;
+    default:
+      g_warning ("Unknown bookmarks journal operation %c", operation);
+  }
+
+  if (value)
+    g_variant_unref (value);
+}
+
+/* Applies the records in @filename, in order, and returns the size of the
+ * readable part of the journal. */
+static gsize
+ephy_bookmarks_manager_replay_journal (EphyBookmarksManager *self,
+                                       const char           *filename)
+{
+  GError *error = NULL;
+  GBytes *bytes;
+  char *contents;
+  gsize length;
+  gsize offset = 0;
+
+  if (!g_file_get_contents (filename, &contents, &length, &error)) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Failed to read bookmarks journal %s: %s", filename, error->message);
+    g_error_free (error);
+    return 0;
+  }
+
+  bytes = g_bytes_new_take (contents, length);
+
+  while (length - offset >= sizeof (guint32)) {
+    GBytes *record_bytes;
+    GVariant *record;
+    guint32 size;
+
+    memcpy (&size, contents + offset, sizeof (size));
+    size = GUINT32_FROM_LE (size);
+    if (size > length - offset - sizeof (size))
+      break;
+
+    record_bytes = g_bytes_new_from_bytes (bytes, offset + sizeof (size), size);
+    record = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(ysmv)"), record_bytes, FALSE));
+    if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+      GVariant *swapped = g_variant_byteswap (record);
+      g_variant_unref (record);
+      record = swapped;
+    }
+
+    ephy_bookmarks_manager_apply_journal_record (self, record);
+
+    g_variant_unref (record);
+    g_bytes_unref (record_bytes);
+    offset += sizeof (size) + size;
+  }
+
+  /* A record cut short by a crash. Drop it, or records appended later would
+   * be unreadable. */
+  if (offset < length) {
+    g_warning ("Discarding truncated record at the end of bookmarks journal %s", filename);
+    if (!g_file_set_contents (filename, contents, offset, &error)) {
+      g_warning ("Failed to truncate bookmarks journal %s: %s", filename, error->message);
+      g_error_free (error);
+    }
+  }
+
+  g_bytes_unref (bytes);
+
+  return offset;
+}
+
 void
 ephy_bookmarks_manager_load_from_file (EphyBookmarksManager *self)
 {
+  gboolean has_old_journal;
+
   ephy_bookmarks_import (self, self->gvdb_filename, NULL);
+
+  /* The old journal is older than the current one, if both exist. */
+  has_old_journal = g_file_test (self->old_journal_filename, G_FILE_TEST_EXISTS);
+  if (has_old_journal)
+    ephy_bookmarks_manager_replay_journal (self, self->old_journal_filename);
+  self->journal_size = ephy_bookmarks_manager_replay_journal (self, self->journal_filename);
+
+  /* Everything in memory is on disk now. */
+  g_hash_table_remove_all (self->saved_tags);
+  g_hash_table_remove_all (self->saved_bookmarks);
+  ephy_bookmarks_manager_diff_saved_state (self, NULL);
+
+  if (has_old_journal || self->journal_size >= JOURNAL_COMPACT_SIZE)
+    ephy_bookmarks_manager_compact (self);
 }
 
 void
@@ -565,7 +1398,7 @@ ephy_bookmarks_manager_save_to_file_warn_on_error_cb (GObject      *object,
 {
   EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (object);
   gboolean ret;
-  GError *error;
+  GError *error = NULL;
 
   ret = ephy_bookmarks_manager_save_to_file_finish (self, result, &error);
   if (ret == FALSE) {
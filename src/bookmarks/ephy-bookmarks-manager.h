@@ -42,9 +42,13 @@ EphyBookmark *ephy_bookmarks_manager_get_bookmark_by_url          (EphyBookmarks
                                                                    const char           *url);
 EphyBookmark *ephy_bookmarks_manager_get_bookmark_by_id           (EphyBookmarksManager *self,
                                                                    const char           *id);
+GPtrArray   *ephy_bookmarks_manager_merge_remote_bookmarks        (EphyBookmarksManager *self,
+                                                                   GPtrArray            *remotes);
 
 void         ephy_bookmarks_manager_create_tag                    (EphyBookmarksManager *self,
                                                                    const char           *tag);
+void         ephy_bookmarks_manager_create_tags                   (EphyBookmarksManager *self,
+                                                                   const char * const   *tags);
 void         ephy_bookmarks_manager_delete_tag                    (EphyBookmarksManager *self,
                                                                    const char           *tag);
 gboolean     ephy_bookmarks_manager_tag_exists                    (EphyBookmarksManager *self,
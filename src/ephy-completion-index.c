@@ -0,0 +1,959 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-completion-index.h"
+
+#include "ephy-debug.h"
+
+#include <libsoup/soup.h>
+#include <string.h>
+
+/* The history is indexed from idles of at most this long, 3/5 of
+ * gdkframeclockidle.c's FRAME_INTERVAL (16667 microsecs). */
+#define LOAD_TIME_MS_PER_IDLE 10
+
+/* When the rarest trigram of a query is in more than one entry out of this
+ * many, walking the history from its most visited URL finds enough matches
+ * sooner than checking every entry that has the trigram. */
+#define SCAN_RATIO 4
+
+/* Removed entries and changed texts leave ids behind in the trigram lists.
+ * Once there are this many, and more than live entries, the lists are
+ * rebuilt. */
+#define MIN_STALE_IDS 1024
+
+typedef struct {
+  guint id;
+  char *url;
+  char *title;
+  char *keywords;
+  /* The casefolded URL, title and keywords, one per line. */
+  char *haystack;
+  int visit_count;
+  int relevance;
+  /* Bookmarks and history URLs are separate entries, even when they share
+   * their URL, so that each one can be updated on its own. */
+  EphyBookmark *bookmark;
+  GSequenceIter *iter;
+  guint serial;
+} Entry;
+
+typedef struct {
+  EphyCompletionMatch match;
+  guint id;
+} Match;
+
+struct _EphyCompletionIndex {
+  GObject parent_instance;
+
+  EphyHistoryService *history_service;
+  EphyBookmarksManager *bookmarks_manager;
+  GCancellable *cancellable;
+
+  /* Entries by id, with holes where they were removed. */
+  GPtrArray *entries;
+  GHashTable *history_entries;
+  GHashTable *bookmark_entries;
+  GSequence *most_visited;
+  /* Three bytes of casefolded text to the ids of the entries having them. */
+  GHashTable *trigrams;
+  guint n_stale_ids;
+  guint serial;
+
+  GList *unindexed_urls;
+  guint load_source_id;
+  gboolean loaded;
+};
+
+enum {
+  LOADED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+G_DEFINE_TYPE (EphyCompletionIndex, ephy_completion_index, G_TYPE_OBJECT)
+
+static gboolean
+is_base_address (const char *address)
+{
+  if (address == NULL)
+    return FALSE;
+
+  /* A base address is <scheme>://<host>/
+   * Neither scheme nor host contain a slash, so we can use slashes
+   * figure out if it's a base address.
+   *
+   * Note: previous code was using a GRegExp to do the same thing.
+   * While regexps are much nicer to read, they're also a lot
+   * slower.
+   */
+  address = strchr (address, '/');
+  if (address == NULL ||
+      address[1] != '/')
+    return FALSE;
+
+  address += 2;
+  address = strchr (address, '/');
+  if (address == NULL ||
+      address[1] != 0)
+    return FALSE;
+
+  return TRUE;
+}
+
+static int
+get_relevance (const char *location,
+               int         visit_count,
+               gboolean    is_bookmark)
+{
+  /* FIXME: use frecency. */
+  int relevance = 0;
+
+  /* We have three ordered groups: history's base addresses,
+     bookmarks, deep history addresses. */
+  if (is_bookmark)
+    relevance = 1 << 5;
+  else {
+    visit_count = MIN (visit_count, (1 << 5) - 1);
+
+    if (is_base_address (location))
+      relevance = visit_count << 10;
+    else
+      relevance = visit_count;
+  }
+
+  return relevance;
+}
+
+static void
+entry_free (Entry *entry)
+{
+  if (entry == NULL)
+    return;
+
+  g_free (entry->url);
+  g_free (entry->title);
+  g_free (entry->keywords);
+  g_free (entry->haystack);
+  g_free (entry);
+}
+
+/* Most visited first, and the most recently added of those. */
+static int
+compare_visit_count (Entry    *a,
+                     Entry    *b,
+                     gpointer  user_data)
+{
+  if (a->visit_count != b->visit_count)
+    return a->visit_count > b->visit_count ? -1 : 1;
+
+  if (a->id != b->id)
+    return a->id > b->id ? -1 : 1;
+
+  return 0;
+}
+
+static void
+index_entry (EphyCompletionIndex *self,
+             Entry               *entry)
+{
+  const guchar *text = (const guchar *)entry->haystack;
+  gsize length = strlen (entry->haystack);
+
+  for (gsize i = 0; i + 3 <= length; i++) {
+    guint trigram = text[i] << 16 | text[i + 1] << 8 | text[i + 2];
+    GArray *ids;
+
+    ids = g_hash_table_lookup (self->trigrams, GUINT_TO_POINTER (trigram));
+    if (!ids) {
+      ids = g_array_new (FALSE, FALSE, sizeof (guint));
+      g_hash_table_insert (self->trigrams, GUINT_TO_POINTER (trigram), ids);
+    }
+
+    /* An entry is indexed in one go, so its repeated trigrams are found
+     * at the end of the list. */
+    if (ids->len == 0 || g_array_index (ids, guint, ids->len - 1) != entry->id)
+      g_array_append_val (ids, entry->id);
+  }
+}
+
+static void
+rebuild_trigrams_if_needed (EphyCompletionIndex *self)
+{
+  GPtrArray *entries;
+
+  if (self->n_stale_ids < MIN_STALE_IDS || self->n_stale_ids < self->entries->len / 2)
+    return;
+
+  LOG ("Rebuilding completion index, %u stale ids", self->n_stale_ids);
+
+  entries = g_ptr_array_new_full (g_hash_table_size (self->history_entries) +
+                                  g_hash_table_size (self->bookmark_entries),
+                                  (GDestroyNotify)entry_free);
+  g_hash_table_remove_all (self->trigrams);
+
+  /* Ids keep their order, so the most visited list stays sorted. */
+  for (guint i = 0; i < self->entries->len; i++) {
+    Entry *entry = g_ptr_array_index (self->entries, i);
+
+    if (!entry)
+      continue;
+
+    entry->id = entries->len;
+    g_ptr_array_add (entries, entry);
+    index_entry (self, entry);
+  }
+
+  g_ptr_array_set_free_func (self->entries, NULL);
+  g_ptr_array_unref (self->entries);
+  self->entries = entries;
+  self->n_stale_ids = 0;
+}
+
+static void
+entry_set_text (EphyCompletionIndex *self,
+                Entry               *entry,
+                const char          *url,
+                const char          *title,
+                const char          *keywords)
+{
+  char *new_title = g_strdup (title);
+  char *new_keywords = g_strdup (keywords);
+  char *text;
+
+  /* The trigrams of the old text stay behind until the next rebuild. */
+  if (entry->haystack)
+    self->n_stale_ids++;
+
+  /* The URL of a history entry is its key in history_entries, and never
+   * changes, so it must be kept rather than replaced by a copy. */
+  if (g_strcmp0 (entry->url, url) != 0) {
+    g_free (entry->url);
+    entry->url = g_strdup (url);
+  }
+
+  g_free (entry->title);
+  g_free (entry->keywords);
+  g_free (entry->haystack);
+
+  entry->title = new_title;
+  entry->keywords = new_keywords;
+
+  text = g_strjoin ("\n",
+                    entry->url ? entry->url : "",
+                    entry->title ? entry->title : "",
+                    entry->keywords ? entry->keywords : "",
+                    NULL);
+  entry->haystack = g_utf8_casefold (text, -1);
+  g_free (text);
+
+  index_entry (self, entry);
+}
+
+static void
+entry_set_visit_count (EphyCompletionIndex *self,
+                       Entry               *entry,
+                       int                  visit_count)
+{
+  entry->visit_count = visit_count;
+  entry->relevance = get_relevance (entry->url, visit_count, entry->bookmark != NULL);
+
+  if (entry->iter)
+    g_sequence_sort_changed (entry->iter, (GCompareDataFunc)compare_visit_count, NULL);
+}
+
+static Entry *
+add_entry (EphyCompletionIndex *self,
+           const char          *url,
+           const char          *title,
+           const char          *keywords,
+           int                  visit_count,
+           EphyBookmark        *bookmark)
+{
+  Entry *entry = g_new0 (Entry, 1);
+
+  entry->id = self->entries->len;
+  entry->bookmark = bookmark;
+  g_ptr_array_add (self->entries, entry);
+
+  entry_set_text (self, entry, url, title, keywords);
+  entry->visit_count = visit_count;
+  entry->relevance = get_relevance (entry->url, visit_count, bookmark != NULL);
+
+  if (bookmark) {
+    g_hash_table_insert (self->bookmark_entries, bookmark, entry);
+  } else {
+    g_hash_table_insert (self->history_entries, entry->url, entry);
+    entry->iter = g_sequence_insert_sorted (self->most_visited, entry,
+                                            (GCompareDataFunc)compare_visit_count, NULL);
+  }
+
+  return entry;
+}
+
+static void
+remove_entry (EphyCompletionIndex *self,
+              Entry               *entry)
+{
+  if (entry->bookmark) {
+    g_hash_table_remove (self->bookmark_entries, entry->bookmark);
+  } else {
+    g_sequence_remove (entry->iter);
+    g_hash_table_remove (self->history_entries, entry->url);
+  }
+
+  g_ptr_array_index (self->entries, entry->id) = NULL;
+  self->n_stale_ids++;
+  entry_free (entry);
+}
+
+static void
+add_history_url (EphyCompletionIndex *self,
+                 EphyHistoryURL      *url)
+{
+  Entry *entry;
+
+  entry = g_hash_table_lookup (self->history_entries, url->url);
+  if (!entry) {
+    add_entry (self, url->url, url->title, NULL, url->visit_count, NULL);
+    return;
+  }
+
+  /* Visited while the history was being indexed, or imported again. */
+  if (url->visit_count > entry->visit_count)
+    entry_set_visit_count (self, entry, url->visit_count);
+  if (!entry->title && url->title)
+    entry_set_text (self, entry, entry->url, url->title, NULL);
+}
+
+static gboolean
+index_urls_cb (EphyCompletionIndex *self)
+{
+  GTimer *timer;
+
+  timer = g_timer_new ();
+
+  while (self->unindexed_urls &&
+         g_timer_elapsed (timer, NULL) < LOAD_TIME_MS_PER_IDLE / 1000.) {
+    EphyHistoryURL *url = self->unindexed_urls->data;
+
+    add_history_url (self, url);
+    ephy_history_url_free (url);
+    self->unindexed_urls = g_list_delete_link (self->unindexed_urls, self->unindexed_urls);
+  }
+
+  g_timer_destroy (timer);
+
+  if (self->unindexed_urls)
+    return G_SOURCE_CONTINUE;
+
+  self->load_source_id = 0;
+  LOG ("Completion index loaded, %u entries", self->entries->len);
+
+  if (!self->loaded) {
+    self->loaded = TRUE;
+    g_signal_emit (self, signals[LOADED], 0);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+urls_loaded_cb (EphyHistoryService  *service,
+                gboolean             success,
+                gpointer             result_data,
+                EphyCompletionIndex *self)
+{
+  if (success)
+    self->unindexed_urls = g_list_concat (self->unindexed_urls, result_data);
+
+  if (self->load_source_id)
+    return;
+
+  self->load_source_id = g_idle_add_full (G_PRIORITY_LOW, (GSourceFunc)index_urls_cb, self, NULL);
+  g_source_set_name_by_id (self->load_source_id, "[epiphany] index_urls_cb");
+}
+
+static void
+load_history (EphyCompletionIndex *self)
+{
+  ephy_history_service_find_urls (self->history_service,
+                                  0, 0,
+                                  0, 0,
+                                  NULL,
+                                  EPHY_HISTORY_SORT_MOST_VISITED,
+                                  self->cancellable,
+                                  (EphyHistoryJobCallback)urls_loaded_cb,
+                                  self);
+}
+
+static void
+visit_url_cb (EphyHistoryService       *service,
+              const char               *url,
+              EphyHistoryPageVisitType  visit_type,
+              EphyCompletionIndex      *self)
+{
+  Entry *entry;
+
+  entry = g_hash_table_lookup (self->history_entries, url);
+  if (entry)
+    entry_set_visit_count (self, entry, entry->visit_count + 1);
+  else
+    add_entry (self, url, NULL, NULL, 1, NULL);
+}
+
+static void
+url_title_changed_cb (EphyHistoryService  *service,
+                      const char          *url,
+                      const char          *title,
+                      EphyCompletionIndex *self)
+{
+  Entry *entry;
+
+  entry = g_hash_table_lookup (self->history_entries, url);
+  if (entry) {
+    entry_set_text (self, entry, entry->url, title, NULL);
+    rebuild_trigrams_if_needed (self);
+  }
+}
+
+static void
+url_deleted_cb (EphyHistoryService  *service,
+                const char          *url,
+                EphyCompletionIndex *self)
+{
+  Entry *entry;
+
+  entry = g_hash_table_lookup (self->history_entries, url);
+  if (entry) {
+    remove_entry (self, entry);
+    rebuild_trigrams_if_needed (self);
+  }
+}
+
+static void
+host_deleted_cb (EphyHistoryService  *service,
+                 const char          *deleted_url,
+                 EphyCompletionIndex *self)
+{
+  GHashTableIter iter;
+  GPtrArray *deleted;
+  SoupURI *deleted_uri;
+  Entry *entry;
+
+  deleted_uri = soup_uri_new (deleted_url);
+  if (!deleted_uri)
+    return;
+
+  deleted = g_ptr_array_new ();
+
+  g_hash_table_iter_init (&iter, self->history_entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry)) {
+    SoupURI *uri = soup_uri_new (entry->url);
+
+    if (uri && g_strcmp0 (soup_uri_get_host (uri), soup_uri_get_host (deleted_uri)) == 0)
+      g_ptr_array_add (deleted, entry);
+
+    g_clear_pointer (&uri, soup_uri_free);
+  }
+
+  for (guint i = 0; i < deleted->len; i++)
+    remove_entry (self, g_ptr_array_index (deleted, i));
+  rebuild_trigrams_if_needed (self);
+
+  g_ptr_array_free (deleted, TRUE);
+  soup_uri_free (deleted_uri);
+}
+
+static void
+history_imported_cb (EphyHistoryService  *service,
+                     EphyCompletionIndex *self)
+{
+  /* Imported visits are not announced one by one, so merge the whole
+   * history in again. */
+  load_history (self);
+}
+
+static void
+history_cleared_cb (EphyHistoryService  *service,
+                    EphyCompletionIndex *self)
+{
+  GList *entries;
+
+  g_list_free_full (self->unindexed_urls, (GDestroyNotify)ephy_history_url_free);
+  self->unindexed_urls = NULL;
+
+  entries = g_hash_table_get_values (self->history_entries);
+  for (GList *l = entries; l; l = l->next)
+    remove_entry (self, l->data);
+  g_list_free (entries);
+
+  rebuild_trigrams_if_needed (self);
+}
+
+static char *
+get_bookmark_keywords (EphyBookmark *bookmark)
+{
+  GSequence *tags = ephy_bookmark_get_tags (bookmark);
+  GSequenceIter *iter;
+  GString *keywords;
+
+  keywords = g_string_new (NULL);
+
+  for (iter = g_sequence_get_begin_iter (tags);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter)) {
+    if (keywords->len > 0)
+      g_string_append_c (keywords, ' ');
+    g_string_append (keywords, g_sequence_get (iter));
+  }
+
+  return g_string_free (keywords, keywords->len == 0);
+}
+
+static void
+sync_bookmark (EphyCompletionIndex *self,
+               EphyBookmark        *bookmark)
+{
+  Entry *entry;
+  char *keywords;
+
+  entry = g_hash_table_lookup (self->bookmark_entries, bookmark);
+
+  /* Smart bookmarks are offered as actions of the location entry. */
+  if (ephy_bookmark_is_smart (bookmark)) {
+    if (entry)
+      remove_entry (self, entry);
+    return;
+  }
+
+  keywords = get_bookmark_keywords (bookmark);
+  if (entry)
+    entry_set_text (self, entry, ephy_bookmark_get_url (bookmark), ephy_bookmark_get_title (bookmark), keywords);
+  else
+    add_entry (self, ephy_bookmark_get_url (bookmark), ephy_bookmark_get_title (bookmark), keywords, 0, bookmark);
+  g_free (keywords);
+
+  rebuild_trigrams_if_needed (self);
+}
+
+static void
+bookmark_changed_cb (EphyBookmarksManager *manager,
+                     EphyBookmark         *bookmark,
+                     EphyCompletionIndex  *self)
+{
+  sync_bookmark (self, bookmark);
+}
+
+static void
+bookmark_tag_changed_cb (EphyBookmarksManager *manager,
+                         EphyBookmark         *bookmark,
+                         const char           *tag,
+                         EphyCompletionIndex  *self)
+{
+  sync_bookmark (self, bookmark);
+}
+
+static void
+bookmark_removed_cb (EphyBookmarksManager *manager,
+                     EphyBookmark         *bookmark,
+                     EphyCompletionIndex  *self)
+{
+  Entry *entry;
+
+  entry = g_hash_table_lookup (self->bookmark_entries, bookmark);
+  if (entry) {
+    remove_entry (self, entry);
+    rebuild_trigrams_if_needed (self);
+  }
+}
+
+static void
+ephy_completion_index_dispose (GObject *object)
+{
+  EphyCompletionIndex *self = EPHY_COMPLETION_INDEX (object);
+
+  if (self->cancellable) {
+    g_cancellable_cancel (self->cancellable);
+    g_clear_object (&self->cancellable);
+  }
+
+  if (self->load_source_id) {
+    g_source_remove (self->load_source_id);
+    self->load_source_id = 0;
+  }
+
+  g_list_free_full (self->unindexed_urls, (GDestroyNotify)ephy_history_url_free);
+  self->unindexed_urls = NULL;
+
+  g_clear_object (&self->history_service);
+  g_clear_object (&self->bookmarks_manager);
+
+  G_OBJECT_CLASS (ephy_completion_index_parent_class)->dispose (object);
+}
+
+static void
+ephy_completion_index_finalize (GObject *object)
+{
+  EphyCompletionIndex *self = EPHY_COMPLETION_INDEX (object);
+
+  g_hash_table_destroy (self->trigrams);
+  g_hash_table_destroy (self->history_entries);
+  g_hash_table_destroy (self->bookmark_entries);
+  g_sequence_free (self->most_visited);
+  g_ptr_array_free (self->entries, TRUE);
+
+  G_OBJECT_CLASS (ephy_completion_index_parent_class)->finalize (object);
+}
+
+static void
+ephy_completion_index_class_init (EphyCompletionIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_completion_index_dispose;
+  object_class->finalize = ephy_completion_index_finalize;
+
+  /**
+   * EphyCompletionIndex::loaded:
+   * @index: the #EphyCompletionIndex
+   *
+   * Emitted once every history URL is in the index.
+   */
+  signals[LOADED] =
+    g_signal_new ("loaded",
+                  EPHY_TYPE_COMPLETION_INDEX,
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 0);
+}
+
+static void
+ephy_completion_index_init (EphyCompletionIndex *self)
+{
+  self->entries = g_ptr_array_new_with_free_func ((GDestroyNotify)entry_free);
+  self->history_entries = g_hash_table_new (g_str_hash, g_str_equal);
+  self->bookmark_entries = g_hash_table_new (NULL, NULL);
+  self->most_visited = g_sequence_new (NULL);
+  self->trigrams = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_array_unref);
+  self->cancellable = g_cancellable_new ();
+}
+
+EphyCompletionIndex *
+ephy_completion_index_new (EphyHistoryService   *history_service,
+                           EphyBookmarksManager *bookmarks_manager)
+{
+  EphyCompletionIndex *self;
+  GSequence *bookmarks;
+  GSequenceIter *iter;
+
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (history_service), NULL);
+  g_return_val_if_fail (EPHY_IS_BOOKMARKS_MANAGER (bookmarks_manager), NULL);
+
+  self = g_object_new (EPHY_TYPE_COMPLETION_INDEX, NULL);
+  self->history_service = g_object_ref (history_service);
+  self->bookmarks_manager = g_object_ref (bookmarks_manager);
+
+  bookmarks = ephy_bookmarks_manager_get_bookmarks (bookmarks_manager);
+  for (iter = g_sequence_get_begin_iter (bookmarks);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter))
+    sync_bookmark (self, g_sequence_get (iter));
+
+  g_signal_connect_object (bookmarks_manager, "bookmark-added",
+                           G_CALLBACK (bookmark_changed_cb), self, 0);
+  g_signal_connect_object (bookmarks_manager, "bookmark-removed",
+                           G_CALLBACK (bookmark_removed_cb), self, 0);
+  g_signal_connect_object (bookmarks_manager, "bookmark-title-changed",
+                           G_CALLBACK (bookmark_changed_cb), self, 0);
+  g_signal_connect_object (bookmarks_manager, "bookmark-url-changed",
+                           G_CALLBACK (bookmark_changed_cb), self, 0);
+  g_signal_connect_object (bookmarks_manager, "bookmark-tag-added",
+                           G_CALLBACK (bookmark_tag_changed_cb), self, 0);
+  g_signal_connect_object (bookmarks_manager, "bookmark-tag-removed",
+                           G_CALLBACK (bookmark_tag_changed_cb), self, 0);
+
+  g_signal_connect_object (history_service, "visit-url",
+                           G_CALLBACK (visit_url_cb), self, 0);
+  g_signal_connect_object (history_service, "url-title-changed",
+                           G_CALLBACK (url_title_changed_cb), self, 0);
+  g_signal_connect_object (history_service, "url-deleted",
+                           G_CALLBACK (url_deleted_cb), self, 0);
+  g_signal_connect_object (history_service, "host-deleted",
+                           G_CALLBACK (host_deleted_cb), self, 0);
+  g_signal_connect_object (history_service, "cleared",
+                           G_CALLBACK (history_cleared_cb), self, 0);
+  g_signal_connect_object (history_service, "imported",
+                           G_CALLBACK (history_imported_cb), self, 0);
+
+  load_history (self);
+
+  return self;
+}
+
+gboolean
+ephy_completion_index_is_loaded (EphyCompletionIndex *self)
+{
+  g_return_val_if_fail (EPHY_IS_COMPLETION_INDEX (self), FALSE);
+
+  return self->loaded;
+}
+
+/* Splits @search_string on the spaces that are not between double quotes,
+ * dropping the quotes. */
+static char **
+parse_search_terms (const char *search_string)
+{
+  GPtrArray *terms;
+  GString *term;
+  gboolean inside_quotes = FALSE;
+
+  terms = g_ptr_array_new ();
+  term = g_string_new (NULL);
+
+  for (const char *p = search_string;; p++) {
+    if (*p == '"') {
+      inside_quotes = !inside_quotes;
+    } else if (*p == '\0' || (*p == ' ' && !inside_quotes)) {
+      g_strstrip (term->str);
+      if (term->str[0] != '\0')
+        g_ptr_array_add (terms, g_utf8_casefold (term->str, -1));
+      g_string_truncate (term, 0);
+
+      if (*p == '\0')
+        break;
+    } else {
+      g_string_append_c (term, *p);
+    }
+  }
+
+  g_string_free (term, TRUE);
+  g_ptr_array_add (terms, NULL);
+
+  return (char **)g_ptr_array_free (terms, FALSE);
+}
+
+static gboolean
+entry_matches (Entry  *entry,
+               char  **terms)
+{
+  for (guint i = 0; terms[i]; i++) {
+    if (!strstr (entry->haystack, terms[i]))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Returns the ids of the entries having the rarest trigram of @terms, which
+ * include every entry matching them, or %NULL if the terms are too short to
+ * have any. Sets @no_match if a trigram is in no entry at all. */
+static GArray *
+get_candidates (EphyCompletionIndex  *self,
+                char                **terms,
+                gboolean             *no_match)
+{
+  GArray *candidates = NULL;
+
+  *no_match = FALSE;
+
+  for (guint i = 0; terms[i]; i++) {
+    const guchar *text = (const guchar *)terms[i];
+    gsize length = strlen (terms[i]);
+
+    for (gsize j = 0; j + 3 <= length; j++) {
+      guint trigram = text[j] << 16 | text[j + 1] << 8 | text[j + 2];
+      GArray *ids;
+
+      ids = g_hash_table_lookup (self->trigrams, GUINT_TO_POINTER (trigram));
+      if (!ids) {
+        *no_match = TRUE;
+        return NULL;
+      }
+
+      if (!candidates || ids->len < candidates->len)
+        candidates = ids;
+    }
+  }
+
+  return candidates;
+}
+
+/* Keeps @history sorted like the most visited list, and no longer than
+ * @max_history_urls. */
+static void
+add_history_match (GPtrArray *history,
+                   Entry     *entry,
+                   guint      max_history_urls)
+{
+  guint position = history->len;
+
+  while (position > 0 &&
+         compare_visit_count (entry, g_ptr_array_index (history, position - 1), NULL) < 0)
+    position--;
+
+  if (position >= max_history_urls)
+    return;
+
+  g_ptr_array_insert (history, position, entry);
+  if (history->len > max_history_urls)
+    g_ptr_array_remove_index (history, history->len - 1);
+}
+
+static Match *
+match_new (Entry *entry)
+{
+  Match *match = g_new (Match, 1);
+
+  match->match.url = entry->url;
+  match->match.title = entry->title;
+  match->match.keywords = entry->keywords;
+  match->match.relevance = entry->relevance;
+  match->match.is_bookmark = entry->bookmark != NULL;
+  match->id = entry->id;
+
+  return match;
+}
+
+static int
+compare_relevance (gconstpointer a,
+                   gconstpointer b)
+{
+  const Match *match_a = *(Match **)a;
+  const Match *match_b = *(Match **)b;
+
+  if (match_a->match.relevance != match_b->match.relevance)
+    return match_a->match.relevance > match_b->match.relevance ? -1 : 1;
+
+  if (match_a->id != match_b->id)
+    return match_a->id < match_b->id ? -1 : 1;
+
+  return 0;
+}
+
+/**
+ * ephy_completion_index_query:
+ * @index: an #EphyCompletionIndex
+ * @search_string: the text typed in the location entry
+ * @max_history_urls: how many of the most visited matching URLs to return
+ *
+ * Finds the bookmarks and history URLs that contain every term of
+ * @search_string in their URL, title or keywords, ignoring case. All the
+ * matching bookmarks are returned, along with the @max_history_urls most
+ * visited history URLs, most relevant first.
+ *
+ * Returns: (transfer full) (element-type EphyCompletionMatch): the matches
+ **/
+GPtrArray *
+ephy_completion_index_query (EphyCompletionIndex *self,
+                             const char          *search_string,
+                             guint                max_history_urls)
+{
+  GPtrArray *bookmarks;
+  GPtrArray *history;
+  GPtrArray *matches;
+  GHashTable *bookmark_matches;
+  GArray *candidates;
+  gboolean no_match;
+  char **terms;
+
+  g_return_val_if_fail (EPHY_IS_COMPLETION_INDEX (self), NULL);
+  g_return_val_if_fail (search_string != NULL, NULL);
+
+  terms = parse_search_terms (search_string);
+  bookmarks = g_ptr_array_new ();
+  history = g_ptr_array_new ();
+
+  candidates = get_candidates (self, terms, &no_match);
+  if (no_match) {
+    /* Nothing to find. */
+  } else if (candidates && candidates->len * SCAN_RATIO < self->entries->len) {
+    /* The trigram lists can hold an id more than once. */
+    self->serial++;
+
+    for (guint i = 0; i < candidates->len; i++) {
+      Entry *entry = g_ptr_array_index (self->entries, g_array_index (candidates, guint, i));
+
+      if (!entry || entry->serial == self->serial)
+        continue;
+      entry->serial = self->serial;
+
+      if (!entry_matches (entry, terms))
+        continue;
+
+      if (entry->bookmark)
+        g_ptr_array_add (bookmarks, entry);
+      else
+        add_history_match (history, entry, max_history_urls);
+    }
+  } else {
+    GSequenceIter *iter;
+    GHashTableIter bookmark_iter;
+    Entry *entry;
+
+    g_hash_table_iter_init (&bookmark_iter, self->bookmark_entries);
+    while (g_hash_table_iter_next (&bookmark_iter, NULL, (gpointer *)&entry)) {
+      if (entry_matches (entry, terms))
+        g_ptr_array_add (bookmarks, entry);
+    }
+
+    for (iter = g_sequence_get_begin_iter (self->most_visited);
+         !g_sequence_iter_is_end (iter) && history->len < max_history_urls;
+         iter = g_sequence_iter_next (iter)) {
+      entry = g_sequence_get (iter);
+      if (entry_matches (entry, terms))
+        g_ptr_array_add (history, entry);
+    }
+  }
+
+  matches = g_ptr_array_new_with_free_func (g_free);
+  bookmark_matches = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (guint i = 0; i < bookmarks->len; i++) {
+    Match *match = match_new (g_ptr_array_index (bookmarks, i));
+
+    g_ptr_array_add (matches, match);
+    g_hash_table_insert (bookmark_matches, (char *)match->match.url, match);
+  }
+
+  /* A bookmarked URL is listed once, as relevant as its history entry
+   * if that is more. */
+  for (guint i = 0; i < history->len; i++) {
+    Entry *entry = g_ptr_array_index (history, i);
+    Match *match;
+
+    match = g_hash_table_lookup (bookmark_matches, entry->url);
+    if (match)
+      match->match.relevance = MAX (match->match.relevance, entry->relevance);
+    else
+      g_ptr_array_add (matches, match_new (entry));
+  }
+
+  g_ptr_array_sort (matches, compare_relevance);
+
+  g_hash_table_destroy (bookmark_matches);
+  g_ptr_array_free (history, TRUE);
+  g_ptr_array_free (bookmarks, TRUE);
+  g_strfreev (terms);
+
+  return matches;
+}
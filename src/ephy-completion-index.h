@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-bookmarks-manager.h"
+#include "ephy-history-service.h"
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_COMPLETION_INDEX (ephy_completion_index_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyCompletionIndex, ephy_completion_index, EPHY, COMPLETION_INDEX, GObject)
+
+/* The strings are owned by the index, and only valid until it changes. */
+typedef struct {
+  const char *url;
+  const char *title;
+  const char *keywords;
+  int relevance;
+  gboolean is_bookmark;
+} EphyCompletionMatch;
+
+EphyCompletionIndex *ephy_completion_index_new       (EphyHistoryService   *history_service,
+                                                      EphyBookmarksManager *bookmarks_manager);
+
+gboolean             ephy_completion_index_is_loaded (EphyCompletionIndex  *index);
+
+GPtrArray           *ephy_completion_index_query     (EphyCompletionIndex  *index,
+                                                      const char           *search_string,
+                                                      guint                 max_history_urls);
+
+G_END_DECLS
@@ -21,30 +21,27 @@
 #include "config.h"
 #include "ephy-completion-model.h"
 
-#include "ephy-embed-prefs.h"
 #include "ephy-embed-shell.h"
-#include "ephy-favicon-helpers.h"
-#include "ephy-history-service.h"
-#include "ephy-shell.h"
-#include "ephy-uri-helpers.h"
-
-#include <string.h>
 
 enum {
   PROP_0,
-  PROP_HISTORY_SERVICE,
-  PROP_BOOKMARKS_MANAGER,
+  PROP_INDEX,
   LAST_PROP
 };
 
+typedef struct {
+  char *search_string;
+  EphyHistoryJobCallback callback;
+  gpointer user_data;
+} PendingUpdate;
+
 struct _EphyCompletionModel {
   GtkListStore parent_instance;
 
-  EphyHistoryService *history_service;
-  GCancellable *cancellable;
+  EphyCompletionIndex *index;
 
-  EphyBookmarksManager *bookmarks_manager;
-  GSList *search_terms;
+  /* Updates asked for before the index had the whole history. */
+  GQueue *pending_updates;
 };
 
 static GParamSpec *obj_properties[LAST_PROP];
@@ -66,14 +63,10 @@ ephy_completion_model_constructed (GObject *object)
 }
 
 static void
-free_search_terms (GSList *search_terms)
+pending_update_free (PendingUpdate *update)
 {
-  GSList *iter;
-
-  for (iter = search_terms; iter != NULL; iter = iter->next)
-    g_regex_unref ((GRegex *)iter->data);
-
-  g_slist_free (search_terms);
+  g_free (update->search_string);
+  g_slice_free (PendingUpdate, update);
 }
 
 static void
@@ -82,11 +75,8 @@ ephy_completion_model_set_property (GObject *object, guint property_id, const GV
   EphyCompletionModel *self = EPHY_COMPLETION_MODEL (object);
 
   switch (property_id) {
-    case PROP_HISTORY_SERVICE:
-      self->history_service = EPHY_HISTORY_SERVICE (g_value_get_pointer (value));
-      break;
-    case PROP_BOOKMARKS_MANAGER:
-      self->bookmarks_manager = EPHY_BOOKMARKS_MANAGER (g_value_get_object (value));
+    case PROP_INDEX:
+      self->index = g_value_dup_object (value);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (self, property_id, pspec);
@@ -95,19 +85,21 @@ ephy_completion_model_set_property (GObject *object, guint property_id, const GV
 }
 
 static void
-ephy_completion_model_finalize (GObject *object)
+ephy_completion_model_dispose (GObject *object)
 {
   EphyCompletionModel *model = EPHY_COMPLETION_MODEL (object);
 
-  if (model->search_terms) {
-    free_search_terms (model->search_terms);
-    model->search_terms = NULL;
-  }
+  g_clear_object (&model->index);
 
-  if (model->cancellable) {
-    g_cancellable_cancel (model->cancellable);
-    g_clear_object (&model->cancellable);
-  }
+  G_OBJECT_CLASS (ephy_completion_model_parent_class)->dispose (object);
+}
+
+static void
+ephy_completion_model_finalize (GObject *object)
+{
+  EphyCompletionModel *model = EPHY_COMPLETION_MODEL (object);
+
+  g_queue_free_full (model->pending_updates, (GDestroyNotify)pending_update_free);
 
   G_OBJECT_CLASS (ephy_completion_model_parent_class)->finalize (object);
 }
@@ -119,19 +111,14 @@ ephy_completion_model_class_init (EphyCompletionModelClass *klass)
 
   object_class->set_property = ephy_completion_model_set_property;
   object_class->constructed = ephy_completion_model_constructed;
+  object_class->dispose = ephy_completion_model_dispose;
   object_class->finalize = ephy_completion_model_finalize;
 
-  obj_properties[PROP_HISTORY_SERVICE] =
-    g_param_spec_pointer ("history-service",
-                          "History Service",
-                          "The history service",
-                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS);
-
-  obj_properties[PROP_BOOKMARKS_MANAGER] =
-    g_param_spec_object ("bookmarks-manager",
-                         "Bookmarks manager",
-                         "The bookmarks manager",
-                         EPHY_TYPE_BOOKMARKS_MANAGER,
+  obj_properties[PROP_INDEX] =
+    g_param_spec_object ("index",
+                         "Index",
+                         "The completion index",
+                         EPHY_TYPE_COMPLETION_INDEX,
                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS);
 
   g_object_class_install_properties (object_class, LAST_PROP, obj_properties);
@@ -140,87 +127,24 @@ ephy_completion_model_class_init (EphyCompletionModelClass *klass)
 static void
 ephy_completion_model_init (EphyCompletionModel *model)
 {
+  model->pending_updates = g_queue_new ();
 }
 
-static gboolean
-is_base_address (const char *address)
-{
-  if (address == NULL)
-    return FALSE;
-
-  /* A base address is <scheme>://<host>/
-   * Neither scheme nor host contain a slash, so we can use slashes
-   * figure out if it's a base address.
-   *
-   * Note: previous code was using a GRegExp to do the same thing.
-   * While regexps are much nicer to read, they're also a lot
-   * slower.
-   */
-  address = strchr (address, '/');
-  if (address == NULL ||
-      address[1] != '/')
-    return FALSE;
-
-  address += 2;
-  address = strchr (address, '/');
-  if (address == NULL ||
-      address[1] != 0)
-    return FALSE;
-
-  return TRUE;
-}
-
-static int
-get_relevance (const char *location,
-               int         visit_count,
-               gboolean    is_bookmark)
-{
-  /* FIXME: use frecency. */
-  int relevance = 0;
-
-  /* We have three ordered groups: history's base addresses,
-     bookmarks, deep history addresses. */
-  if (is_bookmark)
-    relevance = 1 << 5;
-  else {
-    visit_count = MIN (visit_count, (1 << 5) - 1);
-
-    if (is_base_address (location))
-      relevance = visit_count << 10;
-    else
-      relevance = visit_count;
-  }
-
-  return relevance;
-}
-
-typedef struct {
-  char *title;
-  char *location;
-  char *keywords;
-  int relevance;
-  gboolean is_bookmark;
-} PotentialRow;
-
 typedef struct {
   GtkListStore *model;
   GtkTreeRowReference *row_reference;
 } IconLoadData;
 
 static void
-icon_loaded_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+icon_loaded_cb (EphyFaviconCache *cache,
+                GAsyncResult     *result,
+                IconLoadData     *data)
 {
   GtkTreeIter iter;
   GtkTreePath *path;
-  IconLoadData *data = (IconLoadData *)user_data;
-  WebKitFaviconDatabase *database = WEBKIT_FAVICON_DATABASE (source);
-  GdkPixbuf *favicon = NULL;
-  cairo_surface_t *icon_surface = webkit_favicon_database_get_favicon_finish (database, result, NULL);
-
-  if (icon_surface) {
-    favicon = ephy_pixbuf_get_from_surface_scaled (icon_surface, FAVICON_SIZE, FAVICON_SIZE);
-    cairo_surface_destroy (icon_surface);
-  }
+  GdkPixbuf *favicon;
+
+  favicon = ephy_favicon_cache_get_favicon_finish (cache, result, NULL);
 
   if (favicon) {
     /* The completion model might have changed its contents */
@@ -228,9 +152,9 @@ icon_loaded_cb (GObject *source, GAsyncResult *result, gpointer user_data)
       path = gtk_tree_row_reference_get_path (data->row_reference);
       gtk_tree_model_get_iter (GTK_TREE_MODEL (data->model), &iter, path);
       gtk_list_store_set (data->model, &iter, EPHY_COMPLETION_FAVICON_COL, favicon, -1);
-      g_object_unref (favicon);
       gtk_tree_path_free (path);
     }
+    g_object_unref (favicon);
   }
 
   g_object_unref (data->model);
@@ -239,364 +163,122 @@ icon_loaded_cb (GObject *source, GAsyncResult *result, gpointer user_data)
 }
 
 static void
-set_row_in_model (EphyCompletionModel *model, int position, PotentialRow *row)
+set_row_in_model (EphyCompletionModel *model, int position, EphyCompletionMatch *match)
 {
   GtkTreeIter iter;
   GtkTreePath *path;
   IconLoadData *data;
-  WebKitFaviconDatabase *database;
-  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+  EphyFaviconCache *cache;
+  GdkPixbuf *favicon;
+  gboolean cached;
 
-  database = webkit_web_context_get_favicon_database (ephy_embed_shell_get_web_context (shell));
+  cache = ephy_embed_shell_get_favicon_cache (ephy_embed_shell_get_default ());
+  cached = ephy_favicon_cache_lookup (cache, match->url, &favicon);
 
   gtk_list_store_insert_with_values (GTK_LIST_STORE (model), &iter, position,
-                                     EPHY_COMPLETION_TEXT_COL, row->title ? row->title : "",
-                                     EPHY_COMPLETION_URL_COL, row->location,
-                                     EPHY_COMPLETION_ACTION_COL, row->location,
-                                     EPHY_COMPLETION_KEYWORDS_COL, row->keywords ? row->keywords : "",
-                                     EPHY_COMPLETION_EXTRA_COL, row->is_bookmark,
-                                     EPHY_COMPLETION_RELEVANCE_COL, row->relevance,
+                                     EPHY_COMPLETION_TEXT_COL, match->title ? match->title : "",
+                                     EPHY_COMPLETION_URL_COL, match->url,
+                                     EPHY_COMPLETION_ACTION_COL, match->url,
+                                     EPHY_COMPLETION_KEYWORDS_COL, match->keywords ? match->keywords : "",
+                                     EPHY_COMPLETION_EXTRA_COL, match->is_bookmark,
+                                     EPHY_COMPLETION_RELEVANCE_COL, match->relevance,
+                                     EPHY_COMPLETION_FAVICON_COL, favicon,
                                      -1);
 
+  if (cached)
+    return;
+
   data = g_slice_new (IconLoadData);
   data->model = GTK_LIST_STORE (g_object_ref (model));
   path = gtk_tree_model_get_path (GTK_TREE_MODEL (model), &iter);
   data->row_reference = gtk_tree_row_reference_new (GTK_TREE_MODEL (model), path);
   gtk_tree_path_free (path);
 
-  webkit_favicon_database_get_favicon (database, row->location,
-                                       NULL, icon_loaded_cb, data);
+  ephy_favicon_cache_get_favicon_async (cache, match->url, NULL,
+                                        (GAsyncReadyCallback)icon_loaded_cb, data);
 }
 
-static void
-replace_rows_in_model (EphyCompletionModel *model, GSList *new_rows)
-{
-  /* This is by far the simplest way of doing, and yet it gives
-   * basically the same result than the other methods... */
-  int i;
-
-  gtk_list_store_clear (GTK_LIST_STORE (model));
-
-  if (!new_rows)
-    return;
-
-  for (i = 0; new_rows != NULL; i++) {
-    PotentialRow *row = (PotentialRow *)new_rows->data;
-
-    set_row_in_model (model, i, row);
-    new_rows = new_rows->next;
-  }
-}
-
-static gboolean
-should_add_bookmark_to_model (EphyCompletionModel *model,
-                              const char          *search_string,
-                              const char          *title,
-                              const char          *location)
-{
-  gboolean ret = TRUE;
-
-  if (model->search_terms) {
-    GSList *iter;
-    GRegex *current = NULL;
-
-    for (iter = model->search_terms; iter != NULL; iter = iter->next) {
-      current = (GRegex *)iter->data;
-      if ((!g_regex_match (current, title ? title : "", G_REGEX_MATCH_NOTEMPTY, NULL)) &&
-          (!g_regex_match (current, location ? location : "", G_REGEX_MATCH_NOTEMPTY, NULL))) {
-        ret = FALSE;
-        break;
-      }
-    }
-  }
-
-  return ret;
-}
-
-typedef struct {
-  EphyCompletionModel *model;
-  char *search_string;
-  EphyHistoryJobCallback callback;
-  gpointer user_data;
-} FindURLsData;
-
-static int
-find_url (gconstpointer a,
-          gconstpointer b)
-{
-  return g_strcmp0 (((PotentialRow *)a)->location,
-                    ((char *)b));
-}
-
-static PotentialRow *
-potential_row_new (const char *title, const char *location,
-                   const char *keywords, int visit_count,
-                   gboolean is_bookmark)
-{
-  PotentialRow *row = g_slice_new0 (PotentialRow);
-
-  row->title = g_strdup (title);
-  row->location = g_strdup (location);
-  row->keywords = g_strdup (keywords);
-  row->relevance = get_relevance (location, visit_count, is_bookmark);
-  row->is_bookmark = is_bookmark;
-
-  return row;
-}
-
-static void
-free_potential_row (PotentialRow *row)
-{
-  g_free (row->title);
-  g_free (row->location);
-  g_free (row->keywords);
-
-  g_slice_free (PotentialRow, row);
-}
-
-static GSList *
-add_to_potential_rows (GSList     *rows,
-                       const char *title,
-                       const char *location,
-                       const char *keywords,
-                       int         visit_count,
-                       gboolean    is_bookmark,
-                       gboolean    search_for_duplicates)
-{
-  gboolean found = FALSE;
-  PotentialRow *row = potential_row_new (title, location, keywords, visit_count, is_bookmark);
-
-  if (search_for_duplicates) {
-    GSList *p;
-
-    p = g_slist_find_custom (rows, location, find_url);
-    if (p) {
-      PotentialRow *match = (PotentialRow *)p->data;
-      if (row->relevance > match->relevance)
-        match->relevance = row->relevance;
-
-      found = TRUE;
-      free_potential_row (row);
-    }
-  }
-
-  if (!found)
-    rows = g_slist_prepend (rows, row);
-
-  return rows;
-}
-
-static int
-sort_by_relevance (gconstpointer a, gconstpointer b)
-{
-  PotentialRow *r1 = (PotentialRow *)a;
-  PotentialRow *r2 = (PotentialRow *)b;
-
-  if (r1->relevance < r2->relevance)
-    return 1;
-  else if (r1->relevance > r2->relevance)
-    return -1;
-  else
-    return 0;
-}
+#define MAX_COMPLETION_HISTORY_URLS 8
 
 static void
-query_completed_cb (EphyHistoryService *service,
-                    gboolean            success,
-                    gpointer            result_data,
-                    FindURLsData       *user_data)
+update_rows (EphyCompletionModel   *model,
+             const char            *search_string,
+             EphyHistoryJobCallback callback,
+             gpointer               data)
 {
-  EphyCompletionModel *model = user_data->model;
-  GList *p, *urls;
-  GSequence *bookmarks;
-  GSequenceIter *iter;
-  GSList *list = NULL;
-
-  /* Bookmarks */
-  bookmarks = ephy_bookmarks_manager_get_bookmarks (model->bookmarks_manager);
-
-  /* FIXME: perhaps this could be done in a service thread? There
-   * should never be a ton of bookmarks, but seems a bit cleaner and
-   * consistent with what we do for the history. */
-  for (iter = g_sequence_get_begin_iter (bookmarks);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark;
-    const char *url, *title;
-
-    bookmark = g_sequence_get (iter);
-
-    url = ephy_bookmark_get_url (bookmark);
-    title = ephy_bookmark_get_title (bookmark);
-
-    if (!ephy_bookmark_is_smart (bookmark) &&
-        should_add_bookmark_to_model (model, user_data->search_string, title, url)) {
-      list = add_to_potential_rows (list, title, url, NULL, 0, TRUE, FALSE);
-    }
-  }
-
-  /* History */
-  urls = (GList *)result_data;
+  GPtrArray *matches;
 
-  for (p = urls; p != NULL; p = p->next) {
-    EphyHistoryURL *url = (EphyHistoryURL *)p->data;
+  matches = ephy_completion_index_query (model->index, search_string, MAX_COMPLETION_HISTORY_URLS);
 
-    list = add_to_potential_rows (list, url->title, url->url, NULL, url->visit_count, FALSE, TRUE);
-  }
-
-  /* Sort the rows by relevance. */
-  list = g_slist_sort (list, sort_by_relevance);
+  /* This is by far the simplest way of doing, and yet it gives
+   * basically the same result than the other methods... */
+  gtk_list_store_clear (GTK_LIST_STORE (model));
 
-  /* Now that we have all the rows we want to insert, replace the rows
-   * in the current model one by one, sorted by relevance. */
-  replace_rows_in_model (model, list);
+  for (guint i = 0; i < matches->len; i++)
+    set_row_in_model (model, i, g_ptr_array_index (matches, i));
 
-  /* Notify */
-  if (user_data->callback)
-    user_data->callback (service, success, result_data, user_data->user_data);
+  g_ptr_array_free (matches, TRUE);
 
-  g_free (user_data->search_string);
-  g_slice_free (FindURLsData, user_data);
-  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
-  g_slist_free_full (list, (GDestroyNotify)free_potential_row);
-  g_clear_object (&model->cancellable);
+  if (callback)
+    callback (NULL, TRUE, NULL, data);
 }
 
 static void
-update_search_terms (EphyCompletionModel *model,
-                     const char          *text)
+index_loaded_cb (EphyCompletionIndex *index,
+                 EphyCompletionModel *model)
 {
-  const char *current;
-  const char *ptr;
-  char *tmp;
-  char *term;
-  GRegex *term_regex;
-  GRegex *quote_regex;
-  gint count;
-  gboolean inside_quotes = FALSE;
-
-  if (model->search_terms) {
-    free_search_terms (model->search_terms);
-    model->search_terms = NULL;
-  }
+  PendingUpdate *update;
 
-  quote_regex = g_regex_new ("\"", G_REGEX_OPTIMIZE,
-                             G_REGEX_MATCH_NOTEMPTY, NULL);
-
-  /*
-   * This code loops through the string using pointer arythmetics.
-   * Although the string we are handling may contain UTF-8 chars
-   * this works because only ASCII chars affect what is actually
-   * copied from the string as a search term.
-   */
-  for (count = 0, current = ptr = text; ptr[0] != '\0'; ptr++, count++) {
-    /*
-     * If we found a double quote character; we will
-     * consume bytes up until the next quote, or
-     * end of line;
-     */
-    if (ptr[0] == '"')
-      inside_quotes = !inside_quotes;
-
-    /*
-     * If we found a space, and we are not looking for a
-     * closing double quote, or if the next char is the
-     * end of the string, append what we have already as
-     * a search term.
-     */
-    if (((ptr[0] == ' ') && (!inside_quotes)) || ptr[1] == '\0') {
-      /*
-       * We special-case the end of the line because
-       * we would otherwise not copy the last character
-       * of the search string, since the for loop will
-       * stop before that.
-       */
-      if (ptr[1] == '\0')
-        count++;
-
-      /*
-       * remove quotes, and quote any regex-sensitive
-       * characters
-       */
-      tmp = g_regex_escape_string (current, count);
-      term = g_regex_replace (quote_regex, tmp, -1, 0,
-                              "", G_REGEX_MATCH_NOTEMPTY, NULL);
-      g_strstrip (term);
-      g_free (tmp);
-
-      /* we don't want empty search terms */
-      if (term[0] != '\0') {
-        term_regex = g_regex_new (term,
-                                  G_REGEX_CASELESS | G_REGEX_OPTIMIZE,
-                                  G_REGEX_MATCH_NOTEMPTY, NULL);
-        model->search_terms = g_slist_append (model->search_terms, term_regex);
-      }
-      g_free (term);
-
-      /* count will be incremented by the for loop */
-      count = -1;
-      current = ptr + 1;
-    }
+  while ((update = g_queue_pop_head (model->pending_updates))) {
+    update_rows (model, update->search_string, update->callback, update->user_data);
+    pending_update_free (update);
   }
-
-  g_regex_unref (quote_regex);
 }
 
-#define MAX_COMPLETION_HISTORY_URLS 8
-
+/**
+ * ephy_completion_model_update_for_string:
+ * @model: an #EphyCompletionModel
+ * @search_string: the text typed in the location entry
+ * @callback: (nullable): called once the rows are updated
+ * @data: data for @callback
+ *
+ * Replaces the rows of @model with the completions of @search_string. This
+ * happens right away, unless the history is still being indexed. @callback
+ * gets neither a history service nor a result.
+ **/
 void
 ephy_completion_model_update_for_string (EphyCompletionModel   *model,
                                          const char            *search_string,
                                          EphyHistoryJobCallback callback,
                                          gpointer               data)
 {
-  char **strings;
-  int i;
-  GList *query = NULL;
-  FindURLsData *user_data;
+  PendingUpdate *update;
 
   g_return_if_fail (EPHY_IS_COMPLETION_MODEL (model));
   g_return_if_fail (search_string != NULL);
 
-  /* Split the search string. */
-  strings = g_strsplit (search_string, " ", -1);
-  for (i = 0; strings[i]; i++)
-    query = g_list_append (query, g_strdup (strings[i]));
-  g_strfreev (strings);
-
-  update_search_terms (model, search_string);
+  if (ephy_completion_index_is_loaded (model->index)) {
+    update_rows (model, search_string, callback, data);
+    return;
+  }
 
-  user_data = g_slice_new (FindURLsData);
-  user_data->model = model;
-  user_data->search_string = g_strdup (search_string);
-  user_data->callback = callback;
-  user_data->user_data = data;
+  if (g_queue_is_empty (model->pending_updates))
+    g_signal_connect_object (model->index, "loaded",
+                             G_CALLBACK (index_loaded_cb), model, G_CONNECT_AFTER);
 
-  if (model->cancellable) {
-    g_cancellable_cancel (model->cancellable);
-    g_object_unref (model->cancellable);
-  }
-  model->cancellable = g_cancellable_new ();
-
-  ephy_history_service_find_urls (model->history_service,
-                                  0, 0,
-                                  MAX_COMPLETION_HISTORY_URLS, 0,
-                                  query,
-                                  EPHY_HISTORY_SORT_MOST_VISITED,
-                                  model->cancellable,
-                                  (EphyHistoryJobCallback)query_completed_cb,
-                                  user_data);
+  update = g_slice_new (PendingUpdate);
+  update->search_string = g_strdup (search_string);
+  update->callback = callback;
+  update->user_data = data;
+  g_queue_push_tail (model->pending_updates, update);
 }
 
 EphyCompletionModel *
-ephy_completion_model_new (EphyHistoryService   *history_service,
-                           EphyBookmarksManager *bookmarks_manager)
+ephy_completion_model_new (EphyCompletionIndex *index)
 {
-  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (history_service), NULL);
-  g_return_val_if_fail (EPHY_IS_BOOKMARKS_MANAGER (bookmarks_manager), NULL);
+  g_return_val_if_fail (EPHY_IS_COMPLETION_INDEX (index), NULL);
 
   return g_object_new (EPHY_TYPE_COMPLETION_MODEL,
-                       "history-service", history_service,
-                       "bookmarks-manager", bookmarks_manager,
+                       "index", index,
                        NULL);
 }
@@ -20,8 +20,7 @@
 
 #pragma once
 
-#include "ephy-bookmarks-manager.h"
-#include "ephy-history-service.h"
+#include "ephy-completion-index.h"
 
 #include <gtk/gtk.h>
 
@@ -43,8 +42,7 @@ typedef enum
   N_COL
 } EphyCompletionColumn;
 
-EphyCompletionModel *ephy_completion_model_new               (EphyHistoryService   *history_service,
-                                                              EphyBookmarksManager *bookmarks_manager);
+EphyCompletionModel *ephy_completion_model_new               (EphyCompletionIndex *index);
 
 void                 ephy_completion_model_update_for_string (EphyCompletionModel *model,
                                                               const char *string,
@@ -33,7 +33,6 @@
 #include "ephy-embed-container.h"
 #include "ephy-embed-prefs.h"
 #include "ephy-embed-utils.h"
-#include "ephy-favicon-helpers.h"
 #include "ephy-gui.h"
 #include "ephy-history-service.h"
 #include "ephy-location-entry.h"
@@ -248,18 +247,11 @@ item_leave_notify_event_cb (GtkWidget   *widget,
 }
 
 static void
-icon_loaded_cb (GObject      *source,
-                GAsyncResult *result,
-                GtkWidget    *image)
+icon_loaded_cb (EphyFaviconCache *cache,
+                GAsyncResult     *result,
+                GtkWidget        *image)
 {
-  WebKitFaviconDatabase *database = WEBKIT_FAVICON_DATABASE (source);
-  GdkPixbuf *favicon = NULL;
-  cairo_surface_t *icon_surface = webkit_favicon_database_get_favicon_finish (database, result, NULL);
-
-  if (icon_surface) {
-    favicon = ephy_pixbuf_get_from_surface_scaled (icon_surface, FAVICON_SIZE, FAVICON_SIZE);
-    cairo_surface_destroy (icon_surface);
-  }
+  GdkPixbuf *favicon = ephy_favicon_cache_get_favicon_finish (cache, result, NULL);
 
   if (favicon) {
     gtk_image_set_from_pixbuf (GTK_IMAGE (image), favicon);
@@ -280,8 +272,8 @@ new_history_menu_item (EphyWebView *view,
   GtkWidget *box;
   GtkWidget *image;
   GtkWidget *label;
-  WebKitFaviconDatabase *database;
-  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+  EphyFaviconCache *cache;
+  GdkPixbuf *favicon;
 
   g_return_val_if_fail (address != NULL && origtext != NULL, NULL);
 
@@ -299,11 +291,14 @@ new_history_menu_item (EphyWebView *view,
   menu_item = gtk_menu_item_new ();
   gtk_container_add (GTK_CONTAINER (menu_item), box);
 
-  database = webkit_web_context_get_favicon_database (ephy_embed_shell_get_web_context (shell));
-  webkit_favicon_database_get_favicon (database, address,
-                                       NULL,
-                                       (GAsyncReadyCallback)icon_loaded_cb,
-                                       g_object_ref (image));
+  cache = ephy_embed_shell_get_favicon_cache (ephy_embed_shell_get_default ());
+  if (!ephy_favicon_cache_lookup (cache, address, &favicon))
+    ephy_favicon_cache_get_favicon_async (cache, address,
+                                          NULL,
+                                          (GAsyncReadyCallback)icon_loaded_cb,
+                                          g_object_ref (image));
+  else if (favicon)
+    gtk_image_set_from_pixbuf (GTK_IMAGE (image), favicon);
 
   g_object_set_data_full (G_OBJECT (menu_item), "link-message", g_strdup (address), (GDestroyNotify)g_free);
 
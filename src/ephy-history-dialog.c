@@ -25,6 +25,7 @@
 
 #include "ephy-debug.h"
 #include "ephy-gui.h"
+#include "ephy-history-tree-model.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
 #include "ephy-shell.h"
@@ -37,19 +38,22 @@
 #include <string.h>
 #include <time.h>
 
-#define NUM_RESULTS_LIMIT -1
-/* 3/5 of gdkframeclockidle.c's FRAME_INTERVAL (16667 microsecs) */
-#define GTK_TREE_VIEW_TIME_MS_PER_IDLE 10
-
 struct _EphyHistoryDialog {
   GtkDialog parent_instance;
 
   EphyHistoryService *history_service;
   GCancellable *cancellable;
 
+  EphyHistoryQuery *query;
+  GCancellable *query_cancellable;
+
+  GArray *selection_rows;
+  GCancellable *selection_cancellable;
+  void (*selection_callback) (EphyHistoryDialog *self,
+                              GList             *urls);
+
   GtkWidget *treeview;
   GtkTreeSelection *tree_selection;
-  GtkWidget *liststore;
   GtkTreeViewColumn *date_column;
   GtkTreeViewColumn *name_column;
   GtkTreeViewColumn *location_column;
@@ -59,9 +63,6 @@ struct _EphyHistoryDialog {
 
   GActionGroup *action_group;
 
-  GList *urls;
-  guint sorter_source;
-
   char *search_text;
 
   gboolean sort_ascending;
@@ -81,69 +82,40 @@ enum {
 static GParamSpec *obj_properties[LAST_PROP];
 
 typedef enum {
-  COLUMN_DATE,
-  COLUMN_NAME,
-  COLUMN_LOCATION
+  COLUMN_DATE = EPHY_HISTORY_TREE_MODEL_COLUMN_DATE,
+  COLUMN_NAME = EPHY_HISTORY_TREE_MODEL_COLUMN_TITLE,
+  COLUMN_LOCATION = EPHY_HISTORY_TREE_MODEL_COLUMN_LOCATION
 } EphyHistoryDialogColumns;
 
-static gboolean
-add_urls_source (EphyHistoryDialog *self)
-{
-  EphyHistoryURL *url;
-  GTimer *timer;
-  GList *element;
-
-  if (self->urls == NULL) {
-    self->sorter_source = 0;
-    return G_SOURCE_REMOVE;
-  }
-
-  timer = g_timer_new ();
-  g_timer_start (timer);
-
-  do {
-    element = self->urls;
-    url = element->data;
-    gtk_list_store_insert_with_values (GTK_LIST_STORE (self->liststore),
-                                       NULL, G_MAXINT,
-                                       COLUMN_DATE, url->last_visit_time,
-                                       COLUMN_NAME, url->title,
-                                       COLUMN_LOCATION, url->url,
-                                       -1);
-    self->urls = g_list_remove_link (self->urls, element);
-    ephy_history_url_free (url);
-    g_list_free_1 (element);
-  } while (self->urls &&
-           g_timer_elapsed (timer, NULL) < GTK_TREE_VIEW_TIME_MS_PER_IDLE / 1000.);
-
-  g_timer_destroy (timer);
-
-  return G_SOURCE_CONTINUE;
-}
-
 static void
-on_find_urls_cb (gpointer service,
-                 gboolean success,
-                 gpointer result_data,
-                 gpointer user_data)
+on_count_urls_cb (gpointer service,
+                  gboolean success,
+                  gpointer result_data,
+                  gpointer user_data)
 {
   EphyHistoryDialog *self = EPHY_HISTORY_DIALOG (user_data);
+  EphyHistoryURLCount *count = (EphyHistoryURLCount *)result_data;
+  EphyHistoryTreeModel *model;
   GtkTreeViewColumn *column;
 
   if (success != TRUE)
     return;
 
-  self->urls = (GList *)result_data;
+  /* Every page, and the selection, is read with the match the rows were
+   * counted with. */
+  self->query->url_match = count->url_match;
 
-  gtk_tree_view_set_model (GTK_TREE_VIEW (self->treeview), NULL);
-  gtk_list_store_clear (GTK_LIST_STORE (self->liststore));
-  gtk_tree_view_set_model (GTK_TREE_VIEW (self->treeview), GTK_TREE_MODEL (self->liststore));
+  /* The model reads the rows the view shows as it scrolls, until the next
+   * query cancels this one. */
+  model = ephy_history_tree_model_new (self->history_service, self->query,
+                                       count->count, self->query_cancellable);
+  ephy_history_url_count_free (count);
+  gtk_tree_view_set_model (GTK_TREE_VIEW (self->treeview), GTK_TREE_MODEL (model));
+  g_object_unref (model);
 
   column = gtk_tree_view_get_column (GTK_TREE_VIEW (self->treeview), self->sort_column);
   gtk_tree_view_column_set_sort_order (column, self->sort_ascending ? GTK_SORT_ASCENDING : GTK_SORT_DESCENDING);
   gtk_tree_view_column_set_sort_indicator (column, TRUE);
-
-  self->sorter_source = g_idle_add ((GSourceFunc)add_urls_source, self);
 }
 
 static GList *
@@ -167,30 +139,39 @@ substrings_filter (EphyHistoryDialog *self)
 }
 
 static void
-remove_pending_sorter_source (EphyHistoryDialog *self)
+cancel_selection (EphyHistoryDialog *self)
 {
-  if (self->sorter_source != 0) {
-    g_source_remove (self->sorter_source);
-    self->sorter_source = 0;
+  if (self->selection_cancellable) {
+    g_cancellable_cancel (self->selection_cancellable);
+    g_clear_object (&self->selection_cancellable);
   }
 
-  if (self->urls != NULL) {
-    g_list_free_full (self->urls, (GDestroyNotify)ephy_history_url_free);
-    self->urls = NULL;
+  g_clear_pointer (&self->selection_rows, g_array_unref);
+  self->selection_callback = NULL;
+}
+
+static void
+cancel_query (EphyHistoryDialog *self)
+{
+  /* The rows of a pending selection belong to the current query. */
+  cancel_selection (self);
+
+  if (self->query_cancellable) {
+    g_cancellable_cancel (self->query_cancellable);
+    g_clear_object (&self->query_cancellable);
+  }
+
+  if (self->query) {
+    ephy_history_query_free (self->query);
+    self->query = NULL;
   }
 }
 
 static void
 filter_now (EphyHistoryDialog *self)
 {
-  gint64 from, to;
-  GList *substrings;
   EphyHistorySortType type;
 
-  substrings = substrings_filter (self);
-
-  from = to = -1;       /* all */
-
   switch (self->sort_column) {
     case COLUMN_DATE:
       type = self->sort_ascending ? EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED : EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
@@ -205,15 +186,17 @@ filter_now (EphyHistoryDialog *self)
       type = EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
   }
 
-  remove_pending_sorter_source (self);
+  cancel_query (self);
 
-  ephy_history_service_find_urls (self->history_service,
-                                  from, to,
-                                  NUM_RESULTS_LIMIT, 0,
-                                  substrings,
-                                  type,
-                                  self->cancellable,
-                                  (EphyHistoryJobCallback)on_find_urls_cb, self);
+  self->query = ephy_history_query_new ();
+  self->query->substring_list = substrings_filter (self);
+  self->query->sort_type = type;
+  self->query_cancellable = g_cancellable_new ();
+
+  ephy_history_service_count_urls (self->history_service,
+                                   self->query,
+                                   self->query_cancellable,
+                                   (EphyHistoryJobCallback)on_count_urls_cb, self);
 }
 
 static void
@@ -319,54 +302,148 @@ get_url_from_path (GtkTreeModel *model,
   return url;
 }
 
+typedef void (*SelectionCallback) (EphyHistoryDialog *self,
+                                   GList             *urls);
+
+static int
+compare_rows (const guint *a,
+              const guint *b)
+{
+  return *a < *b ? -1 : *a > *b;
+}
+
 static void
-get_selection_foreach (GtkTreeModel *model,
-                       GtkTreePath  *path,
-                       GtkTreeIter  *iter,
-                       gpointer     *data)
+on_selection_loaded_cb (gpointer service,
+                        gboolean success,
+                        gpointer result_data,
+                        gpointer user_data)
 {
-  EphyHistoryURL *url;
+  EphyHistoryDialog *self = EPHY_HISTORY_DIALOG (user_data);
+  SelectionCallback callback = self->selection_callback;
+  GArray *rows = self->selection_rows;
+  GList *urls = result_data;
+  GList *selection = NULL;
+  GList *l = urls;
+  guint position;
+
+  self->selection_rows = NULL;
+  self->selection_callback = NULL;
+  g_clear_object (&self->selection_cancellable);
+
+  if (success != TRUE) {
+    g_array_unref (rows);
+    return;
+  }
+
+  /* The URLs start at the first selected row, and both lists are sorted. */
+  position = g_array_index (rows, guint, 0);
+  for (guint i = 0; i < rows->len && l; i++) {
+    guint row = g_array_index (rows, guint, i);
+
+    for (; l && position < row; position++)
+      l = l->next;
+    if (l)
+      selection = g_list_prepend (selection, ephy_history_url_copy (l->data));
+  }
+
+  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
+  g_array_unref (rows);
 
-  url = get_url_from_path (model, path);
-  *data = g_list_prepend (*data, url);
+  callback (self, g_list_reverse (selection));
 }
 
-static GList *
-get_selection (EphyHistoryDialog *self)
-{
-  GList *list = NULL;
+/* Calls @callback with the selected URLs. Rows the view never showed may not
+ * be loaded yet, in which case they are read from the history service. */
+static void
+get_selection (EphyHistoryDialog *self,
+               SelectionCallback  callback)
+{
+  GtkTreeModel *model;
+  GList *paths;
+  GList *selection = NULL;
+  GArray *rows;
+  gboolean loaded = TRUE;
+  EphyHistoryQuery *query;
+  guint first_row, last_row;
+
+  cancel_selection (self);
+
+  paths = gtk_tree_selection_get_selected_rows (self->tree_selection, &model);
+  if (!paths) {
+    callback (self, NULL);
+    return;
+  }
 
-  gtk_tree_selection_selected_foreach (self->tree_selection,
-                                       (GtkTreeSelectionForeachFunc)get_selection_foreach,
-                                       &list);
+  rows = g_array_new (FALSE, FALSE, sizeof (guint));
+  for (GList *l = paths; l; l = l->next) {
+    EphyHistoryURL *url;
+    guint row = gtk_tree_path_get_indices (l->data)[0];
+
+    g_array_append_val (rows, row);
+    if (!loaded)
+      continue;
+
+    url = get_url_from_path (model, l->data);
+    if (url->url) {
+      selection = g_list_prepend (selection, url);
+    } else {
+      ephy_history_url_free (url);
+      loaded = FALSE;
+    }
+  }
+  g_list_free_full (paths, (GDestroyNotify)gtk_tree_path_free);
+
+  if (loaded) {
+    g_array_unref (rows);
+    callback (self, g_list_reverse (selection));
+    return;
+  }
+
+  g_list_free_full (selection, (GDestroyNotify)ephy_history_url_free);
 
-  return g_list_reverse (list);
+  g_array_sort (rows, (GCompareFunc)compare_rows);
+  first_row = g_array_index (rows, guint, 0);
+  last_row = g_array_index (rows, guint, rows->len - 1);
+
+  self->selection_rows = rows;
+  self->selection_callback = callback;
+  self->selection_cancellable = g_cancellable_new ();
+
+  query = ephy_history_query_copy (self->query);
+  query->offset = first_row;
+  query->limit = last_row - first_row + 1;
+  ephy_history_service_query_urls (self->history_service, query, self->selection_cancellable,
+                                   (EphyHistoryJobCallback)on_selection_loaded_cb, self);
+  ephy_history_query_free (query);
 }
 
 static void
-delete_selected (EphyHistoryDialog *self)
+delete_urls (EphyHistoryDialog *self,
+             GList             *urls)
 {
-  GList *selected;
+  if (!urls)
+    return;
 
-  selected = get_selection (self);
-  ephy_history_service_delete_urls (self->history_service, selected, self->cancellable,
+  ephy_history_service_delete_urls (self->history_service, urls, self->cancellable,
                                     (EphyHistoryJobCallback)on_browse_history_deleted_cb, self);
+  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
 }
 
 static void
-open_selection (GSimpleAction *action,
-                GVariant      *parameter,
-                gpointer       user_data)
+delete_selected (EphyHistoryDialog *self)
+{
+  get_selection (self, delete_urls);
+}
+
+static void
+open_urls (EphyHistoryDialog *self,
+           GList             *urls)
 {
-  EphyHistoryDialog *self = EPHY_HISTORY_DIALOG (user_data);
   EphyWindow *window;
-  GList *selection;
   GList *l;
 
-  selection = get_selection (self);
-
   window = EPHY_WINDOW (get_target_window (self));
-  for (l = selection; l; l = l->next) {
+  for (l = urls; l; l = l->next) {
     EphyHistoryURL *url = l->data;
     EphyEmbed *embed;
 
@@ -375,26 +452,40 @@ open_selection (GSimpleAction *action,
     ephy_web_view_load_url (ephy_embed_get_web_view (embed), url->url);
   }
 
-  g_list_free_full (selection, (GDestroyNotify)ephy_history_url_free);
+  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
 }
 
 static void
-copy_url (GSimpleAction *action,
-          GVariant      *parameter,
-          gpointer       user_data)
+open_selection (GSimpleAction *action,
+                GVariant      *parameter,
+                gpointer       user_data)
 {
   EphyHistoryDialog *self = EPHY_HISTORY_DIALOG (user_data);
-  GList *selection;
 
-  selection = get_selection (self);
+  get_selection (self, open_urls);
+}
 
-  if (g_list_length (selection) == 1) {
-    EphyHistoryURL *url = selection->data;
+static void
+copy_urls (EphyHistoryDialog *self,
+           GList             *urls)
+{
+  if (g_list_length (urls) == 1) {
+    EphyHistoryURL *url = urls->data;
     g_message ("URL %s", url->url);
     gtk_clipboard_set_text (gtk_clipboard_get (GDK_SELECTION_CLIPBOARD), url->url, -1);
   }
 
-  g_list_free_full (selection, (GDestroyNotify)ephy_history_url_free);
+  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
+}
+
+static void
+copy_url (GSimpleAction *action,
+          GVariant      *parameter,
+          gpointer       user_data)
+{
+  EphyHistoryDialog *self = EPHY_HISTORY_DIALOG (user_data);
+
+  get_selection (self, copy_urls);
 }
 
 static void
@@ -635,7 +726,7 @@ ephy_history_dialog_dispose (GObject *object)
                                           self);
   g_clear_object (&self->history_service);
 
-  remove_pending_sorter_source (self);
+  cancel_query (self);
 
   G_OBJECT_CLASS (ephy_history_dialog_parent_class)->dispose (object);
 }
@@ -661,7 +752,6 @@ ephy_history_dialog_class_init (EphyHistoryDialogClass *klass)
 
   gtk_widget_class_set_template_from_resource (widget_class,
                                                "/org/gnome/epiphany/gtk/history-dialog.ui");
-  gtk_widget_class_bind_template_child (widget_class, EphyHistoryDialog, liststore);
   gtk_widget_class_bind_template_child (widget_class, EphyHistoryDialog, treeview);
   gtk_widget_class_bind_template_child (widget_class, EphyHistoryDialog, tree_selection);
   gtk_widget_class_bind_template_child (widget_class, EphyHistoryDialog, date_column);
@@ -696,6 +786,12 @@ convert_date_data_func (GtkTreeViewColumn *column,
                       col_id,
                       &value,
                       -1);
+  /* The row is not loaded yet. */
+  if (value == 0) {
+    g_object_set (renderer, "text", NULL, NULL);
+    return;
+  }
+
   time = (time_t)value;
 
   friendly = ephy_time_helpers_utf_friendly_time (time);
@@ -718,7 +814,7 @@ convert_location_data_func (GtkTreeViewColumn *column,
                       col_id,
                       &url,
                       -1);
-  decoded_url = ephy_uri_decode (url);
+  decoded_url = url ? ephy_uri_decode (url) : NULL;
 
   g_object_set (renderer, "text", decoded_url, NULL);
 
@@ -765,10 +861,8 @@ ephy_history_dialog_init (EphyHistoryDialog *self)
 
   self->cancellable = g_cancellable_new ();
 
-  self->urls = NULL;
   self->sort_ascending = FALSE;
   self->sort_column = COLUMN_DATE;
-  self->sorter_source = 0;
 
   ephy_gui_ensure_window_group (GTK_WINDOW (self));
 
@@ -0,0 +1,498 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-history-tree-model.h"
+
+/* Rows are read from the history database a page at a time, the first time
+ * the view asks for one of them. */
+#define PAGE_SIZE 100
+
+/* Past this many loaded pages, the one farthest from the last page the view
+ * asked for is dropped. */
+#define MAX_LOADED_PAGES 20
+
+struct _EphyHistoryTreeModel {
+  GObject parent_instance;
+
+  EphyHistoryService *history_service;
+  EphyHistoryQuery *query;
+  guint n_rows;
+  int stamp;
+
+  GHashTable *pages;
+  guint n_loaded_pages;
+
+  GCancellable *cancellable;
+  GCancellable *query_cancellable;
+  gulong query_cancelled_id;
+};
+
+typedef struct {
+  EphyHistoryTreeModel *model;
+  guint index;
+  GPtrArray *urls;
+  gboolean prefetched;
+} Page;
+
+static void ephy_history_tree_model_tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EphyHistoryTreeModel, ephy_history_tree_model, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL,
+                                                ephy_history_tree_model_tree_model_init))
+
+static void
+page_free (Page *page)
+{
+  if (page->urls)
+    g_ptr_array_unref (page->urls);
+  g_free (page);
+}
+
+static guint
+get_n_pages (EphyHistoryTreeModel *self)
+{
+  return (self->n_rows + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+static void
+drop_farthest_page (EphyHistoryTreeModel *self,
+                    guint                 index)
+{
+  GHashTableIter iter;
+  Page *farthest = NULL;
+  Page *page;
+  guint max_distance = 0;
+
+  g_hash_table_iter_init (&iter, self->pages);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&page)) {
+    guint distance = page->index > index ? page->index - index : index - page->index;
+
+    /* Pages still being read belong to their callback. */
+    if (page->urls && distance > max_distance) {
+      farthest = page;
+      max_distance = distance;
+    }
+  }
+
+  if (farthest) {
+    g_hash_table_remove (self->pages, GUINT_TO_POINTER (farthest->index));
+    self->n_loaded_pages--;
+  }
+}
+
+static void request_page (EphyHistoryTreeModel *self,
+                          guint                 index,
+                          gboolean              prefetch);
+
+static void
+prefetch_next_page (EphyHistoryTreeModel *self,
+                    Page                 *page)
+{
+  guint index = page->index + 1;
+
+  if (index < get_n_pages (self) &&
+      !g_hash_table_contains (self->pages, GUINT_TO_POINTER (index)))
+    request_page (self, index, TRUE);
+}
+
+static void
+page_loaded_cb (EphyHistoryService *service,
+                gboolean            success,
+                gpointer            result_data,
+                gpointer            user_data)
+{
+  Page *page = user_data;
+  EphyHistoryTreeModel *self = page->model;
+  GList *urls = result_data;
+  GtkTreeIter iter;
+  guint first_row;
+
+  page->urls = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_history_url_free);
+  for (GList *l = urls; l; l = l->next)
+    g_ptr_array_add (page->urls, l->data);
+  g_list_free (urls);
+
+  self->n_loaded_pages++;
+  if (self->n_loaded_pages > MAX_LOADED_PAGES)
+    drop_farthest_page (self, page->index);
+
+  first_row = page->index * PAGE_SIZE;
+  iter.stamp = self->stamp;
+  for (guint row = first_row; row < first_row + page->urls->len && row < self->n_rows; row++) {
+    GtkTreePath *path = gtk_tree_path_new_from_indices (row, -1);
+
+    iter.user_data = GUINT_TO_POINTER (row);
+    gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, &iter);
+    gtk_tree_path_free (path);
+  }
+
+  if (!page->prefetched)
+    prefetch_next_page (self, page);
+}
+
+static void
+request_page (EphyHistoryTreeModel *self,
+              guint                 index,
+              gboolean              prefetch)
+{
+  EphyHistoryQuery *query;
+  Page *previous;
+  Page *page;
+
+  if (g_cancellable_is_cancelled (self->cancellable))
+    return;
+
+  page = g_new0 (Page, 1);
+  page->model = self;
+  page->index = index;
+  page->prefetched = prefetch;
+  g_hash_table_insert (self->pages, GUINT_TO_POINTER (index), page);
+
+  query = ephy_history_query_copy (self->query);
+  query->limit = PAGE_SIZE;
+
+  /* Reading on from the last row of the previous page is a lookup in an
+   * index, while an offset makes SQLite step over every row before it. An
+   * offset is only used for pages the view jumped to. */
+  previous = index > 0 ? g_hash_table_lookup (self->pages, GUINT_TO_POINTER (index - 1)) : NULL;
+  if (previous && previous->urls && previous->urls->len == PAGE_SIZE)
+    query->after = ephy_history_url_copy (g_ptr_array_index (previous->urls, PAGE_SIZE - 1));
+  else
+    query->offset = index * PAGE_SIZE;
+
+  ephy_history_service_query_urls (self->history_service, query, self->cancellable,
+                                   (EphyHistoryJobCallback)page_loaded_cb, page);
+  ephy_history_query_free (query);
+}
+
+static EphyHistoryURL *
+get_url (EphyHistoryTreeModel *self,
+         guint                 row)
+{
+  guint index = row / PAGE_SIZE;
+  Page *page;
+
+  page = g_hash_table_lookup (self->pages, GUINT_TO_POINTER (index));
+  if (!page) {
+    request_page (self, index, FALSE);
+    return NULL;
+  }
+
+  /* The view has reached a prefetched page, so read ahead of it too. */
+  if (page->prefetched) {
+    page->prefetched = FALSE;
+    if (page->urls)
+      prefetch_next_page (self, page);
+  }
+
+  if (!page->urls || row % PAGE_SIZE >= page->urls->len)
+    return NULL;
+
+  return g_ptr_array_index (page->urls, row % PAGE_SIZE);
+}
+
+static GtkTreeModelFlags
+ephy_history_tree_model_get_flags (GtkTreeModel *tree_model)
+{
+  return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static int
+ephy_history_tree_model_get_n_columns (GtkTreeModel *tree_model)
+{
+  return EPHY_HISTORY_TREE_MODEL_N_COLUMNS;
+}
+
+static GType
+ephy_history_tree_model_get_column_type (GtkTreeModel *tree_model,
+                                         int           index)
+{
+  switch (index) {
+    case EPHY_HISTORY_TREE_MODEL_COLUMN_DATE:
+      return G_TYPE_INT64;
+    case EPHY_HISTORY_TREE_MODEL_COLUMN_TITLE:
+    case EPHY_HISTORY_TREE_MODEL_COLUMN_LOCATION:
+      return G_TYPE_STRING;
+    default:
+      g_assert_not_reached ();
+  }
+}
+
+static gboolean
+set_iter (EphyHistoryTreeModel *self,
+          GtkTreeIter          *iter,
+          guint                 row)
+{
+  if (row >= self->n_rows) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+
+  iter->stamp = self->stamp;
+  iter->user_data = GUINT_TO_POINTER (row);
+
+  return TRUE;
+}
+
+static gboolean
+ephy_history_tree_model_get_iter (GtkTreeModel *tree_model,
+                                  GtkTreeIter  *iter,
+                                  GtkTreePath  *path)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (tree_model);
+
+  if (gtk_tree_path_get_depth (path) != 1)
+    return FALSE;
+
+  return set_iter (self, iter, gtk_tree_path_get_indices (path)[0]);
+}
+
+static GtkTreePath *
+ephy_history_tree_model_get_path (GtkTreeModel *tree_model,
+                                  GtkTreeIter  *iter)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (tree_model);
+
+  g_return_val_if_fail (iter->stamp == self->stamp, NULL);
+
+  return gtk_tree_path_new_from_indices (GPOINTER_TO_UINT (iter->user_data), -1);
+}
+
+static void
+ephy_history_tree_model_get_value (GtkTreeModel *tree_model,
+                                   GtkTreeIter  *iter,
+                                   int           column,
+                                   GValue       *value)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (tree_model);
+  EphyHistoryURL *url;
+
+  g_return_if_fail (iter->stamp == self->stamp);
+
+  /* Rows that are not loaded yet are empty until their page arrives. */
+  url = get_url (self, GPOINTER_TO_UINT (iter->user_data));
+
+  g_value_init (value, ephy_history_tree_model_get_column_type (tree_model, column));
+  if (!url)
+    return;
+
+  switch (column) {
+    case EPHY_HISTORY_TREE_MODEL_COLUMN_DATE:
+      g_value_set_int64 (value, url->last_visit_time);
+      break;
+    case EPHY_HISTORY_TREE_MODEL_COLUMN_TITLE:
+      g_value_set_string (value, url->title);
+      break;
+    case EPHY_HISTORY_TREE_MODEL_COLUMN_LOCATION:
+      g_value_set_string (value, url->url);
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+}
+
+static gboolean
+ephy_history_tree_model_iter_next (GtkTreeModel *tree_model,
+                                   GtkTreeIter  *iter)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (tree_model);
+
+  g_return_val_if_fail (iter->stamp == self->stamp, FALSE);
+
+  return set_iter (self, iter, GPOINTER_TO_UINT (iter->user_data) + 1);
+}
+
+static gboolean
+ephy_history_tree_model_iter_previous (GtkTreeModel *tree_model,
+                                       GtkTreeIter  *iter)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (tree_model);
+  guint row;
+
+  g_return_val_if_fail (iter->stamp == self->stamp, FALSE);
+
+  row = GPOINTER_TO_UINT (iter->user_data);
+  if (row == 0) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+
+  return set_iter (self, iter, row - 1);
+}
+
+static gboolean
+ephy_history_tree_model_iter_children (GtkTreeModel *tree_model,
+                                       GtkTreeIter  *iter,
+                                       GtkTreeIter  *parent)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (tree_model);
+
+  if (parent) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+
+  return set_iter (self, iter, 0);
+}
+
+static gboolean
+ephy_history_tree_model_iter_has_child (GtkTreeModel *tree_model,
+                                        GtkTreeIter  *iter)
+{
+  return FALSE;
+}
+
+static int
+ephy_history_tree_model_iter_n_children (GtkTreeModel *tree_model,
+                                         GtkTreeIter  *iter)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (tree_model);
+
+  return iter ? 0 : self->n_rows;
+}
+
+static gboolean
+ephy_history_tree_model_iter_nth_child (GtkTreeModel *tree_model,
+                                        GtkTreeIter  *iter,
+                                        GtkTreeIter  *parent,
+                                        int           n)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (tree_model);
+
+  if (parent || n < 0) {
+    iter->stamp = 0;
+    return FALSE;
+  }
+
+  return set_iter (self, iter, n);
+}
+
+static gboolean
+ephy_history_tree_model_iter_parent (GtkTreeModel *tree_model,
+                                     GtkTreeIter  *iter,
+                                     GtkTreeIter  *child)
+{
+  iter->stamp = 0;
+  return FALSE;
+}
+
+static void
+ephy_history_tree_model_tree_model_init (GtkTreeModelIface *iface)
+{
+  iface->get_flags = ephy_history_tree_model_get_flags;
+  iface->get_n_columns = ephy_history_tree_model_get_n_columns;
+  iface->get_column_type = ephy_history_tree_model_get_column_type;
+  iface->get_iter = ephy_history_tree_model_get_iter;
+  iface->get_path = ephy_history_tree_model_get_path;
+  iface->get_value = ephy_history_tree_model_get_value;
+  iface->iter_next = ephy_history_tree_model_iter_next;
+  iface->iter_previous = ephy_history_tree_model_iter_previous;
+  iface->iter_children = ephy_history_tree_model_iter_children;
+  iface->iter_has_child = ephy_history_tree_model_iter_has_child;
+  iface->iter_n_children = ephy_history_tree_model_iter_n_children;
+  iface->iter_nth_child = ephy_history_tree_model_iter_nth_child;
+  iface->iter_parent = ephy_history_tree_model_iter_parent;
+}
+
+static void
+query_cancelled_cb (GCancellable *query_cancellable,
+                    GCancellable *cancellable)
+{
+  g_cancellable_cancel (cancellable);
+}
+
+static void
+ephy_history_tree_model_dispose (GObject *object)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (object);
+
+  /* Page callbacks point to the model, so none may run after this. */
+  if (self->cancellable) {
+    g_cancellable_cancel (self->cancellable);
+    g_clear_object (&self->cancellable);
+  }
+
+  if (self->query_cancellable) {
+    g_cancellable_disconnect (self->query_cancellable, self->query_cancelled_id);
+    self->query_cancelled_id = 0;
+    g_clear_object (&self->query_cancellable);
+  }
+
+  g_clear_object (&self->history_service);
+
+  G_OBJECT_CLASS (ephy_history_tree_model_parent_class)->dispose (object);
+}
+
+static void
+ephy_history_tree_model_finalize (GObject *object)
+{
+  EphyHistoryTreeModel *self = EPHY_HISTORY_TREE_MODEL (object);
+
+  g_hash_table_destroy (self->pages);
+  ephy_history_query_free (self->query);
+
+  G_OBJECT_CLASS (ephy_history_tree_model_parent_class)->finalize (object);
+}
+
+static void
+ephy_history_tree_model_class_init (EphyHistoryTreeModelClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_history_tree_model_dispose;
+  object_class->finalize = ephy_history_tree_model_finalize;
+}
+
+static void
+ephy_history_tree_model_init (EphyHistoryTreeModel *self)
+{
+  self->stamp = g_random_int ();
+  self->pages = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)page_free);
+  self->cancellable = g_cancellable_new ();
+}
+
+/* Creates a model for the @n_rows URLs matching @query, as counted by
+ * ephy_history_service_count_urls(). Rows are read when the view first asks
+ * for them, and no longer once @cancellable is cancelled. */
+EphyHistoryTreeModel *
+ephy_history_tree_model_new (EphyHistoryService *history_service,
+                             EphyHistoryQuery   *query,
+                             guint               n_rows,
+                             GCancellable       *cancellable)
+{
+  EphyHistoryTreeModel *self;
+
+  g_return_val_if_fail (EPHY_IS_HISTORY_SERVICE (history_service), NULL);
+  g_return_val_if_fail (query != NULL, NULL);
+
+  self = g_object_new (EPHY_TYPE_HISTORY_TREE_MODEL, NULL);
+  self->history_service = g_object_ref (history_service);
+  self->query = ephy_history_query_copy (query);
+  self->n_rows = n_rows;
+
+  if (cancellable) {
+    self->query_cancellable = g_object_ref (cancellable);
+    self->query_cancelled_id = g_cancellable_connect (cancellable, G_CALLBACK (query_cancelled_cb),
+                                                      self->cancellable, NULL);
+  }
+
+  return self;
+}
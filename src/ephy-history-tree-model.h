@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+#include "ephy-history-service.h"
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_HISTORY_TREE_MODEL (ephy_history_tree_model_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyHistoryTreeModel, ephy_history_tree_model, EPHY, HISTORY_TREE_MODEL, GObject)
+
+typedef enum {
+  EPHY_HISTORY_TREE_MODEL_COLUMN_DATE,
+  EPHY_HISTORY_TREE_MODEL_COLUMN_TITLE,
+  EPHY_HISTORY_TREE_MODEL_COLUMN_LOCATION,
+  EPHY_HISTORY_TREE_MODEL_N_COLUMNS
+} EphyHistoryTreeModelColumn;
+
+EphyHistoryTreeModel *ephy_history_tree_model_new (EphyHistoryService *history_service,
+                                                   EphyHistoryQuery   *query,
+                                                   guint               n_rows,
+                                                   GCancellable       *cancellable);
+
+G_END_DECLS
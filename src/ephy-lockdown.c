@@ -86,7 +86,8 @@ static const BindAction app_actions[] = {
   { EPHY_PREFS_LOCKDOWN_FULLSCREEN, "new-window", "enabled" },
   { EPHY_PREFS_LOCKDOWN_FULLSCREEN, "new-incognito", "enabled" },
 
-  { EPHY_PREFS_LOCKDOWN_HISTORY, "history", "enabled" }
+  { EPHY_PREFS_LOCKDOWN_HISTORY, "history", "enabled" },
+  { EPHY_PREFS_LOCKDOWN_HISTORY, "import-history", "enabled" }
 };
 
 static const BindAction window_actions[] = {
@@ -613,6 +613,15 @@ sync_icon (EphyWebView *view,
   gtk_image_set_from_pixbuf (icon, ephy_web_view_get_icon (view));
 }
 
+static void
+sync_virtual_icon (EphyEmbed  *embed,
+                   GParamSpec *pspec,
+                   GtkImage   *icon)
+{
+  if (ephy_embed_is_virtual (embed))
+    gtk_image_set_from_pixbuf (icon, ephy_embed_get_virtual_icon (embed));
+}
+
 static void
 sync_label (EphyEmbed *embed, GParamSpec *pspec, GtkWidget *label)
 {
@@ -679,12 +688,58 @@ tab_label_style_set_cb (GtkWidget *hbox,
   gtk_widget_set_size_request (button, w + 2, h + 2);
 }
 
+static void
+tab_label_connect_web_view (GtkWidget   *box,
+                            EphyWebView *view)
+{
+  GtkWidget *icon = g_object_get_data (G_OBJECT (box), "icon");
+  GtkWidget *speaker_icon = g_object_get_data (G_OBJECT (box), "speaker-icon");
+
+  sync_icon (view, NULL, GTK_IMAGE (icon));
+  sync_load_status (view, NULL, box);
+  sync_is_playing_audio (WEBKIT_WEB_VIEW (view), NULL, speaker_icon);
+
+  g_signal_connect_object (view, "notify::icon",
+                           G_CALLBACK (sync_icon), icon, 0);
+  g_signal_connect_object (view, "load-changed",
+                           G_CALLBACK (load_changed_cb), box, 0);
+  g_signal_connect_object (view, "notify::is-playing-audio",
+                           G_CALLBACK (sync_is_playing_audio), speaker_icon, 0);
+}
+
+static void
+tab_label_show_virtual (GtkWidget *box,
+                        EphyEmbed *embed)
+{
+  GtkWidget *icon = g_object_get_data (G_OBJECT (box), "icon");
+  GtkWidget *spinner = g_object_get_data (G_OBJECT (box), "spinner");
+
+  sync_virtual_icon (embed, NULL, GTK_IMAGE (icon));
+  gtk_spinner_stop (GTK_SPINNER (spinner));
+  gtk_widget_hide (spinner);
+  gtk_widget_show (icon);
+  gtk_widget_hide (g_object_get_data (G_OBJECT (box), "speaker-icon"));
+}
+
+/* The web view of a virtual tab is created when it is first shown, and
+ * goes away again when the tab is hibernated. The handlers connected to a
+ * hibernated web view are destroyed with it. */
+static void
+tab_label_web_view_changed_cb (EphyEmbed  *embed,
+                               GParamSpec *pspec,
+                               GtkWidget  *box)
+{
+  if (ephy_embed_is_virtual (embed))
+    tab_label_show_virtual (box, embed);
+  else
+    tab_label_connect_web_view (box, ephy_embed_get_web_view (embed));
+}
+
 static GtkWidget *
 build_tab_label (EphyNotebook *nb, EphyEmbed *embed)
 {
   GtkWidget *hbox, *label, *close_button, *image, *spinner, *icon, *speaker_icon;
   GtkWidget *box;
-  EphyWebView *view;
 
   box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 4);
   gtk_widget_show (box);
@@ -757,22 +812,23 @@ build_tab_label (EphyNotebook *nb, EphyEmbed *embed)
   g_object_set_data (G_OBJECT (box), "speaker-icon", speaker_icon);
 
   /* Hook the label up to the tab properties */
-  view = ephy_embed_get_web_view (embed);
-  sync_icon (view, NULL, GTK_IMAGE (icon));
   sync_label (embed, NULL, label);
-  sync_load_status (view, NULL, box);
-  sync_is_playing_audio (WEBKIT_WEB_VIEW (view), NULL, speaker_icon);
-
-  g_signal_connect_object (view, "notify::icon",
-                           G_CALLBACK (sync_icon), icon, 0);
   g_signal_connect_object (embed, "notify::title",
                            G_CALLBACK (sync_label), label, 0);
   g_signal_connect_object (embed, "notify::title",
                            G_CALLBACK (rebuild_tab_menu_cb), nb, 0);
-  g_signal_connect_object (view, "load-changed",
-                           G_CALLBACK (load_changed_cb), box, 0);
-  g_signal_connect_object (view, "notify::is-playing-audio",
-                           G_CALLBACK (sync_is_playing_audio), speaker_icon, 0);
+
+  /* Virtual tabs show their saved favicon until the web view exists, asking
+   * for the web view here would defeat the point of having them. */
+  g_signal_connect_object (embed, "notify::virtual-icon",
+                           G_CALLBACK (sync_virtual_icon), icon, 0);
+  g_signal_connect_object (embed, "notify::web-view",
+                           G_CALLBACK (tab_label_web_view_changed_cb), box, 0);
+  if (ephy_embed_is_virtual (embed))
+    tab_label_show_virtual (box, embed);
+  else
+    tab_label_connect_web_view (box, ephy_embed_get_web_view (embed));
+
   return box;
 }
 
@@ -910,18 +966,26 @@ ephy_notebook_remove (GtkContainer *container,
   tab_label_label = g_object_get_data (G_OBJECT (tab_label), "label");
   tab_label_speaker_icon = g_object_get_data (G_OBJECT (tab_label), "speaker-icon");
 
-  view = ephy_embed_get_web_view (EPHY_EMBED (tab_widget));
-
-  g_signal_handlers_disconnect_by_func
-    (view, G_CALLBACK (sync_icon), tab_label_icon);
   g_signal_handlers_disconnect_by_func
     (tab_widget, G_CALLBACK (sync_label), tab_label_label);
   g_signal_handlers_disconnect_by_func
     (tab_widget, G_CALLBACK (sync_label), notebook);
+
   g_signal_handlers_disconnect_by_func
-    (view, G_CALLBACK (sync_load_status), tab_label);
+    (tab_widget, G_CALLBACK (sync_virtual_icon), tab_label_icon);
   g_signal_handlers_disconnect_by_func
-    (view, G_CALLBACK (sync_is_playing_audio), tab_label_speaker_icon);
+    (tab_widget, G_CALLBACK (tab_label_web_view_changed_cb), tab_label);
+
+  if (!ephy_embed_is_virtual (EPHY_EMBED (tab_widget))) {
+    view = ephy_embed_get_web_view (EPHY_EMBED (tab_widget));
+
+    g_signal_handlers_disconnect_by_func
+      (view, G_CALLBACK (sync_icon), tab_label_icon);
+    g_signal_handlers_disconnect_by_func
+      (view, G_CALLBACK (sync_load_status), tab_label);
+    g_signal_handlers_disconnect_by_func
+      (view, G_CALLBACK (sync_is_playing_audio), tab_label_speaker_icon);
+  }
 
   GTK_CONTAINER_CLASS (ephy_notebook_parent_class)->remove (container, tab_widget);
 
@@ -0,0 +1,618 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-session-journal.h"
+
+#include "ephy-debug.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+/* Each commit appends the tabs and windows that changed since the previous
+ * one to the journal, next to the snapshot file, as a single batch. Once the
+ * journal grows past JOURNAL_COMPACT_SIZE the snapshot is replaced with the
+ * whole session and the journal starts over. Batches are numbered, and the
+ * snapshot carries the number of the last batch it includes, so that a
+ * journal left behind by a crash during compaction is not replayed. */
+#define JOURNAL_SUFFIX ".journal"
+#define JOURNAL_COMPACT_SIZE (1024 * 1024)
+
+#define BATCH_TYPE "(ta(yumv))"
+#define TAB_TYPE "(ssbbay)"
+#define LAYOUT_TYPE "a(iiiimsiau)"
+
+typedef enum {
+  JOURNAL_PUT_TAB = 't',
+  JOURNAL_REMOVE_TAB = 'T',
+  JOURNAL_SET_LAYOUT = 'l'
+} JournalOperation;
+
+struct _EphySessionJournal {
+  GMutex mutex;
+
+  char *filename;
+  char *journal_filename;
+
+  /* What the snapshot and the journal hold together: tab id -> TAB_TYPE,
+   * and the windows with the ids of their tabs. */
+  GHashTable *tabs;
+  GVariant *layout;
+  guint64 generation;
+
+  gsize journal_size;
+  gboolean needs_snapshot;
+};
+
+EphySessionJournal *
+ephy_session_journal_new (const char *filename)
+{
+  EphySessionJournal *journal;
+
+  g_return_val_if_fail (filename, NULL);
+
+  journal = g_slice_new0 (EphySessionJournal);
+  g_mutex_init (&journal->mutex);
+  journal->filename = g_strdup (filename);
+  journal->journal_filename = g_strconcat (filename, JOURNAL_SUFFIX, NULL);
+  journal->tabs = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_variant_unref);
+  /* Nothing is known about the files until they are loaded, so the first
+   * commit writes the whole session. */
+  journal->needs_snapshot = TRUE;
+
+  return journal;
+}
+
+void
+ephy_session_journal_free (EphySessionJournal *journal)
+{
+  g_return_if_fail (journal);
+
+  g_mutex_clear (&journal->mutex);
+  g_free (journal->filename);
+  g_free (journal->journal_filename);
+  g_hash_table_unref (journal->tabs);
+  if (journal->layout)
+    g_variant_unref (journal->layout);
+
+  g_slice_free (EphySessionJournal, journal);
+}
+
+static void
+append_batch (GByteArray *buffer,
+              guint64     generation,
+              GVariant   *records)
+{
+  GVariant *batch;
+  guint32 size;
+
+  batch = g_variant_ref_sink (g_variant_new ("(t@a(yumv))", generation, records));
+  if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+    GVariant *swapped = g_variant_byteswap (batch);
+    g_variant_unref (batch);
+    batch = swapped;
+  }
+
+  size = GUINT32_TO_LE (g_variant_get_size (batch));
+  g_byte_array_append (buffer, (const guint8 *)&size, sizeof (size));
+  g_byte_array_append (buffer, g_variant_get_data (batch), g_variant_get_size (batch));
+
+  g_variant_unref (batch);
+}
+
+static void
+ephy_session_journal_apply_record (EphySessionJournal *journal,
+                                   GVariant           *record)
+{
+  GVariant *value = NULL;
+  guchar operation;
+  guint32 id;
+
+  g_variant_get (record, "(yumv)", &operation, &id, &value);
+
+  switch (operation) {
+    case JOURNAL_PUT_TAB:
+      if (value && g_variant_is_of_type (value, G_VARIANT_TYPE (TAB_TYPE))) {
+        g_hash_table_replace (journal->tabs, GUINT_TO_POINTER (id), value);
+        value = NULL;
+      }
+      break;
+    case JOURNAL_REMOVE_TAB:
+      g_hash_table_remove (journal->tabs, GUINT_TO_POINTER (id));
+      break;
+    case JOURNAL_SET_LAYOUT:
+      if (value && g_variant_is_of_type (value, G_VARIANT_TYPE (LAYOUT_TYPE))) {
+        if (journal->layout)
+          g_variant_unref (journal->layout);
+        journal->layout = value;
+        value = NULL;
+      }
+      break;
+    default:
+      g_warning ("Unknown session journal operation %c", operation);
+  }
+
+  if (value)
+    g_variant_unref (value);
+}
+
+/* Applies the batches in @filename that are newer than what is already in
+ * memory, and stores the size of the readable part of the file in @length.
+ * A batch cut short by a crash is dropped from the file. */
+static gboolean
+ephy_session_journal_replay (EphySessionJournal  *journal,
+                             const char          *filename,
+                             gsize               *length,
+                             GError             **error)
+{
+  GBytes *bytes;
+  char *contents;
+  gsize size;
+  gsize offset = 0;
+
+  if (!g_file_get_contents (filename, &contents, &size, error))
+    return FALSE;
+
+  bytes = g_bytes_new_take (contents, size);
+
+  while (size - offset >= sizeof (guint32)) {
+    GBytes *batch_bytes;
+    GVariant *batch;
+    GVariant *records;
+    GVariant *record;
+    GVariantIter iter;
+    guint64 generation;
+    guint32 batch_size;
+
+    memcpy (&batch_size, contents + offset, sizeof (batch_size));
+    batch_size = GUINT32_FROM_LE (batch_size);
+    if (batch_size > size - offset - sizeof (batch_size))
+      break;
+
+    batch_bytes = g_bytes_new_from_bytes (bytes, offset + sizeof (batch_size), batch_size);
+    batch = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (BATCH_TYPE), batch_bytes, FALSE));
+    if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+      GVariant *swapped = g_variant_byteswap (batch);
+      g_variant_unref (batch);
+      batch = swapped;
+    }
+
+    g_variant_get (batch, "(t@a(yumv))", &generation, &records);
+    if (generation > journal->generation) {
+      g_variant_iter_init (&iter, records);
+      while ((record = g_variant_iter_next_value (&iter))) {
+        ephy_session_journal_apply_record (journal, record);
+        g_variant_unref (record);
+      }
+      journal->generation = generation;
+    }
+
+    g_variant_unref (records);
+    g_variant_unref (batch);
+    g_bytes_unref (batch_bytes);
+    offset += sizeof (batch_size) + batch_size;
+  }
+
+  if (offset < size) {
+    GError *truncate_error = NULL;
+
+    g_warning ("Discarding truncated batch at the end of session journal %s", filename);
+    if (!g_file_set_contents (filename, contents, offset, &truncate_error)) {
+      g_warning ("Failed to truncate session journal %s: %s", filename, truncate_error->message);
+      g_error_free (truncate_error);
+    }
+  }
+
+  g_bytes_unref (bytes);
+
+  if (length)
+    *length = offset;
+
+  return TRUE;
+}
+
+static gboolean
+ephy_session_journal_write_snapshot (EphySessionJournal  *journal,
+                                     GError             **error)
+{
+  GVariantBuilder records;
+  GHashTableIter iter;
+  GByteArray *buffer;
+  gpointer key, value;
+  gboolean result;
+
+  g_variant_builder_init (&records, G_VARIANT_TYPE ("a(yumv)"));
+
+  g_hash_table_iter_init (&iter, journal->tabs);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_variant_builder_add (&records, "(yumv)", JOURNAL_PUT_TAB, GPOINTER_TO_UINT (key), value);
+  if (journal->layout)
+    g_variant_builder_add (&records, "(yumv)", JOURNAL_SET_LAYOUT, 0, journal->layout);
+
+  buffer = g_byte_array_new ();
+  append_batch (buffer, journal->generation, g_variant_builder_end (&records));
+
+  /* This writes a new file and renames it over the old one, so either
+   * snapshot is complete. */
+  result = g_file_set_contents (journal->filename, (const char *)buffer->data, buffer->len, error);
+  if (result) {
+    /* The snapshot includes every batch in the journal. */
+    if (g_unlink (journal->journal_filename) == -1 && errno != ENOENT)
+      g_warning ("Failed to delete %s: %s", journal->journal_filename, g_strerror (errno));
+    journal->journal_size = 0;
+
+    LOG ("Wrote %u bytes of session snapshot to %s", buffer->len, journal->filename);
+  }
+  journal->needs_snapshot = !result;
+
+  g_byte_array_unref (buffer);
+
+  return result;
+}
+
+static gboolean
+ephy_session_journal_append (EphySessionJournal  *journal,
+                             GVariant            *records,
+                             GError             **error)
+{
+  GByteArray *buffer;
+  GFile *file;
+  GFileOutputStream *stream;
+  gboolean result = FALSE;
+
+  buffer = g_byte_array_new ();
+  append_batch (buffer, journal->generation, records);
+
+  file = g_file_new_for_path (journal->journal_filename);
+  stream = g_file_append_to (file, G_FILE_CREATE_NONE, NULL, error);
+  if (stream) {
+    result = g_output_stream_write_all (G_OUTPUT_STREAM (stream), buffer->data, buffer->len, NULL, NULL, error) &&
+             g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, error);
+    g_object_unref (stream);
+  }
+  g_object_unref (file);
+
+  if (result)
+    journal->journal_size += buffer->len;
+
+  g_byte_array_unref (buffer);
+
+  return result;
+}
+
+/* Returns the session in memory, in the format documented for
+ * EPHY_SESSION_JOURNAL_STATE_TYPE. */
+static GVariant *
+ephy_session_journal_build_state (EphySessionJournal *journal)
+{
+  GVariantBuilder builder;
+  GVariantIter windows;
+  GVariantIter *ids;
+  gint32 x, y, width, height, active_tab;
+  char *role;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (EPHY_SESSION_JOURNAL_STATE_TYPE));
+  if (!journal->layout)
+    return g_variant_builder_end (&builder);
+
+  g_variant_iter_init (&windows, journal->layout);
+  while (g_variant_iter_next (&windows, "(iiiimsiau)", &x, &y, &width, &height, &role, &active_tab, &ids)) {
+    guint32 id;
+
+    g_variant_builder_open (&builder, G_VARIANT_TYPE ("(iiiimsia(ussbbmay))"));
+    g_variant_builder_add (&builder, "i", x);
+    g_variant_builder_add (&builder, "i", y);
+    g_variant_builder_add (&builder, "i", width);
+    g_variant_builder_add (&builder, "i", height);
+    g_variant_builder_add (&builder, "ms", role);
+    g_variant_builder_add (&builder, "i", active_tab);
+
+    g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ussbbmay)"));
+    while (g_variant_iter_next (ids, "u", &id)) {
+      GVariant *tab;
+      GVariant *history;
+      const char *url;
+      const char *title;
+      gboolean loading;
+      gboolean crashed;
+
+      tab = g_hash_table_lookup (journal->tabs, GUINT_TO_POINTER (id));
+      if (!tab)
+        continue;
+
+      g_variant_get (tab, "(&s&sbb@ay)", &url, &title, &loading, &crashed, &history);
+      g_variant_builder_add (&builder, "(ussbb@may)", id, url, title, loading, crashed,
+                             g_variant_new_maybe (G_VARIANT_TYPE_BYTESTRING,
+                                                  g_variant_get_size (history) ? history : NULL));
+      g_variant_unref (history);
+    }
+    g_variant_builder_close (&builder);
+
+    g_variant_builder_close (&builder);
+
+    g_variant_iter_free (ids);
+    g_free (role);
+  }
+
+  return g_variant_builder_end (&builder);
+}
+
+gboolean
+ephy_session_journal_exists (EphySessionJournal *journal)
+{
+  g_return_val_if_fail (journal, FALSE);
+
+  return g_file_test (journal->filename, G_FILE_TEST_EXISTS);
+}
+
+/**
+ * ephy_session_journal_load:
+ * @journal: an #EphySessionJournal
+ * @error: return location for a #GError, or %NULL
+ *
+ * Reads the snapshot and replays the journal on top of it. Later commits
+ * only write what changed with respect to the loaded session.
+ *
+ * Returns: (transfer full): the session, in the format documented for
+ *   %EPHY_SESSION_JOURNAL_STATE_TYPE, or %NULL on error
+ **/
+GVariant *
+ephy_session_journal_load (EphySessionJournal  *journal,
+                           GError             **error)
+{
+  GError *journal_error = NULL;
+  GVariant *state = NULL;
+
+  g_return_val_if_fail (journal, NULL);
+
+  g_mutex_lock (&journal->mutex);
+
+  g_hash_table_remove_all (journal->tabs);
+  g_clear_pointer (&journal->layout, g_variant_unref);
+  journal->generation = 0;
+  journal->journal_size = 0;
+  journal->needs_snapshot = TRUE;
+
+  if (!ephy_session_journal_replay (journal, journal->filename, NULL, error))
+    goto out;
+
+  if (!ephy_session_journal_replay (journal, journal->journal_filename, &journal->journal_size, &journal_error)) {
+    if (!g_error_matches (journal_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Failed to read session journal %s: %s", journal->journal_filename, journal_error->message);
+    g_error_free (journal_error);
+  }
+
+  /* Everything in memory is on disk now. */
+  journal->needs_snapshot = journal->journal_size >= JOURNAL_COMPACT_SIZE;
+  state = g_variant_ref_sink (ephy_session_journal_build_state (journal));
+
+ out:
+  g_mutex_unlock (&journal->mutex);
+
+  return state;
+}
+
+static gboolean
+tab_matches (GVariant   *tab,
+             const char *url,
+             const char *title,
+             gboolean    loading,
+             gboolean    crashed)
+{
+  const char *tab_url;
+  const char *tab_title;
+  gboolean tab_loading;
+  gboolean tab_crashed;
+
+  g_variant_get (tab, "(&s&sbb@ay)", &tab_url, &tab_title, &tab_loading, &tab_crashed, NULL);
+
+  return strcmp (tab_url, url) == 0 &&
+         strcmp (tab_title, title) == 0 &&
+         tab_loading == loading &&
+         tab_crashed == crashed;
+}
+
+/**
+ * ephy_session_journal_commit:
+ * @journal: an #EphySessionJournal
+ * @state: the session, in the format documented for
+ *   %EPHY_SESSION_JOURNAL_STATE_TYPE
+ * @error: return location for a #GError, or %NULL
+ *
+ * Writes the tabs and windows of @state that changed since the last commit
+ * or load. Tabs without a back/forward list keep the one they had then.
+ * This blocks, and is meant to be called from a worker thread; commits from
+ * several threads are written one after the other.
+ *
+ * Returns: %TRUE if @state is on disk
+ **/
+gboolean
+ephy_session_journal_commit (EphySessionJournal  *journal,
+                             GVariant            *state,
+                             GError             **error)
+{
+  GVariantBuilder changes;
+  GVariantBuilder layout_builder;
+  GVariantIter windows;
+  GVariantIter *tabs;
+  GHashTable *seen;
+  GHashTableIter iter;
+  GVariant *layout;
+  gpointer key;
+  gint32 x, y, width, height, active_tab;
+  char *role;
+  guint n_changes = 0;
+  gboolean result = TRUE;
+
+  g_return_val_if_fail (journal, FALSE);
+  g_return_val_if_fail (g_variant_is_of_type (state, G_VARIANT_TYPE (EPHY_SESSION_JOURNAL_STATE_TYPE)), FALSE);
+
+  g_mutex_lock (&journal->mutex);
+
+  g_variant_builder_init (&changes, G_VARIANT_TYPE ("a(yumv)"));
+  g_variant_builder_init (&layout_builder, G_VARIANT_TYPE (LAYOUT_TYPE));
+  seen = g_hash_table_new (NULL, NULL);
+
+  g_variant_iter_init (&windows, state);
+  while (g_variant_iter_next (&windows, "(iiiimsia(ussbbmay))", &x, &y, &width, &height, &role, &active_tab, &tabs)) {
+    GVariant *history;
+    const char *url;
+    const char *title;
+    gboolean loading;
+    gboolean crashed;
+    guint32 id;
+
+    g_variant_builder_open (&layout_builder, G_VARIANT_TYPE ("(iiiimsiau)"));
+    g_variant_builder_add (&layout_builder, "i", x);
+    g_variant_builder_add (&layout_builder, "i", y);
+    g_variant_builder_add (&layout_builder, "i", width);
+    g_variant_builder_add (&layout_builder, "i", height);
+    g_variant_builder_add (&layout_builder, "ms", role);
+    g_variant_builder_add (&layout_builder, "i", active_tab);
+    g_variant_builder_open (&layout_builder, G_VARIANT_TYPE ("au"));
+
+    while (g_variant_iter_loop (tabs, "(u&s&sbb@may)", &id, &url, &title, &loading, &crashed, &history)) {
+      GVariant *saved;
+      GVariant *bytes;
+      GVariant *value;
+
+      g_variant_builder_add (&layout_builder, "u", id);
+      g_hash_table_add (seen, GUINT_TO_POINTER (id));
+
+      saved = g_hash_table_lookup (journal->tabs, GUINT_TO_POINTER (id));
+      bytes = g_variant_get_maybe (history);
+
+      /* The common case: nothing but other tabs changed. */
+      if (!bytes && saved && tab_matches (saved, url, title, loading, crashed))
+        continue;
+
+      if (!bytes && saved)
+        bytes = g_variant_get_child_value (saved, 4);
+      else if (!bytes)
+        bytes = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE_BYTE, NULL, 0));
+
+      value = g_variant_ref_sink (g_variant_new ("(ssbb@ay)", url, title, loading, crashed, bytes));
+      if (!saved || !g_variant_equal (saved, value)) {
+        g_variant_builder_add (&changes, "(yumv)", JOURNAL_PUT_TAB, id, value);
+        g_hash_table_replace (journal->tabs, GUINT_TO_POINTER (id), g_variant_ref (value));
+        n_changes++;
+      }
+
+      g_variant_unref (value);
+      g_variant_unref (bytes);
+    }
+
+    g_variant_builder_close (&layout_builder);
+    g_variant_builder_close (&layout_builder);
+
+    g_variant_iter_free (tabs);
+    g_free (role);
+  }
+
+  g_hash_table_iter_init (&iter, journal->tabs);
+  while (g_hash_table_iter_next (&iter, &key, NULL)) {
+    if (!g_hash_table_contains (seen, key)) {
+      g_variant_builder_add (&changes, "(yumv)", JOURNAL_REMOVE_TAB, GPOINTER_TO_UINT (key), NULL);
+      g_hash_table_iter_remove (&iter);
+      n_changes++;
+    }
+  }
+  g_hash_table_unref (seen);
+
+  layout = g_variant_ref_sink (g_variant_builder_end (&layout_builder));
+  if (!journal->layout || !g_variant_equal (journal->layout, layout)) {
+    g_variant_builder_add (&changes, "(yumv)", JOURNAL_SET_LAYOUT, 0, layout);
+    if (journal->layout)
+      g_variant_unref (journal->layout);
+    journal->layout = g_variant_ref (layout);
+    n_changes++;
+  }
+  g_variant_unref (layout);
+
+  if (n_changes == 0 && !journal->needs_snapshot) {
+    g_variant_builder_clear (&changes);
+    goto out;
+  }
+
+  journal->generation++;
+
+  if (journal->needs_snapshot) {
+    g_variant_builder_clear (&changes);
+  } else {
+    GError *append_error = NULL;
+
+    if (!ephy_session_journal_append (journal, g_variant_builder_end (&changes), &append_error)) {
+      /* The batch may be on disk in part, and nothing appended after it
+       * could be read. Write everything to the snapshot instead. */
+      g_warning ("Failed to append to session journal %s: %s", journal->journal_filename, append_error->message);
+      g_error_free (append_error);
+      journal->needs_snapshot = TRUE;
+    }
+  }
+
+  if (journal->needs_snapshot || journal->journal_size >= JOURNAL_COMPACT_SIZE)
+    result = ephy_session_journal_write_snapshot (journal, error);
+
+ out:
+  g_mutex_unlock (&journal->mutex);
+
+  return result;
+}
+
+/**
+ * ephy_session_journal_delete:
+ * @journal: an #EphySessionJournal
+ *
+ * Deletes the snapshot and the journal. The next commit writes the whole
+ * session again.
+ **/
+void
+ephy_session_journal_delete (EphySessionJournal *journal)
+{
+  g_return_if_fail (journal);
+
+  g_mutex_lock (&journal->mutex);
+
+  g_hash_table_remove_all (journal->tabs);
+  g_clear_pointer (&journal->layout, g_variant_unref);
+  journal->journal_size = 0;
+  journal->needs_snapshot = TRUE;
+
+  g_unlink (journal->journal_filename);
+  g_unlink (journal->filename);
+
+  g_mutex_unlock (&journal->mutex);
+}
+
+gsize
+ephy_session_journal_get_size (EphySessionJournal *journal)
+{
+  gsize size;
+
+  g_return_val_if_fail (journal, 0);
+
+  g_mutex_lock (&journal->mutex);
+  size = journal->journal_size;
+  g_mutex_unlock (&journal->mutex);
+
+  return size;
+}
@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A list of windows, each one with its geometry, role, active tab and tabs.
+ * Tabs have a unique id, their URL, title, whether they were loading or had
+ * crashed and their serialized back/forward list. A missing back/forward list
+ * in a committed session means that of the last commit is still valid. */
+#define EPHY_SESSION_JOURNAL_STATE_TYPE "a(iiiimsia(ussbbmay))"
+
+typedef struct _EphySessionJournal EphySessionJournal;
+
+EphySessionJournal *ephy_session_journal_new      (const char          *filename);
+void                ephy_session_journal_free     (EphySessionJournal  *journal);
+
+gboolean            ephy_session_journal_exists   (EphySessionJournal  *journal);
+GVariant           *ephy_session_journal_load     (EphySessionJournal  *journal,
+                                                   GError             **error);
+gboolean            ephy_session_journal_commit   (EphySessionJournal  *journal,
+                                                   GVariant            *state,
+                                                   GError             **error);
+void                ephy_session_journal_delete   (EphySessionJournal  *journal);
+
+gsize               ephy_session_journal_get_size (EphySessionJournal  *journal);
+
+G_END_DECLS
@@ -34,6 +34,7 @@
 #include "ephy-link.h"
 #include "ephy-notebook.h"
 #include "ephy-prefs.h"
+#include "ephy-session-journal.h"
 #include "ephy-settings.h"
 #include "ephy-shell.h"
 #include "ephy-string.h"
@@ -41,8 +42,6 @@
 
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
-#include <libxml/tree.h>
-#include <libxml/xmlwriter.h>
 
 typedef struct {
   EphyNotebook *notebook;
@@ -56,19 +55,35 @@ typedef struct {
   WebKitWebViewSessionState *state;
 } ClosedTab;
 
+/* What the session journal knows about a tab, attached to its EphyEmbed. */
+typedef struct {
+  guint32 id;
+  gboolean history_changed;
+} TabJournalData;
+
 struct _EphySession {
   GObject parent_instance;
 
   GQueue *closed_tabs;
   guint save_source_id;
-  GCancellable *save_cancellable;
+  EphySessionJournal *journal;
+  guint32 last_tab_id;
   guint closing : 1;
   guint dont_save : 1;
+  guint saving : 1;
+  guint save_queued : 1;
+  guint refresh_tab_histories : 1;
+  guint remove_legacy_state : 1;
 };
 
+/* The XML session file written by older versions. It is still read when
+ * there is no session journal, and removed once the journal is written. */
 #define SESSION_STATE           "type:session_state"
+#define SESSION_JOURNAL_FILE    "session_state"
 #define MAX_CLOSED_TABS         10
 
+#define TAB_JOURNAL_DATA_KEY    "ephy-session-tab-journal-data"
+
 enum {
   PROP_0,
   PROP_CAN_UNDO_TAB_CLOSED,
@@ -115,6 +130,50 @@ session_delete (EphySession *session)
   file = get_session_file (SESSION_STATE);
   g_file_delete (file, NULL, NULL);
   g_object_unref (file);
+
+  ephy_session_journal_delete (session->journal);
+
+  /* The journal no longer has the back/forward list of any tab. */
+  session->refresh_tab_histories = TRUE;
+  session->save_queued = FALSE;
+}
+
+static void
+tab_journal_data_free (TabJournalData *data)
+{
+  g_slice_free (TabJournalData, data);
+}
+
+static TabJournalData *
+ephy_session_get_tab_journal_data (EphySession *session,
+                                   EphyEmbed   *embed)
+{
+  TabJournalData *data;
+
+  data = g_object_get_data (G_OBJECT (embed), TAB_JOURNAL_DATA_KEY);
+  if (!data) {
+    data = g_slice_new (TabJournalData);
+    data->id = ++session->last_tab_id;
+    data->history_changed = TRUE;
+    g_object_set_data_full (G_OBJECT (embed), TAB_JOURNAL_DATA_KEY, data,
+                            (GDestroyNotify)tab_journal_data_free);
+  }
+
+  return data;
+}
+
+/* Tells the journal that @embed is the tab it knows as @id, with the
+ * back/forward list it had when it was saved. */
+static void
+session_set_tab_journal_id (EphySession *session,
+                            EphyEmbed   *embed,
+                            guint32      id)
+{
+  TabJournalData *data;
+
+  data = ephy_session_get_tab_journal_data (session, embed);
+  data->id = id;
+  data->history_changed = FALSE;
 }
 
 static void
@@ -122,10 +181,30 @@ load_changed_cb (WebKitWebView  *view,
                  WebKitLoadEvent load_event,
                  EphySession    *session)
 {
+  TabJournalData *data;
+
+  data = ephy_session_get_tab_journal_data (session, EPHY_GET_EMBED_FROM_EPHY_WEB_VIEW (view));
+  data->history_changed = TRUE;
+
   if (!ephy_web_view_load_failed (EPHY_WEB_VIEW (view)))
     ephy_session_save (session);
 }
 
+/* Same-document navigations, like pushState() or a fragment change, add
+ * back/forward items without emitting load-changed. */
+static void
+uri_changed_cb (WebKitWebView *view,
+                GParamSpec    *pspec,
+                EphySession   *session)
+{
+  TabJournalData *data;
+
+  data = ephy_session_get_tab_journal_data (session, EPHY_GET_EMBED_FROM_EPHY_WEB_VIEW (view));
+  data->history_changed = TRUE;
+
+  ephy_session_save (session);
+}
+
 static void
 notebook_tracker_set_notebook (NotebookTracker *tracker,
                                EphyNotebook    *notebook)
@@ -197,23 +276,33 @@ closed_tab_free (ClosedTab *tab)
 {
   g_free (tab->url);
   notebook_tracker_unref (tab->notebook_tracker);
-  webkit_web_view_session_state_unref (tab->state);
+  g_clear_pointer (&tab->state, webkit_web_view_session_state_unref);
 
   g_slice_free (ClosedTab, tab);
 }
 
 static ClosedTab *
-closed_tab_new (EphyWebView     *web_view,
+closed_tab_new (EphyEmbed       *embed,
                 int              position,
                 NotebookTracker *notebook_tracker)
 {
   ClosedTab *tab = g_slice_new0 (ClosedTab);
 
-  tab->url = g_strdup (ephy_web_view_get_address (web_view));
   tab->position = position;
   /* Takes the ownership of the tracker */
   tab->notebook_tracker = notebook_tracker;
-  tab->state = webkit_web_view_get_session_state (WEBKIT_WEB_VIEW (web_view));
+
+  if (ephy_embed_is_virtual (embed)) {
+    GBytes *state = ephy_embed_get_virtual_session_state (embed);
+
+    tab->url = g_strdup (ephy_embed_get_virtual_url (embed));
+    tab->state = state ? webkit_web_view_session_state_new (state) : NULL;
+  } else {
+    EphyWebView *web_view = ephy_embed_get_web_view (embed);
+
+    tab->url = g_strdup (ephy_web_view_get_address (web_view));
+    tab->state = webkit_web_view_get_session_state (WEBKIT_WEB_VIEW (web_view));
+  }
 
   return tab;
 }
@@ -263,7 +352,8 @@ ephy_session_undo_close_tab (EphySession *session)
   }
 
   web_view = WEBKIT_WEB_VIEW (ephy_embed_get_web_view (new_tab));
-  webkit_web_view_restore_session_state (web_view, tab->state);
+  if (tab->state)
+    webkit_web_view_restore_session_state (web_view, tab->state);
   bf_list = webkit_web_view_get_back_forward_list (web_view);
   item = webkit_back_forward_list_get_current_item (bf_list);
   if (item) {
@@ -291,19 +381,27 @@ ephy_session_tab_closed (EphySession  *session,
   WebKitWebView *wk_view;
   ClosedTab *tab;
 
-  view = ephy_embed_get_web_view (embed);
-  wk_view = WEBKIT_WEB_VIEW (view);
+  if (ephy_embed_is_virtual (embed)) {
+    const char *url = ephy_embed_get_virtual_url (embed);
 
-  if (!webkit_web_view_can_go_back (wk_view) && !webkit_web_view_can_go_forward (wk_view) &&
-      (ephy_web_view_get_is_blank (view) || ephy_web_view_is_overview (view))) {
-    return;
+    if (!ephy_embed_get_virtual_session_state (embed) &&
+        (strcmp (url, "about:blank") == 0 || strcmp (url, "about:overview") == 0))
+      return;
+  } else {
+    view = ephy_embed_get_web_view (embed);
+    wk_view = WEBKIT_WEB_VIEW (view);
+
+    if (!webkit_web_view_can_go_back (wk_view) && !webkit_web_view_can_go_forward (wk_view) &&
+        (ephy_web_view_get_is_blank (view) || ephy_web_view_is_overview (view))) {
+      return;
+    }
   }
 
   if (g_queue_get_length (session->closed_tabs) == MAX_CLOSED_TABS) {
     closed_tab_free (g_queue_pop_tail (session->closed_tabs));
   }
 
-  tab = closed_tab_new (view, position,
+  tab = closed_tab_new (embed, position,
                         ephy_session_ref_or_create_notebook_tracker (session, notebook));
   g_queue_push_head (session->closed_tabs, tab);
 
@@ -311,7 +409,7 @@ ephy_session_tab_closed (EphySession  *session,
     g_object_notify_by_pspec (G_OBJECT (session), obj_properties[PROP_CAN_UNDO_TAB_CLOSED]);
 
   LOG ("Added: %s to the list (%d elements)",
-       ephy_web_view_get_address (view), g_queue_get_length (session->closed_tabs));
+       tab->url, g_queue_get_length (session->closed_tabs));
 }
 
 gboolean
@@ -322,14 +420,34 @@ ephy_session_get_can_undo_tab_closed (EphySession *session)
   return g_queue_is_empty (session->closed_tabs) == FALSE;
 }
 
+static void
+embed_web_view_changed_cb (EphyEmbed   *embed,
+                           GParamSpec  *pspec,
+                           EphySession *session)
+{
+  /* A hibernated web view takes its handlers with it. */
+  if (!ephy_embed_is_virtual (embed)) {
+    g_signal_connect (ephy_embed_get_web_view (embed), "load-changed",
+                      G_CALLBACK (load_changed_cb), session);
+    g_signal_connect (ephy_embed_get_web_view (embed), "notify::uri",
+                      G_CALLBACK (uri_changed_cb), session);
+  }
+}
+
 static void
 notebook_page_added_cb (GtkWidget   *notebook,
                         EphyEmbed   *embed,
                         guint        position,
                         EphySession *session)
 {
-  g_signal_connect (ephy_embed_get_web_view (embed), "load-changed",
-                    G_CALLBACK (load_changed_cb), session);
+  g_signal_connect (embed, "notify::web-view",
+                    G_CALLBACK (embed_web_view_changed_cb), session);
+  if (!ephy_embed_is_virtual (embed)) {
+    g_signal_connect (ephy_embed_get_web_view (embed), "load-changed",
+                      G_CALLBACK (load_changed_cb), session);
+    g_signal_connect (ephy_embed_get_web_view (embed), "notify::uri",
+                      G_CALLBACK (uri_changed_cb), session);
+  }
 }
 
 static void
@@ -341,8 +459,15 @@ notebook_page_removed_cb (GtkWidget   *notebook,
   ephy_session_save (session);
 
   g_signal_handlers_disconnect_by_func
-    (ephy_embed_get_web_view (embed), G_CALLBACK (load_changed_cb),
-    session);
+    (embed, G_CALLBACK (embed_web_view_changed_cb), session);
+  if (!ephy_embed_is_virtual (embed)) {
+    g_signal_handlers_disconnect_by_func
+      (ephy_embed_get_web_view (embed), G_CALLBACK (load_changed_cb),
+      session);
+    g_signal_handlers_disconnect_by_func
+      (ephy_embed_get_web_view (embed), G_CALLBACK (uri_changed_cb),
+      session);
+  }
 
   ephy_session_tab_closed (session, EPHY_NOTEBOOK (notebook), embed, position);
 }
@@ -438,10 +563,16 @@ static void
 ephy_session_init (EphySession *session)
 {
   EphyShell *shell;
+  char *filename;
 
   LOG ("EphySession initialising");
 
   session->closed_tabs = g_queue_new ();
+
+  filename = g_build_filename (ephy_dot_dir (), SESSION_JOURNAL_FILE, NULL);
+  session->journal = ephy_session_journal_new (filename);
+  g_free (filename);
+
   shell = ephy_shell_get_default ();
   g_signal_connect (shell, "window-added",
                     G_CALLBACK (window_added_cb), session);
@@ -462,6 +593,16 @@ ephy_session_dispose (GObject *object)
   G_OBJECT_CLASS (ephy_session_parent_class)->dispose (object);
 }
 
+static void
+ephy_session_finalize (GObject *object)
+{
+  EphySession *session = EPHY_SESSION (object);
+
+  ephy_session_journal_free (session->journal);
+
+  G_OBJECT_CLASS (ephy_session_parent_class)->finalize (object);
+}
+
 static void
 ephy_session_get_property (GObject    *object,
                            guint       property_id,
@@ -486,6 +627,7 @@ ephy_session_class_init (EphySessionClass *class)
   GObjectClass *object_class = G_OBJECT_CLASS (class);
 
   object_class->dispose = ephy_session_dispose;
+  object_class->finalize = ephy_session_finalize;
   object_class->get_property = ephy_session_get_property;
 
   obj_properties[PROP_CAN_UNDO_TAB_CLOSED] =
@@ -541,23 +683,49 @@ get_window_geometry (GtkWindow    *window,
 }
 
 typedef struct {
+  guint32 id;
   char *url;
   char *title;
   gboolean loading;
   gboolean crashed;
   WebKitWebViewSessionState *state;
+  GBytes *serialized_state;
 } SessionTab;
 
+/* The back/forward list of a tab is only taken when it may have changed
+ * since the last save, the session journal still has it otherwise. */
 static SessionTab *
 session_tab_new (EphyEmbed   *embed,
-                 EphySession *session)
+                 EphySession *session,
+                 gboolean     refresh_history)
 {
   SessionTab *session_tab;
+  TabJournalData *journal_data;
   const char *address;
-  EphyWebView *web_view = ephy_embed_get_web_view (embed);
-  EphyWebViewErrorPage error_page = ephy_web_view_get_error_page (web_view);
+  EphyWebView *web_view;
+  EphyWebViewErrorPage error_page;
+
+  session_tab = g_slice_new0 (SessionTab);
+
+  journal_data = ephy_session_get_tab_journal_data (session, embed);
+  session_tab->id = journal_data->id;
+  refresh_history = refresh_history || journal_data->history_changed;
+  journal_data->history_changed = FALSE;
 
-  session_tab = g_slice_new (SessionTab);
+  /* A virtual tab, restored or hibernated, holds all there is to save. */
+  if (ephy_embed_is_virtual (embed)) {
+    GBytes *state = ephy_embed_get_virtual_session_state (embed);
+
+    session_tab->url = g_strdup (ephy_embed_get_virtual_url (embed));
+    session_tab->title = g_strdup (ephy_embed_get_title (embed));
+    if (refresh_history && state)
+      session_tab->serialized_state = g_bytes_ref (state);
+
+    return session_tab;
+  }
+
+  web_view = ephy_embed_get_web_view (embed);
+  error_page = ephy_web_view_get_error_page (web_view);
 
   address = ephy_web_view_get_address (web_view);
   /* Do not store ephy-about: URIs, they are not valid for loading. */
@@ -578,7 +746,8 @@ session_tab_new (EphyEmbed   *embed,
                           !session->closing);
   session_tab->crashed = (error_page == EPHY_WEB_VIEW_ERROR_PAGE_CRASH ||
                           error_page == EPHY_WEB_VIEW_ERROR_PROCESS_CRASH);
-  session_tab->state = webkit_web_view_get_session_state (WEBKIT_WEB_VIEW (web_view));
+  if (refresh_history)
+    session_tab->state = webkit_web_view_get_session_state (WEBKIT_WEB_VIEW (web_view));
 
   return session_tab;
 }
@@ -589,6 +758,7 @@ session_tab_free (SessionTab *tab)
   g_free (tab->url);
   g_free (tab->title);
   g_clear_pointer (&tab->state, webkit_web_view_session_state_unref);
+  g_clear_pointer (&tab->serialized_state, g_bytes_unref);
 
   g_slice_free (SessionTab, tab);
 }
@@ -603,7 +773,8 @@ typedef struct {
 
 static SessionWindow *
 session_window_new (EphyWindow  *window,
-                    EphySession *session)
+                    EphySession *session,
+                    gboolean     refresh_histories)
 {
   SessionWindow *session_window;
   GList *tabs, *l;
@@ -624,7 +795,7 @@ session_window_new (EphyWindow  *window,
   for (l = tabs; l != NULL; l = l->next) {
     SessionTab *tab;
 
-    tab = session_tab_new (EPHY_EMBED (l->data), session);
+    tab = session_tab_new (EPHY_EMBED (l->data), session, refresh_histories);
     session_window->tabs = g_list_prepend (session_window->tabs, tab);
   }
   g_list_free (tabs);
@@ -657,15 +828,19 @@ save_data_new (EphySession *session)
   SaveData *data;
   EphyShell *shell = ephy_shell_get_default ();
   GList *windows, *w;
+  gboolean refresh_histories;
 
   data = g_slice_new0 (SaveData);
   data->session = g_object_ref (session);
 
+  refresh_histories = session->refresh_tab_histories;
+  session->refresh_tab_histories = FALSE;
+
   windows = gtk_application_get_windows (GTK_APPLICATION (shell));
   for (w = windows; w != NULL; w = w->next) {
     SessionWindow *session_window;
 
-    session_window = session_window_new (EPHY_WINDOW (w->data), session);
+    session_window = session_window_new (EPHY_WINDOW (w->data), session, refresh_histories);
     if (session_window)
       data->windows = g_list_prepend (data->windows, session_window);
   }
@@ -684,131 +859,49 @@ save_data_free (SaveData *data)
   g_slice_free (SaveData, data);
 }
 
-static int
-write_tab (xmlTextWriterPtr writer,
-           SessionTab      *tab)
-{
-  int ret;
-
-  ret = xmlTextWriterStartElement (writer, (xmlChar *)"embed");
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteAttribute (writer, (xmlChar *)"url",
-                                     (const xmlChar *)tab->url);
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteAttribute (writer, (xmlChar *)"title",
-                                     (const xmlChar *)tab->title);
-  if (ret < 0)
-    return ret;
-
-  if (tab->loading) {
-    ret = xmlTextWriterWriteAttribute (writer,
-                                       (const xmlChar *)"loading",
-                                       (const xmlChar *)"true");
-    if (ret < 0)
-      return ret;
-  }
-
-  if (tab->crashed) {
-    ret = xmlTextWriterWriteAttribute (writer,
-                                       (const xmlChar *)"crashed",
-                                       (const xmlChar *)"true");
-    if (ret < 0)
-      return ret;
-  }
-
-  if (tab->state) {
-    GBytes *bytes;
+static GVariant *
+session_tab_to_variant (SessionTab *tab)
+{
+  GVariant *history = NULL;
+  GBytes *bytes = NULL;
 
+  if (tab->state)
     bytes = webkit_web_view_session_state_serialize (tab->state);
-    if (bytes) {
-      gchar *base64;
-      gconstpointer data;
-      gsize data_length;
+  else if (tab->serialized_state)
+    bytes = g_bytes_ref (tab->serialized_state);
 
-      data = g_bytes_get_data (bytes, &data_length);
-      base64 = g_base64_encode (data, data_length);
-      ret = xmlTextWriterWriteAttribute (writer,
-                                         (const xmlChar *)"history",
-                                         (const xmlChar *)base64);
-      g_free (base64);
-      g_bytes_unref (bytes);
-    }
+  if (bytes) {
+    history = g_variant_new_from_bytes (G_VARIANT_TYPE_BYTESTRING, bytes, TRUE);
+    g_bytes_unref (bytes);
   }
 
-  ret = xmlTextWriterEndElement (writer);       /* embed */
-  return ret;
-}
-
-static int
-write_window_geometry (xmlTextWriterPtr writer,
-                       GdkRectangle    *geometry)
-{
-  int ret;
-
-  /* set window properties */
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"x", "%d",
-                                           geometry->x);
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"y", "%d",
-                                           geometry->y);
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"width", "%d",
-                                           geometry->width);
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"height", "%d",
-                                           geometry->height);
-  return ret;
+  return g_variant_new ("(ussbb@may)",
+                        tab->id,
+                        tab->url,
+                        tab->title ? tab->title : "",
+                        tab->loading,
+                        tab->crashed,
+                        g_variant_new_maybe (G_VARIANT_TYPE_BYTESTRING, history));
 }
 
-static int
-write_ephy_window (xmlTextWriterPtr writer,
-                   SessionWindow   *window)
+static GVariant *
+session_window_to_variant (SessionWindow *window)
 {
+  GVariantBuilder tabs;
   GList *l;
-  int ret;
-
-  ret = xmlTextWriterStartElement (writer, (xmlChar *)"window");
-  if (ret < 0)
-    return ret;
-
-  ret = write_window_geometry (writer, &window->geometry);
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"active-tab", "%d",
-                                           window->active_tab);
-  if (ret < 0)
-    return ret;
-
-  if (window->role != NULL) {
-    ret = xmlTextWriterWriteAttribute (writer,
-                                       (const xmlChar *)"role",
-                                       (const xmlChar *)window->role);
-    if (ret < 0)
-      return ret;
-  }
 
-  for (l = window->tabs; l != NULL; l = l->next) {
-    SessionTab *tab = (SessionTab *)l->data;
-    ret = write_tab (writer, tab);
-    if (ret < 0)
-      break;
-  }
-  if (ret < 0)
-    return ret;
+  g_variant_builder_init (&tabs, G_VARIANT_TYPE ("a(ussbbmay)"));
+  for (l = window->tabs; l != NULL; l = l->next)
+    g_variant_builder_add_value (&tabs, session_tab_to_variant ((SessionTab *)l->data));
 
-  ret = xmlTextWriterEndElement (writer);       /* window */
-  return ret;
+  return g_variant_new ("(iiiimsi@a(ussbbmay))",
+                        window->geometry.x,
+                        window->geometry.y,
+                        window->geometry.width,
+                        window->geometry.height,
+                        window->role,
+                        window->active_tab,
+                        g_variant_builder_end (&tabs));
 }
 
 static void
@@ -816,6 +909,31 @@ save_session_in_thread_finished_cb (GObject      *source_object,
                                     GAsyncResult *res,
                                     gpointer      user_data)
 {
+  EphySession *session = EPHY_SESSION (source_object);
+
+  session->saving = FALSE;
+
+  if (!g_task_propagate_boolean (G_TASK (res), NULL)) {
+    /* The back/forward lists taken for this save are not on disk, take all
+     * of them again next time. */
+    session->refresh_tab_histories = TRUE;
+  } else if (session->remove_legacy_state) {
+    GFile *file;
+
+    file = get_session_file (SESSION_STATE);
+    g_file_delete (file, NULL, NULL);
+    g_object_unref (file);
+
+    session->remove_legacy_state = FALSE;
+  }
+
+  /* A save was requested while this one was running, and no other one is
+   * scheduled. */
+  if (session->save_queued && session->save_source_id == 0) {
+    session->save_queued = FALSE;
+    ephy_session_save_idle_cb (session);
+  }
+
   g_application_release (G_APPLICATION (ephy_shell_get_default ()));
 }
 
@@ -851,83 +969,39 @@ save_session_sync (GTask        *task,
                    GCancellable *cancellable)
 {
   SaveData *data = (SaveData *)g_task_get_task_data (task);
-  xmlBufferPtr buffer;
-  xmlTextWriterPtr writer;
+  GVariantBuilder builder;
+  GVariant *state;
+  GError *error = NULL;
   GList *w;
-  int ret = -1;
+  gboolean result;
 
   /* If any web view has an insane URL, then something has probably gone wrong
    * inside WebKit. For instance, if the web process is nonfunctional, the UI
    * process could have an invalid URI property. Yes, this would be a WebKit
    * bug, but Epiphany should be robust to such issues. Do not clobber an
    * existing good session file with our new bogus state. Bug #768250. */
-  if (!session_seems_sane (data->windows))
+  if (!session_seems_sane (data->windows)) {
+    g_task_return_boolean (task, FALSE);
     return;
-
-  buffer = xmlBufferCreate ();
-  writer = xmlNewTextWriterMemory (buffer, 0);
-  if (writer == NULL)
-    goto out;
-
-  ret = xmlTextWriterSetIndent (writer, 1);
-  if (ret < 0)
-    goto out;
-
-  ret = xmlTextWriterSetIndentString (writer, (const xmlChar *)"	 ");
-  if (ret < 0)
-    goto out;
-
-  START_PROFILER ("Saving session")
-
-  ret = xmlTextWriterStartDocument (writer, "1.0", NULL, NULL);
-  if (ret < 0)
-    goto out;
-
-  /* create and set the root node for the session */
-  ret = xmlTextWriterStartElement (writer, (const xmlChar *)"session");
-  if (ret < 0)
-    goto out;
-
-  /* iterate through all the windows */
-  for (w = data->windows; w != NULL && ret >= 0; w = w->next) {
-    ret = write_ephy_window (writer, (SessionWindow *)w->data);
   }
-  if (ret < 0)
-    goto out;
-
-  ret = xmlTextWriterEndElement (writer);       /* session */
-  if (ret < 0)
-    goto out;
-
-  ret = xmlTextWriterEndDocument (writer);
-
- out:
-  if (writer)
-    xmlFreeTextWriter (writer);
-
-  if (ret >= 0 && !g_cancellable_is_cancelled (cancellable)) {
-    GError *error = NULL;
-    GFile *session_file;
 
-    session_file = get_session_file (SESSION_STATE);
+  START_PROFILER ("Saving session")
 
-    if (!g_file_replace_contents (session_file,
-                                  (const char *)buffer->content,
-                                  buffer->use,
-                                  NULL, TRUE, 0, NULL,
-                                  cancellable, &error)) {
-      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
-        g_warning ("Error saving session: %s", error->message);
-      }
-      g_error_free (error);
-    }
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (EPHY_SESSION_JOURNAL_STATE_TYPE));
+  for (w = data->windows; w != NULL; w = w->next)
+    g_variant_builder_add_value (&builder, session_window_to_variant ((SessionWindow *)w->data));
+  state = g_variant_ref_sink (g_variant_builder_end (&builder));
 
-    g_object_unref (session_file);
+  /* Only the tabs and windows that changed since the last save are written. */
+  result = ephy_session_journal_commit (data->session->journal, state, &error);
+  if (!result) {
+    g_warning ("Error saving session: %s", error->message);
+    g_error_free (error);
   }
 
-  xmlBufferFree (buffer);
+  g_variant_unref (state);
 
-  g_task_return_boolean (task, TRUE);
+  g_task_return_boolean (task, result);
 
   STOP_PROFILER ("Saving session")
 }
@@ -955,10 +1029,11 @@ ephy_session_save_idle_cb (EphySession *session)
 
   session->save_source_id = 0;
 
-  if (session->save_cancellable) {
-    g_cancellable_cancel (session->save_cancellable);
-    g_object_unref (session->save_cancellable);
-    session->save_cancellable = NULL;
+  /* Each save only writes what changed since the previous one, so saves
+   * must reach the journal in order. Wait for the one in progress. */
+  if (session->saving) {
+    session->save_queued = TRUE;
+    return G_SOURCE_REMOVE;
   }
 
   LOG ("ephy_sesion_save");
@@ -969,10 +1044,9 @@ ephy_session_save_idle_cb (EphySession *session)
   }
 
   g_application_hold (G_APPLICATION (ephy_shell_get_default ()));
-  session->save_cancellable = g_cancellable_new ();
+  session->saving = TRUE;
   data = save_data_new (session);
-  task = g_task_new (session, session->save_cancellable,
-                     save_session_in_thread_finished_cb, NULL);
+  task = g_task_new (session, NULL, save_session_in_thread_finished_cb, NULL);
   g_task_set_task_data (task, data, (GDestroyNotify)save_data_free);
   g_task_run_in_thread (task, save_session_sync);
   g_object_unref (task);
@@ -1065,16 +1139,139 @@ session_parser_context_free (SessionParserContext *context)
   g_slice_free (SessionParserContext, context);
 }
 
+static void
+session_restore_window (SessionParserContext *context,
+                        GdkRectangle         *geometry,
+                        const char           *role,
+                        int                   active_tab)
+{
+  context->window = ephy_window_new ();
+  context->active_tab = active_tab;
+  context->is_first_tab = TRUE;
+
+  if (role)
+    gtk_window_set_role (GTK_WINDOW (context->window), role);
+
+  restore_geometry (GTK_WINDOW (context->window), geometry);
+}
+
+static void
+session_restore_window_finished (SessionParserContext *context)
+{
+  GtkWidget *notebook;
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+
+  notebook = ephy_window_get_notebook (context->window);
+  gtk_notebook_set_current_page (GTK_NOTEBOOK (notebook), context->active_tab);
+
+  if (ephy_embed_shell_get_mode (ephy_embed_shell_get_default ()) != EPHY_EMBED_SHELL_MODE_TEST) {
+    EphyEmbed *active_child;
+
+    active_child = ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (context->window));
+    gtk_widget_grab_focus (GTK_WIDGET (active_child));
+    gtk_widget_show (GTK_WIDGET (context->window));
+  }
+
+  ephy_embed_shell_restored_window (shell);
+
+  context->window = NULL;
+  context->active_tab = 0;
+  context->is_first_window = FALSE;
+}
+
+/* Tabs restored from the session journal keep their @id, which tells the
+ * journal they are unchanged. Tabs restored from other files use 0. */
+static void
+session_restore_tab (SessionParserContext *context,
+                     guint32               id,
+                     const char           *url,
+                     const char           *title,
+                     gboolean              was_loading,
+                     gboolean              crashed,
+                     GBytes               *history)
+{
+  gboolean is_blank_page;
+
+  is_blank_page = url && (strcmp (url, "about:blank") == 0 ||
+                          strcmp (url, "about:overview") == 0);
+
+  /* In the case that crash happens before we receive the URL from the server,
+   * this will open an about:blank tab.
+   * See http://bugzilla.gnome.org/show_bug.cgi?id=591294
+   * Otherwise, if the web was fully loaded, it is reloaded again.
+   */
+  if ((!was_loading || is_blank_page) && !crashed) {
+    EphyNewTabFlags flags;
+    EphyEmbed *embed;
+    EphyWebView *web_view;
+    gboolean delay_loading;
+    WebKitWebViewSessionState *state = NULL;
+    WebKitBackForwardList *bf_list;
+    WebKitBackForwardListItem *item;
+
+    delay_loading = g_settings_get_boolean (EPHY_SETTINGS_MAIN,
+                                            EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS);
+
+    /* Tabs that are not going to load until shown don't need a web view
+     * until then either, keep just what is needed to create it later. */
+    if (delay_loading && url) {
+      embed = ephy_embed_new_virtual (url, title, history);
+      gtk_widget_show (GTK_WIDGET (embed));
+      ephy_embed_container_add_child (EPHY_EMBED_CONTAINER (context->window), embed, -1, FALSE);
+
+      if (id)
+        session_set_tab_journal_id (context->session, embed, id);
+      return;
+    }
+
+    flags = EPHY_NEW_TAB_APPEND_LAST;
+
+    embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
+                                     title, NULL,
+                                     context->window, NULL, flags,
+                                     0);
+
+    web_view = ephy_embed_get_web_view (embed);
+    if (history)
+      state = webkit_web_view_session_state_new (history);
+
+    if (state) {
+      webkit_web_view_restore_session_state (WEBKIT_WEB_VIEW (web_view), state);
+    }
+
+    bf_list = webkit_web_view_get_back_forward_list (WEBKIT_WEB_VIEW (web_view));
+    item = webkit_back_forward_list_get_current_item (bf_list);
+    if (item) {
+      webkit_web_view_go_to_back_forward_list_item (WEBKIT_WEB_VIEW (web_view), item);
+    } else {
+      ephy_web_view_load_url (web_view, url);
+    }
+
+    if (state) {
+      webkit_web_view_session_state_unref (state);
+    }
+
+    if (id)
+      session_set_tab_journal_id (context->session, embed, id);
+  } else if (url && (was_loading || crashed)) {
+    /* This page was loading during a UI process crash
+     * (was_loading == TRUE) or a web process crash
+     * (crashed == TRUE) and might make Epiphany crash again.
+     */
+    confirm_before_recover (context->window, url, title);
+  }
+}
+
 static void
 session_parse_window (SessionParserContext *context,
                       const gchar         **names,
                       const gchar         **values)
 {
   GdkRectangle geometry = { -1, -1, 0, 0 };
+  const char *role = NULL;
+  int active_tab = 0;
   guint i;
 
-  context->window = ephy_window_new ();
-
   for (i = 0; names[i]; i++) {
     gulong int_value;
 
@@ -1091,14 +1288,14 @@ session_parse_window (SessionParserContext *context,
       ephy_string_to_int (values[i], &int_value);
       geometry.height = int_value;
     } else if (strcmp (names[i], "role") == 0) {
-      gtk_window_set_role (GTK_WINDOW (context->window), values[i]);
+      role = values[i];
     } else if (strcmp (names[i], "active-tab") == 0) {
       ephy_string_to_int (values[i], &int_value);
-      context->active_tab = int_value;
+      active_tab = int_value;
     }
   }
 
-  restore_geometry (GTK_WINDOW (context->window), &geometry);
+  session_restore_window (context, &geometry, role, active_tab);
 }
 
 static void
@@ -1108,17 +1305,14 @@ session_parse_embed (SessionParserContext *context,
 {
   const char *url = NULL;
   const char *title = NULL;
-  const char *history = NULL;
+  GBytes *history = NULL;
   gboolean was_loading = FALSE;
   gboolean crashed = FALSE;
-  gboolean is_blank_page = FALSE;
   guint i;
 
   for (i = 0; names[i]; i++) {
     if (strcmp (names[i], "url") == 0) {
       url = values[i];
-      is_blank_page = (strcmp (url, "about:blank") == 0 ||
-                       strcmp (url, "about:overview") == 0);
     } else if (strcmp (names[i], "title") == 0) {
       title = values[i];
     } else if (strcmp (names[i], "loading") == 0) {
@@ -1126,77 +1320,18 @@ session_parse_embed (SessionParserContext *context,
     } else if (strcmp (names[i], "crashed") == 0) {
       crashed = strcmp (values[i], "true") == 0;
     } else if (strcmp (names[i], "history") == 0) {
-      history = values[i];
-    }
-  }
-
-  /* In the case that crash happens before we receive the URL from the server,
-   * this will open an about:blank tab.
-   * See http://bugzilla.gnome.org/show_bug.cgi?id=591294
-   * Otherwise, if the web was fully loaded, it is reloaded again.
-   */
-  if ((!was_loading || is_blank_page) && !crashed) {
-    EphyNewTabFlags flags;
-    EphyEmbed *embed;
-    EphyWebView *web_view;
-    gboolean delay_loading;
-    WebKitWebViewSessionState *state = NULL;
-
-    delay_loading = g_settings_get_boolean (EPHY_SETTINGS_MAIN,
-                                            EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS);
-
-    flags = EPHY_NEW_TAB_APPEND_LAST;
-
-    embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
-                                     title, NULL,
-                                     context->window, NULL, flags,
-                                     0);
-
-    web_view = ephy_embed_get_web_view (embed);
-    if (history) {
       guchar *data;
       gsize data_length;
-      GBytes *history_data;
 
-      data = g_base64_decode (history, &data_length);
-      history_data = g_bytes_new_take (data, data_length);
-      state = webkit_web_view_session_state_new (history_data);
-      g_bytes_unref (history_data);
+      data = g_base64_decode (values[i], &data_length);
+      history = g_bytes_new_take (data, data_length);
     }
+  }
 
-    if (delay_loading) {
-      WebKitURIRequest *request = webkit_uri_request_new (url);
-
-      ephy_embed_set_delayed_load_request (embed, request, state);
-      ephy_web_view_set_placeholder (web_view, url, title);
-      g_object_unref (request);
-    } else {
-      WebKitBackForwardList *bf_list;
-      WebKitBackForwardListItem *item;
-
-      if (state) {
-        webkit_web_view_restore_session_state (WEBKIT_WEB_VIEW (web_view), state);
-      }
+  session_restore_tab (context, 0, url, title, was_loading, crashed, history);
 
-      bf_list = webkit_web_view_get_back_forward_list (WEBKIT_WEB_VIEW (web_view));
-      item = webkit_back_forward_list_get_current_item (bf_list);
-      if (item) {
-        webkit_web_view_go_to_back_forward_list_item (WEBKIT_WEB_VIEW (web_view), item);
-      } else {
-        ephy_web_view_load_url (web_view, url);
-      }
-    }
-
-    if (state) {
-      webkit_web_view_session_state_unref (state);
-    }
-  } else if (url && (was_loading || crashed)) {
-    /* This page was loading during a UI process crash
-     * (was_loading == TRUE) or a web process crash
-     * (crashed == TRUE) and might make Epiphany crash again.
-     */
-    confirm_before_recover (context->window, url, title);
-  }
+  if (history)
+    g_bytes_unref (history);
 }
 
 static void
@@ -1211,7 +1346,6 @@ session_start_element (GMarkupParseContext *ctx,
 
   if (strcmp (element_name, "window") == 0) {
     session_parse_window (context, names, values);
-    context->is_first_tab = TRUE;
   } else if (strcmp (element_name, "embed") == 0) {
     session_parse_embed (context, names, values);
   }
@@ -1226,25 +1360,7 @@ session_end_element (GMarkupParseContext *ctx,
   SessionParserContext *context = (SessionParserContext *)user_data;
 
   if (strcmp (element_name, "window") == 0) {
-    GtkWidget *notebook;
-    EphyEmbedShell *shell = ephy_embed_shell_get_default ();
-
-    notebook = ephy_window_get_notebook (context->window);
-    gtk_notebook_set_current_page (GTK_NOTEBOOK (notebook), context->active_tab);
-
-    if (ephy_embed_shell_get_mode (ephy_embed_shell_get_default ()) != EPHY_EMBED_SHELL_MODE_TEST) {
-      EphyEmbed *active_child;
-
-      active_child = ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (context->window));
-      gtk_widget_grab_focus (GTK_WIDGET (active_child));
-      gtk_widget_show (GTK_WIDGET (context->window));
-    }
-
-    ephy_embed_shell_restored_window (shell);
-
-    context->window = NULL;
-    context->active_tab = 0;
-    context->is_first_window = FALSE;
+    session_restore_window_finished (context);
   } else if (strcmp (element_name, "embed") == 0) {
     context->is_first_tab = FALSE;
   }
@@ -1579,6 +1695,160 @@ ephy_session_load_finish (EphySession  *session,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+static void
+load_journal_thread (GTask        *task,
+                     EphySession  *session,
+                     gpointer      task_data,
+                     GCancellable *cancellable)
+{
+  GVariant *state;
+  GError *error = NULL;
+
+  state = ephy_session_journal_load (session->journal, &error);
+  if (state)
+    g_task_return_pointer (task, state, (GDestroyNotify)g_variant_unref);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+session_restore_journal_state (EphySession *session,
+                               GVariant    *state,
+                               guint32      user_time)
+{
+  SessionParserContext *context;
+  GVariantIter windows;
+  GVariant *window;
+
+  /* Tabs opened from now on need ids the journal does not use yet. */
+  g_variant_iter_init (&windows, state);
+  while ((window = g_variant_iter_next_value (&windows))) {
+    GVariant *tabs;
+    GVariantIter iter;
+    guint32 id;
+
+    tabs = g_variant_get_child_value (window, 6);
+    g_variant_iter_init (&iter, tabs);
+    while (g_variant_iter_next (&iter, "(ussbbmay)", &id, NULL, NULL, NULL, NULL, NULL))
+      session->last_tab_id = MAX (session->last_tab_id, id);
+
+    g_variant_unref (tabs);
+    g_variant_unref (window);
+  }
+
+  context = session_parser_context_new (session, user_time);
+
+  g_variant_iter_init (&windows, state);
+  while ((window = g_variant_iter_next_value (&windows))) {
+    GdkRectangle geometry;
+    GVariantIter *tabs;
+    GVariant *history;
+    const char *url;
+    const char *title;
+    char *role;
+    gboolean loading;
+    gboolean crashed;
+    gint32 active_tab;
+    guint32 id;
+
+    g_variant_get (window, "(iiiimsia(ussbbmay))",
+                   &geometry.x, &geometry.y, &geometry.width, &geometry.height,
+                   &role, &active_tab, &tabs);
+
+    if (g_variant_iter_n_children (tabs) > 0) {
+      session_restore_window (context, &geometry, role, active_tab);
+
+      while (g_variant_iter_loop (tabs, "(u&s&sbb@may)", &id, &url, &title, &loading, &crashed, &history)) {
+        GVariant *bytes;
+        GBytes *history_data = NULL;
+
+        bytes = g_variant_get_maybe (history);
+        if (bytes)
+          history_data = g_variant_get_data_as_bytes (bytes);
+
+        session_restore_tab (context, id, url, *title ? title : NULL, loading, crashed, history_data);
+        context->is_first_tab = FALSE;
+
+        if (history_data)
+          g_bytes_unref (history_data);
+        if (bytes)
+          g_variant_unref (bytes);
+      }
+
+      session_restore_window_finished (context);
+    }
+
+    g_variant_iter_free (tabs);
+    g_free (role);
+    g_variant_unref (window);
+  }
+
+  session_parser_context_free (context);
+}
+
+static void
+load_journal_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  EphySession *session = EPHY_SESSION (object);
+  GTask *task = G_TASK (user_data);
+  LoadAsyncData *data;
+  GVariant *state;
+  GError *error = NULL;
+
+  data = g_task_get_task_data (task);
+  session->dont_save = FALSE;
+
+  state = g_task_propagate_pointer (G_TASK (result), &error);
+  if (state) {
+    session_restore_journal_state (session, state, data->user_time);
+    g_variant_unref (state);
+
+    ephy_session_save (session);
+    g_task_return_boolean (task, TRUE);
+  } else {
+    /* If the session fails to load for whatever reason,
+     * delete the file and open an empty window.
+     */
+    session_delete (session);
+    session_maybe_open_window (session, data->user_time);
+    g_task_return_error (task, error);
+  }
+
+  g_object_unref (task);
+
+  g_application_release (G_APPLICATION (ephy_shell_get_default ()));
+}
+
+/* Like ephy_session_load(), for the session journal. The journal is read in
+ * a thread, and can be finished with ephy_session_load_finish(). */
+static void
+session_load_journal (EphySession        *session,
+                      guint32             user_time,
+                      GCancellable       *cancellable,
+                      GAsyncReadyCallback callback,
+                      gpointer            user_data)
+{
+  GTask *task;
+  GTask *load_task;
+
+  LOG ("session_load_journal");
+
+  g_application_hold (G_APPLICATION (ephy_shell_get_default ()));
+
+  session->dont_save = TRUE;
+
+  task = g_task_new (session, cancellable, callback, user_data);
+  g_task_set_priority (task, G_PRIORITY_HIGH_IDLE + 30);
+  g_task_set_task_data (task, load_async_data_new (user_time), (GDestroyNotify)load_async_data_free);
+
+  load_task = g_task_new (session, cancellable, load_journal_cb, task);
+  g_task_set_priority (load_task, G_PRIORITY_HIGH_IDLE + 30);
+  g_task_run_in_thread (load_task, (GTaskThreadFunc)load_journal_thread);
+  g_object_unref (load_task);
+}
+
 static gboolean
 session_state_file_exists (EphySession *session)
 {
@@ -1621,6 +1891,8 @@ ephy_session_resume (EphySession        *session,
                      gpointer            user_data)
 {
   GTask *task;
+  gboolean has_journal;
+  gboolean has_legacy_state;
   gboolean has_session_state;
   EphyPrefsRestoreSessionPolicy policy;
   EphyShell *shell;
@@ -1629,7 +1901,9 @@ ephy_session_resume (EphySession        *session,
 
   task = g_task_new (session, cancellable, callback, user_data);
 
-  has_session_state = session_state_file_exists (session);
+  has_journal = ephy_session_journal_exists (session->journal);
+  has_legacy_state = session_state_file_exists (session);
+  has_session_state = has_journal || has_legacy_state;
 
   policy = g_settings_get_enum (EPHY_SETTINGS_MAIN,
                                 EPHY_PREFS_RESTORE_SESSION_POLICY);
@@ -1646,8 +1920,16 @@ ephy_session_resume (EphySession        *session,
 
     session_maybe_open_window (session, user_time);
   } else if (ephy_shell_get_n_windows (shell) == 0) {
-    ephy_session_load (session, SESSION_STATE, user_time, cancellable,
-                       session_resumed_cb, task);
+    /* A session file from an older version is replaced by the journal
+     * once the session is saved. */
+    session->remove_legacy_state = has_legacy_state;
+
+    if (has_journal)
+      session_load_journal (session, user_time, cancellable,
+                            session_resumed_cb, task);
+    else
+      ephy_session_load (session, SESSION_STATE, user_time, cancellable,
+                         session_resumed_cb, task);
     return;
   }
 
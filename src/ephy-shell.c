@@ -61,6 +61,7 @@ struct _EphyShell {
   GList *windows;
   GObject *lockdown;
   EphyBookmarksManager *bookmarks_manager;
+  EphyCompletionIndex *completion_index;
   GNetworkMonitor *network_monitor;
   GtkWidget *history_dialog;
   GObject *prefs_dialog;
@@ -191,6 +192,18 @@ export_bookmarks (GSimpleAction *action,
   window_cmd_export_bookmarks (NULL, NULL, EPHY_WINDOW (window));
 }
 
+static void
+import_history (GSimpleAction *action,
+                GVariant      *parameter,
+                gpointer       user_data)
+{
+  GtkWindow *window;
+
+  window = gtk_application_get_active_window (GTK_APPLICATION (ephy_shell));
+
+  window_cmd_import_history (NULL, NULL, EPHY_WINDOW (window));
+}
+
 static void
 show_history (GSimpleAction *action,
               GVariant      *parameter,
@@ -265,6 +278,7 @@ static GActionEntry app_entries[] = {
   { "import-bookmarks", import_bookmarks, NULL, NULL, NULL },
   { "export-bookmarks", export_bookmarks, NULL, NULL, NULL },
   { "history", show_history, NULL, NULL, NULL },
+  { "import-history", import_history, NULL, NULL, NULL },
   { "preferences", show_preferences, NULL, NULL, NULL },
   { "shortcuts", show_shortcuts, NULL, NULL, NULL },
   { "help", show_help, NULL, NULL, NULL },
@@ -650,6 +664,7 @@ ephy_shell_dispose (GObject *object)
 #ifdef ENABLE_SYNC
   g_clear_object (&shell->sync_service);
 #endif
+  g_clear_object (&shell->completion_index);
   g_clear_object (&shell->bookmarks_manager);
 
   g_slist_free_full (shell->open_uris_idle_ids, remove_open_uris_idle_cb);
@@ -839,6 +854,32 @@ ephy_shell_get_bookmarks_manager (EphyShell *shell)
   return shell->bookmarks_manager;
 }
 
+/**
+ * ephy_shell_get_completion_index:
+ * @shell: the #EphyShell
+ *
+ * Returns the index the location entry completions are looked up in.
+ *
+ * Return value: (transfer none): An #EphyCompletionIndex.
+ */
+EphyCompletionIndex *
+ephy_shell_get_completion_index (EphyShell *shell)
+{
+  EphyEmbedShell *embed_shell = EPHY_EMBED_SHELL (shell);
+
+  g_return_val_if_fail (EPHY_IS_SHELL (shell), NULL);
+
+  if (shell->completion_index == NULL) {
+    EphyHistoryService *history_service;
+
+    history_service = EPHY_HISTORY_SERVICE (ephy_embed_shell_get_global_history_service (embed_shell));
+    shell->completion_index = ephy_completion_index_new (history_service,
+                                                         ephy_shell_get_bookmarks_manager (shell));
+  }
+
+  return shell->completion_index;
+}
+
 /**
  * ephy_shell_get_net_monitor:
  *
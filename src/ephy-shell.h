@@ -23,6 +23,7 @@
 #pragma once
 
 #include "ephy-bookmarks-manager.h"
+#include "ephy-completion-index.h"
 #include "ephy-embed-shell.h"
 #include "ephy-embed.h"
 #include "ephy-session.h"
@@ -105,6 +106,8 @@ GNetworkMonitor *ephy_shell_get_net_monitor              (EphyShell *shell);
 
 EphyBookmarksManager *ephy_shell_get_bookmarks_manager   (EphyShell *shell);
 
+EphyCompletionIndex *ephy_shell_get_completion_index     (EphyShell *shell);
+
 #ifdef ENABLE_SYNC
 EphySyncService *ephy_shell_get_sync_service             (EphyShell *shell);
 #endif
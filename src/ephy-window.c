@@ -2428,6 +2428,17 @@ download_only_load_cb (EphyWebView *view,
   g_idle_add (delayed_remove_child, EPHY_GET_EMBED_FROM_EPHY_WEB_VIEW (view));
 }
 
+static void
+embed_web_view_changed_cb (EphyEmbed  *embed,
+                           GParamSpec *pspec,
+                           EphyWindow *window)
+{
+  /* A hibernated web view takes its handlers with it. */
+  if (!ephy_embed_is_virtual (embed))
+    g_signal_connect_object (ephy_embed_get_web_view (embed), "download-only-load",
+                             G_CALLBACK (download_only_load_cb), window, G_CONNECT_AFTER);
+}
+
 static void
 notebook_page_added_cb (EphyNotebook *notebook,
                         EphyEmbed    *embed,
@@ -2438,8 +2449,11 @@ notebook_page_added_cb (EphyNotebook *notebook,
 
   g_return_if_fail (EPHY_IS_EMBED (embed));
 
-  g_signal_connect_object (ephy_embed_get_web_view (embed), "download-only-load",
-                           G_CALLBACK (download_only_load_cb), window, G_CONNECT_AFTER);
+  g_signal_connect_object (embed, "notify::web-view",
+                           G_CALLBACK (embed_web_view_changed_cb), window, 0);
+  if (!ephy_embed_is_virtual (embed))
+    g_signal_connect_object (ephy_embed_get_web_view (embed), "download-only-load",
+                             G_CALLBACK (download_only_load_cb), window, G_CONNECT_AFTER);
 
   if (window->present_on_insert) {
     window->present_on_insert = FALSE;
@@ -2463,7 +2477,10 @@ notebook_page_removed_cb (EphyNotebook *notebook,
   g_return_if_fail (EPHY_IS_EMBED (embed));
 
   g_signal_handlers_disconnect_by_func
-    (ephy_embed_get_web_view (embed), G_CALLBACK (download_only_load_cb), window);
+    (embed, G_CALLBACK (embed_web_view_changed_cb), window);
+  if (!ephy_embed_is_virtual (embed))
+    g_signal_handlers_disconnect_by_func
+      (ephy_embed_get_web_view (embed), G_CALLBACK (download_only_load_cb), window);
 
   tab_accels_update (window);
 }
@@ -2514,8 +2531,10 @@ notebook_page_close_request_cb (EphyNotebook *notebook,
     }
   }
 
+  /* A virtual tab has no forms to lose. */
   if (g_settings_get_boolean (EPHY_SETTINGS_MAIN,
-                              EPHY_PREFS_WARN_ON_CLOSE_UNSUBMITTED_DATA)) {
+                              EPHY_PREFS_WARN_ON_CLOSE_UNSUBMITTED_DATA) &&
+      !ephy_embed_is_virtual (embed)) {
     ephy_web_view_has_modified_forms (ephy_embed_get_web_view (embed),
                                       NULL,
                                       (GAsyncReadyCallback)tab_has_modified_forms_cb,
@@ -2865,6 +2884,9 @@ allow_popups_notifier (GSettings  *settings,
     embed = EPHY_EMBED (tabs->data);
     g_return_if_fail (EPHY_IS_EMBED (embed));
 
+    if (ephy_embed_is_virtual (embed))
+      continue;
+
     g_object_notify (G_OBJECT (ephy_embed_get_web_view (embed)), "popups-allowed");
   }
   g_list_free (tabs);
@@ -3500,12 +3522,27 @@ ephy_window_check_modified_forms (EphyWindow *window)
   data = g_slice_new0 (ModifiedFormsData);
   data->window = window;
   data->cancellable = g_cancellable_new ();
-  data->embeds_to_check = gtk_notebook_get_n_pages (window->notebook);
 
+  /* Virtual tabs never loaded anything, so there is nothing to check. */
   tabs = impl_get_children (EPHY_EMBED_CONTAINER (window));
+  for (l = tabs; l != NULL; l = l->next) {
+    if (!ephy_embed_is_virtual ((EphyEmbed *)l->data))
+      data->embeds_to_check++;
+  }
+
+  if (data->embeds_to_check == 0) {
+    continue_window_close_after_modified_forms_check (data);
+    modified_forms_data_free (data);
+    g_list_free (tabs);
+    return;
+  }
+
   for (l = tabs; l != NULL; l = l->next) {
     EphyEmbed *embed = (EphyEmbed *)l->data;
 
+    if (ephy_embed_is_virtual (embed))
+      continue;
+
     ephy_web_view_has_modified_forms (ephy_embed_get_web_view (embed),
                                       data->cancellable,
                                       (GAsyncReadyCallback)has_modified_forms_cb,
@@ -44,6 +44,7 @@ struct _EphySearchProvider {
   GSettings                *settings;
   EphyHistoryService       *history_service;
   EphyBookmarksManager     *bookmarks_manager;
+  EphyCompletionIndex      *completion_index;
   EphyCompletionModel      *model;
 };
 
@@ -371,7 +372,8 @@ ephy_search_provider_init (EphySearchProvider *self)
   filename = g_build_filename (ephy_dot_dir (), EPHY_HISTORY_FILE, NULL);
   self->history_service = ephy_history_service_new (filename, TRUE);
   self->bookmarks_manager = ephy_bookmarks_manager_new ();
-  self->model = ephy_completion_model_new (self->history_service, self->bookmarks_manager);
+  self->completion_index = ephy_completion_index_new (self->history_service, self->bookmarks_manager);
+  self->model = ephy_completion_model_new (self->completion_index);
   g_free (filename);
 
   self->cancellable = g_cancellable_new ();
@@ -430,6 +432,7 @@ ephy_search_provider_dispose (GObject *object)
   g_clear_object (&self->settings);
   g_clear_object (&self->cancellable);
   g_clear_object (&self->model);
+  g_clear_object (&self->completion_index);
   g_clear_object (&self->history_service);
   g_clear_object (&self->bookmarks_manager);
 
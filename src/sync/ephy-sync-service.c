@@ -40,6 +40,15 @@
 #define EPHY_BOOKMARKS_COLLECTION "ephy-bookmarks"
 #define SYNC_FREQUENCY            (15 * 60) /* seconds */
 
+/* Limits used for batched uploads when the server does not advertise its own
+ * through info/configuration. These match the Sync 1.5 server defaults. */
+#define DEFAULT_MAX_POST_RECORDS  100
+#define DEFAULT_MAX_POST_BYTES    (2 * 1024 * 1024)
+
+/* Records are encrypted and decrypted in worker threads, in chunks of at
+ * least this many records. */
+#define CRYPTO_CHUNK_MIN_SIZE     32
+
 struct _EphySyncService {
   GObject      parent_instance;
 
@@ -52,6 +61,7 @@ struct _EphySyncService {
   char        *unwrapBKey;
   char        *kA;
   char        *kB;
+  guint8      *sync_key;
 
   char        *user_email;
   double       sync_time;
@@ -64,6 +74,10 @@ struct _EphySyncService {
   gint64       storage_credentials_expiry_time;
   GQueue      *storage_queue;
 
+  gboolean     storage_config_fetched;
+  guint        max_post_records;
+  gsize        max_post_bytes;
+
   char                     *certificate;
   EphySyncCryptoRSAKeyPair *keypair;
 };
@@ -644,6 +658,8 @@ ephy_sync_service_init (EphySyncService *self)
 
   self->session = soup_session_new ();
   self->storage_queue = g_queue_new ();
+  self->max_post_records = DEFAULT_MAX_POST_RECORDS;
+  self->max_post_bytes = DEFAULT_MAX_POST_BYTES;
 
   settings = ephy_embed_prefs_get_settings ();
   user_agent = webkit_settings_get_user_agent (settings);
@@ -770,6 +786,7 @@ ephy_sync_service_set_token (EphySyncService   *self,
     case TOKEN_KB:
       g_free (self->kB);
       self->kB = g_strdup (value);
+      g_clear_pointer (&self->sync_key, g_free);
       break;
     default:
       g_assert_not_reached ();
@@ -799,6 +816,12 @@ ephy_sync_service_clear_tokens (EphySyncService *self)
   g_clear_pointer (&self->unwrapBKey, g_free);
   g_clear_pointer (&self->kA, g_free);
   g_clear_pointer (&self->kB, g_free);
+  g_clear_pointer (&self->sync_key, g_free);
+
+  /* The next account might live on a different storage server. */
+  self->storage_config_fetched = FALSE;
+  self->max_post_records = DEFAULT_MAX_POST_RECORDS;
+  self->max_post_bytes = DEFAULT_MAX_POST_BYTES;
 }
 
 void
@@ -983,6 +1006,296 @@ ephy_sync_service_release_next_storage_message (EphySyncService *self)
     self->locked = FALSE;
 }
 
+static const guint8 *
+ephy_sync_service_get_sync_key (EphySyncService *self)
+{
+  /* The key is decoded once and reused for every record until it changes. */
+  if (self->sync_key == NULL && self->kB != NULL)
+    self->sync_key = ephy_sync_crypto_decode_hex (self->kB);
+
+  return self->sync_key;
+}
+
+typedef struct {
+  gpointer data;
+  guint    start;
+  guint    end;
+} CryptoChunk;
+
+static guint
+crypto_chunk_size (guint n_records)
+{
+  guint n_threads = MAX (1, g_get_num_processors ());
+
+  return MAX (CRYPTO_CHUNK_MIN_SIZE, (n_records + n_threads - 1) / n_threads);
+}
+
+typedef void (*DecryptBatchFunc) (EphySyncService *self,
+                                  GPtrArray       *bookmarks,
+                                  guint            offset,
+                                  gpointer         user_data);
+typedef void (*DecryptDoneFunc)  (EphySyncService *self,
+                                  gpointer         user_data);
+
+typedef struct {
+  guint8           *sync_key;
+  JsonParser       *parser;
+  GPtrArray        *bsos;
+  guint             pending;
+  DecryptBatchFunc  batch_func;
+  DecryptDoneFunc   done_func;
+  gpointer          user_data;
+} DecryptRecordsAsyncData;
+
+static void
+decrypt_records_async_data_free (DecryptRecordsAsyncData *data)
+{
+  g_assert (data != NULL);
+
+  g_free (data->sync_key);
+  g_object_unref (data->parser);
+  g_ptr_array_unref (data->bsos);
+  g_slice_free (DecryptRecordsAsyncData, data);
+}
+
+static void
+decrypt_records_thread (GTask        *task,
+                        gpointer      source_object,
+                        gpointer      task_data,
+                        GCancellable *cancellable)
+{
+  CryptoChunk *chunk = (CryptoChunk *)task_data;
+  DecryptRecordsAsyncData *data = (DecryptRecordsAsyncData *)chunk->data;
+  GPtrArray *bookmarks;
+
+  /* The BSOs are only read here, and the parser owning them is kept alive
+   * until every chunk is done. */
+  bookmarks = g_ptr_array_new_full (chunk->end - chunk->start, g_object_unref);
+  for (guint i = chunk->start; i < chunk->end; i++) {
+    EphyBookmark *bookmark = ephy_bookmark_from_bso (g_ptr_array_index (data->bsos, i), data->sync_key);
+
+    if (bookmark != NULL)
+      g_ptr_array_add (bookmarks, bookmark);
+  }
+
+  g_task_return_pointer (task, bookmarks, (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void
+decrypt_records_cb (GObject      *source_object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  EphySyncService *self = EPHY_SYNC_SERVICE (source_object);
+  DecryptRecordsAsyncData *data = (DecryptRecordsAsyncData *)user_data;
+  CryptoChunk *chunk = g_task_get_task_data (G_TASK (result));
+  GPtrArray *bookmarks;
+
+  /* The chunks finish in any order, so pass on where this one starts in the
+   * server response. */
+  bookmarks = g_task_propagate_pointer (G_TASK (result), NULL);
+  data->batch_func (self, bookmarks, chunk->start, data->user_data);
+  g_ptr_array_unref (bookmarks);
+
+  if (--data->pending == 0) {
+    data->done_func (self, data->user_data);
+    decrypt_records_async_data_free (data);
+  }
+}
+
+static void
+ephy_sync_service_decrypt_records (EphySyncService  *self,
+                                   JsonParser       *parser,
+                                   DecryptBatchFunc  batch_func,
+                                   DecryptDoneFunc   done_func,
+                                   gpointer          user_data)
+{
+  DecryptRecordsAsyncData *data;
+  JsonNode *root;
+  JsonArray *array;
+  guint chunk_size;
+
+  data = g_slice_new0 (DecryptRecordsAsyncData);
+  data->sync_key = g_memdup (ephy_sync_service_get_sync_key (self), EPHY_SYNC_TOKEN_LENGTH);
+  data->parser = g_object_ref (parser);
+  data->bsos = g_ptr_array_new ();
+  data->batch_func = batch_func;
+  data->done_func = done_func;
+  data->user_data = user_data;
+
+  root = json_parser_get_root (parser);
+  if (root != NULL && JSON_NODE_HOLDS_ARRAY (root)) {
+    array = json_node_get_array (root);
+    for (guint i = 0; i < json_array_get_length (array); i++) {
+      JsonNode *node = json_array_get_element (array, i);
+
+      if (JSON_NODE_HOLDS_OBJECT (node))
+        g_ptr_array_add (data->bsos, json_node_get_object (node));
+    }
+  }
+
+  if (data->bsos->len == 0) {
+    done_func (self, user_data);
+    decrypt_records_async_data_free (data);
+    return;
+  }
+
+  /* Every chunk hands its bookmarks back to the main loop as soon as it is
+   * done. None of the callbacks can run before this function returns, so the
+   * pending counter is complete by then. */
+  chunk_size = crypto_chunk_size (data->bsos->len);
+  for (guint start = 0; start < data->bsos->len; start += chunk_size) {
+    CryptoChunk *chunk;
+    GTask *task;
+
+    chunk = g_new (CryptoChunk, 1);
+    chunk->data = data;
+    chunk->start = start;
+    chunk->end = MIN (start + chunk_size, data->bsos->len);
+
+    task = g_task_new (self, NULL, decrypt_records_cb, data);
+    g_task_set_task_data (task, chunk, g_free);
+    g_task_run_in_thread (task, decrypt_records_thread);
+    g_object_unref (task);
+
+    data->pending++;
+  }
+}
+
+/* @bsos is NULL if the bookmarks could not be encrypted, and @error tells
+ * why. */
+typedef void (*EncryptDoneFunc) (EphySyncService *self,
+                                 GPtrArray       *bsos,
+                                 const GError    *error,
+                                 gpointer         user_data);
+
+typedef struct {
+  guint8          *sync_key;
+  GPtrArray       *ids;
+  GPtrArray       *serialized;
+  GPtrArray       *bsos;
+  guint            pending;
+  GError          *error;
+  EncryptDoneFunc  done_func;
+  gpointer         user_data;
+} EncryptRecordsAsyncData;
+
+static void
+encrypt_records_async_data_free (EncryptRecordsAsyncData *data)
+{
+  g_assert (data != NULL);
+
+  g_free (data->sync_key);
+  g_ptr_array_unref (data->ids);
+  g_ptr_array_unref (data->serialized);
+  g_ptr_array_unref (data->bsos);
+  g_clear_error (&data->error);
+  g_slice_free (EncryptRecordsAsyncData, data);
+}
+
+static void
+encrypt_records_thread (GTask        *task,
+                        gpointer      source_object,
+                        gpointer      task_data,
+                        GCancellable *cancellable)
+{
+  CryptoChunk *chunk = (CryptoChunk *)task_data;
+  EncryptRecordsAsyncData *data = (EncryptRecordsAsyncData *)chunk->data;
+
+  /* Chunks never overlap, so each one can fill its own slots of the array
+   * directly. */
+  for (guint i = chunk->start; i < chunk->end; i++)
+    data->bsos->pdata[i] = ephy_bookmark_encrypt_bso (g_ptr_array_index (data->ids, i),
+                                                      g_ptr_array_index (data->serialized, i),
+                                                      data->sync_key);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+encrypt_records_cb (GObject      *source_object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  EphySyncService *self = EPHY_SYNC_SERVICE (source_object);
+  EncryptRecordsAsyncData *data = (EncryptRecordsAsyncData *)user_data;
+  GError *error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+    if (data->error == NULL)
+      data->error = error;
+    else
+      g_error_free (error);
+  }
+
+  if (--data->pending == 0) {
+    data->done_func (self, data->error ? NULL : data->bsos, data->error, data->user_data);
+    encrypt_records_async_data_free (data);
+  }
+}
+
+static void
+ephy_sync_service_encrypt_bookmarks (EphySyncService *self,
+                                     GPtrArray       *bookmarks,
+                                     EncryptDoneFunc  done_func,
+                                     gpointer         user_data)
+{
+  EncryptRecordsAsyncData *data;
+  const guint8 *sync_key;
+  guint chunk_size;
+
+  g_assert (bookmarks->len > 0);
+
+  data = g_slice_new0 (EncryptRecordsAsyncData);
+  data->ids = g_ptr_array_new_full (bookmarks->len, g_free);
+  data->serialized = g_ptr_array_new_full (bookmarks->len, g_free);
+  data->bsos = g_ptr_array_new_full (bookmarks->len, g_free);
+  data->done_func = done_func;
+  data->user_data = user_data;
+
+  /* The key is missing until the account keys are fetched. Fail through a
+   * task, so that the caller is called back from the main loop either way. */
+  sync_key = ephy_sync_service_get_sync_key (self);
+  if (sync_key == NULL) {
+    GTask *task = g_task_new (self, NULL, encrypt_records_cb, data);
+
+    data->pending = 1;
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "There is no sync key to encrypt the bookmarks with");
+    g_object_unref (task);
+    return;
+  }
+  data->sync_key = g_memdup (sync_key, EPHY_SYNC_TOKEN_LENGTH);
+
+  /* Bookmarks can change in the main thread at any time, so they are
+   * serialized here and only the encryption is left to the workers. */
+  for (guint i = 0; i < bookmarks->len; i++) {
+    EphyBookmark *bookmark = g_ptr_array_index (bookmarks, i);
+
+    g_ptr_array_add (data->ids, g_strdup (ephy_bookmark_get_id (bookmark)));
+    g_ptr_array_add (data->serialized, json_gobject_to_data (G_OBJECT (bookmark), NULL));
+  }
+  g_ptr_array_set_size (data->bsos, bookmarks->len);
+
+  chunk_size = crypto_chunk_size (bookmarks->len);
+  for (guint start = 0; start < bookmarks->len; start += chunk_size) {
+    CryptoChunk *chunk;
+    GTask *task;
+
+    chunk = g_new (CryptoChunk, 1);
+    chunk->data = data;
+    chunk->start = start;
+    chunk->end = MIN (start + chunk_size, bookmarks->len);
+
+    task = g_task_new (self, NULL, encrypt_records_cb, data);
+    g_task_set_task_data (task, chunk, g_free);
+    g_task_run_in_thread (task, encrypt_records_thread);
+    g_object_unref (task);
+
+    data->pending++;
+  }
+}
+
 static void
 upload_bookmark_response_cb (SoupSession *session,
                              SoupMessage *msg,
@@ -1030,7 +1343,7 @@ ephy_sync_service_upload_bookmark (EphySyncService *self,
   endpoint = g_strdup_printf ("storage/%s/%s",
                               EPHY_BOOKMARKS_COLLECTION,
                               ephy_bookmark_get_id (bookmark));
-  bso = ephy_bookmark_to_bso (bookmark);
+  bso = ephy_bookmark_to_bso (bookmark, ephy_sync_service_get_sync_key (self));
   modified = ephy_bookmark_get_modification_time (bookmark);
   ephy_sync_service_send_storage_message (self, endpoint,
                                           SOUP_METHOD_PUT, bso, -1,
@@ -1042,6 +1355,197 @@ ephy_sync_service_upload_bookmark (EphySyncService *self,
   g_free (bso);
 }
 
+typedef struct {
+  GPtrArray *bsos;
+  guint      next;
+  gboolean   force;
+} UploadBookmarksAsyncData;
+
+static void
+upload_bookmarks_async_data_free (UploadBookmarksAsyncData *data)
+{
+  g_assert (data != NULL);
+
+  g_ptr_array_unref (data->bsos);
+  g_slice_free (UploadBookmarksAsyncData, data);
+}
+
+static void ephy_sync_service_upload_next_batch (EphySyncService          *self,
+                                                 UploadBookmarksAsyncData *data);
+
+static void
+upload_bookmarks_response_cb (SoupSession *session,
+                              SoupMessage *msg,
+                              gpointer     user_data)
+{
+  EphySyncService *service;
+  EphyBookmarksManager *manager;
+  UploadBookmarksAsyncData *data;
+  JsonParser *parser;
+  JsonNode *root;
+  JsonObject *response;
+  JsonArray *success;
+  double modified;
+
+  service = ephy_shell_get_sync_service (ephy_shell_get_default ());
+  manager = ephy_shell_get_bookmarks_manager (ephy_shell_get_default ());
+  data = (UploadBookmarksAsyncData *)user_data;
+
+  /* A 412 means that somebody else wrote to the collection since our last
+   * sync. The remaining bookmarks are still marked as not uploaded, so the
+   * next sync will merge the remote changes and try again. */
+  if (msg->status_code != 200) {
+    LOG ("Failed to upload batch to server. Status code: %u, response: %s",
+         msg->status_code, msg->response_body->data);
+    upload_bookmarks_async_data_free (data);
+    ephy_sync_service_release_next_storage_message (service);
+    return;
+  }
+
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, msg->response_body->data, -1, NULL);
+  root = json_parser_get_root (parser);
+
+  if (root == NULL || JSON_NODE_HOLDS_OBJECT (root) == FALSE) {
+    LOG ("Unexpected response to batch upload: %s", msg->response_body->data);
+    upload_bookmarks_async_data_free (data);
+    g_object_unref (parser);
+    ephy_sync_service_release_next_storage_message (service);
+    return;
+  }
+
+  response = json_node_get_object (root);
+  modified = json_object_get_double_member (response, "modified");
+
+  if (json_object_has_member (response, "success")) {
+    success = json_object_get_array_member (response, "success");
+    for (guint i = 0; i < json_array_get_length (success); i++) {
+      const char *id = json_array_get_string_element (success, i);
+      EphyBookmark *bookmark = ephy_bookmarks_manager_get_bookmark_by_id (manager, id);
+
+      if (bookmark != NULL) {
+        ephy_bookmark_set_modification_time (bookmark, modified);
+        ephy_bookmark_set_is_uploaded (bookmark, TRUE);
+      }
+    }
+  }
+
+  /* Failed records keep their not uploaded flag and are retried next sync. */
+  if (json_object_has_member (response, "failed"))
+    LOG ("Server rejected %u records of the batch",
+         json_object_get_size (json_object_get_object_member (response, "failed")));
+
+  ephy_bookmarks_manager_save_to_file_async (manager, NULL, NULL, NULL);
+
+  /* A conditional upload only succeeds if nobody else wrote to the collection
+   * in the meantime, so the new collection timestamp does not hide any remote
+   * change from the next sync. It is also what the next batch must be
+   * conditional on. */
+  if (data->force == FALSE)
+    ephy_sync_service_set_sync_time (service, modified);
+
+  g_object_unref (parser);
+
+  /* This releases the storage queue after the last batch. */
+  ephy_sync_service_upload_next_batch (service, data);
+}
+
+static void
+ephy_sync_service_upload_next_batch (EphySyncService          *self,
+                                     UploadBookmarksAsyncData *data)
+{
+  StorageServerRequestAsyncData *request;
+  GString *body;
+  char *endpoint;
+  guint count = 0;
+
+  if (data->next >= data->bsos->len) {
+    upload_bookmarks_async_data_free (data);
+    ephy_sync_service_release_next_storage_message (self);
+    return;
+  }
+
+  /* Fill the batch up to the limits of the server. A single record is always
+   * sent, even if it exceeds the byte limit alone, and left to the server to
+   * reject. */
+  body = g_string_new ("[");
+  while (count < self->max_post_records && data->next < data->bsos->len) {
+    const char *bso = g_ptr_array_index (data->bsos, data->next);
+
+    if (count > 0 && body->len + strlen (bso) + 2 > self->max_post_bytes)
+      break;
+
+    if (count > 0)
+      g_string_append_c (body, ',');
+    g_string_append (body, bso);
+    data->next++;
+    count++;
+  }
+  g_string_append_c (body, ']');
+
+  /* The storage queue is still locked for the upload, so the batch is sent
+   * right away instead of being queued behind other messages. */
+  endpoint = g_strdup_printf ("storage/%s", EPHY_BOOKMARKS_COLLECTION);
+  request = storage_server_request_async_data_new (self, endpoint,
+                                                   SOUP_METHOD_POST, body->str, -1,
+                                                   data->force ? -1 : ephy_sync_service_get_sync_time (self),
+                                                   upload_bookmarks_response_cb,
+                                                   data);
+  ephy_sync_service_issue_storage_request (self, request);
+
+  g_free (endpoint);
+  g_string_free (body, TRUE);
+}
+
+static void
+upload_bookmarks_encrypted_cb (EphySyncService *self,
+                               GPtrArray       *bsos,
+                               const GError    *error,
+                               gpointer         user_data)
+{
+  UploadBookmarksAsyncData *data;
+
+  /* The bookmarks stay marked as not uploaded, so the next sync retries. */
+  if (bsos == NULL) {
+    LOG ("Failed to encrypt bookmarks for upload: %s", error->message);
+    ephy_sync_service_release_next_storage_message (self);
+    return;
+  }
+
+  data = g_slice_new0 (UploadBookmarksAsyncData);
+  data->bsos = g_ptr_array_ref (bsos);
+  data->force = GPOINTER_TO_INT (user_data);
+
+  /* The batches are sent one after the other, each one from the response of
+   * the previous, so that a conditional batch can be made conditional on the
+   * collection timestamp returned for the batch before it. */
+  ephy_sync_service_upload_next_batch (self, data);
+}
+
+/* Must be called with the storage queue locked, by the callback of the
+ * message that locked it. The upload takes the lock over and releases the
+ * queue once the last batch is done, so no other message can change the
+ * collection between the encryption and the upload. */
+void
+ephy_sync_service_upload_bookmarks (EphySyncService *self,
+                                    GPtrArray       *bookmarks,
+                                    gboolean         force)
+{
+  g_return_if_fail (EPHY_IS_SYNC_SERVICE (self));
+  g_return_if_fail (ephy_sync_service_is_signed_in (self));
+  g_return_if_fail (bookmarks != NULL);
+  g_assert (self->locked == TRUE);
+
+  if (bookmarks->len == 0) {
+    ephy_sync_service_release_next_storage_message (self);
+    return;
+  }
+
+  ephy_sync_service_encrypt_bookmarks (self, bookmarks,
+                                       upload_bookmarks_encrypted_cb,
+                                       GINT_TO_POINTER (force));
+}
+
 static void
 download_bookmark_response_cb (SoupSession *session,
                                SoupMessage *msg,
@@ -1055,6 +1559,8 @@ download_bookmark_response_cb (SoupSession *session,
   JsonObject *bso;
   const char *id;
 
+  service = ephy_shell_get_sync_service (ephy_shell_get_default ());
+
   if (msg->status_code != 200) {
     LOG ("Failed to download from server. Status code: %u, response: %s",
          msg->status_code, msg->response_body->data);
@@ -1064,7 +1570,7 @@ download_bookmark_response_cb (SoupSession *session,
   parser = json_parser_new ();
   json_parser_load_from_data (parser, msg->response_body->data, -1, NULL);
   bso = json_node_get_object (json_parser_get_root (parser));
-  bookmark = ephy_bookmark_from_bso (bso);
+  bookmark = ephy_bookmark_from_bso (bso, ephy_sync_service_get_sync_key (service));
   id = ephy_bookmark_get_id (bookmark);
 
   /* Overwrite any local bookmark. */
@@ -1081,7 +1587,6 @@ download_bookmark_response_cb (SoupSession *session,
   g_object_unref (parser);
 
 out:
-  service = ephy_shell_get_sync_service (ephy_shell_get_default ());
   ephy_sync_service_release_next_storage_message (service);
 }
 
@@ -1180,164 +1685,198 @@ ephy_sync_service_delete_bookmark (EphySyncService *self,
   g_free (endpoint);
 }
 
+typedef struct {
+  GTree  *batches;
+  double  server_time;
+} SyncBookmarksFirstTimeData;
+
+static int
+compare_batch_offsets (gconstpointer a,
+                       gconstpointer b,
+                       gpointer      user_data)
+{
+  guint offset_a = GPOINTER_TO_UINT (a);
+  guint offset_b = GPOINTER_TO_UINT (b);
+
+  return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+static gboolean
+append_batch_cb (gpointer key,
+                 gpointer value,
+                 gpointer user_data)
+{
+  GPtrArray *batch = (GPtrArray *)value;
+  GPtrArray *remotes = (GPtrArray *)user_data;
+
+  for (guint i = 0; i < batch->len; i++)
+    g_ptr_array_add (remotes, g_object_ref (g_ptr_array_index (batch, i)));
+
+  return FALSE;
+}
+
+static void
+sync_bookmarks_first_time_collect_cb (EphySyncService *service,
+                                      GPtrArray       *remotes,
+                                      guint            offset,
+                                      gpointer         user_data)
+{
+  SyncBookmarksFirstTimeData *data = (SyncBookmarksFirstTimeData *)user_data;
+
+  /* Keep each batch at its offset in the server response, so the merge sees
+   * the records in server order no matter which chunk finished first. */
+  g_tree_insert (data->batches, GUINT_TO_POINTER (offset), g_ptr_array_ref (remotes));
+}
+
+static void
+sync_bookmarks_first_time_done_cb (EphySyncService *service,
+                                   gpointer         user_data)
+{
+  SyncBookmarksFirstTimeData *data = (SyncBookmarksFirstTimeData *)user_data;
+  EphyBookmarksManager *manager;
+  GPtrArray *remotes;
+  GPtrArray *to_upload;
+
+  manager = ephy_shell_get_bookmarks_manager (ephy_shell_get_default ());
+
+  remotes = g_ptr_array_new_with_free_func (g_object_unref);
+  g_tree_foreach (data->batches, append_batch_cb, remotes);
+
+  /* Reconcile the whole collection with the local bookmarks in one pass, and
+   * upload whatever the server is missing. */
+  to_upload = ephy_bookmarks_manager_merge_remote_bookmarks (manager, remotes);
+
+  /* Set the sync time. */
+  ephy_sync_service_set_sync_time (service, data->server_time);
+
+  /* The upload releases the storage queue when it is done. */
+  ephy_sync_service_upload_bookmarks (service, to_upload, TRUE);
+  g_ptr_array_unref (to_upload);
+
+  g_ptr_array_unref (remotes);
+  g_tree_unref (data->batches);
+  g_slice_free (SyncBookmarksFirstTimeData, data);
+}
+
 static void
 sync_bookmarks_first_time_response_cb (SoupSession *session,
                                        SoupMessage *msg,
                                        gpointer     user_data)
 {
   EphySyncService *service;
-  EphyBookmarksManager *manager;
-  GSequence *bookmarks;
-  GSequenceIter *iter;
-  GHashTable *marked;
+  SyncBookmarksFirstTimeData *data;
   JsonParser *parser;
-  JsonArray *array;
   const char *timestamp;
-  double server_time;
 
   service = ephy_shell_get_sync_service (ephy_shell_get_default ());
-  manager = ephy_shell_get_bookmarks_manager (ephy_shell_get_default ());
-  bookmarks = ephy_bookmarks_manager_get_bookmarks (manager);
-  marked = g_hash_table_new (g_direct_hash, g_direct_equal);
-  parser = json_parser_new ();
-  json_parser_load_from_data (parser, msg->response_body->data, -1, NULL);
 
   if (msg->status_code != 200) {
     LOG ("Failed to do a first time sync. Status code: %u, response: %s",
          msg->status_code, msg->response_body->data);
-    goto out;
+    ephy_sync_service_release_next_storage_message (service);
+    return;
   }
 
-  array = json_node_get_array (json_parser_get_root (parser));
-  for (gsize i = 0; i < json_array_get_length (array); i++) {
-    JsonObject *bso = json_array_get_object_element (array, i);
-    EphyBookmark *remote = ephy_bookmark_from_bso (bso);
-    EphyBookmark *local;
-
-    if (remote == NULL)
-      continue;
-
-    local = ephy_bookmarks_manager_get_bookmark_by_id (manager, ephy_bookmark_get_id (remote));
-
-    if (local == NULL) {
-      local = ephy_bookmarks_manager_get_bookmark_by_url (manager, ephy_bookmark_get_url (remote));
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, msg->response_body->data, -1, NULL);
 
-      /* If there is no local equivalent of the remote bookmark, then add it to
-       * the local instance together with its tags. */
-      if (local == NULL) {
-        ephy_bookmarks_manager_add_bookmark (manager, remote);
+  timestamp = soup_message_headers_get_one (msg->response_headers, "X-Weave-Timestamp");
 
-        /* We have to manually add the tags to the bookmarks manager. */
-        for (iter = g_sequence_get_begin_iter (ephy_bookmark_get_tags (remote));
-             !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter))
-          ephy_bookmarks_manager_create_tag (manager, g_sequence_get (iter));
+  data = g_slice_new0 (SyncBookmarksFirstTimeData);
+  data->batches = g_tree_new_full (compare_batch_offsets, NULL,
+                                   NULL, (GDestroyNotify)g_ptr_array_unref);
+  data->server_time = g_ascii_strtod (timestamp, NULL);
 
-        g_hash_table_add (marked, remote);
-      }
-      /* If there is a local bookmark with the same url as the remote one, then
-       * merge tags into the local one, keep the remote id and upload it to the
-       * server. */
-      else {
-        for (iter = g_sequence_get_begin_iter (ephy_bookmark_get_tags (remote));
-             !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
-          ephy_bookmark_add_tag (local, g_sequence_get (iter));
-          ephy_bookmarks_manager_create_tag (manager, g_sequence_get (iter));
-        }
+  /* The records are decrypted in worker threads, collected by their offset
+   * in the response and then merged at once, in server order. The storage
+   * queue stays locked until the merge is done. */
+  ephy_sync_service_decrypt_records (service, parser,
+                                     sync_bookmarks_first_time_collect_cb,
+                                     sync_bookmarks_first_time_done_cb,
+                                     data);
 
-        ephy_bookmark_set_id (local, ephy_bookmark_get_id (remote));
-        ephy_sync_service_upload_bookmark (service, local, TRUE);
-        g_object_unref (remote);
-        g_hash_table_add (marked, local);
-      }
-    }
-    /* Having a local bookmark with the same id as the remote one means that the
-     * bookmark has been synced before in the past. Keep the one with the most
-     * recent modified timestamp. */
-    else {
-      if (ephy_bookmark_get_modification_time (remote) > ephy_bookmark_get_modification_time (local)) {
-        ephy_bookmarks_manager_remove_bookmark (manager, local);
-        ephy_bookmarks_manager_add_bookmark (manager, remote);
+  g_object_unref (parser);
+}
 
-        /* We have to manually add the tags to the bookmarks manager. */
-        for (iter = g_sequence_get_begin_iter (ephy_bookmark_get_tags (remote));
-             !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter))
-          ephy_bookmarks_manager_create_tag (manager, g_sequence_get (iter));
+static void
+sync_deleted_bookmarks_response_cb (SoupSession *session,
+                                    SoupMessage *msg,
+                                    gpointer     user_data)
+{
+  EphySyncService *service;
+  EphyBookmarksManager *manager;
+  GSequence *bookmarks;
+  GSequenceIter *iter;
+  GHashTable *remote_ids;
+  GPtrArray *deleted;
+  JsonParser *parser;
+  JsonNode *root;
+  JsonArray *array;
 
-        g_hash_table_add (marked, remote);
-      } else {
-        if (ephy_bookmark_get_modification_time (local) > ephy_bookmark_get_modification_time (remote))
-          ephy_sync_service_upload_bookmark (service, local, TRUE);
+  service = ephy_shell_get_sync_service (ephy_shell_get_default ());
+  manager = ephy_shell_get_bookmarks_manager (ephy_shell_get_default ());
+  bookmarks = ephy_bookmarks_manager_get_bookmarks (manager);
+  remote_ids = g_hash_table_new (g_str_hash, g_str_equal);
+  deleted = g_ptr_array_new ();
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, msg->response_body->data, -1, NULL);
+  root = json_parser_get_root (parser);
 
-        g_hash_table_add (marked, local);
-        g_object_unref (remote);
-      }
-    }
+  if (msg->status_code != 200 || root == NULL || JSON_NODE_HOLDS_ARRAY (root) == FALSE) {
+    LOG ("Failed to list the bookmarks on the server. Status code: %u, response: %s",
+         msg->status_code, msg->response_body->data);
+    goto out;
   }
 
-  /* Upload the remaining local bookmarks to the server. */
+  array = json_node_get_array (root);
+  for (guint i = 0; i < json_array_get_length (array); i++)
+    g_hash_table_add (remote_ids, (gpointer)json_array_get_string_element (array, i));
+
+  /* A bookmark that was uploaded before but whose id is no longer on the
+   * server has been deleted by another client. */
   for (iter = g_sequence_get_begin_iter (bookmarks);
        !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
     EphyBookmark *bookmark = g_sequence_get (iter);
 
-    if (g_hash_table_contains (marked, bookmark) == FALSE)
-      ephy_sync_service_upload_bookmark (service, bookmark, TRUE);
+    if (ephy_bookmark_is_uploaded (bookmark) == TRUE &&
+        g_hash_table_contains (remote_ids, ephy_bookmark_get_id (bookmark)) == FALSE)
+      g_ptr_array_add (deleted, bookmark);
   }
 
-  /* Save changes to file. */
-  ephy_bookmarks_manager_save_to_file_async (manager, NULL, NULL, NULL);
+  for (guint i = 0; i < deleted->len; i++)
+    ephy_bookmarks_manager_remove_bookmark (manager, g_ptr_array_index (deleted, i));
 
-  /* Set the sync time. */
-  timestamp = soup_message_headers_get_one (msg->response_headers, "X-Weave-Timestamp");
-  server_time = g_ascii_strtod (timestamp, NULL);
-  ephy_sync_service_set_sync_time (service, server_time);
+  if (deleted->len > 0)
+    ephy_bookmarks_manager_save_to_file_async (manager, NULL, NULL, NULL);
 
 out:
+  g_ptr_array_unref (deleted);
+  g_hash_table_unref (remote_ids);
   g_object_unref (parser);
-  g_hash_table_unref (marked);
 
   ephy_sync_service_release_next_storage_message (service);
 }
 
+typedef struct {
+  double   server_time;
+  gboolean modified;
+} SyncBookmarksData;
+
 static void
-sync_bookmarks_response_cb (SoupSession *session,
-                            SoupMessage *msg,
-                            gpointer     user_data)
+sync_bookmarks_merge_cb (EphySyncService *service,
+                         GPtrArray       *remotes,
+                         guint            offset,
+                         gpointer         user_data)
 {
-  EphySyncService *service;
   EphyBookmarksManager *manager;
-  GSequence *bookmarks;
   GSequenceIter *iter;
-  JsonParser *parser;
-  JsonArray *array;
-  const char *timestamp;
-  double server_time;
 
-  service = ephy_shell_get_sync_service (ephy_shell_get_default ());
   manager = ephy_shell_get_bookmarks_manager (ephy_shell_get_default ());
-  bookmarks = ephy_bookmarks_manager_get_bookmarks (manager);
-  parser = json_parser_new ();
-  json_parser_load_from_data (parser, msg->response_body->data, -1, NULL);
-
-  /* Code 304 indicates that the resource has not been modified. Therefore,
-   * only upload the local bookmarks that were not uploaded. */
-  if (msg->status_code == 304)
-    goto handle_local_bookmarks;
-
-  if (msg->status_code != 200) {
-    LOG ("Failed to sync bookmarks. Status code: %u, response: %s",
-         msg->status_code, msg->response_body->data);
-    goto out;
-  }
 
-  array = json_node_get_array (json_parser_get_root (parser));
-  for (gsize i = 0; i < json_array_get_length (array); i++) {
-    JsonObject *bso = json_array_get_object_element (array, i);
-    EphyBookmark *remote = ephy_bookmark_from_bso (bso);
+  for (guint i = 0; i < remotes->len; i++) {
+    EphyBookmark *remote = g_object_ref (g_ptr_array_index (remotes, i));
     EphyBookmark *local;
 
-    if (remote == NULL)
-      continue;
-
     local = ephy_bookmarks_manager_get_bookmark_by_id (manager, ephy_bookmark_get_id (remote));
 
     if (local == NULL) {
@@ -1357,34 +1896,146 @@ sync_bookmarks_response_cb (SoupSession *session,
              !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter))
           ephy_bookmarks_manager_create_tag (manager, g_sequence_get (iter));
       } else {
+        /* The local copy is newer, have it uploaded with the other local
+         * changes. */
         if (ephy_bookmark_get_modification_time (local) > ephy_bookmark_get_modification_time (remote))
-          ephy_sync_service_upload_bookmark (service, local, TRUE);
+          ephy_bookmark_set_is_uploaded (local, FALSE);
 
         g_object_unref (remote);
       }
     }
   }
+}
+
+static void
+sync_bookmarks_done_cb (EphySyncService *service,
+                        gpointer         user_data)
+{
+  SyncBookmarksData *data = (SyncBookmarksData *)user_data;
+  EphyBookmarksManager *manager;
+  GSequence *bookmarks;
+  GSequenceIter *iter;
+  GPtrArray *to_upload;
+  char *endpoint;
+
+  manager = ephy_shell_get_bookmarks_manager (ephy_shell_get_default ());
+  bookmarks = ephy_bookmarks_manager_get_bookmarks (manager);
+
+  /* Records deleted on the server do not show up in the delta, so fetch the
+   * list of ids still present to find them. This is a single request carrying
+   * no payloads, and is not needed if the collection was not modified at all. */
+  if (data->modified == TRUE) {
+    endpoint = g_strdup_printf ("storage/%s", EPHY_BOOKMARKS_COLLECTION);
+    ephy_sync_service_send_storage_message (service, endpoint,
+                                            SOUP_METHOD_GET, NULL, -1, -1,
+                                            sync_deleted_bookmarks_response_cb, NULL);
+    g_free (endpoint);
+  }
+
+  /* Set the sync time. This has to happen before uploading, as the batches
+   * are conditional on it. */
+  ephy_sync_service_set_sync_time (service, data->server_time);
 
-handle_local_bookmarks:
+  to_upload = g_ptr_array_new ();
   for (iter = g_sequence_get_begin_iter (bookmarks);
        !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
     EphyBookmark *bookmark = EPHY_BOOKMARK (g_sequence_get (iter));
 
-    if (ephy_bookmark_is_uploaded (bookmark) == TRUE)
-      ephy_sync_service_delete_bookmark (service, bookmark, TRUE);
-    else
-      ephy_sync_service_upload_bookmark (service, bookmark, FALSE);
+    if (ephy_bookmark_is_uploaded (bookmark) == FALSE)
+      g_ptr_array_add (to_upload, bookmark);
   }
 
   /* Save changes to file. */
   ephy_bookmarks_manager_save_to_file_async (manager, NULL, NULL, NULL);
 
-  /* Set the sync time. */
+  g_slice_free (SyncBookmarksData, data);
+
+  /* The upload releases the storage queue when it is done. */
+  ephy_sync_service_upload_bookmarks (service, to_upload, FALSE);
+  g_ptr_array_unref (to_upload);
+}
+
+static void
+sync_bookmarks_response_cb (SoupSession *session,
+                            SoupMessage *msg,
+                            gpointer     user_data)
+{
+  EphySyncService *service;
+  SyncBookmarksData *data;
+  JsonParser *parser;
+  const char *timestamp;
+
+  service = ephy_shell_get_sync_service (ephy_shell_get_default ());
+
+  /* Code 304 indicates that the collection has not been modified at all, not
+   * even by deletions. */
+  if (msg->status_code != 200 && msg->status_code != 304) {
+    LOG ("Failed to sync bookmarks. Status code: %u, response: %s",
+         msg->status_code, msg->response_body->data);
+    ephy_sync_service_release_next_storage_message (service);
+    return;
+  }
+
   timestamp = soup_message_headers_get_one (msg->response_headers, "X-Weave-Timestamp");
-  server_time = g_ascii_strtod (timestamp, NULL);
-  ephy_sync_service_set_sync_time (service, server_time);
+
+  data = g_slice_new0 (SyncBookmarksData);
+  data->server_time = g_ascii_strtod (timestamp, NULL);
+  data->modified = msg->status_code == 200;
+
+  /* Only upload the local bookmarks that were not uploaded. */
+  if (data->modified == FALSE) {
+    sync_bookmarks_done_cb (service, data);
+    return;
+  }
+
+  /* The response only contains the records modified since the last sync.
+   * They are decrypted in worker threads and merged as they come back, with
+   * the storage queue locked until the merge is done. */
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, msg->response_body->data, -1, NULL);
+  ephy_sync_service_decrypt_records (service, parser,
+                                     sync_bookmarks_merge_cb,
+                                     sync_bookmarks_done_cb,
+                                     data);
+  g_object_unref (parser);
+}
+
+static void
+storage_configuration_response_cb (SoupSession *session,
+                                   SoupMessage *msg,
+                                   gpointer     user_data)
+{
+  EphySyncService *service;
+  JsonParser *parser;
+  JsonNode *root;
+  JsonObject *config;
+
+  service = ephy_shell_get_sync_service (ephy_shell_get_default ());
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, msg->response_body->data, -1, NULL);
+  root = json_parser_get_root (parser);
+
+  /* Older servers do not implement info/configuration. Keep the defaults. */
+  if (msg->status_code != 200 || root == NULL || JSON_NODE_HOLDS_OBJECT (root) == FALSE) {
+    LOG ("Failed to get the storage server limits. Status code: %u, response: %s",
+         msg->status_code, msg->response_body->data);
+    goto out;
+  }
+
+  config = json_node_get_object (root);
+  if (json_object_has_member (config, "max_post_records"))
+    service->max_post_records = MAX (1, json_object_get_int_member (config, "max_post_records"));
+  if (json_object_has_member (config, "max_post_bytes"))
+    service->max_post_bytes = MAX (1, json_object_get_int_member (config, "max_post_bytes"));
+  if (json_object_has_member (config, "max_request_bytes"))
+    service->max_post_bytes = MIN (service->max_post_bytes,
+                                   (gsize)MAX (1, json_object_get_int_member (config, "max_request_bytes")));
+
+  LOG ("Storage server accepts %u records and %" G_GSIZE_FORMAT " bytes per POST",
+       service->max_post_records, service->max_post_bytes);
 
 out:
+  service->storage_config_fetched = TRUE;
   g_object_unref (parser);
 
   ephy_sync_service_release_next_storage_message (service);
@@ -1395,17 +2046,27 @@ ephy_sync_service_sync_bookmarks (EphySyncService *self,
                                   gboolean         first)
 {
   char *endpoint;
+  char newer[G_ASCII_DTOSTR_BUF_SIZE];
 
   g_return_if_fail (EPHY_IS_SYNC_SERVICE (self));
   g_return_if_fail (ephy_sync_service_is_signed_in (self));
 
-  endpoint = g_strdup_printf ("storage/%s?full=true", EPHY_BOOKMARKS_COLLECTION);
+  /* The storage queue is serialized, so the limits are known by the time the
+   * response to the collection request is uploading local changes. */
+  if (self->storage_config_fetched == FALSE)
+    ephy_sync_service_send_storage_message (self, (char *)"info/configuration",
+                                            SOUP_METHOD_GET, NULL, -1, -1,
+                                            storage_configuration_response_cb, NULL);
 
   if (first == TRUE) {
+    endpoint = g_strdup_printf ("storage/%s?full=true", EPHY_BOOKMARKS_COLLECTION);
     ephy_sync_service_send_storage_message (self, endpoint,
                                             SOUP_METHOD_GET, NULL, -1, -1,
                                             sync_bookmarks_first_time_response_cb, NULL);
   } else {
+    /* Only fetch the records modified since the last sync. */
+    g_ascii_formatd (newer, sizeof (newer), "%.2f", ephy_sync_service_get_sync_time (self));
+    endpoint = g_strdup_printf ("storage/%s?newer=%s&full=true", EPHY_BOOKMARKS_COLLECTION, newer);
     ephy_sync_service_send_storage_message (self, endpoint,
                                             SOUP_METHOD_GET, NULL,
                                             ephy_sync_service_get_sync_time (self), -1,
@@ -73,6 +73,9 @@ void             ephy_sync_service_release_next_storage_message (EphySyncService
 void             ephy_sync_service_upload_bookmark              (EphySyncService *self,
                                                                  EphyBookmark    *bookmark,
                                                                  gboolean         force);
+void             ephy_sync_service_upload_bookmarks             (EphySyncService *self,
+                                                                 GPtrArray       *bookmarks,
+                                                                 gboolean         force);
 void             ephy_sync_service_download_bookmark            (EphySyncService *self,
                                                                  EphyBookmark    *bookmark);
 void             ephy_sync_service_delete_bookmark              (EphySyncService *self,
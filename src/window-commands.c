@@ -43,6 +43,7 @@
 #include "ephy-gui.h"
 #include "ephy-header-bar.h"
 #include "ephy-history-dialog.h"
+#include "ephy-history-service.h"
 #include "ephy-link.h"
 #include "ephy-location-entry.h"
 #include "ephy-notebook.h"
@@ -269,6 +270,37 @@ show_profile_selector (GtkWidget *parent, GSList *profiles)
   return selected_profile;
 }
 
+static void
+firefox_bookmarks_imported_cb (EphyBookmarksManager *manager,
+                               GAsyncResult         *result,
+                               GtkDialog            *dialog)
+{
+  GtkWidget *import_info_dialog;
+  GError *error = NULL;
+  gboolean imported;
+
+  imported = ephy_bookmarks_import_from_firefox_finish (manager, result, &error);
+
+  import_info_dialog = gtk_message_dialog_new (GTK_WINDOW (dialog),
+                                               GTK_DIALOG_MODAL,
+                                               imported ? GTK_MESSAGE_INFO : GTK_MESSAGE_WARNING,
+                                               GTK_BUTTONS_OK,
+                                               "%s",
+                                               imported ? _("Bookmarks successfully imported!") :
+                                                          error->message);
+  gtk_dialog_run (GTK_DIALOG (import_info_dialog));
+  gtk_widget_destroy (import_info_dialog);
+
+  if (imported)
+    gtk_widget_destroy (GTK_WIDGET (dialog));
+  else
+    gtk_widget_set_sensitive (GTK_WIDGET (dialog), TRUE);
+
+  if (error)
+    g_error_free (error);
+  g_object_unref (dialog);
+}
+
 static void
 dialog_bookmarks_import_cb (GtkDialog   *dialog,
                             int          response,
@@ -328,7 +360,6 @@ dialog_bookmarks_import_cb (GtkDialog   *dialog,
       }
       gtk_widget_destroy (file_chooser_dialog);
     } else if (active == 1) {
-      GError *error = NULL;
       GSList *profiles;
       gchar *profile = NULL;
       int num_profiles;
@@ -338,13 +369,9 @@ dialog_bookmarks_import_cb (GtkDialog   *dialog,
       /* Import default profile */
       num_profiles = g_slist_length (profiles);
       if (num_profiles == 1) {
-        imported = ephy_bookmarks_import_from_firefox (manager, profiles->data, &error);
+        profile = g_strdup (profiles->data);
       } else if (num_profiles > 1) {
         profile = show_profile_selector (GTK_WIDGET (dialog), profiles);
-        if (profile) {
-          imported = ephy_bookmarks_import_from_firefox (manager, profile, &error);
-          g_free (profile);
-        }
       } else {
         g_assert_not_reached ();
       }
@@ -352,22 +379,15 @@ dialog_bookmarks_import_cb (GtkDialog   *dialog,
       g_slist_free (profiles);
 
       /* If there are multiple profiles, but the user didn't select one in
-       * the profile (he pressed Cancel), don't display the import info dialog
-       * as no import took place
+       * the profile (they pressed Cancel), no import takes place.
        */
       if (profile) {
-        import_info_dialog = gtk_message_dialog_new (GTK_WINDOW (dialog),
-                                                     GTK_DIALOG_MODAL,
-                                                     imported ? GTK_MESSAGE_INFO : GTK_MESSAGE_WARNING,
-                                                     GTK_BUTTONS_OK,
-                                                     "%s",
-                                                     imported ? _("Bookmarks successfully imported!") :
-                                                                error->message);
-        gtk_dialog_run (GTK_DIALOG (import_info_dialog));
-        gtk_widget_destroy (import_info_dialog);
+        gtk_widget_set_sensitive (GTK_WIDGET (dialog), FALSE);
+        ephy_bookmarks_import_from_firefox_async (manager, profile, NULL,
+                                                  (GAsyncReadyCallback)firefox_bookmarks_imported_cb,
+                                                  g_object_ref (dialog));
+        g_free (profile);
       }
-      if (error)
-        g_error_free (error);
     }
 
     if (imported)
@@ -437,6 +457,213 @@ window_cmd_import_bookmarks (GSimpleAction *action,
   gtk_widget_show_all (dialog);
 }
 
+#define CHROMIUM_HISTORY_FILE "Default/History"
+
+enum {
+  HISTORY_SOURCE_NAME_COL,
+  HISTORY_SOURCE_TYPE_COL,
+  HISTORY_SOURCE_FILE_COL
+};
+
+static void
+append_chromium_history_source (GtkListStore *list_store,
+                                const char   *name,
+                                const char   *config_dir)
+{
+  GtkTreeIter iter;
+  char *filename;
+
+  filename = g_build_filename (g_get_user_config_dir (), config_dir, CHROMIUM_HISTORY_FILE, NULL);
+  if (g_file_test (filename, G_FILE_TEST_IS_REGULAR)) {
+    gtk_list_store_append (list_store, &iter);
+    gtk_list_store_set (list_store, &iter,
+                        HISTORY_SOURCE_NAME_COL, name,
+                        HISTORY_SOURCE_TYPE_COL, EPHY_HISTORY_IMPORT_CHROMIUM,
+                        HISTORY_SOURCE_FILE_COL, filename,
+                        -1);
+  }
+  g_free (filename);
+}
+
+/* Firefox has one history per profile, so its file is only known once a
+ * profile is chosen. */
+static GtkTreeModel *
+create_history_sources_model (void)
+{
+  GtkListStore *list_store;
+  GtkTreeIter iter;
+  GSList *firefox_profiles;
+
+  list_store = gtk_list_store_new (3, G_TYPE_STRING, G_TYPE_INT, G_TYPE_STRING);
+
+  firefox_profiles = get_firefox_profiles ();
+  if (firefox_profiles) {
+    gtk_list_store_append (list_store, &iter);
+    gtk_list_store_set (list_store, &iter,
+                        HISTORY_SOURCE_NAME_COL, _("Firefox"),
+                        HISTORY_SOURCE_TYPE_COL, EPHY_HISTORY_IMPORT_FIREFOX,
+                        -1);
+  }
+  g_slist_free (firefox_profiles);
+
+  append_chromium_history_source (list_store, _("Chromium"), "chromium");
+  append_chromium_history_source (list_store, _("Google Chrome"), "google-chrome");
+
+  return GTK_TREE_MODEL (list_store);
+}
+
+static void
+history_imported_cb (EphyHistoryService *service,
+                     gboolean            success,
+                     gpointer            result_data,
+                     gpointer            user_data)
+{
+  GtkDialog *dialog = GTK_DIALOG (user_data);
+  GtkWidget *import_info_dialog;
+
+  import_info_dialog = gtk_message_dialog_new (GTK_WINDOW (dialog),
+                                               GTK_DIALOG_MODAL,
+                                               success ? GTK_MESSAGE_INFO : GTK_MESSAGE_WARNING,
+                                               GTK_BUTTONS_OK,
+                                               "%s",
+                                               success ? _("History successfully imported!") :
+                                                         _("History could not be imported."));
+  gtk_dialog_run (GTK_DIALOG (import_info_dialog));
+  gtk_widget_destroy (import_info_dialog);
+
+  if (success)
+    gtk_widget_destroy (GTK_WIDGET (dialog));
+  else
+    gtk_widget_set_sensitive (GTK_WIDGET (dialog), TRUE);
+
+  g_object_unref (dialog);
+}
+
+static void
+dialog_history_import_cb (GtkDialog   *dialog,
+                          int          response,
+                          GtkComboBox *combo_box)
+{
+  EphyHistoryService *service;
+  GtkTreeIter iter;
+  int source;
+  char *filename = NULL;
+
+  if (response != GTK_RESPONSE_OK) {
+    gtk_widget_destroy (GTK_WIDGET (dialog));
+    return;
+  }
+
+  if (!gtk_combo_box_get_active_iter (combo_box, &iter))
+    return;
+
+  gtk_tree_model_get (gtk_combo_box_get_model (combo_box), &iter,
+                      HISTORY_SOURCE_TYPE_COL, &source,
+                      HISTORY_SOURCE_FILE_COL, &filename,
+                      -1);
+
+  if (source == EPHY_HISTORY_IMPORT_FIREFOX) {
+    GSList *profiles;
+    gchar *profile = NULL;
+
+    profiles = get_firefox_profiles ();
+    if (g_slist_length (profiles) == 1)
+      profile = g_strdup (profiles->data);
+    else if (profiles)
+      profile = show_profile_selector (GTK_WIDGET (dialog), profiles);
+    g_slist_free (profiles);
+
+    /* No import takes place if the user didn't select a profile. */
+    if (!profile)
+      return;
+
+    filename = g_build_filename (g_get_home_dir (),
+                                 FIREFOX_PROFILES_DIR,
+                                 profile,
+                                 FIREFOX_BOOKMARKS_FILE,
+                                 NULL);
+    g_free (profile);
+  }
+
+  service = EPHY_HISTORY_SERVICE (ephy_embed_shell_get_global_history_service (EPHY_EMBED_SHELL (ephy_shell_get_default ())));
+
+  gtk_widget_set_sensitive (GTK_WIDGET (dialog), FALSE);
+  ephy_history_service_import (service, source, filename, NULL, NULL,
+                               (EphyHistoryJobCallback)history_imported_cb,
+                               g_object_ref (dialog));
+  g_free (filename);
+}
+
+void
+window_cmd_import_history (GSimpleAction *action,
+                           GVariant      *parameter,
+                           gpointer       user_data)
+{
+  EphyWindow *window = EPHY_WINDOW (user_data);
+  GtkWidget *dialog;
+  GtkWidget *content_area;
+  GtkWidget *hbox;
+  GtkWidget *label;
+  GtkWidget *combo_box;
+  GtkTreeModel *tree_model;
+  GtkCellRenderer *cell_renderer;
+
+  tree_model = create_history_sources_model ();
+  if (gtk_tree_model_iter_n_children (tree_model, NULL) == 0) {
+    GtkWidget *info_dialog;
+
+    info_dialog = gtk_message_dialog_new (GTK_WINDOW (window),
+                                          GTK_DIALOG_MODAL,
+                                          GTK_MESSAGE_INFO,
+                                          GTK_BUTTONS_OK,
+                                          "%s",
+                                          _("No history of another browser was found."));
+    gtk_dialog_run (GTK_DIALOG (info_dialog));
+    gtk_widget_destroy (info_dialog);
+    g_object_unref (tree_model);
+    return;
+  }
+
+  dialog = gtk_dialog_new_with_buttons (_("Import History"),
+                                        GTK_WINDOW (window),
+                                        GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_USE_HEADER_BAR,
+                                        _("_Cancel"),
+                                        GTK_RESPONSE_CANCEL,
+                                        _("I_mport"),
+                                        GTK_RESPONSE_OK,
+                                        NULL);
+  gtk_dialog_set_default_response (GTK_DIALOG (dialog), GTK_RESPONSE_OK);
+
+  content_area = gtk_dialog_get_content_area (GTK_DIALOG (dialog));
+  gtk_widget_set_valign (content_area, GTK_ALIGN_CENTER);
+  gtk_widget_set_margin_start (content_area, 25);
+  gtk_widget_set_margin_end (content_area, 25);
+  gtk_container_set_border_width (GTK_CONTAINER (content_area), 5);
+
+  hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 12);
+
+  label = gtk_label_new (_("From:"));
+  gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
+
+  combo_box = gtk_combo_box_new_with_model (tree_model);
+  g_object_unref (tree_model);
+  gtk_combo_box_set_active (GTK_COMBO_BOX (combo_box), 0);
+
+  cell_renderer = gtk_cell_renderer_text_new ();
+  gtk_cell_layout_pack_start (GTK_CELL_LAYOUT (combo_box), cell_renderer, TRUE);
+  gtk_cell_layout_set_attributes (GTK_CELL_LAYOUT (combo_box), cell_renderer,
+                                  "text", HISTORY_SOURCE_NAME_COL, NULL);
+  gtk_box_pack_start (GTK_BOX (hbox), combo_box, TRUE, TRUE, 0);
+
+  gtk_container_add (GTK_CONTAINER (content_area), hbox);
+
+  g_signal_connect (dialog, "response",
+                    G_CALLBACK (dialog_history_import_cb),
+                    GTK_COMBO_BOX (combo_box));
+
+  gtk_widget_show_all (dialog);
+}
+
 void
 window_cmd_export_bookmarks (GSimpleAction *action,
                              GVariant      *parameter,
@@ -0,0 +1,302 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-adblock-matcher.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <string.h>
+
+/* Path to a local EasyList snapshot used by the benchmark, e.g. a copy of
+ * https://easylist.to/easylist/easylist.txt */
+#define BENCHMARK_FILTERS_ENV "EPHY_ADBLOCK_BENCHMARK_FILTERS"
+#define BENCHMARK_ITERATIONS 2000
+
+typedef struct {
+  const char *filter;
+  const char *request_uri;
+  const char *page_uri;
+  EphyAdblockResourceType type;
+  gboolean blocked;
+} MatchTest;
+
+#define ANY EPHY_ADBLOCK_RESOURCE_ANY
+
+static const MatchTest match_tests[] = {
+  { "/banner/", "http://example.com/banner/ad.png", NULL, ANY, TRUE },
+  { "/banner/", "http://example.com/banners/ad.png", NULL, ANY, FALSE },
+  { "/ads/*.js", "http://example.com/ads/foo/bar.js", NULL, ANY, TRUE },
+  { "/ads/*.js", "http://example.com/ads/foo/bar.css", NULL, ANY, FALSE },
+  { "||ads.example.com^", "https://ads.example.com/x.js", NULL, ANY, TRUE },
+  { "||ads.example.com^", "https://cdn.ads.example.com/x.js", NULL, ANY, TRUE },
+  { "||ads.example.com^", "https://ads.example.com.evil.net/x.js", NULL, ANY, FALSE },
+  { "||ads.example.com^", "https://notads.example.com/x.js", NULL, ANY, FALSE },
+  { "||ads.example.com^", "https://example.org/?ads.example.com", NULL, ANY, FALSE },
+  { "|http://track.", "http://track.example.com/", NULL, ANY, TRUE },
+  { "|http://track.", "https://www.example.com/http://track.", NULL, ANY, FALSE },
+  { ".swf|", "http://example.com/movie.swf", NULL, ANY, TRUE },
+  { ".swf|", "http://example.com/movie.swf?autoplay=1", NULL, ANY, FALSE },
+  { "&ad_type=", "http://example.com/show?foo=1&AD_TYPE=banner", NULL, ANY, TRUE },
+  { "/^https?:\\/\\/[a-z]+\\.adserver\\.[a-z]+\\//", "http://foo.adserver.net/x", NULL, ANY, TRUE },
+  { "/^https?:\\/\\/[a-z]+\\.adserver\\.[a-z]+\\//", "http://foo.example.net/adserver/", NULL, ANY, FALSE },
+  { "||cdn.example.com/ads/$third-party", "http://cdn.example.com/ads/a.png", "http://example.org/", ANY, TRUE },
+  { "||cdn.example.com/ads/$third-party", "http://cdn.example.com/ads/a.png", "http://cdn.example.com/ads/", ANY, FALSE },
+  { "||example.com/frame.html$subdocument", "http://example.com/frame.html", NULL, EPHY_ADBLOCK_RESOURCE_SUBDOCUMENT, TRUE },
+  { "||example.com/frame.html$subdocument", "http://example.com/frame.html", NULL, EPHY_ADBLOCK_RESOURCE_IMAGE, FALSE },
+  { "/track.js$script,~third-party", "http://example.com/track.js", "http://www.example.com/", EPHY_ADBLOCK_RESOURCE_SCRIPT, TRUE },
+  { "/track.js$script,~third-party", "http://example.com/track.js", "http://example.org/", EPHY_ADBLOCK_RESOURCE_SCRIPT, FALSE },
+  { "/track.js$~script", "http://example.com/track.js", NULL, EPHY_ADBLOCK_RESOURCE_SCRIPT, FALSE },
+  { "/track.js$~script", "http://example.com/track.js", NULL, EPHY_ADBLOCK_RESOURCE_IMAGE, TRUE },
+  { "||ads.example.net^$third-party", "http://ads.example.net/x.js", "http://www.example.co.uk/", ANY, TRUE },
+  { "||ads.example.net^$third-party", "http://ads.example.net/x.js", "http://www.example.net/", ANY, FALSE },
+  { "/promo/$domain=example.com|~shop.example.com", "http://cdn.net/promo/a.png", "http://www.example.com/", ANY, TRUE },
+  { "/promo/$domain=example.com|~shop.example.com", "http://cdn.net/promo/a.png", "http://shop.example.com/", ANY, FALSE },
+  { "/promo/$domain=example.com|~shop.example.com", "http://cdn.net/promo/a.png", "http://example.org/", ANY, FALSE },
+  { "/promo/$domain=~example.com", "http://cdn.net/promo/a.png", "http://example.org/", ANY, TRUE },
+  { "/promo/$domain=~example.com", "http://cdn.net/promo/a.png", "http://notexample.com/", ANY, TRUE },
+  { "/promo/$domain=~example.com", "http://cdn.net/promo/a.png", "http://www.example.com/", ANY, FALSE },
+  { "/popup/$popup", "http://example.com/popup/", NULL, ANY, FALSE },
+  { "example.com##.ad", "http://example.com/", NULL, ANY, FALSE },
+  { "! /comment/", "http://example.com/comment/", NULL, ANY, FALSE },
+};
+
+static void
+test_ephy_adblock_matcher_match (void)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (match_tests); i++) {
+    EphyAdblockMatcher *matcher;
+    MatchTest test = match_tests[i];
+
+    matcher = ephy_adblock_matcher_new ();
+    ephy_adblock_matcher_add_filter (matcher, test.filter);
+
+    if (ephy_adblock_matcher_match (matcher, test.request_uri, test.page_uri, test.type, FALSE) != test.blocked)
+      g_error ("Filter %s, request %s: expected %s", test.filter, test.request_uri,
+               test.blocked ? "blocked" : "not blocked");
+    g_assert (!ephy_adblock_matcher_match (matcher, test.request_uri, test.page_uri, test.type, TRUE));
+
+    ephy_adblock_matcher_free (matcher);
+  }
+}
+
+static void
+test_ephy_adblock_matcher_whitelist (void)
+{
+  EphyAdblockMatcher *matcher;
+
+  matcher = ephy_adblock_matcher_new ();
+  g_assert (ephy_adblock_matcher_add_filter (matcher, "||example.com/ads/"));
+  g_assert (ephy_adblock_matcher_add_filter (matcher, "@@||example.com/ads/allowed.js"));
+  g_assert_cmpuint (ephy_adblock_matcher_get_n_rules (matcher), ==, 2);
+
+  g_assert (ephy_adblock_matcher_match (matcher, "http://example.com/ads/allowed.js", NULL, ANY, FALSE));
+  g_assert (ephy_adblock_matcher_match (matcher, "http://example.com/ads/allowed.js", NULL, ANY, TRUE));
+  g_assert (ephy_adblock_matcher_match (matcher, "http://example.com/ads/other.js", NULL, ANY, FALSE));
+  g_assert (!ephy_adblock_matcher_match (matcher, "http://example.com/ads/other.js", NULL, ANY, TRUE));
+
+  ephy_adblock_matcher_free (matcher);
+}
+
+static void
+test_ephy_adblock_matcher_many_rules (void)
+{
+  EphyAdblockMatcher *matcher;
+
+  /* Rules sharing tokens must all be reachable through the index. */
+  matcher = ephy_adblock_matcher_new ();
+  for (guint i = 0; i < 1000; i++) {
+    char *filter = g_strdup_printf ("||ads%u.example.com/banner/*.gif", i);
+    g_assert (ephy_adblock_matcher_add_filter (matcher, filter));
+    g_free (filter);
+  }
+
+  for (guint i = 0; i < 1000; i += 37) {
+    char *uri = g_strdup_printf ("http://ads%u.example.com/banner/a/b.gif", i);
+    g_assert (ephy_adblock_matcher_match (matcher, uri, NULL, ANY, FALSE));
+    g_free (uri);
+  }
+  g_assert (!ephy_adblock_matcher_match (matcher, "http://ads1000.example.com/banner/a.gif", NULL, ANY, FALSE));
+
+  /* Generic substring rules are indexed under one of their own tokens,
+   * here the unique one rather than the one they all share. */
+  for (guint i = 0; i < 1000; i++) {
+    char *filter = g_strdup_printf ("/adtrack%u/pixel.", i);
+    g_assert (ephy_adblock_matcher_add_filter (matcher, filter));
+    g_free (filter);
+  }
+
+  for (guint i = 0; i < 1000; i += 37) {
+    char *uri = g_strdup_printf ("http://cdn.example.org/adtrack%u/pixel.gif", i);
+    g_assert (ephy_adblock_matcher_match (matcher, uri, NULL, ANY, FALSE));
+    g_free (uri);
+  }
+  g_assert (!ephy_adblock_matcher_match (matcher, "http://cdn.example.org/adtrack1000/pixel.gif", NULL, ANY, FALSE));
+  g_assert (!ephy_adblock_matcher_match (matcher, "http://cdn.example.org/xadtrack37/pixel.gif", NULL, ANY, FALSE));
+  g_assert (!ephy_adblock_matcher_match (matcher, "http://cdn.example.org/adtrack37/image.gif", NULL, ANY, FALSE));
+
+  ephy_adblock_matcher_free (matcher);
+}
+
+static void
+test_ephy_adblock_matcher_snapshot (void)
+{
+  EphyAdblockMatcher *matcher;
+  const char * const filters[] = { "https://example.com/filters.txt", NULL };
+  const char * const other_filters[] = { "https://example.com/other.txt", NULL };
+  char *tmpdir;
+  char *filename;
+  GError *error = NULL;
+
+  tmpdir = g_dir_make_tmp ("ephy-adblock-matcher-test-XXXXXX", &error);
+  g_assert_no_error (error);
+  filename = g_build_filename (tmpdir, "adblock-filters.gvdb", NULL);
+
+  matcher = ephy_adblock_matcher_new ();
+  for (guint i = 0; i < G_N_ELEMENTS (match_tests); i++)
+    ephy_adblock_matcher_add_filter (matcher, match_tests[i].filter);
+  g_assert (ephy_adblock_matcher_add_filter (matcher, "@@||ads.example.com/allowed/"));
+  ephy_adblock_matcher_save (matcher, filters, filename, &error);
+  g_assert_no_error (error);
+  ephy_adblock_matcher_free (matcher);
+
+  /* A snapshot compiled from a different filter list must be rejected. */
+  matcher = ephy_adblock_matcher_new_from_file (filename, other_filters, &error);
+  g_assert_null (matcher);
+  g_assert_nonnull (error);
+  g_clear_error (&error);
+
+  matcher = ephy_adblock_matcher_new_from_file (filename, filters, &error);
+  g_assert_no_error (error);
+
+  /* Every filter was added to the same matcher, so only check blocked URIs. */
+  for (guint i = 0; i < G_N_ELEMENTS (match_tests); i++) {
+    if (match_tests[i].blocked)
+      g_assert (ephy_adblock_matcher_match (matcher, match_tests[i].request_uri, match_tests[i].page_uri,
+                                            match_tests[i].type, FALSE));
+  }
+  g_assert (ephy_adblock_matcher_match (matcher, "https://ads.example.com/allowed/x.js", NULL, ANY, TRUE));
+  g_assert (!ephy_adblock_matcher_match (matcher, "https://ads.example.com/x.js", NULL, ANY, TRUE));
+
+  ephy_adblock_matcher_free (matcher);
+  g_unlink (filename);
+  g_rmdir (tmpdir);
+  g_free (filename);
+  g_free (tmpdir);
+}
+
+static const char *benchmark_uris[] = {
+  "https://www.example.com/",
+  "https://www.example.com/static/css/main.css",
+  "https://www.example.com/static/js/app.min.js?v=20170301",
+  "https://cdn.example.net/images/logo@2x.png",
+  "https://fonts.googleapis.com/css?family=Open+Sans:400,700",
+  "https://ajax.googleapis.com/ajax/libs/jquery/3.1.1/jquery.min.js",
+  "https://www.google-analytics.com/analytics.js",
+  "https://securepubads.g.doubleclick.net/gpt/pubads_impl_118.js",
+  "https://pagead2.googlesyndication.com/pagead/js/adsbygoogle.js",
+  "https://connect.facebook.net/en_US/sdk.js#xfbml=1&version=v2.8",
+  "https://platform.twitter.com/widgets.js",
+  "https://static.example.org/ads/banner_728x90.gif",
+  "https://news.example.org/2017/03/01/some-article-title.html",
+  "https://news.example.org/api/comments?article=123456&page=2",
+  "https://img.example.org/thumbs/300x250/123456.jpg",
+  "https://tracker.example.com/pixel.gif?uid=abcdef&ref=https%3A%2F%2Fexample.com",
+  "https://video.example.com/player/embed.swf",
+  "https://www.example.com/wp-content/plugins/some-plugin/script.js",
+  "https://s.example.com/beacon?event=pageview&ts=1488326400",
+  "https://a.example.net/adserver/serve?zone=42&size=160x600",
+};
+
+static void
+test_ephy_adblock_matcher_benchmark (void)
+{
+  EphyAdblockMatcher *matcher;
+  const char *filters_path;
+  char *contents;
+  char **lines;
+  GTimer *timer;
+  GError *error = NULL;
+  double elapsed;
+  guint n_requests;
+  guint n_blocked = 0;
+
+  filters_path = g_getenv (BENCHMARK_FILTERS_ENV);
+  if (!filters_path) {
+    g_test_skip ("Set " BENCHMARK_FILTERS_ENV " to the path of an EasyList snapshot");
+    return;
+  }
+
+  if (!g_file_get_contents (filters_path, &contents, NULL, &error))
+    g_error ("Failed to read %s: %s", filters_path, error->message);
+
+  timer = g_timer_new ();
+  matcher = ephy_adblock_matcher_new ();
+  lines = g_strsplit (contents, "\n", -1);
+  for (guint i = 0; lines[i]; i++)
+    ephy_adblock_matcher_add_filter (matcher, g_strchomp (lines[i]));
+  g_strfreev (lines);
+  g_free (contents);
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_test_message ("Compiled %u rules in %.1f ms", ephy_adblock_matcher_get_n_rules (matcher), elapsed * 1000);
+
+  g_timer_start (timer);
+  for (guint i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    for (guint j = 0; j < G_N_ELEMENTS (benchmark_uris); j++) {
+      if (!ephy_adblock_matcher_match (matcher, benchmark_uris[j], benchmark_uris[0], ANY, TRUE) &&
+          ephy_adblock_matcher_match (matcher, benchmark_uris[j], benchmark_uris[0], ANY, FALSE))
+        n_blocked++;
+    }
+  }
+  elapsed = g_timer_elapsed (timer, NULL);
+  n_requests = BENCHMARK_ITERATIONS * G_N_ELEMENTS (benchmark_uris);
+
+  g_test_message ("%u of %u requests blocked", n_blocked / BENCHMARK_ITERATIONS,
+                  (guint)G_N_ELEMENTS (benchmark_uris));
+  g_test_minimized_result (elapsed * G_USEC_PER_SEC / n_requests,
+                           "Matched a request in %.2f µs on average",
+                           elapsed * G_USEC_PER_SEC / n_requests);
+
+  g_timer_destroy (timer);
+  ephy_adblock_matcher_free (matcher);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gtk_test_init (&argc, &argv);
+
+  g_test_add_func ("/lib/ephy-adblock-matcher/match",
+                   test_ephy_adblock_matcher_match);
+  g_test_add_func ("/lib/ephy-adblock-matcher/whitelist",
+                   test_ephy_adblock_matcher_whitelist);
+  g_test_add_func ("/lib/ephy-adblock-matcher/many_rules",
+                   test_ephy_adblock_matcher_many_rules);
+  g_test_add_func ("/lib/ephy-adblock-matcher/snapshot",
+                   test_ephy_adblock_matcher_snapshot);
+
+  if (g_test_perf ())
+    g_test_add_func ("/lib/ephy-adblock-matcher/benchmark",
+                     test_ephy_adblock_matcher_benchmark);
+
+  return g_test_run ();
+}
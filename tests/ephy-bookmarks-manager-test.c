@@ -0,0 +1,559 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-bookmarks-manager.h"
+
+#include "ephy-bookmarks-list-model.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MERGE_N_RECORDS 10000
+
+static char *
+get_bookmarks_filename (const char *suffix)
+{
+  return g_strconcat (ephy_dot_dir (), G_DIR_SEPARATOR_S, "bookmarks.gvdb", suffix, NULL);
+}
+
+static EphyBookmarksManager *
+create_empty_manager (void)
+{
+  const char *suffixes[] = { "", ".journal", ".journal.old" };
+  char *filename;
+
+  for (guint i = 0; i < G_N_ELEMENTS (suffixes); i++) {
+    filename = get_bookmarks_filename (suffixes[i]);
+    g_unlink (filename);
+    g_free (filename);
+  }
+
+  return ephy_bookmarks_manager_new ();
+}
+
+/* A compaction keeps the manager alive until its thread is done writing the
+ * files, so wait for the manager to be finalized before touching them. */
+static void
+destroy_manager (EphyBookmarksManager *manager)
+{
+  g_object_add_weak_pointer (G_OBJECT (manager), (gpointer *)&manager);
+  g_object_unref (manager);
+
+  while (manager)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+saved_cb (EphyBookmarksManager *manager,
+          GAsyncResult         *result,
+          gboolean             *saved)
+{
+  GError *error = NULL;
+
+  g_assert (ephy_bookmarks_manager_save_to_file_finish (manager, result, &error));
+  g_assert_no_error (error);
+  *saved = TRUE;
+}
+
+static void
+save_and_wait (EphyBookmarksManager *manager)
+{
+  gboolean saved = FALSE;
+
+  ephy_bookmarks_manager_save_to_file_async (manager, NULL, (GAsyncReadyCallback)saved_cb, &saved);
+  while (!saved)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static EphyBookmark *
+create_bookmark (const char *id,
+                 const char *url,
+                 gint64      time_added,
+                 double      modified,
+                 const char *tag)
+{
+  EphyBookmark *bookmark;
+
+  bookmark = ephy_bookmark_new (url, url, g_sequence_new (g_free));
+  ephy_bookmark_set_id (bookmark, id);
+  ephy_bookmark_set_time_added (bookmark, time_added);
+  ephy_bookmark_set_modification_time (bookmark, modified);
+  if (tag)
+    ephy_bookmark_add_tag (bookmark, tag);
+
+  return bookmark;
+}
+
+static gboolean
+array_contains (GPtrArray    *array,
+                EphyBookmark *bookmark)
+{
+  for (guint i = 0; i < array->len; i++) {
+    if (g_ptr_array_index (array, i) == bookmark)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+test_merge_remote_bookmarks (void)
+{
+  EphyBookmarksManager *manager = create_empty_manager ();
+  GSequence *locals = g_sequence_new (g_object_unref);
+  GPtrArray *remotes = g_ptr_array_new_with_free_func (g_object_unref);
+  GPtrArray *to_upload;
+  EphyBookmark *older = create_bookmark ("older", "http://older.com/", 1, 10, NULL);
+  EphyBookmark *newer = create_bookmark ("newer", "http://newer.com/", 2, 30, NULL);
+  EphyBookmark *same_url = create_bookmark ("local-id", "http://same-url.com/", 3, 0, NULL);
+  EphyBookmark *local_only = create_bookmark ("local-only", "http://local-only.com/", 4, 0, NULL);
+  EphyBookmark *remote_older;
+
+  g_sequence_append (locals, g_object_ref (older));
+  g_sequence_append (locals, g_object_ref (newer));
+  g_sequence_append (locals, g_object_ref (same_url));
+  g_sequence_append (locals, g_object_ref (local_only));
+  ephy_bookmarks_manager_add_bookmarks (manager, locals);
+
+  remote_older = create_bookmark ("older", "http://older.com/moved", 5, 20, "Remote");
+  g_ptr_array_add (remotes, remote_older);
+  g_ptr_array_add (remotes, create_bookmark ("newer", "http://newer.com/", 6, 25, NULL));
+  g_ptr_array_add (remotes, create_bookmark ("remote-id", "http://same-url.com/", 7, 5, "Merged"));
+  g_ptr_array_add (remotes, create_bookmark ("remote-only", "http://remote-only.com/", 8, 5, "Remote"));
+
+  to_upload = ephy_bookmarks_manager_merge_remote_bookmarks (manager, remotes);
+
+  /* The remote copy wins when it is more recent. */
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_id (manager, "older") == remote_older);
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_url (manager, "http://older.com/") == NULL);
+
+  /* The local copy wins, and goes to the server, when it is more recent. */
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_id (manager, "newer") == newer);
+  g_assert (array_contains (to_upload, newer));
+
+  /* A URL match adopts the remote id and tags. */
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_id (manager, "remote-id") == same_url);
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_id (manager, "local-id") == NULL);
+  g_assert (ephy_bookmark_has_tag (same_url, "Merged"));
+  g_assert (ephy_bookmarks_manager_tag_exists (manager, "Merged"));
+  g_assert (array_contains (to_upload, same_url));
+
+  /* Bookmarks on one side only end up on both. */
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_url (manager, "http://remote-only.com/") != NULL);
+  g_assert (ephy_bookmarks_manager_tag_exists (manager, "Remote"));
+  g_assert (array_contains (to_upload, local_only));
+
+  g_assert_cmpuint (to_upload->len, ==, 3);
+  g_assert_cmpint (g_sequence_get_length (ephy_bookmarks_manager_get_bookmarks (manager)), ==, 5);
+
+  g_ptr_array_unref (to_upload);
+  g_ptr_array_unref (remotes);
+  g_sequence_free (locals);
+  g_object_unref (older);
+  g_object_unref (newer);
+  g_object_unref (same_url);
+  g_object_unref (local_only);
+  destroy_manager (manager);
+}
+
+/* Merges @n_records remote records into as many local bookmarks. A quarter of
+ * the records match by id, a quarter by URL and the rest are new on both
+ * sides. Returns the time the merge took. */
+static double
+merge_synthetic_records (guint n_records)
+{
+  EphyBookmarksManager *manager = create_empty_manager ();
+  GSequence *locals = g_sequence_new (g_object_unref);
+  GPtrArray *remotes = g_ptr_array_new_with_free_func (g_object_unref);
+  GPtrArray *to_upload;
+  GSequence *synced;
+  double elapsed;
+
+  for (guint i = 0; i < n_records; i++) {
+    char *id = g_strdup_printf ("local-%u", i);
+    char *url = g_strdup_printf ("http://local.example.com/%u", i);
+
+    g_sequence_append (locals, create_bookmark (id, url, i + 1, 10, NULL));
+
+    g_free (id);
+    g_free (url);
+  }
+  ephy_bookmarks_manager_add_bookmarks (manager, locals);
+
+  for (guint i = 0; i < n_records; i++) {
+    char *id;
+    char *url;
+
+    if (i < n_records / 4) {
+      id = g_strdup_printf ("local-%u", i);
+      url = g_strdup_printf ("http://local.example.com/%u", i);
+    } else if (i < n_records / 2) {
+      id = g_strdup_printf ("remote-%u", i);
+      url = g_strdup_printf ("http://local.example.com/%u", i);
+    } else {
+      id = g_strdup_printf ("remote-%u", i);
+      url = g_strdup_printf ("http://remote.example.com/%u", i);
+    }
+
+    g_ptr_array_add (remotes, create_bookmark (id, url, n_records + i + 1, 20, "Synced"));
+
+    g_free (id);
+    g_free (url);
+  }
+
+  g_test_timer_start ();
+  to_upload = ephy_bookmarks_manager_merge_remote_bookmarks (manager, remotes);
+  elapsed = g_test_timer_elapsed ();
+
+  /* Every record matching by id replaced its local copy, the URL matches and
+   * the local only bookmarks go up, the rest came down. */
+  g_assert_cmpuint (to_upload->len, ==, n_records - n_records / 4);
+  g_assert_cmpint (g_sequence_get_length (ephy_bookmarks_manager_get_bookmarks (manager)),
+                   ==, n_records + (n_records - n_records / 2));
+  synced = ephy_bookmarks_manager_get_bookmarks_with_tag (manager, "Synced");
+  g_assert_cmpint (g_sequence_get_length (synced), ==, n_records);
+  g_sequence_free (synced);
+
+  g_ptr_array_unref (to_upload);
+  g_ptr_array_unref (remotes);
+  g_sequence_free (locals);
+
+  /* Saving this many bookmarks compacts the journal in a thread, which must
+   * be done before the next test removes the files. */
+  destroy_manager (manager);
+
+  return elapsed;
+}
+
+static void
+test_merge_many_remote_bookmarks (void)
+{
+  double small;
+  double large;
+
+  small = merge_synthetic_records (MERGE_N_RECORDS);
+  g_test_minimized_result (small, "Merged %u records in %.3f s", MERGE_N_RECORDS, small);
+
+  /* Timings depend too much on the machine to be asserted, so the scaling
+   * is only reported, and only when asked for. */
+  if (g_test_perf ()) {
+    large = merge_synthetic_records (2 * MERGE_N_RECORDS);
+    g_test_minimized_result (large, "Merged %u records in %.3f s", 2 * MERGE_N_RECORDS, large);
+    g_test_message ("Doubling the records took %.1f times as long", large / small);
+  }
+}
+
+static void
+count_created_tag_cb (EphyBookmarksManager *manager,
+                      const char           *tag,
+                      guint                *n_created)
+{
+  (*n_created)++;
+}
+
+static void
+test_create_tags (void)
+{
+  EphyBookmarksManager *manager;
+  const char * const tags[] = { "Work", "GNOME", "Work", "Apps", NULL };
+  GSequence *all_tags;
+  guint n_tags;
+  guint n_created = 0;
+
+  manager = create_empty_manager ();
+  ephy_bookmarks_manager_create_tag (manager, "GNOME");
+  n_tags = g_sequence_get_length (ephy_bookmarks_manager_get_tags (manager));
+
+  g_signal_connect (manager, "tag-created",
+                    G_CALLBACK (count_created_tag_cb), &n_created);
+  ephy_bookmarks_manager_create_tags (manager, tags);
+
+  /* Existing and repeated tags are only created once. */
+  g_assert_cmpuint (n_created, ==, 2);
+
+  all_tags = ephy_bookmarks_manager_get_tags (manager);
+  g_assert_cmpint (g_sequence_get_length (all_tags), ==, n_tags + 2);
+  g_assert (ephy_bookmarks_manager_tag_exists (manager, "Apps"));
+  g_assert (ephy_bookmarks_manager_tag_exists (manager, "GNOME"));
+  g_assert (ephy_bookmarks_manager_tag_exists (manager, "Work"));
+
+  destroy_manager (manager);
+}
+
+typedef struct {
+  guint position;
+  guint removed;
+  guint added;
+} ItemsChange;
+
+static void
+record_items_changed_cb (GListModel  *model,
+                         guint        position,
+                         guint        removed,
+                         guint        added,
+                         ItemsChange *change)
+{
+  change->position = position;
+  change->removed = removed;
+  change->added = added;
+}
+
+static void
+assert_bookmark_at (EphyBookmarksListModel *model,
+                    guint                   position,
+                    const char             *url)
+{
+  EphyBookmark *bookmark = g_list_model_get_item (G_LIST_MODEL (model), position);
+
+  g_assert_cmpstr (ephy_bookmark_get_url (bookmark), ==, url);
+  g_object_unref (bookmark);
+}
+
+static void
+test_list_model (void)
+{
+  EphyBookmarksManager *manager;
+  EphyBookmarksListModel *model;
+  EphyBookmark *middle;
+  ItemsChange change = { 0, 0, 0 };
+
+  manager = create_empty_manager ();
+  ephy_bookmarks_manager_add_bookmark (manager, create_bookmark ("aaaaaaaaaaaa", "https://gnome.org/", 100, 0, NULL));
+
+  model = ephy_bookmarks_list_model_new (manager);
+  g_signal_connect (model, "items-changed",
+                    G_CALLBACK (record_items_changed_cb), &change);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (model)), ==, 1);
+
+  ephy_bookmarks_manager_add_bookmark (manager, create_bookmark ("bbbbbbbbbbbb", "https://wiki.gnome.org/", 300, 0, NULL));
+  g_assert_cmpuint (change.position, ==, 0);
+  g_assert_cmpuint (change.removed, ==, 0);
+  g_assert_cmpuint (change.added, ==, 1);
+
+  /* Most recently added first, each addition reported as one row. */
+  middle = create_bookmark ("cccccccccccc", "https://planet.gnome.org/", 200, 0, NULL);
+  ephy_bookmarks_manager_add_bookmark (manager, middle);
+  g_assert_cmpuint (change.position, ==, 1);
+  g_assert_cmpuint (change.removed, ==, 0);
+  g_assert_cmpuint (change.added, ==, 1);
+
+  assert_bookmark_at (model, 0, "https://wiki.gnome.org/");
+  assert_bookmark_at (model, 1, "https://planet.gnome.org/");
+  assert_bookmark_at (model, 2, "https://gnome.org/");
+
+  /* Smart bookmarks are not listed. */
+  change.added = 0;
+  ephy_bookmarks_manager_add_bookmark (manager, create_bookmark ("dddddddddddd", "https://duckduckgo.com/?q=%s", 400, 0, NULL));
+  g_assert_cmpuint (change.added, ==, 0);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (model)), ==, 3);
+
+  ephy_bookmarks_manager_remove_bookmark (manager, middle);
+  g_assert_cmpuint (change.position, ==, 1);
+  g_assert_cmpuint (change.removed, ==, 1);
+  g_assert_cmpuint (change.added, ==, 0);
+  assert_bookmark_at (model, 1, "https://gnome.org/");
+
+  g_object_unref (model);
+  destroy_manager (manager);
+}
+
+/* Writes a journal with every kind of record: bookmarks put and removed,
+ * and tags added and removed. */
+static void
+write_journal (void)
+{
+  EphyBookmarksManager *manager = create_empty_manager ();
+  EphyBookmark *removed;
+
+  ephy_bookmarks_manager_create_tag (manager, "Work");
+  ephy_bookmarks_manager_create_tag (manager, "Deleted");
+  ephy_bookmarks_manager_add_bookmark (manager, create_bookmark ("kept", "https://gnome.org/", 1, 0, "Work"));
+  removed = create_bookmark ("removed", "https://removed.org/", 2, 0, NULL);
+  ephy_bookmarks_manager_add_bookmark (manager, removed);
+  save_and_wait (manager);
+
+  ephy_bookmarks_manager_remove_bookmark (manager, removed);
+  ephy_bookmarks_manager_delete_tag (manager, "Deleted");
+  save_and_wait (manager);
+
+  destroy_manager (manager);
+}
+
+static void
+assert_journal_replayed (EphyBookmarksManager *manager)
+{
+  EphyBookmark *bookmark;
+
+  bookmark = ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://gnome.org/");
+  g_assert (bookmark);
+  g_assert_cmpstr (ephy_bookmark_get_id (bookmark), ==, "kept");
+  g_assert (ephy_bookmark_has_tag (bookmark, "Work"));
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://removed.org/") == NULL);
+  g_assert (ephy_bookmarks_manager_tag_exists (manager, "Work"));
+  g_assert (!ephy_bookmarks_manager_tag_exists (manager, "Deleted"));
+}
+
+static void
+test_journal_replay (void)
+{
+  EphyBookmarksManager *manager;
+  char *filename;
+
+  write_journal ();
+
+  /* Nothing was compacted, so the changes are only in the journal. */
+  filename = get_bookmarks_filename (".journal");
+  g_assert (g_file_test (filename, G_FILE_TEST_IS_REGULAR));
+  g_free (filename);
+
+  manager = ephy_bookmarks_manager_new ();
+  assert_journal_replayed (manager);
+  destroy_manager (manager);
+}
+
+static void
+test_journal_truncated_record (void)
+{
+  EphyBookmarksManager *manager;
+  char *filename;
+  FILE *file;
+
+  write_journal ();
+
+  /* A record cut short by a crash while it was being appended. */
+  filename = get_bookmarks_filename (".journal");
+  file = fopen (filename, "ab");
+  g_assert (file);
+  fwrite ("\xff\x00\x00\x00partial", 1, 11, file);
+  fclose (file);
+  g_free (filename);
+
+  g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "Discarding truncated record*");
+  manager = ephy_bookmarks_manager_new ();
+  g_test_assert_expected_messages ();
+  assert_journal_replayed (manager);
+
+  /* Records appended after the truncated one must be readable. */
+  ephy_bookmarks_manager_add_bookmark (manager, create_bookmark ("later", "https://later.org/", 3, 0, NULL));
+  save_and_wait (manager);
+  destroy_manager (manager);
+
+  manager = ephy_bookmarks_manager_new ();
+  assert_journal_replayed (manager);
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://later.org/"));
+  destroy_manager (manager);
+}
+
+static void
+test_journal_interrupted_compaction (void)
+{
+  EphyBookmarksManager *manager;
+  EphyBookmark *bookmark;
+  char *journal_filename;
+  char *old_journal_filename;
+  char *first;
+  char *contents;
+  gsize first_length;
+  gsize length;
+
+  journal_filename = get_bookmarks_filename (".journal");
+  old_journal_filename = get_bookmarks_filename (".journal.old");
+
+  manager = create_empty_manager ();
+  bookmark = create_bookmark ("moved", "https://gnome.org/", 1, 0, NULL);
+  ephy_bookmarks_manager_add_bookmark (manager, bookmark);
+  save_and_wait (manager);
+  g_assert (g_file_get_contents (journal_filename, &first, &first_length, NULL));
+
+  ephy_bookmarks_manager_remove_bookmark (manager, bookmark);
+  ephy_bookmarks_manager_add_bookmark (manager, create_bookmark ("moved", "https://gnome.org/moved", 2, 0, NULL));
+  save_and_wait (manager);
+  destroy_manager (manager);
+
+  /* A crash after a compaction moved the journal aside but before it wrote
+   * the GVDB file, with more changes appended to the new journal since. */
+  g_assert (g_file_get_contents (journal_filename, &contents, &length, NULL));
+  g_assert_cmpuint (length, >, first_length);
+  g_assert (memcmp (contents, first, first_length) == 0);
+  g_assert (g_file_set_contents (old_journal_filename, first, first_length, NULL));
+  g_assert (g_file_set_contents (journal_filename, contents + first_length, length - first_length, NULL));
+  g_free (contents);
+  g_free (first);
+
+  /* Both journals are replayed, oldest first, and compacted again. */
+  manager = ephy_bookmarks_manager_new ();
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://gnome.org/") == NULL);
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://gnome.org/moved"));
+  destroy_manager (manager);
+
+  g_assert (!g_file_test (old_journal_filename, G_FILE_TEST_EXISTS));
+
+  /* Everything is in the GVDB file now. */
+  g_unlink (journal_filename);
+  manager = ephy_bookmarks_manager_new ();
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://gnome.org/") == NULL);
+  g_assert (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://gnome.org/moved"));
+  destroy_manager (manager);
+
+  g_free (journal_filename);
+  g_free (old_journal_filename);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gboolean ret;
+
+  gtk_test_init (&argc, &argv);
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_PRIVATE_PROFILE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-manager/merge_remote_bookmarks",
+                   test_merge_remote_bookmarks);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-manager/merge_many_remote_bookmarks",
+                   test_merge_many_remote_bookmarks);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-manager/create_tags",
+                   test_create_tags);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-manager/list_model",
+                   test_list_model);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-manager/journal_replay",
+                   test_journal_replay);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-manager/journal_truncated_record",
+                   test_journal_truncated_record);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-manager/journal_interrupted_compaction",
+                   test_journal_interrupted_compaction);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
@@ -30,8 +30,7 @@ static void
 test_ephy_completion_model_create (void)
 {
   EphyCompletionModel *model;
-  model = ephy_completion_model_new (EPHY_HISTORY_SERVICE (ephy_embed_shell_get_global_history_service (ephy_embed_shell_get_default ())),
-                                     ephy_shell_get_bookmarks_manager (ephy_shell_get_default ()));
+  model = ephy_completion_model_new (ephy_shell_get_completion_index (ephy_shell_get_default ()));
   g_assert (model);
   g_object_unref (model);
 }
@@ -42,10 +41,8 @@ update_empty_cb (EphyHistoryService *service,
                  gpointer            result_data,
                  GMainLoop          *loop)
 {
-  GList *results = (GList *)result_data;
-
   g_assert (success);
-  g_assert (results == NULL);
+  g_assert (result_data == NULL);
 
   g_main_loop_quit (loop);
 }
@@ -53,11 +50,12 @@ update_empty_cb (EphyHistoryService *service,
 static void
 test_ephy_completion_model_update_empty (void)
 {
+  EphyCompletionIndex *index;
   EphyCompletionModel *model;
   GMainLoop *loop = NULL;
 
-  model = ephy_completion_model_new (EPHY_HISTORY_SERVICE (ephy_embed_shell_get_global_history_service (ephy_embed_shell_get_default ())),
-                                     ephy_shell_get_bookmarks_manager (ephy_shell_get_default ()));
+  index = ephy_shell_get_completion_index (ephy_shell_get_default ());
+  model = ephy_completion_model_new (index);
   g_assert (model);
 
   loop = g_main_loop_new (NULL, FALSE);
@@ -66,12 +64,73 @@ test_ephy_completion_model_update_empty (void)
                                            (EphyHistoryJobCallback)update_empty_cb,
                                            loop);
 
-  g_main_loop_run (loop);
+  /* The update only waits while the history is being indexed. */
+  if (!ephy_completion_index_is_loaded (index))
+    g_main_loop_run (loop);
+
+  g_assert_cmpint (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL), ==, 0);
 
   g_object_unref (model);
   g_main_loop_unref (loop);
 }
 
+static void
+index_loaded_cb (EphyCompletionIndex *index,
+                 GMainLoop           *loop)
+{
+  g_main_loop_quit (loop);
+}
+
+static void
+test_ephy_completion_index_query (void)
+{
+  EphyBookmarksManager *manager;
+  EphyCompletionIndex *index;
+  EphyBookmark *bookmark;
+  EphyCompletionMatch *match;
+  GSequence *tags;
+  GPtrArray *matches;
+  GMainLoop *loop;
+
+  manager = ephy_shell_get_bookmarks_manager (ephy_shell_get_default ());
+  index = ephy_shell_get_completion_index (ephy_shell_get_default ());
+
+  if (!ephy_completion_index_is_loaded (index)) {
+    loop = g_main_loop_new (NULL, FALSE);
+    g_signal_connect (index, "loaded", G_CALLBACK (index_loaded_cb), loop);
+    g_main_loop_run (loop);
+    g_signal_handlers_disconnect_by_func (index, index_loaded_cb, loop);
+    g_main_loop_unref (loop);
+  }
+
+  tags = g_sequence_new (g_free);
+  g_sequence_append (tags, g_strdup ("Recipes"));
+  bookmark = ephy_bookmark_new ("http://www.example.com/cooking", "Kitchen", tags);
+  ephy_bookmarks_manager_add_bookmark (manager, bookmark);
+
+  /* Terms match the URL, the title or the tags, ignoring case. */
+  matches = ephy_completion_index_query (index, "KITCHEN example", 8);
+  g_assert_cmpuint (matches->len, ==, 1);
+  match = g_ptr_array_index (matches, 0);
+  g_assert_cmpstr (match->url, ==, "http://www.example.com/cooking");
+  g_assert (match->is_bookmark);
+  g_ptr_array_free (matches, TRUE);
+
+  matches = ephy_completion_index_query (index, "recipes", 8);
+  g_assert_cmpuint (matches->len, ==, 1);
+  g_ptr_array_free (matches, TRUE);
+
+  matches = ephy_completion_index_query (index, "\"kitchen example\"", 8);
+  g_assert_cmpuint (matches->len, ==, 0);
+  g_ptr_array_free (matches, TRUE);
+
+  ephy_bookmarks_manager_remove_bookmark (manager, bookmark);
+
+  matches = ephy_completion_index_query (index, "recipes", 8);
+  g_assert_cmpuint (matches->len, ==, 0);
+  g_ptr_array_free (matches, TRUE);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -95,6 +154,9 @@ main (int argc, char *argv[])
   g_test_add_func ("/src/ephy-completion-model/update_empty",
                    test_ephy_completion_model_update_empty);
 
+  g_test_add_func ("/src/ephy-completion-model/index_query",
+                   test_ephy_completion_index_query);
+
   ret = g_test_run ();
 
   return ret;
@@ -21,6 +21,8 @@
 #include "config.h"
 #include "ephy-history-service.h"
 
+#include "ephy-sqlite-connection.h"
+
 #include <glib/gstdio.h>
 #include <gtk/gtk.h>
 
@@ -433,6 +435,108 @@ test_complex_url_query_with_time_range (void)
   gtk_main ();
 }
 
+typedef struct {
+  EphyHistoryQuery *query;
+  guint n_pages;
+} PaginatedQuery;
+
+static void
+verify_paginated_url_query (EphyHistoryService *service,
+                            gboolean            success,
+                            gpointer            result_data,
+                            gpointer            user_data)
+{
+  PaginatedQuery *paginated = (PaginatedQuery *)user_data;
+  const char * const expected[] = {
+    "http://www.wikipedia.org",
+    "http://www.freedesktop.org",
+    "http://www.gnome.org",
+    "http://www.musicbrainz.org",
+    "http://www.webkitgtk.org"
+  };
+  GList *urls = (GList *)result_data;
+  guint first = paginated->n_pages * 2;
+  GList *l;
+
+  g_assert (success == TRUE);
+
+  /* Pages follow each other, whether they start after a row or at an offset. */
+  for (l = urls; l; l = l->next)
+    g_assert_cmpstr (((EphyHistoryURL *)l->data)->url, ==, expected[first++]);
+  g_assert_cmpuint (first, ==, MIN (paginated->n_pages * 2 + 2, G_N_ELEMENTS (expected)));
+
+  paginated->n_pages++;
+
+  if (paginated->n_pages == 1) {
+    paginated->query->after = ephy_history_url_copy (g_list_last (urls)->data);
+    ephy_history_service_query_urls (service, paginated->query, NULL, verify_paginated_url_query, paginated);
+  } else if (paginated->n_pages == 2) {
+    ephy_history_url_free (paginated->query->after);
+    paginated->query->after = NULL;
+    paginated->query->offset = 4;
+    ephy_history_service_query_urls (service, paginated->query, NULL, verify_paginated_url_query, paginated);
+  } else {
+    ephy_history_query_free (paginated->query);
+    g_free (paginated);
+    g_object_unref (service);
+    gtk_main_quit ();
+  }
+
+  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
+}
+
+static void
+verify_url_count (EphyHistoryService *service,
+                  gboolean            success,
+                  gpointer            result_data,
+                  gpointer            user_data)
+{
+  PaginatedQuery *paginated = (PaginatedQuery *)user_data;
+  EphyHistoryURLCount *count = (EphyHistoryURLCount *)result_data;
+
+  g_assert (success == TRUE);
+  g_assert_cmpuint (count->count, ==, 5);
+
+  /* There are no words to look up in the full-text index. */
+  g_assert_cmpint (count->url_match, ==, EPHY_HISTORY_URL_MATCH_SUBSTRINGS);
+  paginated->query->url_match = count->url_match;
+  ephy_history_url_count_free (count);
+
+  ephy_history_service_query_urls (service, paginated->query, NULL, verify_paginated_url_query, paginated);
+}
+
+static void
+perform_paginated_url_query (EphyHistoryService *service,
+                             gboolean            success,
+                             gpointer            result_data,
+                             gpointer            user_data)
+{
+  PaginatedQuery *paginated;
+
+  g_assert (success == TRUE);
+
+  paginated = g_new0 (PaginatedQuery, 1);
+  paginated->query = ephy_history_query_new ();
+  paginated->query->limit = 2;
+  paginated->query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+
+  ephy_history_service_count_urls (service, paginated->query, NULL, verify_url_count, paginated);
+}
+
+static void
+test_paginated_url_query (void)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-history-test.db", NULL);
+  EphyHistoryService *service = ensure_empty_history (temporary_file, FALSE);
+  GList *visits;
+
+  visits = create_visits_for_complex_tests ();
+
+  ephy_history_service_add_visits (service, visits, NULL, perform_paginated_url_query, NULL);
+
+  gtk_main ();
+}
+
 static void
 verify_query_after_clear (EphyHistoryService *service,
                           gboolean            success,
@@ -481,6 +585,292 @@ test_clear (void)
   gtk_main ();
 }
 
+static void
+verify_host_zoom_level (EphyHistoryService *service,
+                        gboolean            success,
+                        gpointer            result_data,
+                        gpointer            user_data)
+{
+  EphyHistoryHost *host = (EphyHistoryHost *)result_data;
+  double zoom_level;
+
+  g_assert (success);
+  g_assert_cmpfloat (host->zoom_level, ==, 1.5);
+  g_assert_cmpint (host->visit_count, ==, 1);
+  ephy_history_host_free (host);
+
+  g_assert (ephy_history_service_get_cached_zoom_level (service, "http://www.gnome.org/about/", &zoom_level));
+  g_assert_cmpfloat (zoom_level, ==, 1.5);
+
+  /* Pages of unknown hosts get the default zoom level. */
+  g_assert (ephy_history_service_get_cached_zoom_level (service, "http://planet.gnome.org/", &zoom_level));
+  g_assert_cmpfloat (zoom_level, ==, 1.0);
+
+  g_object_unref (service);
+
+  gtk_main_quit ();
+}
+
+static void
+test_host_zoom_level (void)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-history-test.db", NULL);
+  EphyHistoryService *service = ensure_empty_history (temporary_file, FALSE);
+  EphyHistoryPageVisit *visit;
+
+  visit = ephy_history_page_visit_new ("http://www.gnome.org/news/", 0, EPHY_PAGE_VISIT_TYPED);
+  ephy_history_service_add_visit (service, visit, NULL, NULL, NULL);
+  ephy_history_page_visit_free (visit);
+
+  /* The https page belongs to the host of the http one. */
+  ephy_history_service_set_url_zoom_level (service, "https://www.gnome.org/", 1.5, NULL, NULL, NULL);
+
+  ephy_history_service_get_host_for_url (service, "http://www.gnome.org/about/", NULL, verify_host_zoom_level, NULL);
+  g_free (temporary_file);
+
+  gtk_main ();
+}
+
+static void
+verify_coalesced_host (EphyHistoryService *service,
+                       gboolean            success,
+                       gpointer            result_data,
+                       gpointer            user_data)
+{
+  EphyHistoryHost *host = (EphyHistoryHost *)result_data;
+
+  g_assert (success);
+  g_assert_cmpint (host->visit_count, ==, 6);
+  ephy_history_host_free (host);
+
+  g_object_unref (service);
+
+  gtk_main_quit ();
+}
+
+static void
+verify_coalesced_url (EphyHistoryService *service,
+                      gboolean            success,
+                      gpointer            result_data,
+                      gpointer            user_data)
+{
+  EphyHistoryURL *url = (EphyHistoryURL *)result_data;
+
+  g_assert (success);
+  g_assert_cmpint (url->visit_count, ==, 5);
+  g_assert_cmpint (url->last_visit_time, ==, 40);
+  g_assert_cmpstr (url->title, ==, "GNOME");
+  ephy_history_url_free (url);
+
+  ephy_history_service_get_host_for_url (service, "http://www.gnome.org/", NULL, verify_coalesced_host, NULL);
+}
+
+static void
+test_coalesced_visits (void)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-history-test.db", NULL);
+  EphyHistoryService *service = ensure_empty_history (temporary_file, FALSE);
+  EphyHistoryPageVisit *visit;
+  GList *visits = NULL;
+
+  /* Visits queued together are written as one batch. */
+  for (int i = 0; i < 3; i++) {
+    visit = ephy_history_page_visit_new ("http://www.gnome.org/", i * 10, EPHY_PAGE_VISIT_LINK);
+    ephy_history_service_add_visit (service, visit, NULL, NULL, NULL);
+    ephy_history_page_visit_free (visit);
+  }
+
+  visit = ephy_history_page_visit_new ("http://www.gnome.org/", 40, EPHY_PAGE_VISIT_TYPED);
+  g_free (visit->url->title);
+  visit->url->title = g_strdup ("GNOME");
+  visits = g_list_prepend (visits, visit);
+  visits = g_list_prepend (visits, ephy_history_page_visit_new ("http://www.gnome.org/", 30, EPHY_PAGE_VISIT_LINK));
+  visits = g_list_prepend (visits, ephy_history_page_visit_new ("http://www.gnome.org/news/", 35, EPHY_PAGE_VISIT_LINK));
+  ephy_history_service_add_visits (service, visits, NULL, NULL, NULL);
+  ephy_history_page_visit_list_free (visits);
+
+  ephy_history_service_get_url (service, "http://www.gnome.org/", NULL, verify_coalesced_url, NULL);
+  g_free (temporary_file);
+
+  gtk_main ();
+}
+
+static char *
+create_firefox_history (void)
+{
+  static const char * const statements[] = {
+    "CREATE TABLE moz_places (id INTEGER PRIMARY KEY, url LONGVARCHAR, title LONGVARCHAR, hidden INTEGER DEFAULT 0 NOT NULL)",
+    "CREATE TABLE moz_historyvisits (id INTEGER PRIMARY KEY, place_id INTEGER, visit_date INTEGER, visit_type INTEGER)",
+    "INSERT INTO moz_places (id, url, title) VALUES (1, 'https://www.gnome.org/', 'GNOME'), (2, 'https://wiki.gnome.org/', ''), (3, 'place:sort=8', NULL)",
+    "INSERT INTO moz_places (id, url, title, hidden) VALUES (4, 'https://www.gnome.org/frame', NULL, 1)",
+    /* The last visit repeats the first one, and is only imported once. */
+    "INSERT INTO moz_historyvisits (place_id, visit_date, visit_type) VALUES "
+    "(1, 10000000, 1), (2, 20000000, 1), (1, 30000000, 2), (3, 40000000, 1), (4, 50000000, 8), (1, 10000000, 1)"
+  };
+  EphySQLiteConnection *connection;
+  char *filename;
+
+  filename = g_build_filename (g_get_tmp_dir (), "epiphany-history-test-places.sqlite", NULL);
+  if (g_file_test (filename, G_FILE_TEST_IS_REGULAR))
+    g_unlink (filename);
+
+  connection = ephy_sqlite_connection_new ();
+  g_assert (ephy_sqlite_connection_open (connection, filename, NULL));
+  for (guint i = 0; i < G_N_ELEMENTS (statements); i++)
+    g_assert (ephy_sqlite_connection_execute (connection, statements[i], NULL));
+  ephy_sqlite_connection_close (connection);
+  g_object_unref (connection);
+
+  return filename;
+}
+
+static void
+verify_imported_url (EphyHistoryService *service,
+                     gboolean            success,
+                     gpointer            result_data,
+                     gpointer            user_data)
+{
+  EphyHistoryURL *url = (EphyHistoryURL *)result_data;
+
+  g_assert (success);
+  g_assert_cmpint (url->visit_count, ==, 2);
+  g_assert_cmpint (url->last_visit_time, ==, 30);
+  g_assert_cmpstr (url->title, ==, "GNOME");
+  ephy_history_url_free (url);
+
+  g_object_unref (service);
+
+  gtk_main_quit ();
+}
+
+static void
+history_imported_again (EphyHistoryService *service,
+                        gboolean            success,
+                        gpointer            result_data,
+                        gpointer            user_data)
+{
+  /* The visits are already there, so none is imported twice. */
+  g_assert (success);
+  g_assert_cmpuint (GPOINTER_TO_UINT (result_data), ==, 0);
+
+  ephy_history_service_get_url (service, "https://www.gnome.org/", NULL, verify_imported_url, NULL);
+}
+
+static void
+history_imported (EphyHistoryService *service,
+                  gboolean            success,
+                  gpointer            result_data,
+                  gpointer            user_data)
+{
+  const char *places = user_data;
+
+  g_assert (success);
+  g_assert_cmpuint (GPOINTER_TO_UINT (result_data), ==, 3);
+
+  ephy_history_service_import (service, EPHY_HISTORY_IMPORT_FIREFOX, places, NULL, NULL, history_imported_again, NULL);
+}
+
+static void
+test_import_firefox_history (void)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-history-test.db", NULL);
+  EphyHistoryService *service = ensure_empty_history (temporary_file, FALSE);
+  char *places = create_firefox_history ();
+
+  ephy_history_service_import (service, EPHY_HISTORY_IMPORT_FIREFOX, places, NULL, NULL, history_imported, places);
+  g_free (temporary_file);
+
+  gtk_main ();
+
+  g_unlink (places);
+  g_free (places);
+}
+
+#define BENCHMARK_HOSTS 1000
+#define BENCHMARK_LOOKUPS 10000
+
+typedef struct {
+  guint n_urls;
+  guint n_pending;
+  GTimer *timer;
+} HistoryBenchmark;
+
+static char *
+benchmark_url (guint i)
+{
+  return g_strdup_printf ("https://host%u.example.com/articles/%u.html", i % BENCHMARK_HOSTS, i);
+}
+
+static void
+benchmark_url_found (EphyHistoryService *service, gboolean success, gpointer result_data, gpointer user_data)
+{
+  HistoryBenchmark *benchmark = (HistoryBenchmark *)user_data;
+  double elapsed;
+
+  g_assert (success);
+  ephy_history_url_free (result_data);
+
+  if (--benchmark->n_pending > 0)
+    return;
+
+  elapsed = g_timer_elapsed (benchmark->timer, NULL);
+  g_test_maximized_result (BENCHMARK_LOOKUPS / elapsed,
+                           "Looked up %u URLs among %u at %.0f lookups/s",
+                           BENCHMARK_LOOKUPS, benchmark->n_urls, BENCHMARK_LOOKUPS / elapsed);
+
+  g_object_unref (service);
+  gtk_main_quit ();
+}
+
+static void
+benchmark_visits_added (EphyHistoryService *service, gboolean success, gpointer result_data, gpointer user_data)
+{
+  HistoryBenchmark *benchmark = (HistoryBenchmark *)user_data;
+  double elapsed;
+
+  g_assert (success);
+
+  elapsed = g_timer_elapsed (benchmark->timer, NULL);
+  g_test_maximized_result (benchmark->n_urls / elapsed,
+                           "Added %u visits at %.0f visits/s",
+                           benchmark->n_urls, benchmark->n_urls / elapsed);
+
+  benchmark->n_pending = BENCHMARK_LOOKUPS;
+  g_timer_start (benchmark->timer);
+
+  for (guint i = 0; i < BENCHMARK_LOOKUPS; i++) {
+    char *url = benchmark_url (g_random_int_range (0, benchmark->n_urls));
+
+    ephy_history_service_get_url (service, url, NULL, benchmark_url_found, benchmark);
+    g_free (url);
+  }
+}
+
+static void
+test_history_benchmark (gconstpointer data)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-history-test.db", NULL);
+  EphyHistoryService *service = ensure_empty_history (temporary_file, FALSE);
+  HistoryBenchmark benchmark = { GPOINTER_TO_UINT (data), 0, NULL };
+  GList *visits = NULL;
+
+  for (guint i = 0; i < benchmark.n_urls; i++) {
+    char *url = benchmark_url (i);
+
+    visits = g_list_prepend (visits, ephy_history_page_visit_new (url, i, EPHY_PAGE_VISIT_LINK));
+    g_free (url);
+  }
+
+  benchmark.timer = g_timer_new ();
+  ephy_history_service_add_visits (service, visits, NULL, benchmark_visits_added, &benchmark);
+  ephy_history_page_visit_list_free (visits);
+  g_free (temporary_file);
+
+  gtk_main ();
+
+  g_timer_destroy (benchmark.timer);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -498,7 +888,16 @@ main (int argc, char *argv[])
   g_test_add_func ("/embed/history/test_get_url_not_existent", test_get_url_not_existent);
   g_test_add_func ("/embed/history/test_complex_url_query", test_complex_url_query);
   g_test_add_func ("/embed/history/test_complex_url_query_with_time_range", test_complex_url_query_with_time_range);
+  g_test_add_func ("/embed/history/test_paginated_url_query", test_paginated_url_query);
   g_test_add_func ("/embed/history/test_clear", test_clear);
+  g_test_add_func ("/embed/history/test_host_zoom_level", test_host_zoom_level);
+  g_test_add_func ("/embed/history/test_coalesced_visits", test_coalesced_visits);
+  g_test_add_func ("/embed/history/test_import_firefox_history", test_import_firefox_history);
+
+  if (g_test_perf ()) {
+    g_test_add_data_func ("/embed/history/benchmark_100k_urls", GUINT_TO_POINTER (100000), test_history_benchmark);
+    g_test_add_data_func ("/embed/history/benchmark_1M_urls", GUINT_TO_POINTER (1000000), test_history_benchmark);
+  }
 
   return g_test_run ();
 }
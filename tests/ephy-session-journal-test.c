@@ -0,0 +1,325 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2017 Igalia S.L.
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-session-journal.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+static EphySessionJournal *
+create_empty_journal (char **filename)
+{
+  char *journal_filename;
+
+  *filename = g_build_filename (g_get_tmp_dir (), "epiphany-session-journal-test", NULL);
+  journal_filename = g_strconcat (*filename, ".journal", NULL);
+  g_unlink (*filename);
+  g_unlink (journal_filename);
+  g_free (journal_filename);
+
+  return ephy_session_journal_new (*filename);
+}
+
+static GVariant *
+new_history (gsize size,
+             char  fill)
+{
+  char *data = g_malloc (size);
+
+  memset (data, fill, size);
+
+  return g_variant_new_from_data (G_VARIANT_TYPE_BYTESTRING, data, size, TRUE, g_free, data);
+}
+
+/* Builds a session with a single window holding the tabs in @ids. Tabs
+ * with a non-zero @fill get a history of @history_size bytes. */
+static GVariant *
+build_session (const guint32 *ids,
+               const char    *fills,
+               guint          n_tabs,
+               gsize          history_size)
+{
+  GVariantBuilder windows;
+  GVariantBuilder tabs;
+
+  g_variant_builder_init (&tabs, G_VARIANT_TYPE ("a(ussbbmay)"));
+  for (guint i = 0; i < n_tabs; i++) {
+    char *url = g_strdup_printf ("http://example.com/%u", ids[i]);
+
+    g_variant_builder_add (&tabs, "(ussbb@may)", ids[i], url, "Example", FALSE, FALSE,
+                           g_variant_new_maybe (G_VARIANT_TYPE_BYTESTRING,
+                                                fills[i] ? new_history (history_size, fills[i]) : NULL));
+    g_free (url);
+  }
+
+  g_variant_builder_init (&windows, G_VARIANT_TYPE (EPHY_SESSION_JOURNAL_STATE_TYPE));
+  g_variant_builder_add (&windows, "(iiiimsi@a(ussbbmay))", 0, 0, 800, 600, "role", 0,
+                         g_variant_builder_end (&tabs));
+
+  return g_variant_ref_sink (g_variant_builder_end (&windows));
+}
+
+static GVariant *
+get_tabs (GVariant *state)
+{
+  GVariant *window;
+  GVariant *tabs;
+
+  window = g_variant_get_child_value (state, 0);
+  tabs = g_variant_get_child_value (window, 6);
+  g_variant_unref (window);
+
+  return tabs;
+}
+
+/* Returns the first byte of the history of the tab at @position, or 0 if
+ * it has none. */
+static char
+get_history_fill (GVariant *state,
+                  guint     position)
+{
+  GVariant *tabs;
+  GVariant *tab;
+  GVariant *maybe;
+  GVariant *history;
+  char fill = 0;
+
+  tabs = get_tabs (state);
+  tab = g_variant_get_child_value (tabs, position);
+  maybe = g_variant_get_child_value (tab, 5);
+  history = g_variant_get_maybe (maybe);
+  if (history) {
+    if (g_variant_get_size (history) > 0)
+      fill = *(const char *)g_variant_get_data (history);
+    g_variant_unref (history);
+  }
+
+  g_variant_unref (maybe);
+  g_variant_unref (tab);
+  g_variant_unref (tabs);
+
+  return fill;
+}
+
+static guint
+get_n_tabs (GVariant *state)
+{
+  GVariant *tabs;
+  guint n_tabs;
+
+  tabs = get_tabs (state);
+  n_tabs = g_variant_n_children (tabs);
+  g_variant_unref (tabs);
+
+  return n_tabs;
+}
+
+static GVariant *
+reload (const char *filename)
+{
+  EphySessionJournal *journal;
+  GError *error = NULL;
+  GVariant *state;
+
+  journal = ephy_session_journal_new (filename);
+  state = ephy_session_journal_load (journal, &error);
+  g_assert_no_error (error);
+  g_assert (state);
+  ephy_session_journal_free (journal);
+
+  return state;
+}
+
+static void
+test_commit_and_load (void)
+{
+  EphySessionJournal *journal;
+  GError *error = NULL;
+  GVariant *session;
+  GVariant *state;
+  char *filename;
+  const guint32 ids[] = { 1, 2, 3 };
+  gsize size;
+
+  journal = create_empty_journal (&filename);
+  g_assert (!ephy_session_journal_exists (journal));
+
+  /* The first commit writes a snapshot. */
+  session = build_session (ids, "abc", 3, 1024);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  g_assert_no_error (error);
+  g_assert (ephy_session_journal_exists (journal));
+  g_assert_cmpuint (ephy_session_journal_get_size (journal), ==, 0);
+  g_variant_unref (session);
+
+  /* Tabs without a history keep theirs, so nothing is written. */
+  session = build_session (ids, "\0\0\0", 3, 1024);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  g_assert_cmpuint (ephy_session_journal_get_size (journal), ==, 0);
+  g_variant_unref (session);
+
+  /* Only the tab that changed is appended to the journal. */
+  session = build_session (ids, "\0x\0", 3, 1024);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  size = ephy_session_journal_get_size (journal);
+  g_assert_cmpuint (size, >, 1024);
+  g_assert_cmpuint (size, <, 2 * 1024);
+  g_variant_unref (session);
+
+  /* Closing a tab only writes its removal and the new layout. */
+  session = build_session (ids, "\0\0", 2, 1024);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  g_assert_cmpuint (ephy_session_journal_get_size (journal) - size, <, 128);
+  g_variant_unref (session);
+
+  ephy_session_journal_free (journal);
+
+  state = reload (filename);
+  g_assert_cmpuint (get_n_tabs (state), ==, 2);
+  g_assert_cmpint (get_history_fill (state, 0), ==, 'a');
+  g_assert_cmpint (get_history_fill (state, 1), ==, 'x');
+  g_variant_unref (state);
+
+  g_free (filename);
+}
+
+static void
+test_truncated_journal (void)
+{
+  EphySessionJournal *journal;
+  GError *error = NULL;
+  GVariant *session;
+  GVariant *state;
+  char *filename;
+  char *journal_filename;
+  const guint32 ids[] = { 1 };
+  FILE *file;
+
+  journal = create_empty_journal (&filename);
+
+  session = build_session (ids, "a", 1, 64);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  g_variant_unref (session);
+
+  session = build_session (ids, "b", 1, 64);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  g_variant_unref (session);
+
+  ephy_session_journal_free (journal);
+
+  /* A batch cut short by a crash while it was being appended. */
+  journal_filename = g_strconcat (filename, ".journal", NULL);
+  file = fopen (journal_filename, "ab");
+  g_assert (file);
+  fwrite ("\xff\x00\x00\x00partial", 1, 11, file);
+  fclose (file);
+
+  g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "Discarding truncated batch*");
+  state = reload (filename);
+  g_test_assert_expected_messages ();
+  g_assert_cmpint (get_history_fill (state, 0), ==, 'b');
+  g_variant_unref (state);
+
+  /* The partial batch is gone, so later batches can be read. */
+  journal = ephy_session_journal_new (filename);
+  state = ephy_session_journal_load (journal, &error);
+  g_assert_no_error (error);
+  g_variant_unref (state);
+
+  session = build_session (ids, "c", 1, 64);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  g_variant_unref (session);
+  ephy_session_journal_free (journal);
+
+  state = reload (filename);
+  g_assert_cmpint (get_history_fill (state, 0), ==, 'c');
+  g_variant_unref (state);
+
+  g_free (journal_filename);
+  g_free (filename);
+}
+
+static void
+test_compaction (void)
+{
+  EphySessionJournal *journal;
+  GError *error = NULL;
+  GVariant *session;
+  GVariant *state;
+  char *filename;
+  char *journal_filename;
+  char *stale_journal;
+  gsize stale_journal_length;
+  const guint32 ids[] = { 1 };
+  const gsize history_size = 600 * 1024;
+
+  journal = create_empty_journal (&filename);
+  journal_filename = g_strconcat (filename, ".journal", NULL);
+
+  session = build_session (ids, "a", 1, history_size);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  g_variant_unref (session);
+
+  session = build_session (ids, "b", 1, history_size);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  g_assert_cmpuint (ephy_session_journal_get_size (journal), >, history_size);
+  g_variant_unref (session);
+
+  g_assert (g_file_get_contents (journal_filename, &stale_journal, &stale_journal_length, NULL));
+
+  /* This one takes the journal past its limit, and into the snapshot. */
+  session = build_session (ids, "c", 1, history_size);
+  g_assert (ephy_session_journal_commit (journal, session, &error));
+  g_assert_cmpuint (ephy_session_journal_get_size (journal), ==, 0);
+  g_assert (!g_file_test (journal_filename, G_FILE_TEST_EXISTS));
+  g_variant_unref (session);
+
+  ephy_session_journal_free (journal);
+
+  /* A journal left behind by a crash during compaction is older than the
+   * snapshot, and must not be replayed on top of it. */
+  g_assert (g_file_set_contents (journal_filename, stale_journal, stale_journal_length, NULL));
+
+  state = reload (filename);
+  g_assert_cmpint (get_history_fill (state, 0), ==, 'c');
+  g_variant_unref (state);
+
+  g_free (stale_journal);
+  g_free (journal_filename);
+  g_free (filename);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/src/ephy-session-journal/commit_and_load",
+                   test_commit_and_load);
+  g_test_add_func ("/src/ephy-session-journal/truncated_journal",
+                   test_truncated_journal);
+  g_test_add_func ("/src/ephy-session-journal/compaction",
+                   test_compaction);
+
+  return g_test_run ();
+}
@@ -245,6 +245,62 @@ test_ephy_session_load_many_windows (void)
   ephy_session_clear (session);
 }
 
+const char *session_data_virtual_tabs =
+  "<?xml version=\"1.0\"?>"
+  "<session>"
+  "<window x=\"94\" y=\"48\" width=\"1132\" height=\"684\" active-tab=\"0\" role=\"epiphany-window-3fa0c1d2\">"
+  "<embed url=\"about:memory\" title=\"Memory usage\"/>"
+  "<embed url=\"about:config\" title=\"Config\"/>"
+  "</window>"
+  "</session>";
+
+static void
+test_ephy_session_load_virtual_tabs (void)
+{
+  EphySession *session;
+  gboolean ret;
+  GList *l;
+  GList *children;
+  EphyEmbed *embed;
+
+  enable_delayed_loading ();
+
+  session = ephy_shell_get_session (ephy_shell_get_default ());
+  g_assert (session);
+
+  ret = load_session_from_string (session, session_data_virtual_tabs);
+  g_assert (ret);
+
+  l = gtk_application_get_windows (GTK_APPLICATION (ephy_shell_get_default ()));
+  g_assert (l);
+  g_assert_cmpint (g_list_length (l), ==, 1);
+
+  children = ephy_embed_container_get_children (EPHY_EMBED_CONTAINER (l->data));
+  g_assert_cmpint (g_list_length (children), ==, 2);
+
+  /* Background tabs have no web view until they are shown. */
+  embed = EPHY_EMBED (children->next->data);
+  g_assert (ephy_embed_is_virtual (embed));
+  g_assert_cmpstr (ephy_embed_get_virtual_url (embed), ==, "about:config");
+  g_assert_cmpstr (ephy_embed_get_title (embed), ==, "Config");
+
+  g_assert (ephy_embed_get_web_view (embed));
+  g_assert (!ephy_embed_is_virtual (embed));
+  g_assert (ephy_embed_has_load_pending (embed));
+
+  /* Hibernating the tab gives back the web view, and keeps the page. */
+  ephy_embed_hibernate (embed);
+  g_assert (ephy_embed_is_virtual (embed));
+  g_assert_cmpstr (ephy_embed_get_virtual_url (embed), ==, "about:config");
+  g_assert_cmpstr (ephy_embed_get_title (embed), ==, "Config");
+
+  g_assert (ephy_embed_get_web_view (embed));
+  g_assert (!ephy_embed_is_virtual (embed));
+
+  g_list_free (children);
+  ephy_session_clear (session);
+}
+
 static void
 open_uris_after_loading_session (const char **uris, int final_num_windows)
 {
@@ -372,6 +428,9 @@ main (int argc, char *argv[])
   g_test_add_func ("/src/ephy-session/load-many-windows",
                    test_ephy_session_load_many_windows);
 
+  g_test_add_func ("/src/ephy-session/load-virtual-tabs",
+                   test_ephy_session_load_virtual_tabs);
+
   g_test_add_func ("/src/ephy-session/open-uri-after-loading_session",
                    test_ephy_session_open_uri_after_loading_session);
 
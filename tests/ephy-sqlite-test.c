@@ -196,6 +196,44 @@ test_table_exists (void)
   g_free (temporary_file);
 }
 
+static void
+test_borrow_statement (void)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-sqlite-test.db", NULL);
+  EphySQLiteConnection *connection = ensure_empty_database (temporary_file);
+  GError *error = NULL;
+  EphySQLiteStatement *statement = NULL;
+  int i;
+
+  ephy_sqlite_connection_execute (connection, "CREATE TABLE test (id INTEGER, text LONGVARCHAR)", &error);
+  g_assert (!error);
+
+  /* Each iteration should get back the statement returned by the previous
+   * one, with its bindings cleared and ready to be stepped again. */
+  for (i = 0; i < 3; i++) {
+    statement = ephy_sqlite_connection_borrow_statement (connection, "INSERT INTO test (id, text) VALUES (?, ?)", &error);
+    g_assert (statement);
+    g_assert (!error);
+
+    g_assert (ephy_sqlite_statement_bind_int (statement, 0, i, &error));
+    g_assert (ephy_sqlite_statement_bind_string (statement, 1, "foo", &error));
+    g_assert (!ephy_sqlite_statement_step (statement, &error));
+    g_assert (!error);
+    g_object_unref (statement);
+  }
+
+  statement = ephy_sqlite_connection_borrow_statement (connection, "SELECT COUNT(*) FROM test", &error);
+  g_assert (statement);
+  g_assert (ephy_sqlite_statement_step (statement, &error));
+  g_assert (!error);
+  g_assert_cmpint (ephy_sqlite_statement_get_column_as_int (statement, 0), ==, 3);
+  g_object_unref (statement);
+
+  g_object_unref (connection);
+  g_unlink (temporary_file);
+  g_free (temporary_file);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -206,6 +244,7 @@ main (int argc, char *argv[])
   g_test_add_func ("/lib/sqlite/ephy-sqlite/create_table_and_insert_row", test_create_table_and_insert_row);
   g_test_add_func ("/lib/sqlite/ephy-sqlite/bind_data", test_bind_data);
   g_test_add_func ("/lib/sqlite/ephy-sqlite/table_exists", test_table_exists);
+  g_test_add_func ("/lib/sqlite/ephy-sqlite/borrow_statement", test_borrow_statement);
 
   return g_test_run ();
 }